@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef HAZEL_BENCH_VARIANT
+#   define HAZEL_BENCH_VARIANT "library"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define BENCH_DO_NOT_OPTIMIZE(value) __asm__ volatile("" : : "g"(value) : "memory")
+#   define BENCH_CLOBBER() __asm__ volatile("" : : : "memory")
+#else
+#   define BENCH_DO_NOT_OPTIMIZE(value) ((void)(value))
+#   define BENCH_CLOBBER()
+#endif
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Print one result as a JSON line, so runs can be collected and compared by
+ * scripts.
+ */
+static inline void bench_report(const char *name, uint64_t iterations,
+                                uint64_t elapsed_ns, size_t bytes_per_op)
+{
+    double ns_per_op = (double)elapsed_ns / (double)iterations;
+    double mb_per_s = bytes_per_op == 0
+        ? 0.0
+        : ((double)bytes_per_op * (double)iterations)
+            / ((double)elapsed_ns / 1e9) / (1024.0 * 1024.0);
+
+    printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"iterations\":%llu,"
+           "\"ns_per_op\":%.3f,\"mb_per_s\":%.2f}\n",
+           name, HAZEL_BENCH_VARIANT, (unsigned long long)iterations,
+           ns_per_op, mb_per_s);
+}
+
+static inline int bench_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print the distribution of \p count latency samples as a JSON line. The
+ * samples are sorted in place.
+ */
+static inline void bench_report_latency(const char *name, uint64_t *samples_ns,
+                                        size_t count, size_t lost)
+{
+    if (count == 0)
+    {
+        printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"samples\":0,"
+               "\"lost\":%zu}\n", name, HAZEL_BENCH_VARIANT, lost);
+        return;
+    }
+
+    qsort(samples_ns, count, sizeof(uint64_t), bench_compare_u64);
+
+#define BENCH_PERCENTILE(p) \
+    ((double)samples_ns[(size_t)((double)(count - 1) * (p))] / 1000.0)
+
+    printf("{\"benchmark\":\"%s\",\"variant\":\"%s\",\"samples\":%zu,"
+           "\"lost\":%zu,\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,"
+           "\"p999_us\":%.2f,\"max_us\":%.2f}\n",
+           name, HAZEL_BENCH_VARIANT, count, lost, BENCH_PERCENTILE(0.5),
+           BENCH_PERCENTILE(0.9), BENCH_PERCENTILE(0.99),
+           BENCH_PERCENTILE(0.999), BENCH_PERCENTILE(1.0));
+
+#undef BENCH_PERCENTILE
+}
+
+/** \name Suites run by hazel_bench
+ * @{
+ */
+int bench_micro(void);
+int bench_loopback(void);
+int bench_inproc(void);
+/** @}*/
@@ -0,0 +1,88 @@
+#pragma once
+
+/*
+ * The entity update used by the serialization benchmarks: a net id, a few
+ * vectors, some small integers and a nested animation message.
+ */
+
+#include "hazel/reader.h"
+#include "hazel/writer.h"
+
+#define ENTITIES_PER_PACKET 8
+
+typedef struct entity_state
+{
+    uint32_t net_id;
+    bool grounded;
+    float position[3];
+    float velocity[3];
+    uint16_t sequence;
+    int32_t health;
+    uint32_t animation;
+    float blend;
+} entity_state;
+
+static int entity_state_write(hazel_message_writer *writer, const entity_state *e)
+{
+    int ret = 0;
+    ret |= hazel_message_writer_start_message(writer, 0x05);
+    ret |= hazel_message_writer_packed_uint32(writer, e->net_id);
+    ret |= hazel_message_writer_bool(writer, e->grounded);
+    for (int i = 0; i < 3; i++)
+    {
+        ret |= hazel_message_writer_single(writer, e->position[i]);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        ret |= hazel_message_writer_single(writer, e->velocity[i]);
+    }
+    ret |= hazel_message_writer_uint16(writer, e->sequence);
+    ret |= hazel_message_writer_packed_int32(writer, e->health);
+
+    ret |= hazel_message_writer_start_message(writer, 0x02);
+    ret |= hazel_message_writer_uint32(writer, e->animation);
+    ret |= hazel_message_writer_single(writer, e->blend);
+    ret |= hazel_message_writer_end_message(writer);
+
+    ret |= hazel_message_writer_end_message(writer);
+    return ret;
+}
+
+static int entity_state_read(hazel_message_reader *reader, entity_state *e)
+{
+    int ret = 0;
+    hazel_message_reader anim;
+
+    ret |= hazel_message_reader_packed_uint32(reader, &e->net_id);
+    ret |= hazel_message_reader_bool(reader, &e->grounded);
+    for (int i = 0; i < 3; i++)
+    {
+        ret |= hazel_message_reader_single(reader, &e->position[i]);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        ret |= hazel_message_reader_single(reader, &e->velocity[i]);
+    }
+    ret |= hazel_message_reader_uint16(reader, &e->sequence);
+    ret |= hazel_message_reader_packed_int32(reader, &e->health);
+
+    ret |= hazel_message_reader_read_message(reader, &anim);
+    ret |= hazel_message_reader_uint32(&anim, &e->animation);
+    ret |= hazel_message_reader_single(&anim, &e->blend);
+    return ret;
+}
+
+static void entity_state_sample(entity_state *e, int i)
+{
+    entity_state sample = {
+        .net_id = 1000 + i,
+        .grounded = i % 2,
+        .position = { i * 1.5f, 2.0f, -i * 0.25f },
+        .velocity = { 0.1f, 0.0f, -0.1f },
+        .sequence = (uint16_t)(i * 7),
+        .health = 100 - i,
+        .animation = 3,
+        .blend = 0.5f
+    };
+    *e = sample;
+}
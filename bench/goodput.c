@@ -0,0 +1,267 @@
+/*
+ * Reliable traffic through an impaired network: a client streams reliable
+ * messages to a connection over a hazel_udp_loopback, with both directions
+ * impaired, and the goodput, delivery latency and retransmission overhead
+ * are reported for each loss profile.
+ */
+
+#include "bench.h"
+
+#include "hazel/udp/client.h"
+#include "hazel/udp/connection.h"
+#include "hazel/udp/impairment.h"
+#include "hazel/udp/loopback.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MESSAGES 2000
+#define PAYLOAD 200
+#define SEND_INTERVAL_NS 200000ull
+#define DRAIN_TIMEOUT_NS 10000000000ull
+
+typedef struct goodput_profile
+{
+    const char *name;
+    hazel_udp_impairment_config config;
+} goodput_profile;
+
+#define GOODPUT_LINK .latency_us = 10000, .jitter_us = 2000, \
+                     .bandwidth_bps = 20000000
+
+static const goodput_profile profiles[] = {
+    { "uniform_0", { GOODPUT_LINK, .loss = 0.0 } },
+    { "uniform_1", { GOODPUT_LINK, .loss = 0.01 } },
+    { "uniform_2", { GOODPUT_LINK, .loss = 0.02 } },
+    { "uniform_5", { GOODPUT_LINK, .loss = 0.05 } },
+    { "uniform_10", { GOODPUT_LINK, .loss = 0.10 } },
+    { "uniform_20", { GOODPUT_LINK, .loss = 0.20 } },
+    // About 4% loss on average, in bursts of four datagrams
+    { "bursty_4", { GOODPUT_LINK, .loss = 0.0, .burst_enter = 0.02,
+                    .burst_exit = 0.25, .burst_loss = 0.5 } },
+};
+
+typedef struct goodput_run
+{
+    hazel_udp_loopback loopback;
+    hazel_udp_socket client_inner;
+    hazel_udp_socket server_inner;
+    hazel_udp_impairment client_impairment;
+    hazel_udp_impairment server_impairment;
+    hazel_udp_client client;
+    hazel_udp_connection server;
+} goodput_run;
+
+static int goodput_run_init(goodput_run *run, const goodput_profile *profile,
+                            uint64_t seed)
+{
+    hazel_udp_impairment_config client_config = profile->config;
+    hazel_udp_impairment_config server_config = profile->config;
+    client_config.seed = seed;
+    server_config.seed = seed ^ 0x5EED;
+
+    hazel_udp_connection_init(&run->server);
+    if (hazel_udp_loopback_init(&run->loopback, 4096) != 0
+        || hazel_udp_socket_init_with(&run->client_inner,
+                                      &hazel_udp_loopback_vtable,
+                                      &run->loopback.a) != 0
+        || hazel_udp_socket_init_with(&run->server_inner,
+                                      &hazel_udp_loopback_vtable,
+                                      &run->loopback.b) != 0
+        || hazel_udp_impairment_init(&run->client_impairment, &client_config,
+                                     &run->client_inner) != 0
+        || hazel_udp_impairment_init(&run->server_impairment, &server_config,
+                                     &run->server_inner) != 0
+        || hazel_udp_client_init_with(&run->client, "loopback", 0,
+                                      HAZEL_IP_MODE_IPV4,
+                                      &hazel_udp_impairment_vtable,
+                                      &run->client_impairment) != 0
+        || hazel_udp_socket_init_with(&run->server._socket,
+                                      &hazel_udp_impairment_vtable,
+                                      &run->server_impairment) != 0
+        || hazel_udp_socket_open(&run->server._socket,
+                                 HAZEL_IP_MODE_IPV4) != 0)
+    {
+        return -1;
+    }
+
+    run->client.udp_connection._connection_state
+        = HAZEL_CONNECTION_STATE_CONNECTED;
+    run->server._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+    return 0;
+}
+
+static void goodput_run_free(goodput_run *run)
+{
+    hazel_udp_client_free(&run->client);
+    hazel_udp_connection_free(&run->server);
+    hazel_udp_impairment_free(&run->client_impairment);
+    hazel_udp_impairment_free(&run->server_impairment);
+    hazel_udp_loopback_free(&run->loopback);
+}
+
+static int goodput_send(goodput_run *run, hazel_message_writer *writer,
+                        uint32_t sequence)
+{
+    static const uint8_t padding[PAYLOAD];
+
+    int ret = 0;
+    hazel_message_writer_clear(writer, HAZEL_SEND_OPTION_RELIABLE);
+    ret |= hazel_message_writer_start_message(writer, 0x01);
+    ret |= hazel_message_writer_uint32(writer, sequence);
+    ret |= hazel_message_writer_uint64(writer, bench_now_ns());
+    ret |= hazel_message_writer_bytes(writer, padding, 0,
+                                      PAYLOAD - sizeof(uint32_t)
+                                          - sizeof(uint64_t));
+    ret |= hazel_message_writer_end_message(writer);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return hazel_udp_connection_send(&run->client.udp_connection, writer) < 0
+        ? -1 : 0;
+}
+
+/**
+ * Handle everything which reached \p connection, recording deliveries when
+ * \p latencies is not NULL.
+ */
+static void goodput_receive(hazel_udp_connection *connection,
+                            bool *delivered, uint64_t *latencies,
+                            size_t *delivered_count, uint64_t *last_delivery)
+{
+    uint8_t datagram[HAZEL_BUFFER_SIZE];
+    int size;
+    while ((size = hazel_udp_socket_try_recv(&connection->_socket, datagram,
+                                             sizeof(datagram), 0)) > 0)
+    {
+        hazel_udp_connection_recv recv;
+        if (hazel_udp_connection_handle_recv_in_place(connection, datagram,
+                                                      size, &recv) != 0)
+        {
+            continue;
+        }
+
+        hazel_message_reader message;
+        uint32_t sequence;
+        uint64_t sent_ns;
+        if (delivered != NULL
+            && recv.packet_type == HAZEL_SEND_OPTION_RELIABLE
+            && hazel_message_reader_read_message(&recv.data.msg.reader,
+                                                 &message) == 0
+            && hazel_message_reader_uint32(&message, &sequence) == 0
+            && hazel_message_reader_uint64(&message, &sent_ns) == 0
+            && sequence < MESSAGES && !delivered[sequence])
+        {
+            uint64_t now = bench_now_ns();
+            delivered[sequence] = true;
+            latencies[(*delivered_count)++] = now - sent_ns;
+            *last_delivery = now;
+        }
+        hazel_udp_connection_release_in_place(connection, datagram, size,
+                                              &recv);
+    }
+}
+
+static double goodput_percentile_ms(const uint64_t *sorted, size_t count,
+                                    double p)
+{
+    if (count == 0)
+    {
+        return 0.0;
+    }
+    return (double)sorted[(size_t)((double)(count - 1) * p)] / 1e6;
+}
+
+static int goodput_profile_run(const goodput_profile *profile)
+{
+    static goodput_run run;
+    static bool delivered[MESSAGES];
+    static uint64_t latencies[MESSAGES];
+    memset(&run, 0, sizeof(run));
+    memset(delivered, 0, sizeof(delivered));
+
+    int ret = -1;
+    if (goodput_run_init(&run, profile, 0x6A7E) != 0)
+    {
+        goto exit;
+    }
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    size_t delivered_count = 0;
+    uint32_t sent = 0;
+    uint64_t start = bench_now_ns();
+    uint64_t last_delivery = start;
+
+    while (delivered_count < MESSAGES
+           && bench_now_ns() - start
+                  < MESSAGES * SEND_INTERVAL_NS + DRAIN_TIMEOUT_NS)
+    {
+        if (sent < MESSAGES
+            && bench_now_ns() - start >= sent * SEND_INTERVAL_NS)
+        {
+            if (goodput_send(&run, &writer, sent) != 0)
+            {
+                goto exit;
+            }
+            sent++;
+        }
+
+        goodput_receive(&run.server, delivered, latencies, &delivered_count,
+                        &last_delivery);
+        goodput_receive(&run.client.udp_connection, NULL, NULL, NULL, NULL);
+        hazel_udp_connection_manage_reliable(&run.client.udp_connection);
+    }
+
+    hazel_udp_stats stats;
+    hazel_udp_connection_get_stats(&run.client.udp_connection, &stats);
+
+    qsort(latencies, delivered_count, sizeof(uint64_t), bench_compare_u64);
+    double elapsed_s = (double)(last_delivery - start) / 1e9;
+    double goodput_kbps = elapsed_s > 0.0
+        ? (double)delivered_count * PAYLOAD * 8.0 / elapsed_s / 1000.0
+        : 0.0;
+    uint64_t impaired_sent = run.client_impairment.sent
+        + run.server_impairment.sent;
+    uint64_t impaired_dropped = run.client_impairment.dropped
+        + run.server_impairment.dropped;
+
+    printf("{\"benchmark\":\"goodput/%s\",\"variant\":\"%s\","
+           "\"messages\":%d,\"delivered\":%zu,\"measured_loss\":%.4f,"
+           "\"goodput_kbps\":%.1f,\"resends\":%llu,"
+           "\"retransmission_overhead\":%.4f,\"reliable_drops\":%llu,"
+           "\"p50_ms\":%.2f,\"p99_ms\":%.2f,\"p999_ms\":%.2f,"
+           "\"max_ms\":%.2f}\n",
+           profile->name, HAZEL_BENCH_VARIANT, MESSAGES, delivered_count,
+           impaired_sent > 0
+               ? (double)impaired_dropped / (double)impaired_sent
+               : 0.0,
+           goodput_kbps, (unsigned long long)stats.resends,
+           (double)stats.resends / MESSAGES,
+           (unsigned long long)stats.drops,
+           goodput_percentile_ms(latencies, delivered_count, 0.5),
+           goodput_percentile_ms(latencies, delivered_count, 0.99),
+           goodput_percentile_ms(latencies, delivered_count, 0.999),
+           goodput_percentile_ms(latencies, delivered_count, 1.0));
+    ret = 0;
+
+exit:
+    goodput_run_free(&run);
+    return ret;
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    {
+        if (goodput_profile_run(&profiles[i]) != 0)
+        {
+            fprintf(stderr, "goodput/%s failed\n", profiles[i].name);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
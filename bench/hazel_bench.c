@@ -0,0 +1,59 @@
+/*
+ * Runs every suite, or only those named on the command line, printing one
+ * JSON line per result:
+ *
+ *     hazel_bench [micro] [loopback] [inproc]
+ */
+
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct bench_suite
+{
+    const char *name;
+    int (*run)(void);
+} bench_suite;
+
+int main(int argc, char **argv)
+{
+    static const bench_suite suites[] = {
+        { "micro", bench_micro },
+        { "loopback", bench_loopback },
+        { "inproc", bench_inproc },
+    };
+    const size_t suite_count = sizeof(suites) / sizeof(suites[0]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        size_t s = 0;
+        while (s < suite_count && strcmp(argv[i], suites[s].name) != 0)
+        {
+            s++;
+        }
+        if (s == suite_count)
+        {
+            fprintf(stderr, "unknown suite: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (size_t s = 0; s < suite_count; s++)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc && !selected; i++)
+        {
+            selected = strcmp(argv[i], suites[s].name) == 0;
+        }
+
+        if (selected && suites[s].run() != 0)
+        {
+            fprintf(stderr, "suite %s failed\n", suites[s].name);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
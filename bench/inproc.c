@@ -0,0 +1,111 @@
+/*
+ * The client and connection code paths without the kernel: a client and a
+ * bare connection exchange datagrams over a hazel_udp_loopback, on a single
+ * thread, so the results only depend on the CPU.
+ */
+
+#include "bench.h"
+
+#include "hazel/udp/client.h"
+#include "hazel/udp/connection.h"
+#include "hazel/udp/loopback.h"
+
+#include <stdlib.h>
+
+#define ITERATIONS 1000000
+#define PAYLOAD 64
+
+static int bench_inproc_run(hazel_udp_client *client,
+                            hazel_udp_connection *server,
+                            enum hazel_send_option send_option,
+                            const char *name)
+{
+    static const uint8_t payload[PAYLOAD];
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    uint8_t datagram[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, send_option);
+        if (hazel_message_writer_start_message(&writer, 0x01) != 0
+            || hazel_message_writer_bytes(&writer, payload, 0,
+                                          sizeof(payload)) != 0
+            || hazel_message_writer_end_message(&writer) != 0
+            || hazel_udp_connection_send(&client->udp_connection,
+                                         &writer) < 0)
+        {
+            return -1;
+        }
+
+        int size = hazel_udp_socket_try_recv(&server->_socket, datagram,
+                                             sizeof(datagram), 0);
+        hazel_udp_connection_recv recv;
+        if (size <= 0
+            || hazel_udp_connection_handle_recv_in_place(
+                   server, datagram, size, &recv) != 0
+            || recv.packet_type != send_option)
+        {
+            return -1;
+        }
+        BENCH_DO_NOT_OPTIMIZE(recv.data.msg.reader.size);
+        hazel_udp_connection_release_in_place(server, datagram, size, &recv);
+
+        // Take in the server's ack, if any, so the client forgets the packet
+        size = hazel_udp_socket_try_recv(&client->udp_connection._socket,
+                                         datagram, sizeof(datagram), 0);
+        if (size > 0
+            && hazel_udp_connection_handle_recv_in_place(
+                   &client->udp_connection, datagram, size, &recv) == 0)
+        {
+            hazel_udp_connection_release_in_place(&client->udp_connection,
+                                                  datagram, size, &recv);
+        }
+    }
+    bench_report(name, ITERATIONS, bench_now_ns() - start, PAYLOAD);
+    return 0;
+}
+
+int bench_inproc(void)
+{
+    hazel_udp_loopback loopback;
+    if (hazel_udp_loopback_init(&loopback, 64) != 0)
+    {
+        return -1;
+    }
+
+    hazel_udp_client client;
+    hazel_udp_connection server;
+    hazel_udp_connection_init(&server);
+    int ret = -1;
+
+    if (hazel_udp_client_init_with(&client, "loopback", 0, HAZEL_IP_MODE_IPV4,
+                                   &hazel_udp_loopback_vtable,
+                                   &loopback.a) != 0
+        || hazel_udp_socket_init_with(&server._socket,
+                                      &hazel_udp_loopback_vtable,
+                                      &loopback.b) != 0
+        || hazel_udp_socket_open(&server._socket, HAZEL_IP_MODE_IPV4) != 0)
+    {
+        goto exit;
+    }
+    client.udp_connection._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+    server._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+
+    if (bench_inproc_run(&client, &server, HAZEL_SEND_OPTION_UNRELIABLE,
+                         "inproc/send_recv_unreliable_64") != 0
+        || bench_inproc_run(&client, &server, HAZEL_SEND_OPTION_RELIABLE,
+                            "inproc/send_recv_ack_reliable_64") != 0)
+    {
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    hazel_udp_client_free(&client);
+    hazel_udp_connection_free(&server);
+    hazel_udp_loopback_free(&loopback);
+    return ret;
+}
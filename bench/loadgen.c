@@ -0,0 +1,752 @@
+/*
+ * Load generator: drives thousands of hazel client connections against a
+ * server from a few threads. Each thread owns a hazel_event_loop and a slice
+ * of the clients, handshakes them asynchronously as the staged ramp reaches
+ * them, and sends each connected client's messages at a fixed rate from a
+ * weighted mix of send options and sizes.
+ *
+ *     hazel_loadgen -c 5000 -t 4 -s 500 -i 2000 -r 20 \
+ *                   -m reliable:64:3,unreliable:512:1 127.0.0.1 22023
+ *
+ * One JSON line is printed per ramp stage and for the steady phase, with the
+ * connections, message rates and the round trip times measured on the acks
+ * of reliable messages during that stage, then the connect latencies.
+ *
+ * Every client has its own socket, so the open file limit must allow for
+ * them (ulimit -n).
+ */
+
+#include "bench.h"
+
+#include "hazel/udp/client.h"
+#include "hazel/udp/event_loop.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOADGEN_MAX_MIX 16
+#define LOADGEN_MAX_HELLO 256
+#define LOADGEN_TIMESTAMP_SIZE sizeof(uint64_t)
+// Room for the packet header and the message framing
+#define LOADGEN_MAX_PAYLOAD (HAZEL_BUFFER_SIZE - 16)
+#define LOADGEN_MESSAGE_TAG 0x01
+#define LOADGEN_POLL_MS 1
+
+typedef struct loadgen_mix_entry
+{
+    enum hazel_send_option send_option;
+    size_t size;
+    unsigned weight;
+} loadgen_mix_entry;
+
+typedef struct loadgen_options
+{
+    const char *host;
+    uint16_t port;
+    enum hazel_ip_mode ip_mode;
+    size_t clients;
+    size_t threads;
+    size_t ramp_step;
+    uint64_t ramp_interval_ms;
+    uint64_t duration_ms;
+    uint64_t handshake_timeout_ms;
+    double rate;
+
+    loadgen_mix_entry mix[LOADGEN_MAX_MIX];
+    size_t mix_count;
+    unsigned mix_weight;
+
+    uint8_t hello[LOADGEN_MAX_HELLO];
+    size_t hello_size;
+} loadgen_options;
+
+enum loadgen_client_state
+{
+    LOADGEN_CLIENT_IDLE,
+    LOADGEN_CLIENT_CONNECTING,
+    LOADGEN_CLIENT_CONNECTED,
+    LOADGEN_CLIENT_DISCONNECTED,
+    LOADGEN_CLIENT_FAILED,
+};
+
+typedef struct loadgen_worker loadgen_worker;
+
+typedef struct loadgen_client
+{
+    hazel_udp_client client;
+    loadgen_worker *worker;
+
+    // Written by the worker, read by the main thread for statistics once
+    // the client is connected
+    atomic_int state;
+    // Whether hazel_udp_client_init() succeeded, so the client needs freeing
+    bool initialized;
+    bool in_loop;
+    uint64_t start_ns;
+    uint64_t hello_ns;
+    uint64_t next_send_ns;
+} loadgen_client;
+
+struct loadgen_worker
+{
+    const loadgen_options *options;
+    loadgen_client *clients;
+    size_t count;
+
+    hazel_event_loop loop;
+    pthread_t thread;
+    uint64_t rng;
+
+    // Connect latencies, only read once the worker has stopped
+    uint64_t *connect_ns;
+    size_t connect_count;
+
+    atomic_uint_least64_t connected;
+    atomic_uint_least64_t failed;
+    atomic_uint_least64_t disconnected;
+    atomic_uint_least64_t messages_sent;
+    atomic_uint_least64_t bytes_sent;
+    atomic_uint_least64_t messages_received;
+};
+
+static atomic_bool loadgen_running;
+
+static uint64_t loadgen_next_random(loadgen_worker *worker)
+{
+    // xorshift64, plenty for picking messages
+    uint64_t x = worker->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return worker->rng = x;
+}
+
+static void loadgen_on_connected(hazel_udp_connection *connection,
+                                 void *user_data)
+{
+    (void)connection;
+    loadgen_client *client = user_data;
+    loadgen_worker *worker = client->worker;
+
+    uint64_t now = bench_now_ns();
+    worker->connect_ns[worker->connect_count++] = now - client->hello_ns;
+    client->next_send_ns = now;
+    atomic_store_explicit(&client->state, LOADGEN_CLIENT_CONNECTED,
+                          memory_order_release);
+    atomic_fetch_add_explicit(&worker->connected, 1, memory_order_relaxed);
+}
+
+static void loadgen_on_message(hazel_udp_connection *connection,
+                               enum hazel_send_option send_option,
+                               hazel_message_reader *reader, void *user_data)
+{
+    (void)connection;
+    (void)send_option;
+    (void)reader;
+    loadgen_client *client = user_data;
+    atomic_fetch_add_explicit(&client->worker->messages_received, 1,
+                              memory_order_relaxed);
+}
+
+static void loadgen_on_disconnect(hazel_udp_connection *connection,
+                                  hazel_message_reader *reader,
+                                  void *user_data)
+{
+    (void)connection;
+    (void)reader;
+    loadgen_client *client = user_data;
+    // Taken out of the loop by the worker, not from inside hazel_poll()
+    atomic_store_explicit(&client->state, LOADGEN_CLIENT_DISCONNECTED,
+                          memory_order_release);
+    atomic_fetch_add_explicit(&client->worker->disconnected, 1,
+                              memory_order_relaxed);
+}
+
+static void loadgen_client_start(loadgen_worker *worker,
+                                 loadgen_client *client, uint64_t now)
+{
+    const loadgen_options *options = worker->options;
+    hazel_udp_connection *connection = &client->client.udp_connection;
+
+    if (hazel_udp_client_init(&client->client, options->host, options->port,
+                              options->ip_mode) != 0)
+    {
+        atomic_store(&client->state, LOADGEN_CLIENT_FAILED);
+        atomic_fetch_add_explicit(&worker->failed, 1, memory_order_relaxed);
+        return;
+    }
+    client->initialized = true;
+
+    connection->handlers.on_connected = loadgen_on_connected;
+    connection->handlers.on_message = loadgen_on_message;
+    connection->handlers.on_disconnect = loadgen_on_disconnect;
+    connection->handlers.user_data = client;
+
+    client->hello_ns = now;
+    atomic_store(&client->state, LOADGEN_CLIENT_CONNECTING);
+    if (hazel_event_loop_add(&worker->loop, connection) != 0
+        || hazel_udp_client_handshake_async(
+               &client->client,
+               options->hello_size > 0 ? (uint8_t *)options->hello : NULL,
+               options->hello_size) != 0)
+    {
+        atomic_store(&client->state, LOADGEN_CLIENT_FAILED);
+        atomic_fetch_add_explicit(&worker->failed, 1, memory_order_relaxed);
+        return;
+    }
+    client->in_loop = true;
+}
+
+static void loadgen_client_stop(loadgen_worker *worker,
+                                loadgen_client *client)
+{
+    if (client->in_loop)
+    {
+        hazel_event_loop_remove(&worker->loop,
+                                &client->client.udp_connection);
+        client->in_loop = false;
+    }
+}
+
+static const loadgen_mix_entry *loadgen_pick(loadgen_worker *worker)
+{
+    const loadgen_options *options = worker->options;
+    unsigned pick = (unsigned)(loadgen_next_random(worker)
+                               % options->mix_weight);
+    for (size_t i = 0; i < options->mix_count; i++)
+    {
+        if (pick < options->mix[i].weight)
+        {
+            return &options->mix[i];
+        }
+        pick -= options->mix[i].weight;
+    }
+    return &options->mix[options->mix_count - 1];
+}
+
+static void loadgen_client_send(loadgen_worker *worker,
+                                loadgen_client *client,
+                                hazel_message_writer *writer)
+{
+    static const uint8_t padding[LOADGEN_MAX_PAYLOAD];
+
+    const loadgen_mix_entry *entry = loadgen_pick(worker);
+    int ret = 0;
+    hazel_message_writer_clear(writer, entry->send_option);
+    ret |= hazel_message_writer_start_message(writer, LOADGEN_MESSAGE_TAG);
+    ret |= hazel_message_writer_uint64(writer, bench_now_ns());
+    ret |= hazel_message_writer_bytes(writer, padding, 0,
+                                      entry->size - LOADGEN_TIMESTAMP_SIZE);
+    ret |= hazel_message_writer_end_message(writer);
+    if (ret != 0)
+    {
+        return;
+    }
+
+    if (hazel_udp_connection_send(&client->client.udp_connection, writer) >= 0)
+    {
+        atomic_fetch_add_explicit(&worker->messages_sent, 1,
+                                  memory_order_relaxed);
+        atomic_fetch_add_explicit(&worker->bytes_sent, entry->size,
+                                  memory_order_relaxed);
+    }
+}
+
+static void *loadgen_worker_main(void *arg)
+{
+    loadgen_worker *worker = arg;
+    const loadgen_options *options = worker->options;
+    uint64_t send_interval_ns = options->rate > 0.0
+        ? (uint64_t)(1e9 / options->rate) : 0;
+    uint64_t handshake_timeout_ns = options->handshake_timeout_ms * 1000000ull;
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    while (atomic_load_explicit(&loadgen_running, memory_order_relaxed))
+    {
+        uint64_t now = bench_now_ns();
+        for (size_t i = 0; i < worker->count; i++)
+        {
+            loadgen_client *client = &worker->clients[i];
+            switch (atomic_load_explicit(&client->state,
+                                         memory_order_relaxed))
+            {
+            case LOADGEN_CLIENT_IDLE:
+                if (now >= client->start_ns)
+                {
+                    loadgen_client_start(worker, client, now);
+                }
+                break;
+            case LOADGEN_CLIENT_CONNECTING:
+                if (now - client->hello_ns > handshake_timeout_ns)
+                {
+                    atomic_store(&client->state, LOADGEN_CLIENT_FAILED);
+                    atomic_fetch_add_explicit(&worker->failed, 1,
+                                              memory_order_relaxed);
+                    loadgen_client_stop(worker, client);
+                }
+                break;
+            case LOADGEN_CLIENT_CONNECTED:
+                // Catch up on missed sends rather than silently lowering
+                // the rate when the thread falls behind
+                while (send_interval_ns > 0 && client->next_send_ns <= now)
+                {
+                    loadgen_client_send(worker, client, &writer);
+                    client->next_send_ns += send_interval_ns;
+                }
+                break;
+            case LOADGEN_CLIENT_DISCONNECTED:
+            case LOADGEN_CLIENT_FAILED:
+                loadgen_client_stop(worker, client);
+                break;
+            }
+        }
+
+        hazel_poll(&worker->loop, LOADGEN_POLL_MS);
+    }
+
+    // Tell the server to let go of the connections rather than time out
+    uint8_t disconnect[] = { HAZEL_SEND_OPTION_DISCONNECT };
+    for (size_t i = 0; i < worker->count; i++)
+    {
+        loadgen_client *client = &worker->clients[i];
+        if (atomic_load(&client->state) == LOADGEN_CLIENT_CONNECTED)
+        {
+            hazel_udp_socket_send(&client->client.udp_connection._socket,
+                                  disconnect, sizeof(disconnect), 0);
+        }
+        loadgen_client_stop(worker, client);
+    }
+    return NULL;
+}
+
+/**
+ * Sum the statistics of every connected client.
+ */
+static void loadgen_collect_stats(loadgen_worker *workers, size_t threads,
+                                  hazel_udp_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    hazel_udp_stats stats;
+    for (size_t t = 0; t < threads; t++)
+    {
+        for (size_t i = 0; i < workers[t].count; i++)
+        {
+            loadgen_client *client = &workers[t].clients[i];
+            int state = atomic_load_explicit(&client->state,
+                                             memory_order_acquire);
+            if (state != LOADGEN_CLIENT_CONNECTED
+                && state != LOADGEN_CLIENT_DISCONNECTED)
+            {
+                continue;
+            }
+
+            hazel_udp_connection_get_stats(&client->client.udp_connection,
+                                           &stats);
+            out->resends += stats.resends;
+            out->acks_received += stats.acks_received;
+            out->drops += stats.drops;
+            for (size_t b = 0; b < HAZEL_UDP_STATS_RTT_BUCKETS; b++)
+            {
+                out->rtt_histogram[b] += stats.rtt_histogram[b];
+            }
+        }
+    }
+}
+
+typedef struct loadgen_totals
+{
+    uint64_t connected;
+    uint64_t failed;
+    uint64_t disconnected;
+    uint64_t messages_sent;
+    uint64_t bytes_sent;
+    uint64_t messages_received;
+} loadgen_totals;
+
+static void loadgen_collect_totals(loadgen_worker *workers, size_t threads,
+                                   loadgen_totals *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (size_t t = 0; t < threads; t++)
+    {
+        out->connected += atomic_load(&workers[t].connected);
+        out->failed += atomic_load(&workers[t].failed);
+        out->disconnected += atomic_load(&workers[t].disconnected);
+        out->messages_sent += atomic_load(&workers[t].messages_sent);
+        out->bytes_sent += atomic_load(&workers[t].bytes_sent);
+        out->messages_received += atomic_load(&workers[t].messages_received);
+    }
+}
+
+/**
+ * Print what happened since the previous report, and make the current
+ * numbers the previous ones.
+ */
+static void loadgen_report_stage(const char *stage, size_t target_clients,
+                                 uint64_t elapsed_ns, loadgen_worker *workers,
+                                 size_t threads, loadgen_totals *previous,
+                                 hazel_udp_stats *previous_stats)
+{
+    static hazel_udp_stats stats, delta;
+    loadgen_totals totals;
+    loadgen_collect_totals(workers, threads, &totals);
+    loadgen_collect_stats(workers, threads, &stats);
+
+    memset(&delta, 0, sizeof(delta));
+    for (size_t b = 0; b < HAZEL_UDP_STATS_RTT_BUCKETS; b++)
+    {
+        delta.rtt_histogram[b] = stats.rtt_histogram[b]
+            - previous_stats->rtt_histogram[b];
+    }
+
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("{\"benchmark\":\"loadgen/%s\",\"variant\":\"%s\","
+           "\"target_clients\":%zu,\"connected\":%llu,\"failed\":%llu,"
+           "\"disconnected\":%llu,\"sent_per_s\":%.1f,\"sent_kbps\":%.1f,"
+           "\"received_per_s\":%.1f,\"resends\":%llu,\"drops\":%llu,"
+           "\"rtt_p50_us\":%llu,\"rtt_p90_us\":%llu,\"rtt_p99_us\":%llu,"
+           "\"rtt_p999_us\":%llu}\n",
+           stage, HAZEL_BENCH_VARIANT, target_clients,
+           (unsigned long long)(totals.connected - totals.disconnected),
+           (unsigned long long)totals.failed,
+           (unsigned long long)totals.disconnected,
+           (double)(totals.messages_sent - previous->messages_sent) / seconds,
+           (double)(totals.bytes_sent - previous->bytes_sent) * 8.0 / 1000.0
+               / seconds,
+           (double)(totals.messages_received - previous->messages_received)
+               / seconds,
+           (unsigned long long)(stats.resends - previous_stats->resends),
+           (unsigned long long)(stats.drops - previous_stats->drops),
+           (unsigned long long)hazel_udp_stats_rtt_percentile(&delta, 50.0),
+           (unsigned long long)hazel_udp_stats_rtt_percentile(&delta, 90.0),
+           (unsigned long long)hazel_udp_stats_rtt_percentile(&delta, 99.0),
+           (unsigned long long)hazel_udp_stats_rtt_percentile(&delta, 99.9));
+    fflush(stdout);
+
+    *previous = totals;
+    *previous_stats = stats;
+}
+
+static void loadgen_sleep_until(uint64_t deadline_ns)
+{
+    uint64_t now = bench_now_ns();
+    if (deadline_ns > now)
+    {
+        struct timespec wait = {
+            .tv_sec = (time_t)((deadline_ns - now) / 1000000000ull),
+            .tv_nsec = (long)((deadline_ns - now) % 1000000000ull),
+        };
+        nanosleep(&wait, NULL);
+    }
+}
+
+/**
+ * Parse a mix such as "reliable:64:3,unreliable:512:1", a list of send
+ * option, message size in bytes and weight, the weight defaulting to 1.
+ */
+static int loadgen_parse_mix(const char *text, loadgen_options *options)
+{
+    options->mix_count = 0;
+    options->mix_weight = 0;
+    while (*text != '\0')
+    {
+        if (options->mix_count == LOADGEN_MAX_MIX)
+        {
+            return -1;
+        }
+        loadgen_mix_entry *entry = &options->mix[options->mix_count];
+
+        size_t name_length = strcspn(text, ":");
+        if (name_length == strlen("reliable")
+            && strncmp(text, "reliable", name_length) == 0)
+        {
+            entry->send_option = HAZEL_SEND_OPTION_RELIABLE;
+        }
+        else if (name_length == strlen("unreliable")
+                 && strncmp(text, "unreliable", name_length) == 0)
+        {
+            entry->send_option = HAZEL_SEND_OPTION_UNRELIABLE;
+        }
+        else
+        {
+            return -1;
+        }
+        text += name_length;
+        if (*text++ != ':')
+        {
+            return -1;
+        }
+
+        char *end;
+        unsigned long size = strtoul(text, &end, 10);
+        unsigned long weight = 1;
+        if (end == text || size < LOADGEN_TIMESTAMP_SIZE
+            || size > LOADGEN_MAX_PAYLOAD)
+        {
+            return -1;
+        }
+        text = end;
+        if (*text == ':')
+        {
+            text++;
+            weight = strtoul(text, &end, 10);
+            if (end == text || weight == 0)
+            {
+                return -1;
+            }
+            text = end;
+        }
+        if (*text == ',')
+        {
+            text++;
+        }
+        else if (*text != '\0')
+        {
+            return -1;
+        }
+
+        entry->size = size;
+        entry->weight = (unsigned)weight;
+        options->mix_weight += entry->weight;
+        options->mix_count++;
+    }
+    return options->mix_count > 0 ? 0 : -1;
+}
+
+static int loadgen_parse_hex(const char *text, loadgen_options *options)
+{
+    size_t length = strlen(text);
+    if (length % 2 != 0 || length / 2 > LOADGEN_MAX_HELLO)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < length / 2; i++)
+    {
+        unsigned value;
+        if (sscanf(text + 2 * i, "%2x", &value) != 1)
+        {
+            return -1;
+        }
+        options->hello[i] = (uint8_t)value;
+    }
+    options->hello_size = length / 2;
+    return 0;
+}
+
+static void loadgen_usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [options] host port\n"
+            "  -c clients     connections to open (100)\n"
+            "  -t threads     threads sharing the connections (4)\n"
+            "  -s step        connections added per ramp stage (all)\n"
+            "  -i ms          length of a ramp stage (1000)\n"
+            "  -d seconds     steady phase once every stage ran (10)\n"
+            "  -r rate        messages per second per connection (10)\n"
+            "  -m mix         option:size[:weight],... (reliable:64)\n"
+            "  -T ms          handshake timeout (5000)\n"
+            "  -H hex         payload appended to the hello\n"
+            "  -6             connect over IPv6\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    static loadgen_options options = {
+        .ip_mode = HAZEL_IP_MODE_IPV4,
+        .clients = 100,
+        .threads = 4,
+        .ramp_interval_ms = 1000,
+        .duration_ms = 10000,
+        .handshake_timeout_ms = 5000,
+        .rate = 10.0,
+        .mix = { { HAZEL_SEND_OPTION_RELIABLE, 64, 1 } },
+        .mix_count = 1,
+        .mix_weight = 1,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:s:i:d:r:m:T:H:6")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            options.clients = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            options.threads = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            options.ramp_step = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            options.ramp_interval_ms = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            options.duration_ms = strtoull(optarg, NULL, 10) * 1000;
+            break;
+        case 'r':
+            options.rate = strtod(optarg, NULL);
+            break;
+        case 'm':
+            if (loadgen_parse_mix(optarg, &options) != 0)
+            {
+                fprintf(stderr, "invalid mix: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            options.handshake_timeout_ms = strtoull(optarg, NULL, 10);
+            break;
+        case 'H':
+            if (loadgen_parse_hex(optarg, &options) != 0)
+            {
+                fprintf(stderr, "invalid hello payload: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case '6':
+            options.ip_mode = HAZEL_IP_MODE_IPV6;
+            break;
+        default:
+            loadgen_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || options.clients == 0 || options.threads == 0)
+    {
+        loadgen_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    options.host = argv[optind];
+    options.port = (uint16_t)strtoul(argv[optind + 1], NULL, 10);
+    if (options.ramp_step == 0 || options.ramp_step > options.clients)
+    {
+        options.ramp_step = options.clients;
+    }
+    if (options.threads > options.clients)
+    {
+        options.threads = options.clients;
+    }
+
+    loadgen_worker *workers = calloc(options.threads, sizeof(*workers));
+    loadgen_client *clients = calloc(options.clients, sizeof(*clients));
+    uint64_t *connect_ns = calloc(options.clients, sizeof(uint64_t));
+    if (workers == NULL || clients == NULL || connect_ns == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t stages = (options.clients + options.ramp_step - 1)
+        / options.ramp_step;
+    uint64_t start = bench_now_ns();
+    size_t offset = 0;
+    for (size_t t = 0; t < options.threads; t++)
+    {
+        loadgen_worker *worker = &workers[t];
+        worker->options = &options;
+        worker->count = options.clients / options.threads
+            + (t < options.clients % options.threads ? 1 : 0);
+        worker->clients = clients + offset;
+        worker->connect_ns = connect_ns + offset;
+        worker->rng = 0x9E3779B97F4A7C15ull * (t + 1);
+        offset += worker->count;
+        if (hazel_event_loop_init(&worker->loop) != 0)
+        {
+            fprintf(stderr, "out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t t = 0; t < options.threads; t++)
+    {
+        for (size_t i = 0; i < workers[t].count; i++)
+        {
+            // The threads take turns in the start order, so that every
+            // stage starts clients on all of them
+            size_t order = i * options.threads + t;
+            loadgen_client *client = &workers[t].clients[i];
+            client->worker = &workers[t];
+            client->start_ns = start + (order / options.ramp_step)
+                * options.ramp_interval_ms * 1000000ull;
+            atomic_init(&client->state, LOADGEN_CLIENT_IDLE);
+        }
+    }
+
+    atomic_store(&loadgen_running, true);
+    for (size_t t = 0; t < options.threads; t++)
+    {
+        if (pthread_create(&workers[t].thread, NULL, loadgen_worker_main,
+                           &workers[t]) != 0)
+        {
+            fprintf(stderr, "could not start thread %zu\n", t);
+            return EXIT_FAILURE;
+        }
+    }
+
+    static hazel_udp_stats previous_stats;
+    loadgen_totals previous;
+    memset(&previous, 0, sizeof(previous));
+    char stage_name[32];
+    uint64_t stage_start = start;
+    for (size_t stage = 0; stage < stages; stage++)
+    {
+        uint64_t stage_end = start
+            + (stage + 1) * options.ramp_interval_ms * 1000000ull;
+        loadgen_sleep_until(stage_end);
+        size_t target = (stage + 1) * options.ramp_step;
+        snprintf(stage_name, sizeof(stage_name), "ramp_%zu", stage);
+        loadgen_report_stage(stage_name,
+                             target < options.clients ? target
+                                                      : options.clients,
+                             bench_now_ns() - stage_start, workers,
+                             options.threads, &previous, &previous_stats);
+        stage_start = bench_now_ns();
+    }
+
+    if (options.duration_ms > 0)
+    {
+        loadgen_sleep_until(stage_start + options.duration_ms * 1000000ull);
+        loadgen_report_stage("steady", options.clients,
+                             bench_now_ns() - stage_start, workers,
+                             options.threads, &previous, &previous_stats);
+    }
+
+    atomic_store(&loadgen_running, false);
+    size_t connect_count = 0;
+    uint64_t failed = 0;
+    for (size_t t = 0; t < options.threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        // Pack the samples of every worker together
+        memmove(connect_ns + connect_count, workers[t].connect_ns,
+                workers[t].connect_count * sizeof(uint64_t));
+        connect_count += workers[t].connect_count;
+        failed += atomic_load(&workers[t].failed);
+    }
+    bench_report_latency("loadgen/connect", connect_ns, connect_count,
+                         (size_t)failed);
+
+    for (size_t i = 0; i < options.clients; i++)
+    {
+        if (clients[i].initialized)
+        {
+            hazel_udp_client_close(&clients[i].client);
+            hazel_udp_client_free(&clients[i].client);
+        }
+    }
+    for (size_t t = 0; t < options.threads; t++)
+    {
+        hazel_event_loop_free(&workers[t].loop);
+    }
+    free(connect_ns);
+    free(clients);
+    free(workers);
+    return EXIT_SUCCESS;
+}
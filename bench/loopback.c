@@ -0,0 +1,345 @@
+/*
+ * End to end throughput and latency over 127.0.0.1: a hazel_udp_client talks
+ * to an echo server made of a bare hazel_udp_connection on its own thread.
+ */
+
+#include "bench.h"
+
+#include "hazel/udp/client.h"
+#include "hazel/udp/connection.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#define LATENCY_SAMPLES 20000
+#define THROUGHPUT_MESSAGES 200000
+#define THROUGHPUT_WINDOW 32
+#define THROUGHPUT_PAYLOAD 256
+#define RECV_ATTEMPTS 10
+
+typedef struct echo_server
+{
+    hazel_udp_connection connection;
+    uint16_t port;
+    atomic_bool running;
+    pthread_t thread;
+} echo_server;
+
+/*
+ * Accept the client's hello: connect the socket to its address and ack the
+ * hello's reliable ID, which is what a hazel server does before anything else.
+ */
+static int echo_server_accept(echo_server *server)
+{
+    int handle = server->connection._socket._sock_handle;
+    struct pollfd pfd = { .fd = handle, .events = POLLIN };
+    uint8_t hello[HAZEL_BUFFER_SIZE];
+    struct sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+
+    while (atomic_load(&server->running))
+    {
+        if (poll(&pfd, 1, 10) <= 0)
+        {
+            continue;
+        }
+
+        ssize_t size = recvfrom(handle, hello, sizeof(hello), 0,
+                                (struct sockaddr *)&address, &address_length);
+        if (size < 3 || hello[0] != HAZEL_SEND_OPTION_HELLO)
+        {
+            continue;
+        }
+        if (connect(handle, (struct sockaddr *)&address, address_length) != 0)
+        {
+            return -1;
+        }
+
+        uint8_t ack[] = { HAZEL_SEND_OPTION_ACK, hello[1], hello[2], 0xFF };
+        if (hazel_udp_socket_send(&server->connection._socket, ack,
+                                  sizeof(ack), 0) < 0)
+        {
+            return -1;
+        }
+        server->connection._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+        return 0;
+    }
+    return -1;
+}
+
+static void *echo_server_main(void *arg)
+{
+    echo_server *server = arg;
+    hazel_udp_connection *connection = &server->connection;
+
+    if (echo_server_accept(server) != 0)
+    {
+        return NULL;
+    }
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    uint8_t echo_buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, echo_buffer, sizeof(echo_buffer));
+
+    while (atomic_load(&server->running))
+    {
+        int size = hazel_udp_socket_recv(&connection->_socket, buffer,
+                                         sizeof(buffer), 0, 10);
+        if (size > 0)
+        {
+            hazel_udp_connection_recv recv;
+            if (hazel_udp_connection_handle_recv_in_place(
+                    connection, buffer, size, &recv) == 0)
+            {
+                if (recv.packet_type == HAZEL_SEND_OPTION_UNRELIABLE
+                    || recv.packet_type == HAZEL_SEND_OPTION_RELIABLE)
+                {
+                    hazel_message_reader *reader = &recv.data.msg.reader;
+                    hazel_message_writer_clear(&writer, recv.packet_type);
+                    hazel_message_writer_bytes(&writer, reader->data,
+                                               reader->offset,
+                                               reader->size - reader->offset);
+                    hazel_udp_connection_send(connection, &writer);
+                }
+                // Disconnects may carry a decompressed reader too
+                hazel_udp_connection_release_in_place(connection, buffer,
+                                                      size, &recv);
+            }
+        }
+        hazel_udp_connection_manage_reliable(connection);
+    }
+    return NULL;
+}
+
+static int echo_server_start(echo_server *server)
+{
+    hazel_udp_connection_init(&server->connection);
+    atomic_init(&server->running, true);
+
+    hazel_udp_socket *socket = &server->connection._socket;
+    if (hazel_udp_socket_init(socket) != 0
+        || hazel_udp_socket_open(socket, HAZEL_IP_MODE_IPV4) != 0)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t address_length = sizeof(address);
+    if (bind(socket->_sock_handle, (struct sockaddr *)&address,
+             sizeof(address)) != 0
+        || getsockname(socket->_sock_handle, (struct sockaddr *)&address,
+                       &address_length) != 0)
+    {
+        return -1;
+    }
+    server->port = ntohs(address.sin_port);
+
+    return pthread_create(&server->thread, NULL, echo_server_main, server);
+}
+
+static void echo_server_stop(echo_server *server)
+{
+    atomic_store(&server->running, false);
+    pthread_join(server->thread, NULL);
+    hazel_udp_connection_close(&server->connection);
+    hazel_udp_connection_free(&server->connection);
+}
+
+/**
+ * Wait for the next message from the echo server.
+ *
+ * \return 0 and the echoed sequence number, or -1 if nothing came back
+ */
+static int bench_recv_echo(hazel_udp_client *client, uint64_t *out_sequence)
+{
+    for (int attempt = 0; attempt < RECV_ATTEMPTS; attempt++)
+    {
+        enum hazel_send_option send_option;
+        hazel_message_reader reader, message;
+        if (hazel_udp_client_recv(client, &send_option, &reader)
+            != HAZEL_UDP_CLIENT_RECV_HAS_MESSAGE)
+        {
+            continue;
+        }
+
+        int ret = hazel_message_reader_read_message(&reader, &message) == 0
+            && hazel_message_reader_uint64(&message, out_sequence) == 0
+            ? 0 : -1;
+        hazel_message_reader_free(&reader);
+        return ret;
+    }
+    return -1;
+}
+
+static int bench_send_sequence(hazel_udp_client *client,
+                               hazel_message_writer *writer,
+                               enum hazel_send_option send_option,
+                               uint64_t sequence, size_t payload)
+{
+    static const uint8_t padding[THROUGHPUT_PAYLOAD];
+
+    int ret = 0;
+    hazel_message_writer_clear(writer, send_option);
+    ret |= hazel_message_writer_start_message(writer, 0x01);
+    ret |= hazel_message_writer_uint64(writer, sequence);
+    if (payload > sizeof(uint64_t))
+    {
+        ret |= hazel_message_writer_bytes(writer, padding, 0,
+                                          payload - sizeof(uint64_t));
+    }
+    ret |= hazel_message_writer_end_message(writer);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return hazel_udp_connection_send(&client->udp_connection, writer);
+}
+
+/*
+ * One message in flight at a time, timing each round trip.
+ */
+static int bench_latency(hazel_udp_client *client,
+                         enum hazel_send_option send_option, const char *name)
+{
+    uint64_t *samples = malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+    if (samples == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    size_t count = 0, lost = 0;
+    for (uint64_t sequence = 0; sequence < LATENCY_SAMPLES; sequence++)
+    {
+        uint64_t start = bench_now_ns();
+        if (bench_send_sequence(client, &writer, send_option, sequence,
+                                sizeof(uint64_t)) < 0)
+        {
+            free(samples);
+            return -1;
+        }
+
+        uint64_t echoed;
+        if (bench_recv_echo(client, &echoed) != 0 || echoed != sequence)
+        {
+            lost++;
+            continue;
+        }
+        samples[count++] = bench_now_ns() - start;
+    }
+
+    bench_report_latency(name, samples, count, lost);
+    free(samples);
+    return 0;
+}
+
+/*
+ * Keep THROUGHPUT_WINDOW unreliable messages in flight and count the bytes
+ * echoed back.
+ */
+static int bench_throughput(hazel_udp_client *client)
+{
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    // Echoes given up on when a window timed out may still arrive later, so
+    // they only stop counting as in flight, and loss is counted at the end
+    uint64_t sent = 0, received = 0, abandoned = 0;
+    uint64_t start = bench_now_ns();
+    while (sent < THROUGHPUT_MESSAGES)
+    {
+        uint64_t settled = received > abandoned ? received : abandoned;
+        while (sent - settled < THROUGHPUT_WINDOW
+               && sent < THROUGHPUT_MESSAGES)
+        {
+            if (bench_send_sequence(client, &writer,
+                                    HAZEL_SEND_OPTION_UNRELIABLE, sent,
+                                    THROUGHPUT_PAYLOAD) < 0)
+            {
+                return -1;
+            }
+            sent++;
+        }
+
+        uint64_t echoed;
+        if (bench_recv_echo(client, &echoed) == 0)
+        {
+            received++;
+        }
+        else
+        {
+            // Nothing came back in time, give up on the whole window
+            abandoned = sent;
+        }
+    }
+    while (received < sent)
+    {
+        uint64_t echoed;
+        if (bench_recv_echo(client, &echoed) != 0)
+        {
+            break;
+        }
+        received++;
+    }
+    uint64_t lost = sent - received;
+    uint64_t elapsed = bench_now_ns() - start;
+
+    bench_report("loopback/throughput_unreliable_256", received, elapsed,
+                 THROUGHPUT_PAYLOAD);
+    if (lost > 0)
+    {
+        fprintf(stderr, "loopback/throughput_unreliable_256: %llu lost\n",
+                (unsigned long long)lost);
+    }
+    return 0;
+}
+
+int bench_loopback(void)
+{
+    static echo_server server;
+    if (echo_server_start(&server) != 0)
+    {
+        fprintf(stderr, "echo server failed to start\n");
+        return -1;
+    }
+
+    int ret = -1;
+    hazel_udp_client client;
+    if (hazel_udp_client_init(&client, "127.0.0.1", server.port,
+                              HAZEL_IP_MODE_IPV4) != 0
+        || hazel_udp_client_handshake(&client, NULL, 0) != 0)
+    {
+        fprintf(stderr, "client failed to connect to the echo server\n");
+        goto exit;
+    }
+
+    if (bench_latency(&client, HAZEL_SEND_OPTION_UNRELIABLE,
+                      "loopback/latency_unreliable") != 0
+        || bench_latency(&client, HAZEL_SEND_OPTION_RELIABLE,
+                         "loopback/latency_reliable") != 0
+        || bench_throughput(&client) != 0)
+    {
+        goto exit;
+    }
+    ret = 0;
+
+exit:
+    hazel_udp_client_close(&client);
+    hazel_udp_client_free(&client);
+    echo_server_stop(&server);
+    return ret;
+}
@@ -0,0 +1,357 @@
+/*
+ * Microbenchmarks of every reader and writer primitive, varints of different
+ * sizes, strings, and building and parsing a tree of nested messages.
+ */
+
+#include "bench.h"
+
+#include "hazel/reader.h"
+#include "hazel/writer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 100000
+#define VALUES_PER_ITERATION 64
+
+/*
+ * Write VALUES_PER_ITERATION values with the writer primitive FN, then read
+ * them back with the matching reader primitive. VALUE may depend on i so the
+ * values cannot be folded into constants.
+ */
+#define BENCH_PRIMITIVE(LABEL, FN, TYPE, VALUE)                               \
+    static int bench_##LABEL(void)                                            \
+    {                                                                         \
+        uint8_t buffer[HAZEL_BUFFER_SIZE];                                    \
+        hazel_message_writer writer;                                          \
+        hazel_message_writer_init(&writer, buffer, sizeof(buffer));           \
+                                                                              \
+        uint64_t start = bench_now_ns();                                      \
+        for (int iter = 0; iter < ITERATIONS; iter++)                         \
+        {                                                                     \
+            hazel_message_writer_clear(&writer,                               \
+                                       HAZEL_SEND_OPTION_UNRELIABLE);         \
+            for (uint32_t i = 0; i < VALUES_PER_ITERATION; i++)               \
+            {                                                                 \
+                if (hazel_message_writer_##FN(&writer, (TYPE)(VALUE)) != 0)   \
+                {                                                             \
+                    return -1;                                                \
+                }                                                             \
+            }                                                                 \
+            BENCH_CLOBBER();                                                  \
+        }                                                                     \
+        uint64_t elapsed = bench_now_ns() - start;                            \
+        size_t size = writer.size - 1;                                        \
+        bench_report("writer/" #LABEL,                                        \
+                     (uint64_t)ITERATIONS * VALUES_PER_ITERATION, elapsed,    \
+                     size / VALUES_PER_ITERATION);                            \
+                                                                              \
+        TYPE value;                                                           \
+        start = bench_now_ns();                                               \
+        for (int iter = 0; iter < ITERATIONS; iter++)                         \
+        {                                                                     \
+            hazel_message_reader reader;                                      \
+            hazel_message_reader_init(&reader, buffer, size, 1);              \
+            for (uint32_t i = 0; i < VALUES_PER_ITERATION; i++)               \
+            {                                                                 \
+                if (hazel_message_reader_##FN(&reader, &value) != 0)          \
+                {                                                             \
+                    return -1;                                                \
+                }                                                             \
+                BENCH_DO_NOT_OPTIMIZE(value);                                 \
+            }                                                                 \
+            BENCH_CLOBBER();                                                  \
+        }                                                                     \
+        elapsed = bench_now_ns() - start;                                     \
+        bench_report("reader/" #LABEL,                                        \
+                     (uint64_t)ITERATIONS * VALUES_PER_ITERATION, elapsed,    \
+                     size / VALUES_PER_ITERATION);                            \
+        return 0;                                                             \
+    }
+
+BENCH_PRIMITIVE(bool, bool, bool, i & 1)
+BENCH_PRIMITIVE(uint8, uint8, uint8_t, i * 7)
+BENCH_PRIMITIVE(uint16, uint16, uint16_t, i * 1031)
+BENCH_PRIMITIVE(int16, int16, int16_t, -(int32_t)i * 1031)
+BENCH_PRIMITIVE(uint32, uint32, uint32_t, i * 2654435761u)
+BENCH_PRIMITIVE(int32, int32, int32_t, -(int32_t)(i * 40503))
+BENCH_PRIMITIVE(uint64, uint64, uint64_t, i * 0x9E3779B97F4A7C15ull)
+BENCH_PRIMITIVE(int64, int64, int64_t, -(int64_t)i * 0x9E3779B9ll)
+BENCH_PRIMITIVE(single, single, float, (float)i * 0.25f)
+// Varints of one, three and five bytes
+BENCH_PRIMITIVE(packed_uint32_1b, packed_uint32, uint32_t, i)
+BENCH_PRIMITIVE(packed_uint32_3b, packed_uint32, uint32_t, 0x4000 + i)
+BENCH_PRIMITIVE(packed_uint32_5b, packed_uint32, uint32_t, 0xF0000000u + i)
+BENCH_PRIMITIVE(packed_int32_neg, packed_int32, int32_t, -(int32_t)i - 1)
+
+/*
+ * Strings of \p length characters: the writer, then each of the readers,
+ * copying, allocating and viewing.
+ */
+static int bench_string(size_t length)
+{
+    char input[256];
+    memset(input, 'h', length);
+    input[length] = '\0';
+
+    size_t count = (HAZEL_BUFFER_SIZE - 1) / (length + 5);
+    if (count > VALUES_PER_ITERATION)
+    {
+        count = VALUES_PER_ITERATION;
+    }
+
+    char name[64];
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (hazel_message_writer_string(&writer, input) != 0)
+            {
+                return -1;
+            }
+        }
+        BENCH_CLOBBER();
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    size_t size = writer.size - 1;
+    snprintf(name, sizeof(name), "writer/string_%zu", length);
+    bench_report(name, (uint64_t)ITERATIONS * count, elapsed, size / count);
+
+    char output[256];
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader;
+        hazel_message_reader_init(&reader, buffer, size, 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (hazel_message_reader_string(&reader, output,
+                                            sizeof(output)) != 0)
+            {
+                return -1;
+            }
+            BENCH_DO_NOT_OPTIMIZE(output[0]);
+        }
+        BENCH_CLOBBER();
+    }
+    elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "reader/string_%zu", length);
+    bench_report(name, (uint64_t)ITERATIONS * count, elapsed, size / count);
+
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader;
+        hazel_message_reader_init(&reader, buffer, size, 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            char *allocated;
+            if (hazel_message_reader_string_malloc(&reader, &allocated) != 0)
+            {
+                return -1;
+            }
+            BENCH_DO_NOT_OPTIMIZE(allocated);
+            free(allocated);
+        }
+        BENCH_CLOBBER();
+    }
+    elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "reader/string_malloc_%zu", length);
+    bench_report(name, (uint64_t)ITERATIONS * count, elapsed, size / count);
+
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader;
+        hazel_message_reader_init(&reader, buffer, size, 1);
+        for (size_t i = 0; i < count; i++)
+        {
+            hazel_message_reader_string_buffer_view view;
+            if (hazel_message_reader_string_view(&reader, &view) != 0)
+            {
+                return -1;
+            }
+            BENCH_DO_NOT_OPTIMIZE(view.buffer);
+        }
+        BENCH_CLOBBER();
+    }
+    elapsed = bench_now_ns() - start;
+    snprintf(name, sizeof(name), "reader/string_view_%zu", length);
+    bench_report(name, (uint64_t)ITERATIONS * count, elapsed, size / count);
+
+    return 0;
+}
+
+static int bench_bytes(void)
+{
+    uint8_t input[128];
+    for (size_t i = 0; i < sizeof(input); i++)
+    {
+        input[i] = (uint8_t)i;
+    }
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    const size_t count = 7;
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (hazel_message_writer_bytes_and_size(&writer, input, 0,
+                                                    sizeof(input)) != 0)
+            {
+                return -1;
+            }
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("writer/bytes_and_size_128", (uint64_t)ITERATIONS * count,
+                 bench_now_ns() - start, (writer.size - 1) / count);
+    return 0;
+}
+
+#define NESTED_FANOUT 4
+
+/*
+ * A three level tree: NESTED_FANOUT messages, each holding NESTED_FANOUT
+ * children, each holding a few fields.
+ */
+static int bench_nested_build(hazel_message_writer *writer)
+{
+    int ret = 0;
+    hazel_message_writer_clear(writer, HAZEL_SEND_OPTION_UNRELIABLE);
+    for (uint32_t i = 0; i < NESTED_FANOUT; i++)
+    {
+        ret |= hazel_message_writer_start_message(writer, 0x01);
+        for (uint32_t j = 0; j < NESTED_FANOUT; j++)
+        {
+            ret |= hazel_message_writer_start_message(writer, 0x02);
+            for (uint32_t k = 0; k < NESTED_FANOUT; k++)
+            {
+                ret |= hazel_message_writer_start_message(writer, 0x03);
+                ret |= hazel_message_writer_packed_uint32(writer, i * j + k);
+                ret |= hazel_message_writer_single(writer, (float)k);
+                ret |= hazel_message_writer_end_message(writer);
+            }
+            ret |= hazel_message_writer_end_message(writer);
+        }
+        ret |= hazel_message_writer_end_message(writer);
+    }
+    return ret;
+}
+
+static int bench_nested_parse(hazel_message_reader *reader, int depth,
+                              uint32_t *sum)
+{
+    hazel_message_reader child;
+    while (hazel_message_reader_can_read_message(reader))
+    {
+        if (hazel_message_reader_read_message(reader, &child) != 0)
+        {
+            return -1;
+        }
+        if (depth > 1)
+        {
+            if (bench_nested_parse(&child, depth - 1, sum) != 0)
+            {
+                return -1;
+            }
+            continue;
+        }
+
+        uint32_t value;
+        float single;
+        if (hazel_message_reader_packed_uint32(&child, &value) != 0
+            || hazel_message_reader_single(&child, &single) != 0)
+        {
+            return -1;
+        }
+        *sum += value;
+    }
+    return 0;
+}
+
+static int bench_nested(void)
+{
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        if (bench_nested_build(&writer) != 0)
+        {
+            return -1;
+        }
+        BENCH_CLOBBER();
+    }
+    size_t size = writer.size - 1;
+    bench_report("nested/build", ITERATIONS, bench_now_ns() - start, size);
+
+    uint32_t sum = 0;
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader;
+        hazel_message_reader_init(&reader, buffer, size, 1);
+        if (bench_nested_parse(&reader, 3, &sum) != 0)
+        {
+            return -1;
+        }
+        BENCH_CLOBBER();
+    }
+    BENCH_DO_NOT_OPTIMIZE(sum);
+    bench_report("nested/parse", ITERATIONS, bench_now_ns() - start, size);
+
+    hazel_message_reader validated;
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader;
+        hazel_message_reader_init(&reader, buffer, size, 1);
+        if (hazel_message_reader_validate(&reader, 3, &validated) != 0)
+        {
+            return -1;
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("nested/validate", ITERATIONS, bench_now_ns() - start, size);
+
+    return 0;
+}
+
+int bench_micro(void)
+{
+    int (*const benches[])(void) = {
+        bench_bool, bench_uint8, bench_uint16, bench_int16, bench_uint32,
+        bench_int32, bench_uint64, bench_int64, bench_single,
+        bench_packed_uint32_1b, bench_packed_uint32_3b,
+        bench_packed_uint32_5b, bench_packed_int32_neg, bench_bytes,
+        bench_nested,
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        if (benches[i]() != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (bench_string(16) != 0 || bench_string(200) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Serialize/deserialize throughput of the reader and writer primitives for a
+ * typical entity update packet. Built twice, once against the library and once
+ * with HAZEL_CONFIG_INLINE_PRIMITIVES, so the two can be compared directly.
+ */
+
+#include "bench.h"
+#include "entity.h"
+
+#include <stdlib.h>
+
+#define ITERATIONS 200000
+
+int main(void)
+{
+    entity_state entities[ENTITIES_PER_PACKET];
+    for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+    {
+        entity_state_sample(&entities[i], i);
+    }
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+        {
+            if (entity_state_write(&writer, &entities[i]) != 0)
+            {
+                fprintf(stderr, "write failed\n");
+                return EXIT_FAILURE;
+            }
+        }
+        BENCH_CLOBBER();
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    size_t packet_size = writer.size;
+    bench_report("primitives/serialize_entity_packet", ITERATIONS, elapsed,
+                 packet_size);
+
+    entity_state decoded = {0};
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader, message;
+        hazel_message_reader_init(&reader, buffer, packet_size - 1, 1);
+
+        while (hazel_message_reader_can_read_message(&reader))
+        {
+            if (hazel_message_reader_read_message(&reader, &message) != 0
+                || entity_state_read(&message, &decoded) != 0)
+            {
+                fprintf(stderr, "read failed\n");
+                return EXIT_FAILURE;
+            }
+            BENCH_DO_NOT_OPTIMIZE(decoded.net_id);
+        }
+        BENCH_CLOBBER();
+    }
+    elapsed = bench_now_ns() - start;
+    bench_report("primitives/deserialize_entity_packet", ITERATIONS, elapsed,
+                 packet_size);
+
+    return EXIT_SUCCESS;
+}
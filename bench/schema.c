@@ -0,0 +1,177 @@
+/*
+ * Compares the encoders/decoders generated by HAZEL_SCHEMA with the same
+ * entity update written by hand against the primitive API.
+ */
+
+#include "bench.h"
+#include "entity.h"
+
+#include "hazel/schema.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 200000
+
+#define ANIMATION_FIELDS(FIELD, MESSAGE) \
+    FIELD(uint32, state)                 \
+    FIELD(single, blend)
+HAZEL_SCHEMA(animation_schema, ANIMATION_FIELDS)
+
+#define ENTITY_FIELDS(FIELD, MESSAGE)           \
+    FIELD(packed_uint32, net_id)                \
+    FIELD(bool, grounded)                       \
+    FIELD(single, px)                           \
+    FIELD(single, py)                           \
+    FIELD(single, pz)                           \
+    FIELD(single, vx)                           \
+    FIELD(single, vy)                           \
+    FIELD(single, vz)                           \
+    FIELD(uint16, sequence)                     \
+    FIELD(packed_int32, health)                 \
+    MESSAGE(animation_schema, 0x02, anim)
+HAZEL_SCHEMA(entity_schema, ENTITY_FIELDS)
+
+static void entity_schema_from_state(entity_schema *out,
+                                     const entity_state *e)
+{
+    out->net_id = e->net_id;
+    out->grounded = e->grounded;
+    out->px = e->position[0];
+    out->py = e->position[1];
+    out->pz = e->position[2];
+    out->vx = e->velocity[0];
+    out->vy = e->velocity[1];
+    out->vz = e->velocity[2];
+    out->sequence = e->sequence;
+    out->health = e->health;
+    out->anim.state = e->animation;
+    out->anim.blend = e->blend;
+}
+
+typedef struct packet
+{
+    uint8_t data[HAZEL_BUFFER_SIZE];
+    size_t size;
+} packet;
+
+static int bench_manual(const entity_state *entities, packet *out)
+{
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, out->data, sizeof(out->data));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+        {
+            if (entity_state_write(&writer, &entities[i]) != 0)
+            {
+                return -1;
+            }
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("schema/serialize_manual", ITERATIONS,
+                 bench_now_ns() - start, writer.size);
+    out->size = writer.size;
+
+    entity_state decoded = {0};
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader, message;
+        hazel_message_reader_init(&reader, out->data, out->size - 1, 1);
+        while (hazel_message_reader_can_read_message(&reader))
+        {
+            if (hazel_message_reader_read_message(&reader, &message) != 0
+                || entity_state_read(&message, &decoded) != 0)
+            {
+                return -1;
+            }
+            BENCH_DO_NOT_OPTIMIZE(decoded.net_id);
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("schema/deserialize_manual", ITERATIONS,
+                 bench_now_ns() - start, out->size);
+    return 0;
+}
+
+static int bench_generated(const entity_state *entities, packet *out)
+{
+    entity_schema schemas[ENTITIES_PER_PACKET];
+    for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+    {
+        entity_schema_from_state(&schemas[i], &entities[i]);
+    }
+
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, out->data, sizeof(out->data));
+
+    uint64_t start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+        {
+            if (entity_schema_encode_message(&writer, 0x05, &schemas[i]) != 0)
+            {
+                return -1;
+            }
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("schema/serialize_generated", ITERATIONS,
+                 bench_now_ns() - start, writer.size);
+    out->size = writer.size;
+
+    entity_schema decoded = {0};
+    start = bench_now_ns();
+    for (int iter = 0; iter < ITERATIONS; iter++)
+    {
+        hazel_message_reader reader, message;
+        hazel_message_reader_init(&reader, out->data, out->size - 1, 1);
+        while (hazel_message_reader_can_read_message(&reader))
+        {
+            if (hazel_message_reader_read_message(&reader, &message) != 0
+                || entity_schema_decode(&message, &decoded) != 0)
+            {
+                return -1;
+            }
+            BENCH_DO_NOT_OPTIMIZE(decoded.net_id);
+        }
+        BENCH_CLOBBER();
+    }
+    bench_report("schema/deserialize_generated", ITERATIONS,
+                 bench_now_ns() - start, out->size);
+    return 0;
+}
+
+int main(void)
+{
+    entity_state entities[ENTITIES_PER_PACKET];
+    for (int i = 0; i < ENTITIES_PER_PACKET; i++)
+    {
+        entity_state_sample(&entities[i], i);
+    }
+
+    static packet manual, generated;
+    if (bench_manual(entities, &manual) != 0
+        || bench_generated(entities, &generated) != 0)
+    {
+        fprintf(stderr, "benchmark failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Both paths must produce the same bytes for the comparison to be fair
+    if (manual.size != generated.size
+        || memcmp(manual.data, generated.data, manual.size) != 0)
+    {
+        fprintf(stderr, "generated encoding differs from manual encoding\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
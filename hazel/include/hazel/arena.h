@@ -0,0 +1,67 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** \defgroup Arena Tick Arena
+ * \brief Bump allocator for data which only lives for a single network tick.
+ *
+ * Readers and strings produced while receiving can be allocated from an arena
+ * instead of the heap. Nothing allocated from an arena is freed individually,
+ * instead the whole arena is rewound with hazel_arena_reset() once the tick
+ * is over. Chunks are kept around between resets, so a steady state server
+ * does not touch the system allocator at all.
+ * @{
+ */
+
+#ifndef HAZEL_ARENA_DEFAULT_CHUNK_SIZE
+#   define HAZEL_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+#endif
+
+typedef struct hazel_arena_chunk hazel_arena_chunk;
+
+typedef struct hazel_arena
+{
+    size_t chunk_size;
+
+    hazel_arena_chunk *_head;
+    hazel_arena_chunk *_current;
+} hazel_arena;
+
+/**
+ * Initialise the arena and allocate its first chunk.
+ *
+ * \param arena      The arena structure
+ * \param chunk_size The size of each chunk, pass 0 to use
+ *                   #HAZEL_ARENA_DEFAULT_CHUNK_SIZE
+ */
+int hazel_arena_init(hazel_arena *arena, size_t chunk_size);
+
+/**
+ * Free every chunk owned by the arena. Any memory handed out by the arena is
+ * invalid afterwards.
+ */
+void hazel_arena_free(hazel_arena *arena);
+
+/**
+ * \brief Allocate \p size bytes from the arena.
+ *
+ * The returned memory is aligned for any fundamental type and stays valid
+ * until the next hazel_arena_reset() or hazel_arena_free().
+ *
+ * \return A pointer to the memory, or NULL if a new chunk could not be
+ *         allocated.
+ */
+void *hazel_arena_alloc(hazel_arena *arena, size_t size);
+
+/**
+ * \brief Release everything allocated from the arena in O(1).
+ *
+ * The chunks stay owned by the arena and are reused by later allocations.
+ */
+void hazel_arena_reset(hazel_arena *arena);
+
+/** @}*/
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "hazel/reader.h"
+#include "hazel/writer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** \defgroup Bits Bit Packing
+ * \brief Bit level writer and reader layered on the message writer/reader.
+ *
+ * Values are packed least significant bit first into a 64-bit scratch word,
+ * which is written out 32 bits at a time. Messages and plain byte aligned
+ * fields can still be mixed in, as long as the bit stream is flushed (writer)
+ * or aligned (reader) before the underlying writer or reader is used
+ * directly. The message helpers below do this automatically, so a nested
+ * message always starts and ends on a byte boundary.
+ * @{
+ */
+
+typedef struct hazel_bit_writer
+{
+    hazel_message_writer *writer;
+
+    uint64_t _scratch;
+    uint32_t _scratch_bits;
+} hazel_bit_writer;
+
+typedef struct hazel_bit_reader
+{
+    hazel_message_reader *reader;
+
+    uint64_t _scratch;
+    uint32_t _scratch_bits;
+} hazel_bit_reader;
+
+/**
+ * \return The number of bits needed to quantize values in [\p min, \p max]
+ *         with steps of at most \p precision, between 1 and 32.
+ */
+uint8_t hazel_bit_quantize_bits(float min, float max, float precision);
+
+uint16_t hazel_bit_float_to_half(float value);
+float hazel_bit_half_to_float(uint16_t value);
+
+void hazel_bit_writer_init(hazel_bit_writer *bit_writer,
+                           hazel_message_writer *writer);
+
+/**
+ * \brief Write the low \p bits bits of \p value.
+ *
+ * \param bits Between 1 and 32
+ */
+int hazel_bit_writer_bits(hazel_bit_writer *bit_writer, uint32_t value,
+                          uint8_t bits);
+int hazel_bit_writer_bool(hazel_bit_writer *bit_writer, bool value);
+int hazel_bit_writer_signed(hazel_bit_writer *bit_writer, int32_t value,
+                            uint8_t bits);
+
+/**
+ * \brief Write \p value clamped to [\p min, \p max] in as few bits as
+ *        \p precision allows.
+ *
+ * The reader must pass the same \p min, \p max and \p precision.
+ */
+int hazel_bit_writer_quantized(hazel_bit_writer *bit_writer, float value,
+                               float min, float max, float precision);
+
+/**
+ * Write \p value as an IEEE 754 half precision float.
+ */
+int hazel_bit_writer_half(hazel_bit_writer *bit_writer, float value);
+
+/**
+ * \brief Write out the pending bits, padding with zeroes to a byte boundary.
+ */
+int hazel_bit_writer_flush(hazel_bit_writer *bit_writer);
+
+int hazel_bit_writer_start_message(hazel_bit_writer *bit_writer, uint8_t tag);
+int hazel_bit_writer_end_message(hazel_bit_writer *bit_writer);
+
+void hazel_bit_reader_init(hazel_bit_reader *bit_reader,
+                           hazel_message_reader *reader);
+
+int hazel_bit_reader_bits(hazel_bit_reader *bit_reader, uint8_t bits,
+                          uint32_t *result);
+int hazel_bit_reader_bool(hazel_bit_reader *bit_reader, bool *result);
+int hazel_bit_reader_signed(hazel_bit_reader *bit_reader, uint8_t bits,
+                            int32_t *result);
+int hazel_bit_reader_quantized(hazel_bit_reader *bit_reader, float min,
+                               float max, float precision, float *result);
+int hazel_bit_reader_half(hazel_bit_reader *bit_reader, float *result);
+
+/**
+ * \brief Skip the padding up to the next byte boundary.
+ *
+ * Bytes which were prefetched into the scratch word are handed back to the
+ * underlying reader, so it can be used directly afterwards.
+ */
+void hazel_bit_reader_align(hazel_bit_reader *bit_reader);
+
+/**
+ * Align, then read the next message from the underlying reader.
+ */
+int hazel_bit_reader_read_message(hazel_bit_reader *bit_reader,
+                                  hazel_message_reader *output);
+
+/** @}*/
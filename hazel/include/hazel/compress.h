@@ -0,0 +1,87 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** \defgroup Compress Compression
+ * \brief Small LZ77 compressor for message payloads.
+ *
+ * The format is a sequence of LZ4 style blocks: a token holding the literal
+ * and match lengths, the literals, and a 16-bit little endian match offset.
+ * Lengths of 15 or more continue in extra bytes of 255. The stream always ends
+ * with a literal run, without an offset.
+ *
+ * Both sides may share a dictionary, which acts as if it was prepended to the
+ * data: matches can refer back into it, so even short payloads compress well
+ * when they resemble the dictionary contents. The dictionary is typically a
+ * concatenation of representative payloads captured offline.
+ * @{
+ */
+
+#define HAZEL_COMPRESS_INSUFFICIENT_BUFFER -0xD001
+#define HAZEL_COMPRESS_MALFORMED_INPUT -0xD002
+
+/** The largest dictionary whose tail can still be referenced by a match. */
+#define HAZEL_COMPRESS_MAX_OFFSET 0xFFFF
+
+#define HAZEL_COMPRESS_HASH_BITS 12
+#define HAZEL_COMPRESS_HASH_SIZE (1 << HAZEL_COMPRESS_HASH_BITS)
+
+/**
+ * A dictionary with its match table built, so it is hashed once rather than
+ * on every hazel_compress() call. The table is copied by each call, the
+ * dictionary itself is not copied and must outlive the structure.
+ */
+typedef struct hazel_compress_dictionary
+{
+    const uint8_t *data;
+    size_t size;
+    // Positions are stored off by one, so zero means empty
+    uint32_t table[HAZEL_COMPRESS_HASH_SIZE];
+} hazel_compress_dictionary;
+
+/**
+ * \return The largest size \p input_size bytes can compress to.
+ */
+size_t hazel_compress_bound(size_t input_size);
+
+/**
+ * \brief Hash \p data into \p dictionary for use by hazel_compress().
+ *
+ * \param data The shared dictionary, may be NULL
+ * \param size The size of \p data, only the last #HAZEL_COMPRESS_MAX_OFFSET
+ *             bytes are used
+ */
+void hazel_compress_dictionary_init(hazel_compress_dictionary *dictionary,
+                                    const uint8_t *data, size_t size);
+
+/**
+ * \brief Compress \p input into \p output.
+ *
+ * \param dictionary Dictionary built by hazel_compress_dictionary_init(), may
+ *                   be NULL
+ * \param out_size   The compressed size
+ * \return \c 0 if successful
+ * \return #HAZEL_COMPRESS_INSUFFICIENT_BUFFER if \p output is too small
+ */
+int hazel_compress(const hazel_compress_dictionary *dictionary,
+                   const uint8_t *input, size_t input_size,
+                   uint8_t *output, size_t output_capacity, size_t *out_size);
+
+/**
+ * \brief Decompress \p input into \p output, using the same dictionary it
+ *        was compressed with.
+ *
+ * \return \c 0 if successful
+ * \return #HAZEL_COMPRESS_INSUFFICIENT_BUFFER if \p output is too small
+ * \return #HAZEL_COMPRESS_MALFORMED_INPUT if \p input is not a valid stream
+ */
+int hazel_decompress(const uint8_t *dictionary, size_t dictionary_size,
+                     const uint8_t *input, size_t input_size,
+                     uint8_t *output, size_t output_capacity,
+                     size_t *out_size);
+
+/** @}*/
@@ -0,0 +1,180 @@
+#pragma once
+
+/*
+ * Definitions of the reader primitives. This file is compiled into the library
+ * by reader.c, and included by hazel/reader.h as static inline functions when
+ * HAZEL_CONFIG_INLINE_PRIMITIVES is defined. Do not include it directly.
+ */
+
+#include "hazel/reader.h"
+
+#include <string.h>
+
+HAZEL_PRIMITIVE_API
+size_t hazel_message_reader_get_position(hazel_message_reader* reader)
+{
+    return reader->_position;
+}
+HAZEL_PRIMITIVE_API
+void hazel_message_reader_set_position(hazel_message_reader* reader, size_t value)
+{
+    reader->_position = value;
+    reader->read_head = value + reader->offset;
+}
+
+HAZEL_PRIMITIVE_API
+size_t hazel_message_reader_remaining(hazel_message_reader* reader)
+{
+    return reader->size - reader->_position;
+}
+HAZEL_PRIMITIVE_API
+bool hazel_message_reader_has_remaining(hazel_message_reader* reader,
+                                        size_t amount)
+{
+    return hazel_message_reader_remaining(reader) >= amount;
+}
+
+#define HAZEL_READER_BUFFER_CHECK(reader, wanted_size)            \
+    if (!hazel_message_reader_has_remaining(reader, wanted_size)) \
+    {                                                             \
+        return HAZEL_READER_CAPACITY_EXCEEDED;                    \
+    }
+
+static inline uint8_t hazel_message_reader_byte(hazel_message_reader* reader)
+{
+    reader->_position++;
+    size_t pos = reader->read_head++;
+    return reader->data[pos];
+}
+
+// Multi-byte fields are decoded from a pointer to their first byte, rather
+// than by chaining hazel_message_reader_byte() calls whose evaluation order
+// inside one expression is unspecified.
+static inline const uint8_t* hazel_message_reader_advance(
+    hazel_message_reader* reader, size_t amount)
+{
+    const uint8_t* p = reader->data + reader->read_head;
+    reader->_position += amount;
+    reader->read_head += amount;
+    return p;
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_bool(hazel_message_reader* reader, bool* result)
+{
+    uint8_t tmp = 0;
+    int ret = hazel_message_reader_uint8(reader, &tmp);
+    if (ret == 0)
+    {
+        *result = tmp != 0;
+    }
+    return ret;
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_uint8(hazel_message_reader* reader, uint8_t* result)
+{
+    HAZEL_READER_BUFFER_CHECK(reader, sizeof(uint8_t));
+    *result = hazel_message_reader_byte(reader);
+    return 0;
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_uint16(hazel_message_reader* reader, uint16_t *result)
+{
+    HAZEL_READER_BUFFER_CHECK(reader, sizeof(uint16_t));
+    const uint8_t* p = hazel_message_reader_advance(reader, sizeof(uint16_t));
+    *result = (uint16_t)(p[0] | (p[1] << 8));
+    return 0;
+}
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_int16(hazel_message_reader* reader, int16_t *result)
+{
+    return hazel_message_reader_uint16(reader, (uint16_t*) result);
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_uint32(hazel_message_reader* reader, uint32_t *result)
+{
+    HAZEL_READER_BUFFER_CHECK(reader, sizeof(uint32_t));
+    const uint8_t* p = hazel_message_reader_advance(reader, sizeof(uint32_t));
+    *result = (uint32_t)p[0]
+        | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16)
+        | ((uint32_t)p[3] << 24);
+    return 0;
+}
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_int32(hazel_message_reader* reader, int32_t *result)
+{
+    return hazel_message_reader_uint32(reader, (uint32_t*) result);
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_uint64(hazel_message_reader* reader, uint64_t *result)
+{
+    HAZEL_READER_BUFFER_CHECK(reader, sizeof(uint64_t));
+    const uint8_t* p = hazel_message_reader_advance(reader, sizeof(uint64_t));
+    *result = (uint64_t)p[0]
+        | ((uint64_t)p[1] << 8)
+        | ((uint64_t)p[2] << 16)
+        | ((uint64_t)p[3] << 24)
+        | ((uint64_t)p[4] << 32)
+        | ((uint64_t)p[5] << 40)
+        | ((uint64_t)p[6] << 48)
+        | ((uint64_t)p[7] << 56);
+    return 0;
+}
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_int64(hazel_message_reader* reader, int64_t *result)
+{
+    return hazel_message_reader_uint64(reader, (uint64_t*) result);
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_packed_uint32(hazel_message_reader* reader, uint32_t* result)
+{
+    int ret = 0;
+    bool readMore = true;
+    int32_t shift = 0;
+    uint32_t output = 0;
+    while (readMore) 
+    {
+        uint8_t b;
+        if ((ret = hazel_message_reader_uint8(reader, &b)) != 0)
+        {
+            return ret;
+        }
+        if (b >= 0x80)
+        {
+            readMore = true;
+            b ^= 0x80;
+        }
+        else
+        {
+            readMore = false;
+        }
+        output |= (uint32_t)(b << shift);
+        shift += 7;
+    }
+
+    *result = output;
+
+    return 0;
+}
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_packed_int32(hazel_message_reader* reader, int32_t* result)
+{
+    return hazel_message_reader_packed_uint32(reader, (uint32_t*) result);
+}
+
+HAZEL_PRIMITIVE_API
+int hazel_message_reader_single(hazel_message_reader* reader, float* result)
+{
+    HAZEL_READER_BUFFER_CHECK(reader, sizeof(float));
+    memcpy(result, hazel_message_reader_advance(reader, sizeof(float)),
+           sizeof(float));
+    return 0;
+}
+
+#undef HAZEL_READER_BUFFER_CHECK
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** \defgroup Log Logging
+ * \brief Leveled logging which stays off the hot path.
+ *
+ * Log statements below #HAZEL_LOG_LEVEL compile to nothing. Enabled
+ * statements do not format anything: they copy the format string pointer
+ * and up to #HAZEL_LOG_MAX_ARGS raw arguments into a lock-free ring owned by
+ * the calling thread. Records are formatted and handed to the sink later, by
+ * hazel_log_drain() or by the thread started with hazel_log_start_thread().
+ *
+ * So that nothing is lost when neither runs, a thread whose ring is full
+ * drains all rings itself, errors are drained as soon as they are written
+ * unless the drain thread is running, and whatever is left is drained at
+ * exit. A thread's ring is drained and freed when the thread exits. Records
+ * are only dropped, and counted, when a sink logs while its own thread's
+ * ring is full.
+ *
+ * Because formatting is deferred, format strings and \c %s arguments must
+ * have static storage duration, string literals for example. \c * widths and
+ * precisions are not supported.
+ * @{
+ */
+
+enum hazel_log_level
+{
+    HAZEL_LOG_LEVEL_OFF = 0,
+    HAZEL_LOG_LEVEL_ERROR = 1,
+    HAZEL_LOG_LEVEL_WARN = 2,
+    HAZEL_LOG_LEVEL_INFO = 3,
+    HAZEL_LOG_LEVEL_DEBUG = 4,
+    HAZEL_LOG_LEVEL_TRACE = 5,
+};
+
+/** The most verbose level compiled in, 0 compiles out all logging */
+#ifndef HAZEL_LOG_LEVEL
+#   if defined(HAZEL_LOGGING_DEBUG)
+#       define HAZEL_LOG_LEVEL 4
+#   elif defined(HAZEL_LOGGING_ENABLE)
+#       define HAZEL_LOG_LEVEL 1
+#   else
+#       define HAZEL_LOG_LEVEL 0
+#   endif
+#endif
+
+#define HAZEL_LOG_MAX_ARGS 8
+/** The most bytes kept by HAZEL_LOG_TRACE_BYTES() */
+#define HAZEL_LOG_MAX_BYTES 64
+
+/** Records each thread can buffer before they are dropped */
+#ifndef HAZEL_LOG_RING_CAPACITY
+#   define HAZEL_LOG_RING_CAPACITY 1024
+#endif
+
+/**
+ * Receives every drained record. \p message is only valid during the call.
+ */
+typedef void (*hazel_log_sink)(enum hazel_log_level level,
+                               uint64_t timestamp_ns, const char *file,
+                               int line, const char *message,
+                               void *user_data);
+
+/**
+ * \brief Replace the sink, the default prints to stderr. Pass NULL to go
+ *        back to the default.
+ */
+void hazel_log_set_sink(hazel_log_sink sink, void *user_data);
+
+/**
+ * \brief Format every buffered record and pass it to the sink.
+ *
+ * Records of one thread are delivered in order. Safe to call from any
+ * thread, concurrent drains are serialized.
+ *
+ * \return The number of records drained
+ */
+size_t hazel_log_drain(void);
+
+/**
+ * \brief Drain from a background thread every \p interval_ms.
+ */
+int hazel_log_start_thread(int interval_ms);
+
+/**
+ * \brief Stop the background thread, after a final drain.
+ */
+void hazel_log_stop_thread(void);
+
+/**
+ * \return The number of records dropped because a ring was full
+ */
+uint64_t hazel_log_dropped(void);
+
+/**
+ * \brief Format a record as hazel_log_drain() does.
+ *
+ * \return The length of the message written to \p out
+ */
+size_t hazel_log_format(char *out, size_t size, const char *format,
+                        const uint64_t *args, size_t arg_count);
+
+/** \name Used by the logging macros
+ * @{
+ */
+void hazel_log_write(enum hazel_log_level level, const char *file, int line,
+                     const char *format, size_t arg_count,
+                     const uint64_t *args);
+void hazel_log_write_bytes(enum hazel_log_level level, const char *file,
+                           int line, const char *tag, const uint8_t *bytes,
+                           size_t size);
+
+static inline uint64_t hazel_log_arg_signed(long long value)
+{
+    return (uint64_t)value;
+}
+
+static inline uint64_t hazel_log_arg_unsigned(unsigned long long value)
+{
+    return (uint64_t)value;
+}
+
+static inline uint64_t hazel_log_arg_double(double value)
+{
+    union { double d; uint64_t u; } bits = { value };
+    return bits.u;
+}
+
+static inline uint64_t hazel_log_arg_pointer(const void *value)
+{
+    return (uint64_t)(uintptr_t)value;
+}
+
+#define HAZEL_LOG_ARG(x) _Generic((x),                                       \
+    float: hazel_log_arg_double,                                             \
+    double: hazel_log_arg_double,                                            \
+    _Bool: hazel_log_arg_unsigned,                                           \
+    char: hazel_log_arg_signed,                                              \
+    signed char: hazel_log_arg_signed,                                       \
+    short: hazel_log_arg_signed,                                             \
+    int: hazel_log_arg_signed,                                               \
+    long: hazel_log_arg_signed,                                              \
+    long long: hazel_log_arg_signed,                                         \
+    unsigned char: hazel_log_arg_unsigned,                                   \
+    unsigned short: hazel_log_arg_unsigned,                                  \
+    unsigned int: hazel_log_arg_unsigned,                                    \
+    unsigned long: hazel_log_arg_unsigned,                                   \
+    unsigned long long: hazel_log_arg_unsigned,                              \
+    default: hazel_log_arg_pointer)(x)
+
+#define HAZEL_LOG_NARGS(...)                                                 \
+    HAZEL_LOG_NARGS_(__VA_ARGS__, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define HAZEL_LOG_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, n, ...) n
+#define HAZEL_LOG_CONCAT(a, b) HAZEL_LOG_CONCAT_(a, b)
+#define HAZEL_LOG_CONCAT_(a, b) a##b
+
+#define HAZEL_LOG_CALL(level, fmt, n, ...)                                   \
+    hazel_log_write(level, __FILE__, __LINE__, fmt, n,                       \
+                    (const uint64_t[]){ __VA_ARGS__ })
+
+#define HAZEL_LOG_WRITE_1(level, fmt)                                        \
+    hazel_log_write(level, __FILE__, __LINE__, fmt, 0, NULL)
+#define HAZEL_LOG_WRITE_2(level, fmt, a)                                     \
+    HAZEL_LOG_CALL(level, fmt, 1, HAZEL_LOG_ARG(a))
+#define HAZEL_LOG_WRITE_3(level, fmt, a, b)                                  \
+    HAZEL_LOG_CALL(level, fmt, 2, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b))
+#define HAZEL_LOG_WRITE_4(level, fmt, a, b, c)                               \
+    HAZEL_LOG_CALL(level, fmt, 3, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c))
+#define HAZEL_LOG_WRITE_5(level, fmt, a, b, c, d)                            \
+    HAZEL_LOG_CALL(level, fmt, 4, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c), HAZEL_LOG_ARG(d))
+#define HAZEL_LOG_WRITE_6(level, fmt, a, b, c, d, e)                         \
+    HAZEL_LOG_CALL(level, fmt, 5, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c), HAZEL_LOG_ARG(d), HAZEL_LOG_ARG(e))
+#define HAZEL_LOG_WRITE_7(level, fmt, a, b, c, d, e, f)                      \
+    HAZEL_LOG_CALL(level, fmt, 6, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c), HAZEL_LOG_ARG(d), HAZEL_LOG_ARG(e),     \
+                   HAZEL_LOG_ARG(f))
+#define HAZEL_LOG_WRITE_8(level, fmt, a, b, c, d, e, f, g)                   \
+    HAZEL_LOG_CALL(level, fmt, 7, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c), HAZEL_LOG_ARG(d), HAZEL_LOG_ARG(e),     \
+                   HAZEL_LOG_ARG(f), HAZEL_LOG_ARG(g))
+#define HAZEL_LOG_WRITE_9(level, fmt, a, b, c, d, e, f, g, h)                \
+    HAZEL_LOG_CALL(level, fmt, 8, HAZEL_LOG_ARG(a), HAZEL_LOG_ARG(b),        \
+                   HAZEL_LOG_ARG(c), HAZEL_LOG_ARG(d), HAZEL_LOG_ARG(e),     \
+                   HAZEL_LOG_ARG(f), HAZEL_LOG_ARG(g), HAZEL_LOG_ARG(h))
+
+#define HAZEL_LOG_WRITE(level, ...)                                          \
+    HAZEL_LOG_CONCAT(HAZEL_LOG_WRITE_, HAZEL_LOG_NARGS(__VA_ARGS__))         \
+        (level, __VA_ARGS__)
+/** @}*/
+
+#if HAZEL_LOG_LEVEL >= 1
+#   define HAZEL_LOG_ERROR(...) HAZEL_LOG_WRITE(HAZEL_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#   define HAZEL_LOG_ERROR(...) ((void)0)
+#endif
+
+#if HAZEL_LOG_LEVEL >= 2
+#   define HAZEL_LOG_WARN(...) HAZEL_LOG_WRITE(HAZEL_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#   define HAZEL_LOG_WARN(...) ((void)0)
+#endif
+
+#if HAZEL_LOG_LEVEL >= 3
+#   define HAZEL_LOG_INFO(...) HAZEL_LOG_WRITE(HAZEL_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#   define HAZEL_LOG_INFO(...) ((void)0)
+#endif
+
+#if HAZEL_LOG_LEVEL >= 4
+#   define HAZEL_LOG_DEBUG(...) HAZEL_LOG_WRITE(HAZEL_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#   define HAZEL_LOG_DEBUG(...) ((void)0)
+#endif
+
+#if HAZEL_LOG_LEVEL >= 5
+#   define HAZEL_LOG_TRACE(...) HAZEL_LOG_WRITE(HAZEL_LOG_LEVEL_TRACE, __VA_ARGS__)
+/** Hex dump of the first #HAZEL_LOG_MAX_BYTES of \p size bytes */
+#   define HAZEL_LOG_TRACE_BYTES(tag, input, size, offset)                  \
+        hazel_log_write_bytes(HAZEL_LOG_LEVEL_TRACE, __FILE__, __LINE__,     \
+                              tag, (const uint8_t *)(input) + (offset), size)
+#else
+#   define HAZEL_LOG_TRACE(...) ((void)0)
+#   define HAZEL_LOG_TRACE_BYTES(tag, input, size, offset) ((void)0)
+#endif
+
+/** @}*/
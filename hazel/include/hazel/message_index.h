@@ -0,0 +1,106 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/reader.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** \defgroup Message_Index Message Index
+ * \brief Tag lookup table over the child messages of a reader.
+ *
+ * Scans the child messages of a reader once and records where each one is,
+ * chained per tag in the order they appear. Dispatch code can then jump
+ * straight to the messages it handles instead of looping over
+ * hazel_message_reader_read_message(). Nested levels are indexed lazily, by
+ * building another index over a reader returned from
+ * hazel_message_index_get() when it is needed.
+ * @{
+ */
+
+#define HAZEL_MESSAGE_INDEX_FULL -0xE101
+#define HAZEL_MESSAGE_INDEX_NOT_FOUND -0xE102
+
+#ifndef HAZEL_MESSAGE_INDEX_CAPACITY
+#   define HAZEL_MESSAGE_INDEX_CAPACITY 64
+#endif
+
+#if HAZEL_MESSAGE_INDEX_CAPACITY > 255
+#   error "HAZEL_MESSAGE_INDEX_CAPACITY must fit in an uint8_t"
+#endif
+
+/** Returned by the iteration functions when there are no more entries. */
+#define HAZEL_MESSAGE_INDEX_END 0xFF
+
+typedef struct hazel_message_index_entry
+{
+    uint32_t offset;
+    uint16_t size;
+    uint8_t tag;
+    uint8_t next;
+} hazel_message_index_entry;
+
+typedef struct hazel_message_index
+{
+    uint8_t *data;
+    size_t count;
+
+    uint8_t first[256];
+    hazel_message_index_entry entries[HAZEL_MESSAGE_INDEX_CAPACITY];
+} hazel_message_index;
+
+/**
+ * \brief Index the child messages in the remaining bytes of \p reader.
+ *
+ * The reader is not advanced. The index points into the reader's buffer, so
+ * the buffer must outlive the index.
+ *
+ * \return \c 0 if successful
+ * \return #HAZEL_READER_MALFORMED_INPUT if a child message is out of bounds
+ * \return #HAZEL_MESSAGE_INDEX_FULL if there are more than
+ *         #HAZEL_MESSAGE_INDEX_CAPACITY child messages
+ */
+int hazel_message_index_build(hazel_message_index *index,
+                              hazel_message_reader *reader);
+
+/**
+ * \return The first entry with tag \p tag, or #HAZEL_MESSAGE_INDEX_END
+ */
+static inline uint8_t hazel_message_index_first(hazel_message_index *index,
+                                                uint8_t tag)
+{
+    return index->first[tag];
+}
+
+/**
+ * \return The entry after \p entry with the same tag, or
+ *         #HAZEL_MESSAGE_INDEX_END
+ */
+static inline uint8_t hazel_message_index_next(hazel_message_index *index,
+                                               uint8_t entry)
+{
+    return index->entries[entry].next;
+}
+
+/**
+ * Initialise \p output as a reader over the message of entry \p entry.
+ */
+void hazel_message_index_get(hazel_message_index *index, uint8_t entry,
+                             hazel_message_reader *output);
+
+/**
+ * \brief Find the first message with tag \p tag.
+ *
+ * \return \c 0 if successful
+ * \return #HAZEL_MESSAGE_INDEX_NOT_FOUND if there is no such message
+ */
+int hazel_message_index_find(hazel_message_index *index, uint8_t tag,
+                             hazel_message_reader *output);
+
+/**
+ * \return The number of messages with tag \p tag
+ */
+size_t hazel_message_index_count(hazel_message_index *index, uint8_t tag);
+
+/** @}*/
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "hazel/common.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/** \defgroup MPSC_Queue MPSC Queue
+ * \brief Intrusive lock-free multi-producer single-consumer queue.
+ *
+ * Any number of threads may push concurrently; pushing is a single atomic
+ * exchange and never blocks. Only one thread may pop. Nodes are embedded in
+ * the caller's own structures, the queue never allocates.
+ *
+ * A pop can briefly see the queue as empty while a push is half way done.
+ * That node is returned by a later pop, so consumers which drain in a loop
+ * simply pick it up on their next round.
+ *
+ * The producer end is kept off the cache lines of everything around it by
+ * a line of padding on either side, not by alignment, so structures
+ * embedding a queue can still come from \c malloc().
+ *
+ * The queue points into itself, at its \c _stub node, so it must not be
+ * copied or moved after hazel_mpsc_queue_init(): a copy would keep linking
+ * nodes into the original.
+ * @{
+ */
+
+typedef struct hazel_mpsc_node
+{
+    struct hazel_mpsc_node *_Atomic next;
+} hazel_mpsc_node;
+
+typedef struct hazel_mpsc_queue
+{
+    char _pad_before[HAZEL_CACHE_LINE_SIZE];
+    // Written by producers
+    hazel_mpsc_node *_Atomic _head;
+    char _pad_after[HAZEL_CACHE_LINE_SIZE];
+
+    // Only touched by the consumer
+    hazel_mpsc_node *_tail;
+    hazel_mpsc_node _stub;
+} hazel_mpsc_queue;
+
+void hazel_mpsc_queue_init(hazel_mpsc_queue *queue);
+
+/**
+ * \brief Append \p node to the queue. Safe to call from any thread.
+ */
+void hazel_mpsc_queue_push(hazel_mpsc_queue *queue, hazel_mpsc_node *node);
+
+/**
+ * \brief Remove the oldest node. Must only be called by the consumer thread.
+ *
+ * \return The node, or NULL if the queue is empty
+ */
+hazel_mpsc_node *hazel_mpsc_queue_pop(hazel_mpsc_queue *queue);
+
+/** @}*/
@@ -0,0 +1,17 @@
+#pragma once
+
+/**
+ * \def HAZEL_CONFIG_INLINE_PRIMITIVES
+ * Define to get the fixed size reader and writer primitives as header-only
+ * \c static \c inline functions instead of calls into the library. This lets
+ * the compiler merge the bounds checks of consecutive fields. The structures
+ * are unchanged, so code built either way can share readers and writers.
+ */
+#ifndef HAZEL_PRIMITIVE_API
+#   if defined(HAZEL_CONFIG_INLINE_PRIMITIVES) \
+        && !defined(HAZEL_PRIMITIVES_IMPLEMENTATION)
+#       define HAZEL_PRIMITIVE_API static inline
+#   else
+#       define HAZEL_PRIMITIVE_API
+#   endif
+#endif
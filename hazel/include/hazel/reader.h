@@ -2,6 +2,8 @@
 
 #include "hazel/common.h"
 #include "hazel/errors.h"
+#include "hazel/arena.h"
+#include "hazel/primitive_api.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -40,7 +42,9 @@ int hazel_message_reader_init(hazel_message_reader* reader, uint8_t* data,
  */
 void hazel_message_reader_free(hazel_message_reader* reader);
 
+HAZEL_PRIMITIVE_API
 size_t hazel_message_reader_get_position(hazel_message_reader* reader);
+HAZEL_PRIMITIVE_API
 void hazel_message_reader_set_position(hazel_message_reader* reader, size_t value);
 
 /**
@@ -52,6 +56,7 @@ void hazel_message_reader_set_position(hazel_message_reader* reader, size_t valu
  * \param reader A pointer to the hazel_message_reader structure.
  * \return The number of bytes remaining which can be read.
  */
+HAZEL_PRIMITIVE_API
 size_t hazel_message_reader_remaining(hazel_message_reader* reader);
 
 /**
@@ -64,20 +69,24 @@ size_t hazel_message_reader_remaining(hazel_message_reader* reader);
  * \param amount The number of bytes to check for availability.
  * \return true if there are at least 'amount' bytes remaining, false otherwise.
  */
+HAZEL_PRIMITIVE_API
 bool hazel_message_reader_has_remaining(hazel_message_reader* reader, size_t amount);
 
-int hazel_message_reader_bool  (hazel_message_reader* reader, bool* result);
-int hazel_message_reader_uint8 (hazel_message_reader* reader, uint8_t *result);
-int hazel_message_reader_uint16(hazel_message_reader* reader, uint16_t *result);
-int hazel_message_reader_int16 (hazel_message_reader* reader, int16_t *result);
-int hazel_message_reader_uint32(hazel_message_reader* reader, uint32_t *result);
-int hazel_message_reader_int32 (hazel_message_reader* reader, int32_t *result);
-int hazel_message_reader_uint64(hazel_message_reader* reader, uint64_t *result);
-int hazel_message_reader_int64 (hazel_message_reader* reader, int64_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_bool  (hazel_message_reader* reader, bool* result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_uint8 (hazel_message_reader* reader, uint8_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_uint16(hazel_message_reader* reader, uint16_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_int16 (hazel_message_reader* reader, int16_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_uint32(hazel_message_reader* reader, uint32_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_int32 (hazel_message_reader* reader, int32_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_uint64(hazel_message_reader* reader, uint64_t *result);
+HAZEL_PRIMITIVE_API int hazel_message_reader_int64 (hazel_message_reader* reader, int64_t *result);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_reader_packed_uint32(hazel_message_reader* reader, uint32_t* result);
+HAZEL_PRIMITIVE_API
 int hazel_message_reader_packed_int32(hazel_message_reader* reader, int32_t* result);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_reader_single(hazel_message_reader* reader, float* result);
 
 int hazel_message_reader_string(hazel_message_reader* reader, 
@@ -91,6 +100,15 @@ int hazel_message_reader_string(hazel_message_reader* reader,
 int hazel_message_reader_string_malloc(hazel_message_reader* reader,
                                        char** output);
 
+/**
+ * \brief Read a string into a new null-terminated buffer taken from \p arena.
+ *
+ * The string must not be freed, it is released together with everything else
+ * in the arena by hazel_arena_reset().
+ */
+int hazel_message_reader_string_arena(hazel_message_reader* reader,
+                                      hazel_arena* arena, char** output);
+
 typedef struct hazel_message_reader_string_buffer_view {
     int32_t length;
     const char* buffer;
@@ -114,4 +132,37 @@ int hazel_message_reader_string_view(
 bool hazel_message_reader_can_read_message(hazel_message_reader* reader);
 int hazel_message_reader_read_message(hazel_message_reader* reader, hazel_message_reader* output);
 
+#ifndef HAZEL_READER_MAX_VALIDATE_DEPTH
+#   define HAZEL_READER_MAX_VALIDATE_DEPTH 16
+#endif
+
+/**
+ * \brief Walk the nested message tree of a reader once and prove its bounds.
+ *
+ * The remaining bytes of \p reader are treated as a sequence of messages.
+ * For the first \p depth - 1 levels the payload of every message must in turn
+ * be made up entirely of child messages, the payloads at the last level are
+ * left opaque. Every header (length and tag) is checked to lie within its
+ * parent, which is what hazel_message_reader_read_message() would otherwise
+ * re-check on every call.
+ *
+ * On success \p output is a copy of \p reader, on which the unchecked
+ * accessors in hazel/reader_unchecked.h may be used to walk the validated
+ * levels.
+ *
+ * \param reader The reader to validate, it is not advanced
+ * \param depth  The number of levels made up of messages, at most
+ *               #HAZEL_READER_MAX_VALIDATE_DEPTH
+ * \param output The validated reader
+ * \return \c 0 if the tree is well formed
+ * \return #HAZEL_READER_MALFORMED_INPUT if a header or length is out of bounds
+ */
+int hazel_message_reader_validate(hazel_message_reader* reader, size_t depth,
+                                  hazel_message_reader* output);
+
+#if defined(HAZEL_CONFIG_INLINE_PRIMITIVES) \
+    && !defined(HAZEL_PRIMITIVES_IMPLEMENTATION)
+#   include "hazel/impl/reader_primitives.h"
+#endif
+
 /** @}*/
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "hazel/reader.h"
+
+#include <string.h>
+
+/** \addtogroup Reader
+ * @{
+ */
+
+/**
+ * \name Unchecked accessors
+ *
+ * Inline accessors which skip the bounds check done by the regular reader
+ * functions. They are only safe when the caller already proved that the bytes
+ * are there, either through hazel_message_reader_validate() for message
+ * headers, or with a single hazel_message_reader_has_remaining() covering a
+ * whole run of fixed size fields.
+ * @{
+ */
+
+static inline uint8_t hazel_message_reader_byte_unchecked(
+    hazel_message_reader* reader)
+{
+    reader->_position++;
+    return reader->data[reader->read_head++];
+}
+
+static inline void hazel_message_reader_skip_unchecked(
+    hazel_message_reader* reader, size_t amount)
+{
+    reader->_position += amount;
+    reader->read_head += amount;
+}
+
+static inline bool hazel_message_reader_bool_unchecked(
+    hazel_message_reader* reader)
+{
+    return hazel_message_reader_byte_unchecked(reader) != 0;
+}
+
+static inline uint8_t hazel_message_reader_uint8_unchecked(
+    hazel_message_reader* reader)
+{
+    return hazel_message_reader_byte_unchecked(reader);
+}
+
+static inline uint16_t hazel_message_reader_uint16_unchecked(
+    hazel_message_reader* reader)
+{
+    const uint8_t* p = reader->data + reader->read_head;
+    hazel_message_reader_skip_unchecked(reader, sizeof(uint16_t));
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline int16_t hazel_message_reader_int16_unchecked(
+    hazel_message_reader* reader)
+{
+    return (int16_t)hazel_message_reader_uint16_unchecked(reader);
+}
+
+static inline uint32_t hazel_message_reader_uint32_unchecked(
+    hazel_message_reader* reader)
+{
+    const uint8_t* p = reader->data + reader->read_head;
+    hazel_message_reader_skip_unchecked(reader, sizeof(uint32_t));
+    return (uint32_t)p[0]
+        | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16)
+        | ((uint32_t)p[3] << 24);
+}
+
+static inline int32_t hazel_message_reader_int32_unchecked(
+    hazel_message_reader* reader)
+{
+    return (int32_t)hazel_message_reader_uint32_unchecked(reader);
+}
+
+static inline uint64_t hazel_message_reader_uint64_unchecked(
+    hazel_message_reader* reader)
+{
+    uint64_t low = hazel_message_reader_uint32_unchecked(reader);
+    uint64_t high = hazel_message_reader_uint32_unchecked(reader);
+    return low | (high << 32);
+}
+
+static inline int64_t hazel_message_reader_int64_unchecked(
+    hazel_message_reader* reader)
+{
+    return (int64_t)hazel_message_reader_uint64_unchecked(reader);
+}
+
+static inline float hazel_message_reader_single_unchecked(
+    hazel_message_reader* reader)
+{
+    float result;
+    memcpy(&result, reader->data + reader->read_head, sizeof(float));
+    hazel_message_reader_skip_unchecked(reader, sizeof(float));
+    return result;
+}
+
+/**
+ * Reads a packed integer. The caller must have proved that 5 bytes, or the
+ * length of the encoded integer, are available. At most 5 bytes are consumed,
+ * even if the input keeps setting the continuation bit.
+ */
+static inline uint32_t hazel_message_reader_packed_uint32_unchecked(
+    hazel_message_reader* reader)
+{
+    uint32_t output = 0;
+    for (int32_t shift = 0; shift < 35; shift += 7)
+    {
+        uint8_t b = hazel_message_reader_byte_unchecked(reader);
+        output |= (uint32_t)(b & 0x7F) << shift;
+        if (b < 0x80)
+        {
+            break;
+        }
+    }
+    return output;
+}
+
+static inline int32_t hazel_message_reader_packed_int32_unchecked(
+    hazel_message_reader* reader)
+{
+    return (int32_t)hazel_message_reader_packed_uint32_unchecked(reader);
+}
+
+/**
+ * Reads the next child message of a reader returned by
+ * hazel_message_reader_validate(), at a level which was validated.
+ */
+static inline void hazel_message_reader_read_message_unchecked(
+    hazel_message_reader* reader, hazel_message_reader* output)
+{
+    const uint8_t* header = reader->data + reader->read_head;
+    uint16_t size = (uint16_t)(header[0] | (header[1] << 8));
+
+    hazel_message_reader message = {
+        .data = reader->data,
+        .size = size,
+        .offset = reader->read_head + 3,
+        .read_head = reader->read_head + 3,
+        .tag = header[2]
+    };
+
+    hazel_message_reader_skip_unchecked(reader, (size_t)size + 3);
+
+    *output = message;
+}
+
+/** @}*/
+
+/** @}*/
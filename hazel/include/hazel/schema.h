@@ -0,0 +1,259 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/reader.h"
+#include "hazel/reader_unchecked.h"
+#include "hazel/writer.h"
+#include "hazel/writer_unchecked.h"
+
+/** \defgroup Schema Message Schema
+ * \brief Specialized encoders and decoders generated from an X-macro schema.
+ *
+ * A schema is a macro listing the fields of a message, which takes two macro
+ * parameters: one applied to primitive fields as `FIELD(kind, name)`, one
+ * applied to nested messages as `MESSAGE(schema, tag, name)`. The kinds are
+ * the names of the reader/writer primitives: \c bool, \c uint8, \c uint16,
+ * \c int16, \c uint32, \c int32, \c uint64, \c int64, \c packed_uint32,
+ * \c packed_int32 and \c single.
+ *
+ * \code
+ * #define ANIMATION_FIELDS(FIELD, MESSAGE) \
+ *     FIELD(uint32, state)                 \
+ *     FIELD(single, blend)
+ * HAZEL_SCHEMA(animation, ANIMATION_FIELDS)
+ *
+ * #define ENTITY_FIELDS(FIELD, MESSAGE)    \
+ *     FIELD(packed_uint32, net_id)         \
+ *     FIELD(single, x)                     \
+ *     MESSAGE(animation, 0x02, anim)
+ * HAZEL_SCHEMA(entity, ENTITY_FIELDS)
+ * \endcode
+ *
+ * HAZEL_SCHEMA(name, FIELDS) defines:
+ * - the struct \c name with one member per field,
+ * - \c name_max_size, the worst case encoded size,
+ * - `int name_encode(hazel_message_writer*, const name*)`, which does a single
+ *   capacity check for the worst case size and then writes every field
+ *   straight-line without further checks,
+ * - `int name_encode_message(hazel_message_writer*, uint8_t tag, const name*)`,
+ *   the same wrapped in a message with tag \c tag,
+ * - `int name_decode(hazel_message_reader*, name*)`, which checks once that
+ *   the smallest possible encoding fits and then reads every fixed size field
+ *   unchecked. The only remaining branches are on the continuation bytes of
+ *   packed integers and on nested message headers, which are paid for from the
+ *   bytes left over after the minimum size, and the nested message tags which
+ *   are compared with the schema.
+ *
+ * The single capacity check means name_encode() fails when the worst case
+ * does not fit, even if the actual values would have. A schema whose worst
+ * case exceeds the 16-bit message length cannot be nested, which is rejected
+ * at compile time, and its name_encode_message() always fails with
+ * #HAZEL_WRITER_CAPACITY_EXCEEDED.
+ *
+ * Everything is \c static \c inline, so a schema can be placed in a header
+ * shared between the encoding and decoding side.
+ * @{
+ */
+
+#define HAZEL_SCHEMA_TYPE_bool bool
+#define HAZEL_SCHEMA_TYPE_uint8 uint8_t
+#define HAZEL_SCHEMA_TYPE_uint16 uint16_t
+#define HAZEL_SCHEMA_TYPE_int16 int16_t
+#define HAZEL_SCHEMA_TYPE_uint32 uint32_t
+#define HAZEL_SCHEMA_TYPE_int32 int32_t
+#define HAZEL_SCHEMA_TYPE_uint64 uint64_t
+#define HAZEL_SCHEMA_TYPE_int64 int64_t
+#define HAZEL_SCHEMA_TYPE_packed_uint32 uint32_t
+#define HAZEL_SCHEMA_TYPE_packed_int32 int32_t
+#define HAZEL_SCHEMA_TYPE_single float
+
+#define HAZEL_SCHEMA_MAX_bool 1
+#define HAZEL_SCHEMA_MAX_uint8 1
+#define HAZEL_SCHEMA_MAX_uint16 2
+#define HAZEL_SCHEMA_MAX_int16 2
+#define HAZEL_SCHEMA_MAX_uint32 4
+#define HAZEL_SCHEMA_MAX_int32 4
+#define HAZEL_SCHEMA_MAX_uint64 8
+#define HAZEL_SCHEMA_MAX_int64 8
+#define HAZEL_SCHEMA_MAX_packed_uint32 5
+#define HAZEL_SCHEMA_MAX_packed_int32 5
+#define HAZEL_SCHEMA_MAX_single 4
+
+#define HAZEL_SCHEMA_STRUCT_FIELD(kind, field) HAZEL_SCHEMA_TYPE_##kind field;
+#define HAZEL_SCHEMA_STRUCT_MESSAGE(schema, message_tag, field) schema field;
+
+#define HAZEL_SCHEMA_MIN_bool 1
+#define HAZEL_SCHEMA_MIN_uint8 1
+#define HAZEL_SCHEMA_MIN_uint16 2
+#define HAZEL_SCHEMA_MIN_int16 2
+#define HAZEL_SCHEMA_MIN_uint32 4
+#define HAZEL_SCHEMA_MIN_int32 4
+#define HAZEL_SCHEMA_MIN_uint64 8
+#define HAZEL_SCHEMA_MIN_int64 8
+#define HAZEL_SCHEMA_MIN_packed_uint32 1
+#define HAZEL_SCHEMA_MIN_packed_int32 1
+#define HAZEL_SCHEMA_MIN_single 4
+
+#define HAZEL_SCHEMA_MAX_SIZE_FIELD(kind, field) + HAZEL_SCHEMA_MAX_##kind
+#define HAZEL_SCHEMA_MAX_SIZE_MESSAGE(schema, message_tag, field)            \
+    + 3 + schema##_max_size
+#define HAZEL_SCHEMA_MIN_SIZE_FIELD(kind, field) + HAZEL_SCHEMA_MIN_##kind
+#define HAZEL_SCHEMA_MIN_SIZE_MESSAGE(schema, message_tag, field)            \
+    + 3 + schema##_min_size
+
+// Message lengths are 16 bits, a nested schema which could encode to more
+// would have its length silently truncated
+#define HAZEL_SCHEMA_CHECK_FIELD(kind, field)
+#define HAZEL_SCHEMA_CHECK_MESSAGE(schema, message_tag, field)               \
+    _Static_assert(schema##_max_size <= UINT16_MAX,                          \
+                   "nested schema " #schema " may exceed a message length");
+
+#define HAZEL_SCHEMA_ENCODE_FIELD(kind, field)                               \
+    hazel_message_writer_##kind##_unchecked(writer, value->field);
+#define HAZEL_SCHEMA_ENCODE_MESSAGE(schema, message_tag, field)              \
+    {                                                                        \
+        size_t start = hazel_message_writer_start_message_unchecked(         \
+            writer, message_tag);                                            \
+        schema##_encode_unchecked(writer, &value->field);                    \
+        hazel_message_writer_end_message_unchecked(writer, start);           \
+    }
+
+#define HAZEL_SCHEMA_DECODE_FIELD(kind, field)                               \
+    HAZEL_SCHEMA_DECODE_##kind(out->field)
+
+#define HAZEL_SCHEMA_READ(kind, target)                              \
+    target = hazel_message_reader_##kind##_unchecked(reader);
+#define HAZEL_SCHEMA_DECODE_bool(target) HAZEL_SCHEMA_READ(bool, target)
+#define HAZEL_SCHEMA_DECODE_uint8(target) HAZEL_SCHEMA_READ(uint8, target)
+#define HAZEL_SCHEMA_DECODE_uint16(target) HAZEL_SCHEMA_READ(uint16, target)
+#define HAZEL_SCHEMA_DECODE_int16(target) HAZEL_SCHEMA_READ(int16, target)
+#define HAZEL_SCHEMA_DECODE_uint32(target) HAZEL_SCHEMA_READ(uint32, target)
+#define HAZEL_SCHEMA_DECODE_int32(target) HAZEL_SCHEMA_READ(int32, target)
+#define HAZEL_SCHEMA_DECODE_uint64(target) HAZEL_SCHEMA_READ(uint64, target)
+#define HAZEL_SCHEMA_DECODE_int64(target) HAZEL_SCHEMA_READ(int64, target)
+#define HAZEL_SCHEMA_DECODE_single(target) HAZEL_SCHEMA_READ(single, target)
+
+#define HAZEL_SCHEMA_DECODE_packed_uint32(target)                            \
+    if ((ret = hazel_schema_read_packed(reader, &slack,                      \
+                                        (uint32_t *)&(target))) != 0)        \
+    {                                                                        \
+        return ret;                                                          \
+    }
+#define HAZEL_SCHEMA_DECODE_packed_int32(target)                             \
+    HAZEL_SCHEMA_DECODE_packed_uint32(target)
+
+// The child header and the child's minimum size are part of the parent's
+// minimum, anything the child claims on top of that is paid for from the
+// slack, so the fields following it stay inside the checked region.
+#define HAZEL_SCHEMA_DECODE_MESSAGE(schema, message_tag, field)              \
+    {                                                                        \
+        hazel_message_reader child;                                          \
+        hazel_message_reader_read_message_unchecked(reader, &child);         \
+        if (child.tag != (message_tag) || child.size < schema##_min_size     \
+            || child.size - schema##_min_size > slack)                       \
+        {                                                                    \
+            return HAZEL_READER_MALFORMED_INPUT;                             \
+        }                                                                    \
+        slack -= child.size - schema##_min_size;                             \
+        if ((ret = schema##_decode(&child, &out->field)) != 0)               \
+        {                                                                    \
+            return ret;                                                      \
+        }                                                                    \
+    }
+
+/**
+ * Reads a packed integer on the decode path, where the first byte is covered
+ * by the minimum size check and every further byte is taken from \p slack.
+ */
+static inline int hazel_schema_read_packed(hazel_message_reader *reader,
+                                           size_t *slack, uint32_t *result)
+{
+    uint32_t output = 0;
+    for (int32_t shift = 0; shift < 35; shift += 7)
+    {
+        if (shift != 0)
+        {
+            if (*slack == 0)
+            {
+                return HAZEL_READER_MALFORMED_INPUT;
+            }
+            (*slack)--;
+        }
+
+        uint8_t b = hazel_message_reader_byte_unchecked(reader);
+        output |= (uint32_t)(b & 0x7F) << shift;
+        if (b < 0x80)
+        {
+            break;
+        }
+    }
+    *result = output;
+    return 0;
+}
+
+#define HAZEL_SCHEMA(name, FIELDS)                                           \
+    typedef struct name                                                      \
+    {                                                                        \
+        FIELDS(HAZEL_SCHEMA_STRUCT_FIELD, HAZEL_SCHEMA_STRUCT_MESSAGE)       \
+    } name;                                                                  \
+                                                                             \
+    enum                                                                     \
+    {                                                                        \
+        name##_max_size = 0                                                  \
+            FIELDS(HAZEL_SCHEMA_MAX_SIZE_FIELD, HAZEL_SCHEMA_MAX_SIZE_MESSAGE) \
+        , name##_min_size = 0                                                \
+            FIELDS(HAZEL_SCHEMA_MIN_SIZE_FIELD, HAZEL_SCHEMA_MIN_SIZE_MESSAGE) \
+    };                                                                       \
+                                                                             \
+    FIELDS(HAZEL_SCHEMA_CHECK_FIELD, HAZEL_SCHEMA_CHECK_MESSAGE)             \
+                                                                             \
+    static inline void name##_encode_unchecked(                              \
+        hazel_message_writer *writer, const name *value)                     \
+    {                                                                        \
+        FIELDS(HAZEL_SCHEMA_ENCODE_FIELD, HAZEL_SCHEMA_ENCODE_MESSAGE)       \
+    }                                                                        \
+                                                                             \
+    static inline int name##_encode(hazel_message_writer *writer,            \
+                                    const name *value)                       \
+    {                                                                        \
+        if (!hazel_message_writer_reserve(writer, name##_max_size))          \
+        {                                                                    \
+            return HAZEL_WRITER_CAPACITY_EXCEEDED;                           \
+        }                                                                    \
+        name##_encode_unchecked(writer, value);                              \
+        hazel_message_writer_commit_unchecked(writer);                       \
+        return 0;                                                            \
+    }                                                                        \
+                                                                             \
+    static inline int name##_encode_message(hazel_message_writer *writer,    \
+                                            uint8_t tag, const name *value)  \
+    {                                                                        \
+        if (name##_max_size > UINT16_MAX                                     \
+            || !hazel_message_writer_reserve(writer, 3 + name##_max_size))   \
+        {                                                                    \
+            return HAZEL_WRITER_CAPACITY_EXCEEDED;                           \
+        }                                                                    \
+        size_t start = hazel_message_writer_start_message_unchecked(writer,  \
+                                                                    tag);    \
+        name##_encode_unchecked(writer, value);                              \
+        hazel_message_writer_end_message_unchecked(writer, start);           \
+        hazel_message_writer_commit_unchecked(writer);                       \
+        return 0;                                                            \
+    }                                                                        \
+                                                                             \
+    static inline int name##_decode(hazel_message_reader *reader,            \
+                                    name *out)                               \
+    {                                                                        \
+        int ret = 0;                                                         \
+        if (!hazel_message_reader_has_remaining(reader, name##_min_size))    \
+        {                                                                    \
+            return HAZEL_READER_CAPACITY_EXCEEDED;                           \
+        }                                                                    \
+        size_t slack = hazel_message_reader_remaining(reader)                \
+            - name##_min_size;                                               \
+        FIELDS(HAZEL_SCHEMA_DECODE_FIELD, HAZEL_SCHEMA_DECODE_MESSAGE)       \
+        (void)slack;                                                         \
+        return ret;                                                          \
+    }
+
+/** @}*/
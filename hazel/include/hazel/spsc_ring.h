@@ -0,0 +1,81 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** \defgroup SPSC_Ring SPSC Ring
+ * \brief Bounded lock-free single-producer single-consumer ring of slots.
+ *
+ * The slots are allocated once by hazel_spsc_ring_init() and reused, so
+ * elements are built and read in place instead of being copied in and out.
+ * The producer fills the slot returned by hazel_spsc_ring_acquire() and
+ * publishes it with hazel_spsc_ring_commit(); the consumer reads the slot
+ * returned by hazel_spsc_ring_peek() and hands it back with
+ * hazel_spsc_ring_release().
+ *
+ * Each side keeps its index and a cached copy of the other side's index on
+ * its own cache line, so the shared indices are only read when the cached
+ * copy says the ring is full or empty. The sides are kept apart by a line of
+ * padding, not by alignment, so structures embedding a ring can still come
+ * from \c malloc().
+ * @{
+ */
+
+typedef struct hazel_spsc_ring
+{
+    char _pad_start[HAZEL_CACHE_LINE_SIZE];
+
+    // Producer side
+    atomic_size_t _head;
+    size_t _cached_tail;
+    char _pad_producer[HAZEL_CACHE_LINE_SIZE];
+
+    // Consumer side
+    atomic_size_t _tail;
+    size_t _cached_head;
+    char _pad_consumer[HAZEL_CACHE_LINE_SIZE];
+
+    uint8_t *_slots;
+    size_t _stride;
+    size_t capacity;
+} hazel_spsc_ring;
+
+/**
+ * \param ring         The ring structure
+ * \param element_size The size of a slot, rounded up to a cache line
+ * \param capacity     The number of slots, rounded up to a power of two
+ */
+int hazel_spsc_ring_init(hazel_spsc_ring *ring, size_t element_size,
+                         size_t capacity);
+void hazel_spsc_ring_free(hazel_spsc_ring *ring);
+
+/**
+ * \brief Producer: get the next free slot.
+ *
+ * \return The slot, or NULL if the ring is full
+ */
+void *hazel_spsc_ring_acquire(hazel_spsc_ring *ring);
+
+/**
+ * \brief Producer: publish the slot returned by hazel_spsc_ring_acquire().
+ */
+void hazel_spsc_ring_commit(hazel_spsc_ring *ring);
+
+/**
+ * \brief Consumer: get the oldest published slot.
+ *
+ * \return The slot, or NULL if the ring is empty
+ */
+void *hazel_spsc_ring_peek(hazel_spsc_ring *ring);
+
+/**
+ * \brief Consumer: hand the slot returned by hazel_spsc_ring_peek() back to
+ *        the producer.
+ */
+void hazel_spsc_ring_release(hazel_spsc_ring *ring);
+
+/** @}*/
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "socket.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** \addtogroup UDP_Capture UDP Capture
+ *  \ingroup UDP
+ *  \brief Record every datagram sent and received to a pcap file
+ *
+ * While a capture is enabled, every datagram passing through
+ * hazel_udp_socket_send(), hazel_udp_socket_recv() and
+ * hazel_udp_socket_try_recv() on any socket is copied, with a nanosecond
+ * timestamp and synthesized IP and UDP headers, into a preallocated ring. A
+ * background thread writes the ring to the file, so the sockets never wait on
+ * disk. The file uses the raw IP link type and opens in Wireshark or tcpdump.
+ *
+ * Addresses are read from the socket's descriptor the first time it captures
+ * a datagram. Sockets without one, like loopback sockets, get 127.0.0.1 and
+ * 127.0.0.2 with ports taken from the socket and its transport, so each
+ * socket still shows as its own flow.
+ *
+ * When disabled, the hooks cost one relaxed atomic load and a branch per
+ * datagram. When the ring is full datagrams are dropped and counted rather
+ * than blocking the sender.
+ *  @{
+ */
+
+#define HAZEL_UDP_CAPTURE_OPEN_ERROR -0xB401
+#define HAZEL_UDP_CAPTURE_THREAD_ERROR -0xB402
+
+/** How often the background thread writes the ring to the file */
+#ifndef HAZEL_UDP_CAPTURE_FLUSH_INTERVAL_MS
+#   define HAZEL_UDP_CAPTURE_FLUSH_INTERVAL_MS 10
+#endif
+
+enum hazel_udp_capture_direction
+{
+    HAZEL_UDP_CAPTURE_SENT,
+    HAZEL_UDP_CAPTURE_RECEIVED,
+};
+
+typedef struct hazel_udp_capture
+{
+    // Producer side, shared by every capturing thread
+    _Alignas(HAZEL_CACHE_LINE_SIZE) atomic_size_t _head;
+
+    // Consumer side, owned by the flush thread
+    _Alignas(HAZEL_CACHE_LINE_SIZE) size_t _tail;
+
+    _Alignas(HAZEL_CACHE_LINE_SIZE) uint8_t *_slots;
+    size_t _stride;
+    size_t _capacity;
+    /** Bytes kept of each packet, headers included */
+    size_t snaplen;
+
+    /** Datagrams lost because the ring was full */
+    atomic_uint_least64_t dropped;
+    /** Datagrams written to the file */
+    atomic_uint_least64_t written;
+
+    FILE *_file;
+    pthread_t _thread;
+    atomic_bool _running;
+} hazel_udp_capture;
+
+/**
+ * \brief Create the pcap file and start the thread writing to it. The
+ *        capture starts disabled.
+ *
+ * \param capture  The capture structure, which must not move while open
+ * \param path     The file to create, overwritten if it exists
+ * \param capacity The number of datagrams the ring holds, rounded up to a
+ *                 power of two
+ * \param snaplen  The most bytes kept of each packet, headers included
+ * \return #HAZEL_UDP_CAPTURE_OPEN_ERROR if the file cannot be written
+ * \return #HAZEL_UDP_CAPTURE_THREAD_ERROR if the thread cannot be started
+ */
+int hazel_udp_capture_open(hazel_udp_capture *capture, const char *path,
+                           size_t capacity, size_t snaplen);
+
+/**
+ * \brief Disable the capture if it is enabled, write what is left in the
+ *        ring and close the file.
+ */
+void hazel_udp_capture_close(hazel_udp_capture *capture);
+
+/**
+ * \brief Start capturing the traffic of every socket into \p capture,
+ *        replacing the capture enabled before, if any.
+ *
+ * Returns once no thread writes into the replaced capture any more, so it
+ * may be closed right away.
+ */
+void hazel_udp_capture_enable(hazel_udp_capture *capture);
+
+/**
+ * \brief Stop capturing. Returns once no thread is still writing into the
+ *        capture which was enabled.
+ */
+void hazel_udp_capture_disable(void);
+
+/** \name Used by the socket hooks
+ * @{
+ */
+extern _Atomic(hazel_udp_capture *) hazel_udp_capture_active;
+
+enum hazel_udp_capture_state
+{
+    HAZEL_UDP_CAPTURE_UNRESOLVED,
+    HAZEL_UDP_CAPTURE_RESOLVING,
+    HAZEL_UDP_CAPTURE_RESOLVED,
+};
+
+/**
+ * Resolve the socket's addresses again on its next captured datagram, after
+ * it was opened or connected.
+ */
+static inline void hazel_udp_capture_forget(hazel_udp_socket *socket)
+{
+    atomic_store_explicit(&socket->_capture_state,
+                          HAZEL_UDP_CAPTURE_UNRESOLVED, memory_order_relaxed);
+}
+
+void hazel_udp_capture_write(hazel_udp_socket *socket,
+                             enum hazel_udp_capture_direction direction,
+                             const uint8_t *data, size_t size);
+
+static inline void hazel_udp_capture_packet(
+    hazel_udp_socket *socket, enum hazel_udp_capture_direction direction,
+    const uint8_t *data, int size)
+{
+    if (size > 0
+        && atomic_load_explicit(&hazel_udp_capture_active,
+                                memory_order_relaxed) != NULL)
+    {
+        hazel_udp_capture_write(socket, direction, data, (size_t)size);
+    }
+}
+/** @}*/
+
+/** @}*/
@@ -4,6 +4,10 @@
 #include "hazel/udp/socket.h"
 #include "hazel/udp/connection.h"
 #include "hazel/ip_mode.h"
+#include "hazel/spsc_ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
 
 /** \addtogroup UDP_Client UDP Client
  *  \ingroup UDP
@@ -11,9 +15,40 @@
  *  @{
  */
 
+/**
+ * A message received by the network thread, see
+ * hazel_udp_client_start_network_thread().
+ */
+typedef struct hazel_udp_client_delivery
+{
+    /** #HAZEL_SEND_OPTION_UNRELIABLE, #HAZEL_SEND_OPTION_RELIABLE or
+     *  #HAZEL_SEND_OPTION_DISCONNECT */
+    enum hazel_send_option send_option;
+
+    hazel_message_reader reader;
+
+    // Whether the reader's data was decompressed into a buffer of its own
+    bool _allocated;
+    // Next spilled delivery, see hazel_udp_client_start_network_thread()
+    struct hazel_udp_client_delivery *_next;
+    uint8_t _buffer[HAZEL_BUFFER_SIZE];
+} hazel_udp_client_delivery;
+
 typedef struct hazel_udp_client
 {
     hazel_udp_connection udp_connection;
+
+    /** Messages the network thread left for the peer to send again, or
+     *  dropped if unreliable, because the delivery ring was full */
+    atomic_uint_least64_t deferred_messages;
+
+    hazel_spsc_ring _deliveries;
+    // Owned by the network thread, waiting for room in the ring
+    hazel_udp_client_delivery *_spilled;
+    hazel_udp_client_delivery *_spilled_tail;
+    size_t _spilled_count;
+    pthread_t _network_thread;
+    atomic_bool _network_running;
 } hazel_udp_client;
 
 #define HAZEL_UDP_CLIENT_RECV_NO_ERROR 0x00
@@ -26,8 +61,41 @@ typedef struct hazel_udp_client
 #define HAZEL_UDP_CLIENT_HANDSHAKE_TIMEOUT -0xC201
 #define HAZEL_UDP_CLIENT_HANDSHAKE_DISCONNECTED -0xC202
 
+#define HAZEL_UDP_CLIENT_THREAD_RUNNING -0xC301
+#define HAZEL_UDP_CLIENT_THREAD_ERROR -0xC302
+
+/** How long the network thread waits on the socket before servicing its
+ *  send queue and reliable packets again. */
+#ifndef HAZEL_UDP_CLIENT_NETWORK_THREAD_TIMEOUT_MS
+#   define HAZEL_UDP_CLIENT_NETWORK_THREAD_TIMEOUT_MS 5
+#endif
+
+/** The same while the delivery ring is full, shorter so a released slot is
+ *  picked up quickly. */
+#ifndef HAZEL_UDP_CLIENT_FULL_TIMEOUT_MS
+#   define HAZEL_UDP_CLIENT_FULL_TIMEOUT_MS 1
+#endif
+
+/** Reliable messages held on the heap while the delivery ring is full,
+ *  before further ones are left unacked. */
+#ifndef HAZEL_UDP_CLIENT_SPILL_LIMIT
+#   define HAZEL_UDP_CLIENT_SPILL_LIMIT 256
+#endif
+
 int hazel_udp_client_init(hazel_udp_client* client, const char* hostname, 
                            uint16_t port, enum hazel_ip_mode ip_mode);
+
+/**
+ * \brief Like hazel_udp_client_init(), over the transport \p vtable instead
+ *        of a kernel socket.
+ *
+ * For example, with #hazel_udp_loopback_vtable and an endpoint of a
+ * hazel_udp_loopback as \p context, the client runs entirely in process.
+ */
+int hazel_udp_client_init_with(hazel_udp_client *client, const char *hostname,
+                               uint16_t port, enum hazel_ip_mode ip_mode,
+                               const hazel_udp_socket_vtable *vtable,
+                               void *context);
 void hazel_udp_client_free(hazel_udp_client* client);
 
 int hazel_udp_client_close(hazel_udp_client* client);
@@ -47,8 +115,70 @@ int hazel_udp_client_close(hazel_udp_client* client);
 int hazel_udp_client_handshake(hazel_udp_client* client, 
                                uint8_t* buffer, size_t buffer_len);
 
+/**
+ * \brief Send the hello and return immediately.
+ *
+ * The handshake completes when the hello is acknowledged, which is reported
+ * by the connection's \c on_connected handler from hazel_poll().
+ *
+ * \param client     The client structure
+ * \param buffer     A byte buffer to append to the hello message, may be NULL
+ * \param buffer_len The length of buffer \p buffer
+ */
+int hazel_udp_client_handshake_async(hazel_udp_client* client,
+                                     uint8_t* buffer, size_t buffer_len);
+
 int hazel_udp_client_recv(hazel_udp_client* client, 
                           enum hazel_send_option* out_send_option, 
                           hazel_message_reader* out_reader);
 
+/**
+ * \brief Receive on a dedicated network thread.
+ *
+ * The thread receives, acknowledges reliable packets, answers pings and sends
+ * everything queued with hazel_udp_connection_submit(), independently of the
+ * frame rate of the application. Messages are decoded in place into a ring of
+ * \p capacity preallocated slots, which the application drains with
+ * hazel_udp_client_peek() and hazel_udp_client_release(), typically once per
+ * frame.
+ *
+ * While the thread runs, the connection belongs to it: the application must
+ * only use hazel_udp_connection_submit() to send, and must not call
+ * hazel_udp_client_recv(). If an arena is set on the connection, compressed
+ * payloads are decompressed into it, so it must not be reset while
+ * deliveries are outstanding.
+ *
+ * When the ring is full the thread keeps receiving, acknowledging and
+ * answering pings. Reliable messages wait on the heap until a slot is
+ * released, up to #HAZEL_UDP_CLIENT_SPILL_LIMIT of them; beyond that they
+ * are left unacked, so the peer's retransmissions slow it down and deliver
+ * them later. Unreliable messages are dropped while the ring is full. Both
+ * are counted in \c deferred_messages.
+ *
+ * \param client   A client which has completed its handshake
+ * \param capacity The number of slots, rounded up to a power of two
+ */
+int hazel_udp_client_start_network_thread(hazel_udp_client *client,
+                                          size_t capacity);
+
+/**
+ * \brief Stop and join the network thread. Undelivered messages are dropped.
+ */
+int hazel_udp_client_stop_network_thread(hazel_udp_client *client);
+
+/**
+ * \brief Get the oldest message received by the network thread.
+ *
+ * The delivery stays valid until it is passed to hazel_udp_client_release().
+ *
+ * \return The delivery, or NULL if there is none
+ */
+hazel_udp_client_delivery *hazel_udp_client_peek(hazel_udp_client *client);
+
+/**
+ * \brief Hand the delivery returned by hazel_udp_client_peek() back to the
+ *        network thread.
+ */
+void hazel_udp_client_release(hazel_udp_client *client);
+
 /** @}*/
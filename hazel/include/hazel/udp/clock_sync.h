@@ -0,0 +1,134 @@
+#pragma once
+
+#include "hazel/common.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** \addtogroup UDP_Clock_Sync UDP Clock Synchronization
+ *  \ingroup UDP
+ *  \brief Estimates the clock of the remote end of a connection
+ *
+ * Every timestamped ping gives four times, as in NTP: \c t1 when the ping
+ * left, \c t2 when the peer received it and \c t3 when the peer sent the
+ * ack, on the peer's clock, and \c t4 when the ack arrived. From them come
+ * the offset between the clocks, <tt>((t2 - t1) + (t3 - t4)) / 2</tt>, and
+ * the round trip delay, <tt>(t4 - t1) - (t3 - t2)</tt>.
+ *
+ * A sample is only as good as its delay is symmetric, so, like NTP's clock
+ * filter, the sample with the smallest delay of the last
+ * #HAZEL_CLOCK_SYNC_FILTER_SIZE is used. The drift between the clocks is
+ * the slope of a least squares fit through the samples used over the last
+ * seconds.
+ *
+ * The estimate is written by the thread which owns the connection and may be
+ * read from any thread.
+ *  @{
+ */
+
+#define HAZEL_CLOCK_SYNC_NOT_SYNCED -0xB601
+
+/** Samples the one with the smallest delay is picked from */
+#ifndef HAZEL_CLOCK_SYNC_FILTER_SIZE
+#   define HAZEL_CLOCK_SYNC_FILTER_SIZE 8
+#endif
+
+/** Picked samples the drift is fitted through, one per
+ *  #HAZEL_CLOCK_SYNC_HISTORY_INTERVAL_MS */
+#ifndef HAZEL_CLOCK_SYNC_HISTORY
+#   define HAZEL_CLOCK_SYNC_HISTORY 16
+#endif
+
+#ifndef HAZEL_CLOCK_SYNC_HISTORY_INTERVAL_MS
+#   define HAZEL_CLOCK_SYNC_HISTORY_INTERVAL_MS 1000
+#endif
+
+/** Samples in the history before the drift is estimated, and taken as 0
+ *  until then */
+#ifndef HAZEL_CLOCK_SYNC_DRIFT_MIN_SAMPLES
+#   define HAZEL_CLOCK_SYNC_DRIFT_MIN_SAMPLES 4
+#endif
+
+/** Drift estimates beyond this are taken for noise and clamped */
+#ifndef HAZEL_CLOCK_SYNC_MAX_DRIFT_PPM
+#   define HAZEL_CLOCK_SYNC_MAX_DRIFT_PPM 500
+#endif
+
+/** How fast the error bound grows with the age of the picked sample, NTP's
+ *  frequency tolerance */
+#ifndef HAZEL_CLOCK_SYNC_DISPERSION_PPM
+#   define HAZEL_CLOCK_SYNC_DISPERSION_PPM 15
+#endif
+
+typedef struct hazel_clock_sync_sample
+{
+    /** Local time the ack arrived */
+    uint64_t local_ns;
+    int64_t offset_ns;
+    uint64_t delay_ns;
+} hazel_clock_sync_sample;
+
+typedef struct hazel_clock_estimate
+{
+    /** Remote clock minus local clock, at the time asked for */
+    int64_t offset_ns;
+    /** How much faster the remote clock runs, in parts per million */
+    double drift_ppm;
+    /** Bound on the error of \c offset_ns: half the round trip of the
+     *  sample used, growing with its age */
+    uint64_t error_ns;
+    /** Round trip delay of the sample used */
+    uint64_t rtt_ns;
+    /** Samples taken so far */
+    uint64_t samples;
+} hazel_clock_estimate;
+
+typedef struct hazel_clock_sync
+{
+    // Owned by the connection's thread
+    hazel_clock_sync_sample _filter[HAZEL_CLOCK_SYNC_FILTER_SIZE];
+    size_t _filter_count;
+    size_t _filter_next;
+    hazel_clock_sync_sample _history[HAZEL_CLOCK_SYNC_HISTORY];
+    size_t _history_count;
+    size_t _history_next;
+    uint64_t _used_local_ns;
+
+    // The published estimate, behind a sequence lock
+    atomic_uint _sequence;
+    atomic_uint_least64_t _samples;
+    atomic_uint_least64_t _reference_ns;
+    atomic_int_least64_t _offset_ns;
+    atomic_uint_least64_t _delay_ns;
+    atomic_int_least64_t _drift_ppb;
+} hazel_clock_sync;
+
+/**
+ * \return The local clock the estimates are relative to, \c CLOCK_MONOTONIC
+ *         in nanoseconds
+ */
+uint64_t hazel_clock_now_ns(void);
+
+void hazel_clock_sync_init(hazel_clock_sync *sync);
+
+/**
+ * \brief Add the sample of one ping.
+ *
+ * \param t1 Local time the ping was sent
+ * \param t2 Remote time the ping was received
+ * \param t3 Remote time the ack was sent
+ * \param t4 Local time the ack was received
+ */
+void hazel_clock_sync_add(hazel_clock_sync *sync, uint64_t t1, uint64_t t2,
+                          uint64_t t3, uint64_t t4);
+
+/**
+ * \brief Estimate the remote clock at local time \p local_ns.
+ *
+ * \return #HAZEL_CLOCK_SYNC_NOT_SYNCED before the first sample
+ */
+int hazel_clock_sync_estimate(hazel_clock_sync *sync, uint64_t local_ns,
+                              hazel_clock_estimate *out_estimate);
+
+/** @}*/
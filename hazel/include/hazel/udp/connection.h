@@ -3,10 +3,15 @@
 #include "hazel/common.h"
 #include "hazel/connection_state.h"
 #include "hazel/errors.h"
+#include "hazel/arena.h"
 #include "hazel/reader.h"
 #include "hazel/writer.h"
 #include "hazel/send_option.h"
+#include "hazel/mpsc_queue.h"
+#include "hazel/compress.h"
+#include "clock_sync.h"
 #include "socket.h"
+#include "stats.h"
 
 #include <time.h>
 
@@ -18,6 +23,80 @@
 
 #define HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG -0xB001
 #define HAZEL_UDP_CONNECTION_NOT_CONNECTED -0xB002
+#define HAZEL_UDP_CONNECTION_HANDLE_RECV_DUPLICATE -0xB003
+
+/** Round trip time assumed until the first ack is measured */
+#ifndef HAZEL_RELIABLE_INITIAL_RTT_MS
+#   define HAZEL_RELIABLE_INITIAL_RTT_MS 200
+#endif
+
+/** Bounds of the time to wait for an ack before resending, which is twice
+ *  the smoothed round trip time and doubles with every resend */
+#ifndef HAZEL_RELIABLE_RESEND_MIN_MS
+#   define HAZEL_RELIABLE_RESEND_MIN_MS 50
+#endif
+#ifndef HAZEL_RELIABLE_RESEND_MAX_MS
+#   define HAZEL_RELIABLE_RESEND_MAX_MS 2000
+#endif
+
+/** Reliable packets which are still not acked after this many resends are
+ *  dropped */
+#ifndef HAZEL_RELIABLE_MAX_RESENDS
+#   define HAZEL_RELIABLE_MAX_RESENDS 10
+#endif
+
+/**
+ * Reliable IDs remembered to drop duplicates, a multiple of 64. Resends
+ * arriving more than this many IDs behind the newest one are dropped as
+ * duplicates, so it must cover every packet sent while a resend may still be
+ * in flight. The default is half the ID space, the most which can be told
+ * apart from newer IDs, at a cost of 4 KiB per connection.
+ */
+#ifndef HAZEL_RELIABLE_RECEIVE_WINDOW
+#   define HAZEL_RELIABLE_RECEIVE_WINDOW 32768
+#endif
+
+_Static_assert(HAZEL_RELIABLE_RECEIVE_WINDOW > 0
+               && HAZEL_RELIABLE_RECEIVE_WINDOW % 64 == 0,
+               "HAZEL_RELIABLE_RECEIVE_WINDOW must be a multiple of 64");
+_Static_assert(HAZEL_RELIABLE_RECEIVE_WINDOW <= 32768,
+               "HAZEL_RELIABLE_RECEIVE_WINDOW must be at most half the "
+               "reliable ID space");
+
+/**
+ * Set in the send option byte of a message packet whose payload is
+ * compressed: the decompressed size as a packed integer, followed by the
+ * compressed bytes.
+ */
+#define HAZEL_SEND_OPTION_COMPRESSED 0x80
+
+/** Payloads smaller than this are never compressed. */
+#ifndef HAZEL_COMPRESS_MIN_SIZE
+#   define HAZEL_COMPRESS_MIN_SIZE 96
+#endif
+
+/**
+ * The compressed payload, its size prefix included, must be at most this
+ * percentage of the original payload for it to be sent compressed.
+ */
+#ifndef HAZEL_COMPRESS_MAX_RATIO
+#   define HAZEL_COMPRESS_MAX_RATIO 90
+#endif
+
+/** The largest decompressed payload accepted from a peer. */
+#ifndef HAZEL_COMPRESS_MAX_DECOMPRESSED_SIZE
+#   define HAZEL_COMPRESS_MAX_DECOMPRESSED_SIZE 0xFFFF
+#endif
+
+/** A ping carrying the time it was sent */
+#define HAZEL_UDP_CONNECTION_PING_SIZE 11
+/** Pings whose acks are told apart from duplicate acks */
+#ifndef HAZEL_UDP_CONNECTION_PENDING_PINGS
+#   define HAZEL_UDP_CONNECTION_PENDING_PINGS 8
+#endif
+/** The ack of a timestamped ping, carrying the ping's time and the times the
+ *  peer received it and sent the ack */
+#define HAZEL_UDP_CONNECTION_CLOCK_ACK_SIZE 28
 
 typedef struct hazel_udp_connection hazel_udp_connection;
 typedef struct hazel_udp_sent_packet hazel_udp_sent_packet;
@@ -25,20 +104,64 @@ typedef struct hazel_udp_sent_packet hazel_udp_sent_packet;
 typedef void (*ack_callback)(hazel_udp_connection *connection,
                              hazel_udp_sent_packet *packet);
 
+/**
+ * Callbacks run by hazel_poll() for a connection. Any of them may be NULL.
+ * Readers are only valid for the duration of the callback.
+ */
+typedef struct hazel_udp_connection_handlers
+{
+    void (*on_message)(hazel_udp_connection *connection,
+                       enum hazel_send_option send_option,
+                       hazel_message_reader *reader, void *user_data);
+    void (*on_disconnect)(hazel_udp_connection *connection,
+                          hazel_message_reader *reader, void *user_data);
+    void (*on_ack)(hazel_udp_connection *connection, uint16_t reliable_id,
+                   void *user_data);
+    /** The hello sent by hazel_udp_client_handshake_async() was acked */
+    void (*on_connected)(hazel_udp_connection *connection, void *user_data);
+
+    void *user_data;
+} hazel_udp_connection_handlers;
+
 typedef struct hazel_udp_sent_packet
 {
     uint16_t id;
     uint32_t length;
+    uint8_t *data;
     bool acked;
     uint8_t retransmission_count;
     struct timespec created_at;
     struct timespec last_transmission;
+    /** The socket's TX timestamp key for the first transmission, and the
+     *  kernel's software and hardware timestamps for it once reported, see
+     *  hazel_udp_socket_set_timestamping() */
+    uint32_t tx_key;
+    uint64_t tx_timestamp_ns;
+    uint64_t tx_hardware_timestamp_ns;
 
     ack_callback callback_func;
 
     struct hazel_udp_sent_packet *next_packet;
 } hazel_udp_sent_packet;
 
+/**
+ * What the socket reported about a received datagram, read right after it
+ * was received, see hazel_udp_connection_handle_recv_rx().
+ */
+typedef struct hazel_udp_connection_rx
+{
+    /** See hazel_udp_socket_rx_timestamp() */
+    uint64_t timestamp_ns;
+    /** See hazel_udp_socket_rx_hardware_timestamp() */
+    uint64_t hardware_timestamp_ns;
+    /** See hazel_udp_socket_rx_dropped() */
+    uint32_t kernel_drops;
+} hazel_udp_connection_rx;
+
+/**
+ * Embeds a #hazel_mpsc_queue, so like the queue it must not be copied or
+ * moved once hazel_udp_connection_init() has been called.
+ */
 typedef struct hazel_udp_connection
 {
     enum hazel_connection_state _connection_state;
@@ -48,19 +171,187 @@ typedef struct hazel_udp_connection
     uint16_t last_reliable_id;
     hazel_udp_sent_packet *reliable_packets;
 
+    uint32_t _smoothed_rtt_us;
+    bool _rtt_sampled;
+
+    // Window of the reliable IDs received, to drop duplicates
+    bool _received_any;
+    uint16_t _received_reliable_id;
+    uint64_t _received_reliable_mask[HAZEL_RELIABLE_RECEIVE_WINDOW / 64];
+
+    hazel_udp_connection_stats _stats;
+    // The socket's cumulative count of kernel drops when last seen, so
+    // only what was dropped since is added to the stats
+    uint32_t _kernel_drops_seen;
+    // What the socket reported about the datagram being handled
+    hazel_udp_connection_rx _rx;
+
+    hazel_clock_sync _clock_sync;
+    uint32_t _clock_sync_interval_ms;
+    uint64_t _next_clock_ping_ns;
+    // IDs of the last pings not acked yet, which are not in the reliable
+    // list
+    uint16_t _ping_ids[HAZEL_UDP_CONNECTION_PENDING_PINGS];
+    bool _ping_pending[HAZEL_UDP_CONNECTION_PENDING_PINGS];
+    size_t _ping_next;
+
+    hazel_arena *_arena;
+
+    bool _compression;
+    const uint8_t *_dictionary;
+    size_t _dictionary_size;
+    // Hashed once when compression is enabled, NULL without a dictionary
+    hazel_compress_dictionary *_compress_dictionary;
+
+    hazel_mpsc_queue _send_queue;
+
+    hazel_udp_connection_handlers handlers;
+    uint16_t _handshake_id;
+
 } hazel_udp_connection;
 
 int hazel_udp_connection_init(hazel_udp_connection *connection);
 void hazel_udp_connection_free(hazel_udp_connection *connection);
 
+/**
+ * \brief Allocate received readers from a tick arena instead of the heap.
+ *
+ * While an arena is set, the readers handed out by
+ * hazel_udp_connection_handle_recv() point into \p arena and must not be
+ * passed to hazel_message_reader_free(). They stay valid until the arena is
+ * reset, which is expected to happen once at the end of every network tick.
+ * The arena is not owned by the connection and may be shared between
+ * connections serviced by the same thread.
+ *
+ * \param connection The connection structure
+ * \param arena      The arena to allocate from, or NULL to go back to malloc
+ */
+void hazel_udp_connection_set_arena(hazel_udp_connection *connection,
+                                    hazel_arena *arena);
+
+void hazel_udp_connection_set_handlers(
+    hazel_udp_connection *connection,
+    const hazel_udp_connection_handlers *handlers);
+
+/**
+ * \brief Copy the connection's counters. Safe to call from any thread.
+ */
+void hazel_udp_connection_get_stats(hazel_udp_connection *connection,
+                                    hazel_udp_stats *out_stats);
+
+/**
+ * \return The smoothed round trip time in microseconds, measured from acks
+ *         of reliable packets
+ */
+uint32_t hazel_udp_connection_rtt_us(hazel_udp_connection *connection);
+
+/**
+ * \brief Send a ping carrying the local time, to take a sample of the remote
+ *        clock from its ack.
+ *
+ * The ping is the usual ping followed by the local time, and the peer's ack
+ * echoes it with the times it received the ping and sent the ack. The ping
+ * is not reliable: a lost one is simply a sample less. Like the usual ping,
+ * it uses up a reliable ID, which its ack is matched by.
+ *
+ * A peer which does not know timestamped pings takes any ping other than
+ * the usual 3 bytes for invalid and does not answer, so no samples come from
+ * it. A plain ack to the ping is counted as an ack but not sampled.
+ */
+int hazel_udp_connection_ping(hazel_udp_connection *connection);
+
+/**
+ * \brief Ping every \p interval_ms from
+ *        hazel_udp_connection_manage_reliable(), to keep the estimate of the
+ *        remote clock fresh.
+ *
+ * \param interval_ms Time between pings, \c 0 to stop pinging
+ */
+void hazel_udp_connection_set_clock_sync(hazel_udp_connection *connection,
+                                         uint32_t interval_ms);
+
+/**
+ * \brief Estimate the remote clock now. Safe to call from any thread.
+ *
+ * \param out_remote_ns The remote end's \c CLOCK_MONOTONIC in nanoseconds
+ * \param out_error_ns  Bound on the error of \p out_remote_ns, may be NULL
+ * \return #HAZEL_CLOCK_SYNC_NOT_SYNCED before the first timestamped ack
+ */
+int hazel_udp_connection_remote_time(hazel_udp_connection *connection,
+                                     uint64_t *out_remote_ns,
+                                     uint64_t *out_error_ns);
+
+/**
+ * \brief Copy the estimate of the remote clock, as of now. Safe to call from
+ *        any thread.
+ *
+ * \return #HAZEL_CLOCK_SYNC_NOT_SYNCED before the first timestamped ack
+ */
+int hazel_udp_connection_get_clock(hazel_udp_connection *connection,
+                                   hazel_clock_estimate *out_estimate);
+
+/**
+ * \brief Enable payload compression for writers with their \c compress flag
+ *        set.
+ *
+ * A payload is only sent compressed when it is at least
+ * #HAZEL_COMPRESS_MIN_SIZE bytes and compresses to
+ * #HAZEL_COMPRESS_MAX_RATIO percent or less, otherwise it goes out as is.
+ * Received compressed payloads are decompressed into the connection's arena
+ * if one is set, so the reader is handed out without an extra copy.
+ *
+ * Both peers must enable compression with the same dictionary.
+ *
+ * \param connection      The connection structure
+ * \param enabled         Whether compression is enabled
+ * \param dictionary      A dictionary shared with the peer, may be NULL. It
+ *                        is not copied, and may be shared between connections
+ * \param dictionary_size The size of \p dictionary
+ * \return #HAZEL_ERR_FAILED_ALLOC if the dictionary's match table could not
+ *         be allocated, in which case compression is left disabled
+ */
+int hazel_udp_connection_set_compression(hazel_udp_connection *connection,
+                                          bool enabled,
+                                          const uint8_t *dictionary,
+                                          size_t dictionary_size);
+
 int hazel_udp_connection_close(hazel_udp_connection *connection);
 
 int hazel_udp_connection_send(hazel_udp_connection *connection,
                               hazel_message_writer *writer);
 
+/**
+ * \brief Queue the contents of \p writer to be sent by the network thread.
+ *
+ * This is the only connection function which is safe to call from other
+ * threads. The payload is copied, so \p writer can be cleared and reused as
+ * soon as this returns. The packet is not sent, and for reliable packets not
+ * given a reliable ID, until the thread which owns the connection calls
+ * hazel_udp_connection_send_submitted().
+ *
+ * \return \c 0 if successful
+ * \return #HAZEL_ERR_FAILED_ALLOC if the copy could not be allocated
+ */
+int hazel_udp_connection_submit(hazel_udp_connection *connection,
+                                hazel_message_writer *writer);
+
+/**
+ * \brief Send every packet queued by hazel_udp_connection_submit().
+ *
+ * Packets are sent in the order they were submitted by each thread. Must only
+ * be called by the thread which owns the connection. This is done by
+ * hazel_udp_client_recv() for client connections.
+ *
+ * \param out_count The number of packets sent, may be NULL
+ * \return \c 0 if successful, otherwise the first error. Packets which fail
+ *         to send are dropped, the rest of the queue is still sent
+ */
+int hazel_udp_connection_send_submitted(hazel_udp_connection *connection,
+                                        size_t *out_count);
+
 /**
  * Make a packet reliable by adding a 2-byte reliable ID at an offset and adding
- * it to a list for retransmission
+ * a copy of it to a list for retransmission, until the ID is acked
  * @param connection The connection structure
  * @param buffer The buffer to write the reliable ID into, and to store for
  * retransmission
@@ -104,6 +395,11 @@ typedef struct hazel_udp_connection_recv
 {
     enum hazel_send_option packet_type;
 
+    /** When the datagram reached the kernel, on \c CLOCK_REALTIME, as the
+     *  socket reported when receiving it, or \c 0 without receive
+     *  timestamps */
+    uint64_t timestamp_ns;
+
     hazel_udp_connection_recv_data data;
 
 } hazel_udp_connection_recv;
@@ -112,6 +408,61 @@ int hazel_udp_connection_handle_recv(hazel_udp_connection *connection,
                                      uint8_t *buffer, size_t buffer_size,
                                      hazel_udp_connection_recv *out_recv_data);
 
+/**
+ * \brief Like hazel_udp_connection_handle_recv(), but the readers point
+ *        straight into \p buffer instead of a copy.
+ *
+ * \p buffer must stay valid and unchanged for as long as the reader is used.
+ * Compressed payloads still need a buffer of their own; their reader is
+ * allocated as in hazel_udp_connection_handle_recv(), so its data lies outside
+ * \p buffer.
+ */
+int hazel_udp_connection_handle_recv_in_place(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection_recv *out_recv_data);
+
+/**
+ * \brief Fill \p out_rx with what \p socket reported about the datagram it
+ *        received last.
+ */
+static inline void hazel_udp_connection_rx_from_socket(
+    const hazel_udp_socket *socket, hazel_udp_connection_rx *out_rx)
+{
+    out_rx->timestamp_ns = hazel_udp_socket_rx_timestamp(socket);
+    out_rx->hardware_timestamp_ns
+        = hazel_udp_socket_rx_hardware_timestamp(socket);
+    out_rx->kernel_drops = hazel_udp_socket_rx_dropped(socket);
+}
+
+/**
+ * \brief Like hazel_udp_connection_handle_recv_in_place(), with what the
+ *        socket reported when it received the datagram, for datagrams which
+ *        are handled after the socket went on to receive others.
+ */
+int hazel_udp_connection_handle_recv_rx(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    const hazel_udp_connection_rx *rx,
+    hazel_udp_connection_recv *out_recv_data);
+
+/**
+ * \brief Free the reader of \p recv_data if
+ *        hazel_udp_connection_handle_recv_in_place() had to allocate it
+ *        outside of \p buffer.
+ */
+void hazel_udp_connection_release_in_place(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection_recv *recv_data);
+
+/**
+ * \brief Forget which reliable IDs were received, so that they are accepted
+ *        again instead of dropped as duplicates.
+ */
+void hazel_udp_connection_reset_received(hazel_udp_connection *connection);
+
+/**
+ * \brief Resend reliable packets whose ack is overdue, and drop those which
+ *        were resent #HAZEL_RELIABLE_MAX_RESENDS times.
+ */
 int hazel_udp_connection_manage_reliable(hazel_udp_connection *connection);
 
 int hazel_udp_connection_disconnect(hazel_udp_connection *connection);
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "connection.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \addtogroup UDP_Decode_Pool UDP Decode Pool
+ *  \ingroup UDP
+ *  \brief Worker threads which handle received datagrams for many connections
+ *
+ * The I/O thread only receives datagrams and hands them to the pool with
+ * hazel_decode_pool_submit(). Datagrams are grouped per connection in a
+ * strand: a strand is queued on one worker at a time and its whole batch of
+ * pending datagrams is handled in order, so messages of one connection are
+ * never processed concurrently or out of order, while different connections
+ * are spread over the workers.
+ *
+ * Each worker takes strands from the front of its own deque. A worker whose
+ * deque is empty steals a strand from the back of another worker's deque.
+ *
+ * The strand owns its connection: only the worker running the strand touches
+ * it. Workers run hazel_udp_connection_handle_recv_rx() on each datagram,
+ * which acknowledges reliable packets and answers pings, then call the pool's
+ * callback, and send what hazel_udp_connection_submit() queued once the batch
+ * is done. Resends are driven by hazel_decode_pool_tick(), which the owner
+ * calls as it would hazel_udp_connection_manage_reliable(). While a
+ * connection is attached to a strand, other threads must only send on it
+ * with hazel_udp_connection_submit().
+ *  @{
+ */
+
+#define HAZEL_DECODE_POOL_THREAD_ERROR -0xB201
+
+typedef struct hazel_decode_strand hazel_decode_strand;
+typedef struct hazel_decode_datagram hazel_decode_datagram;
+typedef struct hazel_decode_worker hazel_decode_worker;
+
+/**
+ * Called on a worker thread for every handled datagram. The readers in
+ * \p recv point into the datagram, or into a buffer of their own for a
+ * compressed payload, and are only valid during the call: the worker
+ * releases both with hazel_udp_connection_release_in_place() once it
+ * returns.
+ */
+typedef void (*hazel_decode_callback)(hazel_decode_strand *strand,
+                                      hazel_udp_connection_recv *recv,
+                                      void *user_data);
+
+typedef struct hazel_decode_strand
+{
+    hazel_udp_connection *connection;
+    void *user_data;
+
+    pthread_mutex_t _lock;
+    hazel_decode_datagram *_head;
+    hazel_decode_datagram *_tail;
+    bool _tick;
+    bool _scheduled;
+} hazel_decode_strand;
+
+typedef struct hazel_decode_pool
+{
+    hazel_decode_callback callback;
+    void *user_data;
+
+    size_t worker_count;
+    hazel_decode_worker *_workers;
+    atomic_size_t _next_worker;
+
+    pthread_mutex_t _idle_lock;
+    pthread_cond_t _idle_cond;
+    size_t _queued;
+    bool _running;
+} hazel_decode_pool;
+
+/**
+ * \param connection The connection the strand's datagrams belong to
+ * \param user_data  Passed through to the callback via the strand
+ */
+int hazel_decode_strand_init(hazel_decode_strand *strand,
+                             hazel_udp_connection *connection,
+                             void *user_data);
+
+/**
+ * Free the datagrams which are still pending. The strand must not be queued
+ * on a running pool.
+ */
+void hazel_decode_strand_free(hazel_decode_strand *strand);
+
+/**
+ * \brief Start \p worker_count worker threads.
+ */
+int hazel_decode_pool_init(hazel_decode_pool *pool, size_t worker_count,
+                           hazel_decode_callback callback, void *user_data);
+
+/**
+ * \brief Stop and join the workers. Strands which are still queued keep their
+ *        pending datagrams until hazel_decode_strand_free().
+ */
+void hazel_decode_pool_free(hazel_decode_pool *pool);
+
+/**
+ * \brief Queue a received datagram for \p strand's connection.
+ *
+ * The datagram is copied, \p buffer can be reused as soon as this returns.
+ * What the connection's socket reported about its last receive, the
+ * timestamps and the kernel drop count, is taken along, so it must be called
+ * right after receiving the datagram on that socket.
+ */
+int hazel_decode_pool_submit(hazel_decode_pool *pool,
+                             hazel_decode_strand *strand,
+                             const uint8_t *buffer, size_t size);
+
+/**
+ * \brief Have a worker run hazel_udp_connection_manage_reliable() on
+ *        \p strand's connection and send what was submitted.
+ *
+ * Ticks which come in while one is pending are merged into it.
+ */
+int hazel_decode_pool_tick(hazel_decode_pool *pool,
+                           hazel_decode_strand *strand);
+
+/** @}*/
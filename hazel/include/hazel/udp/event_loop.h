@@ -0,0 +1,77 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "connection.h"
+
+#include <stddef.h>
+
+/** \addtogroup UDP_Event_Loop UDP Event Loop
+ *  \ingroup UDP
+ *  \brief Callback driven receiving for any number of connections
+ *
+ * Connections are added to a loop, and a single hazel_poll() call waits for
+ * any of their sockets to become readable, then drains every datagram which
+ * is ready and runs the connection's handlers for each of them. Reliable
+ * packets are acknowledged and pings answered before the handlers run.
+ *
+ * Readers passed to handlers point into the loop's receive buffer and are
+ * only valid for the duration of the callback.
+ *  @{
+ */
+
+#define HAZEL_EVENT_LOOP_POLL_ERROR -0xB301
+#define HAZEL_EVENT_LOOP_NOT_FOUND -0xB302
+
+/** The most datagrams read from one socket in a single hazel_poll() call,
+ *  so one busy connection cannot hold up the others. */
+#ifndef HAZEL_EVENT_LOOP_RECV_BUDGET
+#   define HAZEL_EVENT_LOOP_RECV_BUDGET 64
+#endif
+
+struct pollfd;
+
+typedef struct hazel_event_loop
+{
+    hazel_udp_connection **_connections;
+    struct pollfd *_pollfds;
+    size_t _count;
+    size_t _capacity;
+} hazel_event_loop;
+
+int hazel_event_loop_init(hazel_event_loop *loop);
+void hazel_event_loop_free(hazel_event_loop *loop);
+
+/**
+ * \brief Add an open connection to the loop. Must not be called from a
+ *        handler.
+ */
+int hazel_event_loop_add(hazel_event_loop *loop,
+                         hazel_udp_connection *connection);
+
+/**
+ * \brief Remove a connection from the loop. Must not be called from a
+ *        handler.
+ *
+ * \return #HAZEL_EVENT_LOOP_NOT_FOUND if \p connection is not in the loop
+ */
+int hazel_event_loop_remove(hazel_event_loop *loop,
+                            hazel_udp_connection *connection);
+
+/**
+ * \brief Wait up to \p timeout_ms for traffic and dispatch all of it.
+ *
+ * Also sends the packets queued with hazel_udp_connection_submit() and
+ * services reliable packets for every connection in the loop.
+ *
+ * Sockets without a file descriptor, such as loopback ones, cannot be waited
+ * on: while the loop holds any, hazel_poll() never waits.
+ *
+ * \param timeout_ms How long to wait, \c 0 to only handle what is already
+ *                   queued, \c -1 to wait indefinitely
+ * \return The number of datagrams handled
+ * \return #HAZEL_EVENT_LOOP_POLL_ERROR if waiting on the sockets failed
+ */
+int hazel_poll(hazel_event_loop *loop, int timeout_ms);
+
+/** @}*/
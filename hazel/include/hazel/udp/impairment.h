@@ -0,0 +1,127 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "socket.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** \addtogroup UDP_Impairment UDP Impairment
+ *  \ingroup UDP
+ *  \brief Emulates a bad network on the datagrams sent through a socket
+ *
+ * An impairment wraps an inner socket, kernel or loopback, and is used as
+ * the transport of an outer socket:
+ *
+ *     hazel_udp_impairment_init(&impairment, &config, &inner);
+ *     hazel_udp_socket_init_with(&outer, &hazel_udp_impairment_vtable,
+ *                                &impairment);
+ *
+ * Every datagram sent on the outer socket may be lost, duplicated, delayed
+ * and rate limited before it is passed to the inner socket. Received
+ * datagrams are passed through untouched, so to impair both directions each
+ * peer wraps its own socket. All random decisions come from a generator
+ * seeded by the config, so a given sequence of sends is always impaired the
+ * same way.
+ *
+ * Delayed datagrams are held by the impairment and only handed to the inner
+ * socket during calls on the outer socket, or to
+ * hazel_udp_impairment_flush(). Receives with a timeout keep releasing them
+ * while they wait. The outer socket has no file descriptor. Datagrams are
+ * captured on the outer socket only, before they are impaired.
+ *  @{
+ */
+
+#define HAZEL_UDP_IMPAIRMENT_QUEUE_LIMIT 1024
+
+typedef struct hazel_udp_impairment_config
+{
+    uint64_t seed;
+
+    /** Probability of losing a datagram, in the good state of the
+     *  Gilbert-Elliott model. On its own this is uniform loss. */
+    double loss;
+
+    /** Per datagram probability of moving from the good to the bad state,
+     *  \c 0 disables the bad state */
+    double burst_enter;
+    /** Per datagram probability of moving from the bad to the good state */
+    double burst_exit;
+    /** Probability of losing a datagram in the bad state */
+    double burst_loss;
+
+    /** Fixed one-way delay */
+    uint32_t latency_us;
+    /** Extra delay, uniform between 0 and this */
+    uint32_t jitter_us;
+
+    /** Probability of holding a datagram back by \c reorder_us, so that
+     *  later datagrams overtake it */
+    double reorder;
+    uint32_t reorder_us;
+
+    /** Probability of sending a datagram twice */
+    double duplicate;
+
+    /** Link rate in bits per second, \c 0 for unlimited. Datagrams queue
+     *  behind each other at this rate. */
+    uint64_t bandwidth_bps;
+
+    /** The most datagrams held at once, further ones are dropped like by a
+     *  full router queue. \c 0 for #HAZEL_UDP_IMPAIRMENT_QUEUE_LIMIT. */
+    size_t queue_limit;
+} hazel_udp_impairment_config;
+
+typedef struct hazel_udp_impairment
+{
+    hazel_udp_impairment_config config;
+
+    /** Datagrams sent on the outer socket */
+    uint64_t sent;
+    /** Datagrams lost, queue overflows included */
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+    /** Datagrams handed to the inner socket, duplicates included */
+    uint64_t delivered;
+
+    hazel_udp_socket *_inner;
+    uint64_t _rng;
+    bool _bad_state;
+    uint64_t _link_free_ns;
+    uint64_t _sequence;
+
+    // Min-heap of held datagrams by release time, and their storage
+    struct hazel_udp_impaired_datagram *_heap;
+    size_t _count;
+    uint8_t *_slots;
+    uint32_t *_free_slots;
+    size_t _free_count;
+} hazel_udp_impairment;
+
+extern const hazel_udp_socket_vtable hazel_udp_impairment_vtable;
+
+/**
+ * \param impairment The impairment structure
+ * \param config     The impairment to apply, copied
+ * \param inner      An initialised socket, which must outlive the impairment
+ */
+int hazel_udp_impairment_init(hazel_udp_impairment *impairment,
+                              const hazel_udp_impairment_config *config,
+                              hazel_udp_socket *inner);
+
+/**
+ * \brief Free the impairment. Held datagrams are dropped.
+ */
+void hazel_udp_impairment_free(hazel_udp_impairment *impairment);
+
+/**
+ * \brief Hand every held datagram which is due to the inner socket.
+ *
+ * \return The number of datagrams released
+ */
+size_t hazel_udp_impairment_flush(hazel_udp_impairment *impairment);
+
+/** @}*/
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "hazel/spsc_ring.h"
+#include "socket.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/** \addtogroup UDP_Loopback UDP Loopback
+ *  \ingroup UDP
+ *  \brief In-process transport connecting two sockets without the kernel
+ *
+ * A loopback holds two endpoints, \c a and \c b. A socket initialised with
+ * hazel_udp_socket_init_with(socket, &hazel_udp_loopback_vtable, &loopback.a)
+ * exchanges datagrams with the socket on \c loopback.b through a pair of
+ * preallocated lock-free rings: sending and receiving are a copy into and out
+ * of a slot, with no system call.
+ *
+ * Each endpoint may be used from a different thread, but each from only one.
+ * hazel_udp_socket_connect() ignores its address, the endpoints are already
+ * connected to each other. Like UDP, a datagram sent while the peer's ring is
+ * full is dropped, and counted in \c dropped. Loopback sockets have no file
+ * descriptor; hazel_poll() checks them on every call instead of waiting.
+ *  @{
+ */
+
+/** How long a receive with a timeout sleeps between checks of the ring */
+#ifndef HAZEL_UDP_LOOPBACK_WAIT_US
+#   define HAZEL_UDP_LOOPBACK_WAIT_US 50
+#endif
+
+typedef struct hazel_udp_loopback_endpoint
+{
+    hazel_spsc_ring *_inbox;
+    hazel_spsc_ring *_outbox;
+    atomic_bool _open;
+
+    /** Datagrams sent from this endpoint which did not fit in the peer's
+     *  ring */
+    atomic_uint_least64_t dropped;
+} hazel_udp_loopback_endpoint;
+
+typedef struct hazel_udp_loopback
+{
+    hazel_udp_loopback_endpoint a;
+    hazel_udp_loopback_endpoint b;
+
+    hazel_spsc_ring _a_to_b;
+    hazel_spsc_ring _b_to_a;
+} hazel_udp_loopback;
+
+extern const hazel_udp_socket_vtable hazel_udp_loopback_vtable;
+
+/**
+ * \param loopback The loopback structure, which must not move while in use
+ * \param capacity The number of datagrams each direction can queue, rounded
+ *                 up to a power of two
+ */
+int hazel_udp_loopback_init(hazel_udp_loopback *loopback, size_t capacity);
+void hazel_udp_loopback_free(hazel_udp_loopback *loopback);
+
+/** @}*/
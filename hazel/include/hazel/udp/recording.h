@@ -0,0 +1,177 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "connection.h"
+#include "socket.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/** \addtogroup UDP_Recording UDP Recording
+ *  \ingroup UDP
+ *  \brief Record the datagrams a session receives and replay them offline
+ *
+ * A recorder wraps an inner socket, kernel or loopback, and is used as the
+ * transport of the socket to record:
+ *
+ *     hazel_udp_recorder_open(&recorder, "session.hzr", &inner);
+ *     hazel_udp_socket_init_with(&outer, &hazel_udp_recorder_vtable,
+ *                                &recorder);
+ *
+ * Everything passes through to the inner socket, and every datagram received
+ * is appended to the file with the time it arrived. Datagrams may also be
+ * appended by hand with hazel_udp_recorder_write().
+ *
+ * A replay maps the file into memory and hands each datagram, in place, to
+ * hazel_udp_connection_handle_recv_in_place(): no datagram is copied, so
+ * replaying measures the decoding and reading alone. It runs as fast as
+ * possible or paced like the recording.
+ *
+ * The file is a 16 byte header, the magic \c "HZRC", a version and the wall
+ * clock time the recording started in nanoseconds, followed by one record
+ * per datagram: the nanoseconds since the start, the size, and the datagram.
+ * Integers are little endian.
+ *  @{
+ */
+
+#define HAZEL_UDP_RECORDING_OPEN_ERROR -0xB501
+#define HAZEL_UDP_RECORDING_WRITE_ERROR -0xB502
+#define HAZEL_UDP_RECORDING_FORMAT_ERROR -0xB503
+#define HAZEL_UDP_RECORDING_END -0xB504
+
+#define HAZEL_UDP_RECORDING_VERSION 1
+
+typedef struct hazel_udp_recorder
+{
+    /** Datagrams recorded */
+    uint64_t records;
+    /** Bytes recorded, headers included */
+    uint64_t bytes;
+
+    FILE *_file;
+    hazel_udp_socket *_inner;
+    uint64_t _start_ns;
+} hazel_udp_recorder;
+
+extern const hazel_udp_socket_vtable hazel_udp_recorder_vtable;
+
+/**
+ * \brief Create the recording file and write its header.
+ *
+ * \param recorder The recorder structure
+ * \param path     The file to create, overwritten if it exists
+ * \param inner    An initialised socket, which must outlive the recorder, or
+ *                 NULL when only recording with hazel_udp_recorder_write()
+ * \return #HAZEL_UDP_RECORDING_OPEN_ERROR if the file cannot be written
+ */
+int hazel_udp_recorder_open(hazel_udp_recorder *recorder, const char *path,
+                            hazel_udp_socket *inner);
+
+/**
+ * \brief Append a received datagram, stamped with the current time.
+ *
+ * \return #HAZEL_UDP_RECORDING_WRITE_ERROR if the file cannot be written
+ */
+int hazel_udp_recorder_write(hazel_udp_recorder *recorder,
+                             const uint8_t *data, size_t size);
+
+/**
+ * \brief Flush and close the file.
+ */
+int hazel_udp_recorder_close(hazel_udp_recorder *recorder);
+
+enum hazel_udp_replay_pace
+{
+    /** Hand over each datagram as soon as the previous one is handled */
+    HAZEL_UDP_REPLAY_FAST,
+    /** Wait for each datagram's time since the start of the recording */
+    HAZEL_UDP_REPLAY_REAL_TIME,
+};
+
+typedef struct hazel_udp_replay_record
+{
+    /** Nanoseconds since the recording started */
+    uint64_t timestamp_ns;
+    /** The datagram, inside the replay's copy of the file */
+    uint8_t *data;
+    size_t size;
+} hazel_udp_replay_record;
+
+/**
+ * Called by hazel_udp_replay_run() with each datagram the connection
+ * accepted. \p recv is released when the callback returns.
+ */
+typedef void (*hazel_udp_replay_callback)(hazel_udp_connection *connection,
+                                          hazel_udp_connection_recv *recv,
+                                          void *user_data);
+
+typedef struct hazel_udp_replay
+{
+    /** Wall clock time the recording started, in nanoseconds */
+    uint64_t started_at_ns;
+    /** Datagrams handed over by hazel_udp_replay_run() */
+    uint64_t replayed;
+    /** Datagrams which hazel_udp_connection_handle_recv_in_place()
+     *  rejected */
+    uint64_t rejected;
+
+    uint8_t *_data;
+    size_t _size;
+    size_t _offset;
+} hazel_udp_replay;
+
+/**
+ * A transport which discards everything sent and never receives, for the
+ * connection fed by a replay: the acks it answers reliable datagrams with
+ * go nowhere.
+ */
+extern const hazel_udp_socket_vtable hazel_udp_replay_sink_vtable;
+
+/**
+ * \brief Map a recording into memory, or read it into a buffer where
+ *        files cannot be mapped.
+ *
+ * \return #HAZEL_UDP_RECORDING_OPEN_ERROR if the file cannot be mapped
+ * \return #HAZEL_UDP_RECORDING_FORMAT_ERROR if it is not a recording
+ */
+int hazel_udp_replay_open(hazel_udp_replay *replay, const char *path);
+void hazel_udp_replay_close(hazel_udp_replay *replay);
+
+/**
+ * \brief Go back to the first datagram.
+ */
+void hazel_udp_replay_rewind(hazel_udp_replay *replay);
+
+/**
+ * \brief Read the next datagram, without copying it.
+ *
+ * The replay's copy of the file is private, so \c data may be written to
+ * without changing the file.
+ *
+ * \return #HAZEL_UDP_RECORDING_END after the last datagram
+ * \return #HAZEL_UDP_RECORDING_FORMAT_ERROR if the file is truncated
+ */
+int hazel_udp_replay_next(hazel_udp_replay *replay,
+                          hazel_udp_replay_record *out_record);
+
+/**
+ * \brief Hand every datagram left to \p connection.
+ *
+ * When the replay is at its first datagram, after opening or
+ * hazel_udp_replay_rewind(), the connection's received reliable IDs are
+ * forgotten, so the same connection may replay the recording again.
+ *
+ * \param connection A connection whose socket may send, usually over
+ *                   #hazel_udp_replay_sink_vtable
+ * \param callback   Called with each accepted datagram, may be NULL
+ * \return 0 once every datagram was handed over
+ * \return #HAZEL_UDP_RECORDING_FORMAT_ERROR if the file is truncated
+ */
+int hazel_udp_replay_run(hazel_udp_replay *replay,
+                         hazel_udp_connection *connection,
+                         enum hazel_udp_replay_pace pace,
+                         hazel_udp_replay_callback callback, void *user_data);
+
+/** @}*/
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "hazel/ip_mode.h"
+#include "socket.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \addtogroup UDP_Resolver UDP Resolver
+ *  \ingroup UDP
+ *  \brief Resolve hostnames off the calling thread, with a cache
+ *
+ * A blocking \c getaddrinfo() per connect makes connections opened at once
+ * wait on DNS one after the other. A resolver instead runs the lookups on a
+ * few threads of its own and calls back with the address, which is then
+ * connected to with hazel_udp_socket_connect_address().
+ * hazel_udp_socket_connect_async() does both without blocking:
+ *
+ *     static void on_connected(hazel_udp_socket *socket, int status,
+ *                              void *user_data)
+ *     {
+ *         if (status == 0)
+ *         {
+ *             // Start the handshake
+ *         }
+ *     }
+ *
+ *     hazel_udp_socket_connect_async(&socket, &resolver, "play.example.com",
+ *                                    22023, on_connected, NULL);
+ *
+ * hazel_udp_socket_connect(), and so hazel_udp_client_init(), wait on the
+ * lookup of hazel_resolver_default(), sharing its cache.
+ *
+ * Addresses are cached for #HAZEL_RESOLVER_TTL_MS, so connecting to the same
+ * host again skips DNS, and concurrent requests for a host which is being
+ * looked up wait for that one lookup. \c getaddrinfo() does not tell the
+ * record's TTL, so the cache uses its own.
+ *  @{
+ */
+
+#define HAZEL_RESOLVER_THREAD_ERROR -0xB701
+/** The hostname could not be resolved to an address of the IP mode */
+#define HAZEL_RESOLVER_FAILED -0xB702
+/** hazel_resolver_lookup() found nothing in the cache */
+#define HAZEL_RESOLVER_NOT_CACHED -0xB703
+/** The resolver was freed before the lookup ran */
+#define HAZEL_RESOLVER_CANCELLED -0xB704
+
+/** Hostnames which are resolved and remembered at the same time */
+#ifndef HAZEL_RESOLVER_CACHE_SIZE
+#   define HAZEL_RESOLVER_CACHE_SIZE 64
+#endif
+
+/** How long a resolved address is used before it is looked up again */
+#ifndef HAZEL_RESOLVER_TTL_MS
+#   define HAZEL_RESOLVER_TTL_MS 60000
+#endif
+
+/** How long a failed lookup is remembered, so a missing host does not hit
+ *  DNS on every connect */
+#ifndef HAZEL_RESOLVER_NEGATIVE_TTL_MS
+#   define HAZEL_RESOLVER_NEGATIVE_TTL_MS 5000
+#endif
+
+/** Threads of the resolver hazel_resolver_default() starts */
+#ifndef HAZEL_RESOLVER_DEFAULT_THREADS
+#   define HAZEL_RESOLVER_DEFAULT_THREADS 2
+#endif
+
+/** Longest hostname, terminator included */
+#ifndef HAZEL_RESOLVER_HOSTNAME_SIZE
+#   define HAZEL_RESOLVER_HOSTNAME_SIZE 256
+#endif
+
+/**
+ * Called with the outcome of hazel_resolver_resolve(): on a resolver thread
+ * after a lookup, or on the calling thread when the cache answered.
+ *
+ * \param status  \c 0, #HAZEL_RESOLVER_FAILED or #HAZEL_RESOLVER_CANCELLED
+ * \param address The address, with port \c 0, or NULL unless \p status is
+ *                \c 0. Only valid during the call.
+ */
+typedef void (*hazel_resolver_callback)(int status,
+                                        const hazel_udp_address *address,
+                                        void *user_data);
+
+typedef struct hazel_resolver_query hazel_resolver_query;
+
+typedef struct hazel_resolver_entry
+{
+    char hostname[HAZEL_RESOLVER_HOSTNAME_SIZE];
+    enum hazel_ip_mode ip_mode;
+    /** \c 0 or #HAZEL_RESOLVER_FAILED */
+    int status;
+    hazel_udp_address address;
+    /** \c 0 for an empty entry */
+    uint64_t expires_ns;
+} hazel_resolver_entry;
+
+typedef struct hazel_resolver
+{
+    /** Requests the cache answered */
+    atomic_uint_least64_t cache_hits;
+    /** Lookups which went to DNS */
+    atomic_uint_least64_t lookups;
+
+    size_t thread_count;
+    pthread_t *_threads;
+
+    pthread_mutex_t _lock;
+    pthread_cond_t _cond;
+    // Lookups waiting for or taken by a thread, in order
+    hazel_resolver_query *_queries;
+    bool _running;
+
+    hazel_resolver_entry _cache[HAZEL_RESOLVER_CACHE_SIZE];
+} hazel_resolver;
+
+/**
+ * \brief Start \p thread_count resolver threads.
+ *
+ * \return #HAZEL_ERR_INVALID_ARGUMENTS if \p thread_count is \c 0, with
+ *         nothing to free
+ */
+int hazel_resolver_init(hazel_resolver *resolver, size_t thread_count);
+
+/**
+ * \brief Stop and join the threads. Lookups which have not started are
+ *        called back with #HAZEL_RESOLVER_CANCELLED, running ones are waited
+ *        for.
+ *
+ * hazel_resolver_resolve() returns #HAZEL_RESOLVER_CANCELLED once this has
+ * begun, also after it returned.
+ */
+void hazel_resolver_free(hazel_resolver *resolver);
+
+/**
+ * \brief Resolve \p hostname, calling back once the address is known.
+ *
+ * \param hostname A hostname or an IP address literal
+ * \return #HAZEL_RESOLVER_FAILED if \p hostname is too long, in which case
+ *         the callback is not called
+ * \return #HAZEL_RESOLVER_CANCELLED if the resolver is being or was freed,
+ *         in which case the callback is not called either
+ */
+int hazel_resolver_resolve(hazel_resolver *resolver, const char *hostname,
+                           enum hazel_ip_mode ip_mode,
+                           hazel_resolver_callback callback, void *user_data);
+
+/**
+ * \brief Look \p hostname up in the cache only, never waiting on DNS.
+ *
+ * \return #HAZEL_RESOLVER_NOT_CACHED if it is not cached or expired
+ * \return #HAZEL_RESOLVER_FAILED if its last lookup failed
+ */
+int hazel_resolver_lookup(hazel_resolver *resolver, const char *hostname,
+                          enum hazel_ip_mode ip_mode,
+                          hazel_udp_address *out_address);
+
+/**
+ * \brief Resolve \p hostname and wait for the address.
+ *
+ * Shares the cache and the lookups in flight of \p resolver, so must not be
+ * called from one of its callbacks.
+ *
+ * \param resolver The resolver, or NULL to call \c getaddrinfo() on the
+ *                 calling thread
+ * \return #HAZEL_RESOLVER_FAILED or #HAZEL_RESOLVER_CANCELLED
+ */
+int hazel_resolver_resolve_wait(hazel_resolver *resolver,
+                                const char *hostname,
+                                enum hazel_ip_mode ip_mode,
+                                hazel_udp_address *out_address);
+
+/**
+ * \brief The resolver shared by hazel_udp_socket_connect() and
+ *        hazel_udp_socket_connect_async(), started on first use and kept
+ *        until the process exits.
+ *
+ * \return NULL if its threads could not be started
+ */
+hazel_resolver *hazel_resolver_default(void);
+
+/** @}*/
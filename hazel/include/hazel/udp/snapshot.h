@@ -0,0 +1,135 @@
+#pragma once
+
+#include "hazel/common.h"
+#include "hazel/errors.h"
+#include "hazel/reader.h"
+#include "hazel/writer.h"
+#include "connection.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/** \addtogroup UDP_Snapshot UDP Snapshot Channel
+ *  \ingroup UDP
+ *  \brief Delta compressed state snapshots over unreliable messages
+ *
+ * A snapshot is a fixed number of 32-bit fields (floats are sent by their bit
+ * pattern). Each snapshot is sent as an unreliable message, encoded against
+ * the newest snapshot the peer has acknowledged: a bitmask of the fields that
+ * changed, followed by the XOR of every changed field with its baseline value
+ * as a packed integer. The receiver rebuilds the full state from its copy of
+ * the same baseline and acknowledges the snapshot number, so the sender can
+ * move its baseline forward. Until a baseline is acknowledged, snapshots are
+ * encoded against an all-zero state.
+ *
+ * Both directions use a hazel message with the channel's tags:
+ * - snapshot: packed sequence, packed baseline sequence (0 for none), the
+ *   changed bitmask, then the changed fields
+ * - ack: packed sequence
+ *  @{
+ */
+
+#define HAZEL_SNAPSHOT_BASELINE_MISSING -0xB101
+#define HAZEL_SNAPSHOT_STALE -0xB102
+
+/**
+ * Number of snapshots kept on each side to be used as baselines. A baseline
+ * which is acknowledged after it has been pushed out of the history is
+ * ignored.
+ */
+#ifndef HAZEL_SNAPSHOT_HISTORY
+#   define HAZEL_SNAPSHOT_HISTORY 32
+#endif
+
+typedef struct hazel_snapshot_channel
+{
+    size_t field_count;
+
+    uint8_t snapshot_tag;
+    uint8_t ack_tag;
+
+    uint32_t _next_sequence;
+    uint32_t _acked_sequence;
+    uint32_t _sent_sequences[HAZEL_SNAPSHOT_HISTORY];
+    uint32_t *_sent;
+
+    uint32_t _last_received_sequence;
+    uint32_t _received_sequences[HAZEL_SNAPSHOT_HISTORY];
+    uint32_t *_received;
+} hazel_snapshot_channel;
+
+/**
+ * \param channel      The channel structure
+ * \param field_count  The number of 32-bit fields in a snapshot
+ * \param snapshot_tag The message tag used for snapshots
+ * \param ack_tag      The message tag used for acknowledgements
+ */
+int hazel_snapshot_channel_init(hazel_snapshot_channel *channel,
+                                size_t field_count, uint8_t snapshot_tag,
+                                uint8_t ack_tag);
+void hazel_snapshot_channel_free(hazel_snapshot_channel *channel);
+
+/**
+ * \brief Write \p fields as a delta against the acknowledged baseline.
+ *
+ * The snapshot only becomes a baseline the peer may acknowledge once
+ * hazel_snapshot_channel_mark_sent() is called; until then, the next write
+ * reuses its number.
+ *
+ * \param out_sequence The snapshot number, may be NULL
+ */
+int hazel_snapshot_channel_write(hazel_snapshot_channel *channel,
+                                 hazel_message_writer *writer,
+                                 const uint32_t *fields,
+                                 uint32_t *out_sequence);
+
+/**
+ * \brief Keep the snapshot last written with \p fields as a baseline, once
+ *        its message was sent.
+ */
+void hazel_snapshot_channel_mark_sent(hazel_snapshot_channel *channel,
+                                      const uint32_t *fields);
+
+/**
+ * \brief Rebuild a snapshot from a message with the channel's snapshot tag.
+ *
+ * \param reader       A reader over the snapshot message, as returned by
+ *                     hazel_message_reader_read_message()
+ * \param out_fields   Receives \c field_count fields
+ * \param out_sequence The snapshot number, may be NULL
+ * \return \c 0 if successful
+ * \return #HAZEL_SNAPSHOT_STALE if a newer snapshot was already received
+ * \return #HAZEL_SNAPSHOT_BASELINE_MISSING if the baseline is no longer known
+ */
+int hazel_snapshot_channel_read(hazel_snapshot_channel *channel,
+                                hazel_message_reader *reader,
+                                uint32_t *out_fields,
+                                uint32_t *out_sequence);
+
+int hazel_snapshot_channel_write_ack(hazel_snapshot_channel *channel,
+                                     hazel_message_writer *writer,
+                                     uint32_t sequence);
+
+/**
+ * \brief Handle a message with the channel's ack tag, moving the baseline.
+ */
+int hazel_snapshot_channel_read_ack(hazel_snapshot_channel *channel,
+                                    hazel_message_reader *reader);
+
+/**
+ * Send \p fields on \p channel as an unreliable message on \p connection.
+ */
+int hazel_udp_connection_send_snapshot(hazel_udp_connection *connection,
+                                       hazel_snapshot_channel *channel,
+                                       const uint32_t *fields);
+
+/**
+ * \brief Rebuild a received snapshot and acknowledge it to the peer.
+ */
+int hazel_udp_connection_recv_snapshot(hazel_udp_connection *connection,
+                                       hazel_snapshot_channel *channel,
+                                       hazel_message_reader *reader,
+                                       uint32_t *out_fields);
+
+/** @}*/
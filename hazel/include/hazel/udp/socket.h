@@ -4,6 +4,8 @@
 #include "hazel/ip_mode.h"
 
 #include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -29,26 +31,402 @@
 
 #define HAZEL_UDP_SOCKET_SEND_ERROR -0xA302
 
+#define HAZEL_UDP_SOCKET_UNSUPPORTED -0xA401
+
+/** Size in bytes of the kernel receive buffer of sockets when they open,
+ *  \c 0 for the system default */
+#ifndef HAZEL_UDP_SOCKET_RECV_BUFFER_SIZE
+#   define HAZEL_UDP_SOCKET_RECV_BUFFER_SIZE 0
+#endif
+
+/** Size in bytes of the kernel send buffer of sockets when they open,
+ *  \c 0 for the system default */
+#ifndef HAZEL_UDP_SOCKET_SEND_BUFFER_SIZE
+#   define HAZEL_UDP_SOCKET_SEND_BUFFER_SIZE 0
+#endif
+
+/** \name Timestamping flags, see hazel_udp_socket_set_timestamping()
+ * @{
+ */
+/** Stamp received datagrams with the time they reached the kernel */
+#define HAZEL_UDP_SOCKET_TIMESTAMP_RX 0x01
+/** Report the time sent datagrams left the kernel */
+#define HAZEL_UDP_SOCKET_TIMESTAMP_TX 0x02
+/** Also take stamps from the network card's clock, where the card and
+ *  driver were set up to stamp packets */
+#define HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE 0x04
+/** @}*/
+
+/** Sent datagrams whose first bytes are remembered until their TX timestamp
+ *  is read, see hazel_udp_socket_read_tx_timestamp() */
+#ifndef HAZEL_UDP_SOCKET_TX_TAGS
+#   define HAZEL_UDP_SOCKET_TX_TAGS 64
+#endif
+
+/** First bytes of a sent datagram which are remembered, enough for the send
+ *  option and reliable ID of a connection's packets */
+#define HAZEL_UDP_SOCKET_TX_TAG_SIZE 4
+
+/** Large enough for a \c sockaddr_in6 */
+#define HAZEL_UDP_ADDRESS_SIZE 28
+
+/**
+ * A resolved address, a \c sockaddr_in or \c sockaddr_in6 kept as bytes so
+ * this header does not pull in the system's socket headers.
+ */
+typedef struct hazel_udp_address
+{
+    uint8_t data[HAZEL_UDP_ADDRESS_SIZE];
+    uint32_t length;
+} hazel_udp_address;
+
+typedef struct hazel_udp_socket hazel_udp_socket;
+
+/**
+ * The transport behind a socket. Every function has the contract of the
+ * hazel_udp_socket_* function of the same name.
+ */
+typedef struct hazel_udp_socket_vtable
+{
+    int (*open)(hazel_udp_socket *socket, enum hazel_ip_mode ip_mode);
+    int (*connect)(hazel_udp_socket *socket, const char *hostname, int port);
+    int (*send)(hazel_udp_socket *socket, uint8_t *buffer, size_t size,
+                int flags);
+    int (*recv)(hazel_udp_socket *socket, uint8_t *buffer, size_t size,
+                int flags, int timeout);
+    int (*try_recv)(hazel_udp_socket *socket, uint8_t *buffer, size_t size,
+                    int flags);
+    int (*close)(hazel_udp_socket *socket);
+} hazel_udp_socket_vtable;
+
+#ifndef HAZEL_CONFIG_CUSTOM_SOCKET
+/** Kernel UDP sockets, used by hazel_udp_socket_init() */
+extern const hazel_udp_socket_vtable hazel_udp_socket_kernel_vtable;
+#endif
+
+/**
+ * The addresses written into the headers of captured packets, see
+ * hazel/udp/capture.h. Resolved from the descriptor on the first capture.
+ */
+typedef struct hazel_udp_socket_capture_info
+{
+    bool ipv6;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint8_t local_address[16];
+    uint8_t remote_address[16];
+} hazel_udp_socket_capture_info;
+
+typedef struct hazel_udp_socket_tx_tag
+{
+    uint32_t key;
+    uint32_t size;
+    uint8_t data[HAZEL_UDP_SOCKET_TX_TAG_SIZE];
+} hazel_udp_socket_tx_tag;
+
+/** A TX timestamp reported by the kernel */
+typedef struct hazel_udp_tx_timestamp
+{
+    /** The key the datagram was sent with, counting up from \c 0 for the
+     *  first datagram sent after timestamping was turned on */
+    uint32_t key;
+    /** When the datagram left, on \c CLOCK_REALTIME, or \c 0 */
+    uint64_t software_ns;
+    /** When the datagram left, on the network card's clock, or \c 0 */
+    uint64_t hardware_ns;
+    /** The first bytes of the datagram sent with \c key, \c tag_size is
+     *  \c 0 if they were already forgotten */
+    uint8_t tag[HAZEL_UDP_SOCKET_TX_TAG_SIZE];
+    size_t tag_size;
+} hazel_udp_tx_timestamp;
+
 typedef struct hazel_udp_socket
 {
     enum hazel_ip_mode ip_mode;
 
+    /** The file descriptor, or -1 for transports which have none */
     int _sock_handle;
+
+    const hazel_udp_socket_vtable *_vtable;
+    void *_context;
+
+    hazel_udp_socket_capture_info _capture_info;
+    // Sending and receiving threads may capture at once, the first one to
+    // claim this resolves _capture_info for all of them
+    atomic_int _capture_state;
+
+    int _timestamping;
+    // The key the kernel gives the next sent datagram's TX timestamp, and
+    // the first bytes of the datagrams sent with the last keys
+    uint32_t _tx_next_key;
+    hazel_udp_socket_tx_tag _tx_tags[HAZEL_UDP_SOCKET_TX_TAGS];
+    // The stamps of the last datagram received, on CLOCK_REALTIME and on
+    // the network card's clock, which are never compared
+    uint64_t _rx_timestamp_ns;
+    uint64_t _rx_hardware_timestamp_ns;
+
+    // Whether the kernel reports receive queue overflows, and how many
+    // datagrams it dropped by the last receive
+    bool _count_drops;
+    uint32_t _rx_dropped;
+
+    // Busy polling, see hazel_udp_socket_set_busy_poll()
+    uint64_t _busy_poll_budget_ns;
+    uint64_t _busy_poll_spin_ns;
+    uint64_t _last_arrival_ns;
+    uint64_t _interarrival_ns;
 } hazel_udp_socket;
 
 
+/**
+ * \brief Initialise a kernel UDP socket.
+ *
+ * With #HAZEL_CONFIG_CUSTOM_SOCKET there is no kernel transport and
+ * hazel_udp_socket_init_with() must be used instead.
+ */
 int hazel_udp_socket_init(hazel_udp_socket* socket);
+
+/**
+ * \brief Initialise a socket backed by \p vtable.
+ *
+ * \param context Passed through to the transport, see
+ *                hazel_udp_socket_context()
+ */
+int hazel_udp_socket_init_with(hazel_udp_socket *socket,
+                               const hazel_udp_socket_vtable *vtable,
+                               void *context);
 void hazel_udp_socket_free(hazel_udp_socket* socket);
 
+static inline void *hazel_udp_socket_context(hazel_udp_socket *socket)
+{
+    return socket->_context;
+}
+
 int hazel_udp_socket_open(hazel_udp_socket* socket, enum hazel_ip_mode ip_mode);
 int hazel_udp_socket_close(hazel_udp_socket* socket);
 
+/**
+ * \brief Connect to \p hostname, waiting for it to be resolved.
+ *
+ * Kernel sockets resolve it with hazel_resolver_default(), so the address
+ * is cached and connects to the same host at once share one lookup. The
+ * first such connect starts the #HAZEL_RESOLVER_DEFAULT_THREADS threads of
+ * that resolver, which run until the process exits.
+ */
 int hazel_udp_socket_connect(hazel_udp_socket* socket, 
                           const char* hostname, int port);
 
+typedef struct hazel_resolver hazel_resolver;
+
+/**
+ * Called with the outcome of hazel_udp_socket_connect_async().
+ *
+ * \param status \c 0, the error of the lookup, or of the connect
+ */
+typedef void (*hazel_udp_socket_connect_callback)(hazel_udp_socket *socket,
+                                                  int status,
+                                                  void *user_data);
+
+/**
+ * \brief Connect to \p hostname without waiting for it to be resolved.
+ *
+ * A kernel socket is connected on a thread of \p resolver once the address
+ * is known, or on the calling thread if it was cached, and \p callback is
+ * called there. The socket must stay open until then. Other transports have
+ * nothing to resolve, they connect and call back before this returns.
+ *
+ * \param resolver The resolver, or NULL for hazel_resolver_default()
+ * \return An error if the lookup could not be started, in which case
+ *         \p callback is not called
+ */
+int hazel_udp_socket_connect_async(hazel_udp_socket *socket,
+                                   hazel_resolver *resolver,
+                                   const char *hostname, int port,
+                                   hazel_udp_socket_connect_callback callback,
+                                   void *user_data);
+
+/**
+ * \brief Connect a kernel socket to an address which is already resolved,
+ *        without a DNS lookup, see hazel/udp/resolver.h.
+ *
+ * \param port Replaces the port of \p address
+ * \return #HAZEL_UDP_SOCKET_UNSUPPORTED on transports other than the kernel's
+ * \return #HAZEL_UDP_SOCKET_SOCKET_ERROR if the address is not of the
+ *         socket's IP mode or the connect fails
+ */
+int hazel_udp_socket_connect_address(hazel_udp_socket *socket,
+                                     const hazel_udp_address *address,
+                                     int port);
+
 int hazel_udp_socket_recv(hazel_udp_socket* socket, uint8_t* buffer, 
                               size_t size, int flags, int timeout);
+
+/**
+ * \brief Size the kernel buffers of an open kernel socket.
+ *
+ * Bursts larger than the receive buffer are dropped by the kernel before the
+ * application sees them, see hazel_udp_socket_rx_dropped(). When the process
+ * may (\c CAP_NET_ADMIN), \c SO_RCVBUFFORCE and \c SO_SNDBUFFORCE are used
+ * to go past the \c net.core.rmem_max and \c wmem_max sysctls; otherwise the
+ * kernel silently caps the sizes, so read back what was applied with
+ * hazel_udp_socket_get_buffer_sizes().
+ *
+ * \param recv_bytes The receive buffer size, \c 0 to leave it as it is
+ * \param send_bytes The send buffer size, \c 0 to leave it as it is
+ * \return #HAZEL_UDP_SOCKET_UNSUPPORTED on transports other than the kernel's
+ * \return #HAZEL_UDP_SOCKET_SOCKET_ERROR if the kernel refused a size
+ */
+int hazel_udp_socket_set_buffer_sizes(hazel_udp_socket *socket,
+                                      int recv_bytes, int send_bytes);
+
+/**
+ * \brief Read the kernel buffer sizes of an open kernel socket, as the
+ *        kernel applied them. Linux doubles the sizes it was asked for, to
+ *        make room for its own bookkeeping.
+ *
+ * \return #HAZEL_UDP_SOCKET_UNSUPPORTED on transports other than the kernel's
+ */
+int hazel_udp_socket_get_buffer_sizes(hazel_udp_socket *socket,
+                                      int *out_recv_bytes,
+                                      int *out_send_bytes);
+
+/**
+ * \brief Have the kernel tell how many datagrams it dropped because the
+ *        receive queue was full, see hazel_udp_socket_rx_dropped().
+ *
+ * Sets \c SO_RXQ_OVFL on a Linux kernel socket which is already open. The
+ * count comes as a control message, so every receive then goes through
+ * \c recvmsg(), which is why it is off unless asked for.
+ *
+ * \return #HAZEL_UDP_SOCKET_UNSUPPORTED on transports and platforms without
+ *         the count
+ */
+int hazel_udp_socket_set_drop_counting(hazel_udp_socket *socket,
+                                       bool enable);
+
+/**
+ * \return The number of datagrams the kernel dropped because the receive
+ *         queue of \p socket was full since it opened, as of the last
+ *         datagram received. \c 0 unless counted with
+ *         hazel_udp_socket_set_drop_counting().
+ */
+static inline uint32_t hazel_udp_socket_rx_dropped(
+    const hazel_udp_socket *socket)
+{
+    return socket->_rx_dropped;
+}
+
+/**
+ * \brief Have hazel_udp_socket_recv() spin before it blocks.
+ *
+ * Waking up from \c select() costs tens of microseconds and whatever the
+ * scheduler adds. With busy polling, hazel_udp_socket_recv() first tries to
+ * receive without waiting, over and over, for up to \p budget_us, and only
+ * then blocks for the rest of its timeout.
+ *
+ * The spin adapts to the traffic: while datagrams arrive on average within
+ * the budget of each other, the whole budget is spun; every spin which ends
+ * without a datagram halves the next one, so sparse traffic soon blocks
+ * straight away again. On machines with a single CPU there is no spin,
+ * which would only keep the sender from running.
+ *
+ * On Linux kernel sockets, \c SO_BUSY_POLL and \c SO_PREFER_BUSY_POLL are
+ * also set, so each try polls the network card's queue directly. Raising
+ * \c SO_BUSY_POLL past the \c net.core.busy_read sysctl needs
+ * \c CAP_NET_ADMIN; without it the spin still happens in user space. They
+ * are only set on a socket which is already open.
+ *
+ * \param budget_us The longest spin in microseconds, \c 0 to turn busy
+ *                  polling off
+ */
+int hazel_udp_socket_set_busy_poll(hazel_udp_socket *socket,
+                                   uint32_t budget_us);
+
+/**
+ * \brief Receive a datagram if one is already queued, without waiting.
+ *
+ * \return The size of the datagram
+ * \return #HAZEL_UDP_SOCKET_RECV_NO_MESSAGE if none is queued
+ */
+int hazel_udp_socket_try_recv(hazel_udp_socket* socket, uint8_t* buffer,
+                              size_t size, int flags);
+
 int hazel_udp_socket_send(hazel_udp_socket* socket, uint8_t* buffer, 
                               size_t size, int flags);
 
+/**
+ * \brief Have the kernel timestamp the datagrams of a kernel socket.
+ *
+ * Round trips measured from these timestamps leave out the time datagrams
+ * spent queued in the socket before the application got to them. Timestamps
+ * are nanoseconds of \c CLOCK_REALTIME. With
+ * #HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE, stamps of the network card's clock
+ * are kept alongside; the two clocks are unrelated, so only stamps of the
+ * same clock may be subtracted.
+ *
+ * With #HAZEL_UDP_SOCKET_TIMESTAMP_TX, the timestamps of sent datagrams
+ * queue up in the socket until read with hazel_udp_socket_read_tx_timestamp(),
+ * which connections do on their own.
+ *
+ * \param flags #HAZEL_UDP_SOCKET_TIMESTAMP_RX and the other
+ *              timestamping flags, \c 0 to turn timestamping off
+ * \return #HAZEL_UDP_SOCKET_UNSUPPORTED on transports and platforms without
+ *         kernel timestamps
+ */
+int hazel_udp_socket_set_timestamping(hazel_udp_socket *socket, int flags);
+
+/**
+ * \return The timestamping flags enabled on \p socket, \c 0 if none
+ */
+static inline int hazel_udp_socket_timestamping(
+    const hazel_udp_socket *socket)
+{
+    return socket->_timestamping;
+}
+
+/**
+ * \return The time the last datagram received on \p socket reached the
+ *         kernel, on \c CLOCK_REALTIME, or \c 0 without
+ *         #HAZEL_UDP_SOCKET_TIMESTAMP_RX
+ */
+static inline uint64_t hazel_udp_socket_rx_timestamp(
+    const hazel_udp_socket *socket)
+{
+    return socket->_rx_timestamp_ns;
+}
+
+/**
+ * \return The time the network card received the last datagram received on
+ *         \p socket, on the card's clock, or \c 0 unless the card stamped it
+ */
+static inline uint64_t hazel_udp_socket_rx_hardware_timestamp(
+    const hazel_udp_socket *socket)
+{
+    return socket->_rx_hardware_timestamp_ns;
+}
+
+/**
+ * \return The key the TX timestamp of the next datagram sent on \p socket
+ *         will be reported with
+ */
+static inline uint32_t hazel_udp_socket_tx_next_key(
+    const hazel_udp_socket *socket)
+{
+    return socket->_tx_next_key;
+}
+
+/**
+ * \brief Read the oldest TX timestamp reported by the kernel.
+ *
+ * The kernel only reports the key, a counter of sent datagrams. Which
+ * datagram was sent with it is told by the first bytes the socket remembers
+ * of the last #HAZEL_UDP_SOCKET_TX_TAGS datagrams sent. With
+ * #HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE, the software and the hardware stamp
+ * of a datagram may come in separate reports.
+ *
+ * \return #HAZEL_UDP_SOCKET_RECV_NO_MESSAGE if none is waiting
+ */
+int hazel_udp_socket_read_tx_timestamp(hazel_udp_socket *socket,
+                                       hazel_udp_tx_timestamp *out_timestamp);
+
 /** @}*/
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "hazel/common.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** \addtogroup UDP_Stats UDP Connection Statistics
+ *  \ingroup UDP
+ *  \brief Counters and an RTT histogram kept by every connection
+ *
+ * The counters are relaxed atomic adds, so the thread which owns the
+ * connection and the workers of a decode pool may count into the same
+ * connection without losing counts. Any thread may take a consistent enough
+ * copy with hazel_udp_connection_get_stats() to export to a metrics system.
+ *
+ * Round trip times are recorded in microseconds into a log-linear
+ * histogram: values below 8 have a bucket each, above that every power of
+ * two is split into 8 buckets, so a bucket is at most 12.5% wide.
+ *  @{
+ */
+
+/** Counters per send option are indexed by the send option's value. */
+#define HAZEL_UDP_STATS_SEND_OPTIONS 16
+
+#define HAZEL_UDP_STATS_RTT_SUB_BUCKETS 8
+/** Covers round trips up to 2^27 us, longer ones go in the last bucket */
+#define HAZEL_UDP_STATS_RTT_BUCKETS 200
+
+typedef atomic_uint_least64_t hazel_udp_stats_counter;
+
+/**
+ * Live counters, owned by the connection. Read them through
+ * hazel_udp_connection_get_stats().
+ */
+typedef struct hazel_udp_connection_stats
+{
+    hazel_udp_stats_counter packets_sent[HAZEL_UDP_STATS_SEND_OPTIONS];
+    hazel_udp_stats_counter bytes_sent[HAZEL_UDP_STATS_SEND_OPTIONS];
+    hazel_udp_stats_counter packets_received[HAZEL_UDP_STATS_SEND_OPTIONS];
+    hazel_udp_stats_counter bytes_received[HAZEL_UDP_STATS_SEND_OPTIONS];
+
+    hazel_udp_stats_counter resends;
+    hazel_udp_stats_counter acks_sent;
+    hazel_udp_stats_counter acks_received;
+    hazel_udp_stats_counter duplicates;
+    hazel_udp_stats_counter drops;
+    hazel_udp_stats_counter malformed;
+    hazel_udp_stats_counter kernel_drops;
+
+    hazel_udp_stats_counter rtt_histogram[HAZEL_UDP_STATS_RTT_BUCKETS];
+} hazel_udp_connection_stats;
+
+/**
+ * A plain copy of the counters.
+ */
+typedef struct hazel_udp_stats
+{
+    /** Packets and bytes put on the wire, resends included */
+    uint64_t packets_sent[HAZEL_UDP_STATS_SEND_OPTIONS];
+    uint64_t bytes_sent[HAZEL_UDP_STATS_SEND_OPTIONS];
+    uint64_t packets_received[HAZEL_UDP_STATS_SEND_OPTIONS];
+    uint64_t bytes_received[HAZEL_UDP_STATS_SEND_OPTIONS];
+
+    /** Reliable packets sent again because no ack arrived in time */
+    uint64_t resends;
+    uint64_t acks_sent;
+    uint64_t acks_received;
+    /** Reliable packets received more than once, or acked more than once */
+    uint64_t duplicates;
+    /** Reliable packets given up on, and packets the socket failed to send */
+    uint64_t drops;
+    /** Received packets which could not be parsed */
+    uint64_t malformed;
+    /** Datagrams the kernel dropped because the socket's receive queue was
+     *  full, counted from the datagrams received since, with
+     *  hazel_udp_socket_set_drop_counting() */
+    uint64_t kernel_drops;
+
+    uint64_t rtt_histogram[HAZEL_UDP_STATS_RTT_BUCKETS];
+} hazel_udp_stats;
+
+#define HAZEL_UDP_STATS_ADD(counter, amount)                                 \
+    atomic_fetch_add_explicit(&(counter), (amount), memory_order_relaxed)
+
+void hazel_udp_connection_stats_init(hazel_udp_connection_stats *stats);
+
+/**
+ * \brief Copy the live counters of \p stats into \p out.
+ */
+void hazel_udp_connection_stats_copy(const hazel_udp_connection_stats *stats,
+                                     hazel_udp_stats *out);
+
+void hazel_udp_connection_stats_record_rtt(hazel_udp_connection_stats *stats,
+                                           uint64_t rtt_us);
+
+/**
+ * \return The histogram bucket \p rtt_us falls in
+ */
+size_t hazel_udp_stats_rtt_bucket(uint64_t rtt_us);
+
+/**
+ * \return The smallest round trip time counted in \p bucket, in microseconds
+ */
+uint64_t hazel_udp_stats_rtt_bucket_floor(size_t bucket);
+
+/**
+ * \return The round trip time below which \p percentile (0 to 100) of the
+ *         samples fall, to the precision of a bucket, or \c 0 without
+ *         samples
+ */
+uint64_t hazel_udp_stats_rtt_percentile(const hazel_udp_stats *stats,
+                                        double percentile);
+
+/** @}*/
@@ -2,6 +2,7 @@
 
 #include "hazel/common.h"
 #include "hazel/errors.h"
+#include "hazel/primitive_api.h"
 #include "hazel/send_option.h"
 
 #include <stdint.h>
@@ -26,6 +27,13 @@ typedef struct hazel_message_writer
 
     enum hazel_send_option send_option;
 
+    /**
+     * Compress the payload when it is sent over a connection with
+     * compression enabled, see hazel_udp_connection_set_compression().
+     * Kept across hazel_message_writer_clear().
+     */
+    bool compress;
+
     hazel_message_writer_message_start *_start_head;
 
     size_t _buffer_size;
@@ -53,6 +61,7 @@ int hazel_message_writer_to_bytes(hazel_message_writer *writer, uint8_t *buffer,
                                   size_t buffer_size, bool include_header,
                                   size_t *out_size);
 
+HAZEL_PRIMITIVE_API
 size_t hazel_message_writer_remaining(hazel_message_writer *writer);
 
 int hazel_message_writer_start_message(hazel_message_writer *writer,
@@ -63,30 +72,49 @@ int hazel_message_writer_cancel_message(hazel_message_writer *writer);
 int hazel_message_writer_clear(hazel_message_writer *writer,
                                enum hazel_send_option send_option);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_bool(hazel_message_writer *writer, bool value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_uint8(hazel_message_writer *writer, uint8_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_uint16(hazel_message_writer *writer, uint16_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_int16(hazel_message_writer *writer, int16_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_uint32(hazel_message_writer *writer, uint32_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_int32(hazel_message_writer *writer, int32_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_uint64(hazel_message_writer *writer, uint64_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_int64(hazel_message_writer *writer, int64_t value);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_packed_uint32(hazel_message_writer *writer,
                                        uint32_t value);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_packed_int32(hazel_message_writer *writer,
                                       int32_t value);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_single(hazel_message_writer *writer, float value);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_string(hazel_message_writer *writer,
                                 const char *string);
 
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_bytes(hazel_message_writer *writer,
                                const uint8_t *buffer, size_t offset,
                                size_t length);
+HAZEL_PRIMITIVE_API
 int hazel_message_writer_bytes_and_size(hazel_message_writer *writer,
                                         const uint8_t *buffer, size_t offset, 
                                         size_t length);
 
-/** @}*/
+#if defined(HAZEL_CONFIG_INLINE_PRIMITIVES) \
+    && !defined(HAZEL_PRIMITIVES_IMPLEMENTATION)
+#   include "hazel/impl/writer_primitives.h"
+#endif
+
+/** @}*/
\ No newline at end of file
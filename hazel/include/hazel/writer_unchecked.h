@@ -0,0 +1,161 @@
+#pragma once
+
+#include "hazel/writer.h"
+
+#include <string.h>
+
+/** \addtogroup Writer
+ * @{
+ */
+
+/**
+ * \name Unchecked accessors
+ *
+ * Inline writers which skip the capacity check and the size bookkeeping done
+ * by the regular writer functions. The caller reserves room for a whole run
+ * of fields up front with hazel_message_writer_reserve(), writes them, and
+ * then calls hazel_message_writer_commit_unchecked() once.
+ * @{
+ */
+
+/**
+ * \return true if at least \p amount bytes can be written at the current
+ *         position.
+ */
+static inline bool hazel_message_writer_reserve(hazel_message_writer *writer,
+                                                size_t amount)
+{
+    return writer->_buffer_size - writer->position >= amount;
+}
+
+/**
+ * Update the writer's size after a run of unchecked writes.
+ */
+static inline void hazel_message_writer_commit_unchecked(
+    hazel_message_writer *writer)
+{
+    if (writer->position > writer->size)
+    {
+        writer->size = writer->position;
+    }
+}
+
+static inline uint8_t *hazel_message_writer_advance_unchecked(
+    hazel_message_writer *writer, size_t amount)
+{
+    uint8_t *p = writer->data + writer->position;
+    writer->position += amount;
+    return p;
+}
+
+static inline void hazel_message_writer_uint8_unchecked(
+    hazel_message_writer *writer, uint8_t value)
+{
+    writer->data[writer->position++] = value;
+}
+
+static inline void hazel_message_writer_bool_unchecked(
+    hazel_message_writer *writer, bool value)
+{
+    hazel_message_writer_uint8_unchecked(writer, value ? 1 : 0);
+}
+
+static inline void hazel_message_writer_uint16_unchecked(
+    hazel_message_writer *writer, uint16_t value)
+{
+    uint8_t *p = hazel_message_writer_advance_unchecked(writer,
+                                                        sizeof(uint16_t));
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void hazel_message_writer_int16_unchecked(
+    hazel_message_writer *writer, int16_t value)
+{
+    hazel_message_writer_uint16_unchecked(writer, (uint16_t)value);
+}
+
+static inline void hazel_message_writer_uint32_unchecked(
+    hazel_message_writer *writer, uint32_t value)
+{
+    uint8_t *p = hazel_message_writer_advance_unchecked(writer,
+                                                        sizeof(uint32_t));
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static inline void hazel_message_writer_int32_unchecked(
+    hazel_message_writer *writer, int32_t value)
+{
+    hazel_message_writer_uint32_unchecked(writer, (uint32_t)value);
+}
+
+static inline void hazel_message_writer_uint64_unchecked(
+    hazel_message_writer *writer, uint64_t value)
+{
+    hazel_message_writer_uint32_unchecked(writer, (uint32_t)value);
+    hazel_message_writer_uint32_unchecked(writer, (uint32_t)(value >> 32));
+}
+
+static inline void hazel_message_writer_int64_unchecked(
+    hazel_message_writer *writer, int64_t value)
+{
+    hazel_message_writer_uint64_unchecked(writer, (uint64_t)value);
+}
+
+static inline void hazel_message_writer_single_unchecked(
+    hazel_message_writer *writer, float value)
+{
+    memcpy(hazel_message_writer_advance_unchecked(writer, sizeof(float)),
+           &value, sizeof(float));
+}
+
+/**
+ * Writes a packed integer, which takes at most 5 bytes.
+ */
+static inline void hazel_message_writer_packed_uint32_unchecked(
+    hazel_message_writer *writer, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        hazel_message_writer_uint8_unchecked(writer,
+                                             (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    hazel_message_writer_uint8_unchecked(writer, (uint8_t)value);
+}
+
+static inline void hazel_message_writer_packed_int32_unchecked(
+    hazel_message_writer *writer, int32_t value)
+{
+    hazel_message_writer_packed_uint32_unchecked(writer, (uint32_t)value);
+}
+
+/**
+ * Start a message without going through the writer's message stack.
+ *
+ * \return The start position, to pass to
+ *         hazel_message_writer_end_message_unchecked()
+ */
+static inline size_t hazel_message_writer_start_message_unchecked(
+    hazel_message_writer *writer, uint8_t tag)
+{
+    size_t start = writer->position;
+    uint8_t *p = hazel_message_writer_advance_unchecked(writer, 3);
+    p[2] = tag;
+    return start;
+}
+
+static inline void hazel_message_writer_end_message_unchecked(
+    hazel_message_writer *writer, size_t start)
+{
+    uint16_t length = (uint16_t)(writer->position - start - 3);
+    writer->data[start] = (uint8_t)length;
+    writer->data[start + 1] = (uint8_t)(length >> 8);
+}
+
+/** @}*/
+
+/** @}*/
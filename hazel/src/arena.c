@@ -0,0 +1,118 @@
+#include "hazel/arena.h"
+
+#include <stdlib.h>
+
+#define HAZEL_ARENA_ALIGNMENT 16
+#define HAZEL_ARENA_ALIGN(size) \
+    (((size) + (HAZEL_ARENA_ALIGNMENT - 1)) & ~(size_t)(HAZEL_ARENA_ALIGNMENT - 1))
+
+typedef struct hazel_arena_chunk
+{
+    struct hazel_arena_chunk *next;
+
+    size_t size;
+    size_t used;
+
+    _Alignas(HAZEL_ARENA_ALIGNMENT) uint8_t data[];
+} hazel_arena_chunk;
+
+static hazel_arena_chunk *hazel_arena_chunk_new(size_t size)
+{
+    hazel_arena_chunk *chunk = malloc(sizeof(hazel_arena_chunk) + size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+int hazel_arena_init(hazel_arena *arena, size_t chunk_size)
+{
+    if (chunk_size == 0)
+    {
+        chunk_size = HAZEL_ARENA_DEFAULT_CHUNK_SIZE;
+    }
+
+    arena->chunk_size = HAZEL_ARENA_ALIGN(chunk_size);
+    arena->_head = hazel_arena_chunk_new(arena->chunk_size);
+    arena->_current = arena->_head;
+
+    if (arena->_head == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    return 0;
+}
+
+void hazel_arena_free(hazel_arena *arena)
+{
+    hazel_arena_chunk *chunk = arena->_head;
+    while (chunk != NULL)
+    {
+        hazel_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    arena->_head = NULL;
+    arena->_current = NULL;
+}
+
+void *hazel_arena_alloc(hazel_arena *arena, size_t size)
+{
+    size = HAZEL_ARENA_ALIGN(size);
+
+    hazel_arena_chunk *chunk = arena->_current;
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+
+    if (chunk->size - chunk->used < size)
+    {
+        // Chunks after the current one are left over from before the last
+        // reset, so their contents are dead and they can be rewound as we
+        // step into them.
+        hazel_arena_chunk *next = chunk->next;
+        if (next == NULL || next->size < size)
+        {
+            size_t chunk_size = size > arena->chunk_size
+                ? size
+                : arena->chunk_size;
+
+            hazel_arena_chunk *fresh = hazel_arena_chunk_new(chunk_size);
+            if (fresh == NULL)
+            {
+                return NULL;
+            }
+
+            fresh->next = next;
+            chunk->next = fresh;
+            next = fresh;
+        }
+
+        next->used = 0;
+        arena->_current = chunk = next;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void hazel_arena_reset(hazel_arena *arena)
+{
+    if (arena->_head == NULL)
+    {
+        return;
+    }
+
+    arena->_head->used = 0;
+    arena->_current = arena->_head;
+}
@@ -0,0 +1,379 @@
+#include "hazel/bits.h"
+
+#include <string.h>
+
+#define HAZEL_BIT_MASK(bits) ((((uint64_t)1) << (bits)) - 1)
+
+uint8_t hazel_bit_quantize_bits(float min, float max, float precision)
+{
+    if (!(max > min) || !(precision > 0.0f))
+    {
+        return 1;
+    }
+
+    double range = ((double)max - (double)min) / (double)precision;
+    if (range >= 4294967295.0)
+    {
+        return 32;
+    }
+
+    uint64_t steps = (uint64_t)range;
+    if ((double)steps < range)
+    {
+        steps++;
+    }
+
+    uint8_t bits = 1;
+    while (bits < 32 && HAZEL_BIT_MASK(bits) < steps)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+uint16_t hazel_bit_float_to_half(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+
+    uint16_t sign = (uint16_t)((f >> 16) & 0x8000);
+    uint32_t float_exp = (f >> 23) & 0xFF;
+    uint32_t mant = f & 0x7FFFFF;
+
+    if (float_exp == 0xFF)
+    {
+        // Infinity stays infinity, NaN stays a (quiet) NaN
+        return sign | 0x7C00 | (mant != 0 ? 0x200 : 0);
+    }
+
+    int32_t exp = (int32_t)float_exp - 127 + 15;
+    if (exp >= 31)
+    {
+        return sign | 0x7C00;
+    }
+
+    if (exp <= 0)
+    {
+        if (exp < -10)
+        {
+            return sign;
+        }
+
+        // Subnormal half, shift the implicit bit into the mantissa
+        mant |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exp);
+        uint32_t half_mant = mant >> shift;
+        uint32_t remainder = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway
+            || (remainder == halfway && (half_mant & 1)))
+        {
+            half_mant++;
+        }
+        return sign | (uint16_t)half_mant;
+    }
+
+    uint16_t half = sign | (uint16_t)(exp << 10) | (uint16_t)(mant >> 13);
+
+    // Round to nearest even, a carry out of the mantissa correctly bumps the
+    // exponent (up to infinity).
+    uint32_t remainder = mant & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+    return half;
+}
+
+float hazel_bit_half_to_float(uint16_t value)
+{
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exp = (value >> 10) & 0x1F;
+    uint32_t mant = value & 0x3FF;
+    uint32_t f;
+
+    if (exp == 0)
+    {
+        if (mant == 0)
+        {
+            f = sign;
+        }
+        else
+        {
+            exp = 1;
+            while (!(mant & 0x400))
+            {
+                mant <<= 1;
+                exp--;
+            }
+            mant &= 0x3FF;
+            f = sign | ((exp + 112) << 23) | (mant << 13);
+        }
+    }
+    else if (exp == 31)
+    {
+        f = sign | 0x7F800000 | (mant << 13);
+    }
+    else
+    {
+        f = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
+}
+
+void hazel_bit_writer_init(hazel_bit_writer *bit_writer,
+                           hazel_message_writer *writer)
+{
+    bit_writer->writer = writer;
+    bit_writer->_scratch = 0;
+    bit_writer->_scratch_bits = 0;
+}
+
+int hazel_bit_writer_bits(hazel_bit_writer *bit_writer, uint32_t value,
+                          uint8_t bits)
+{
+    if (bits == 0 || bits > 32)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    bit_writer->_scratch |= (value & HAZEL_BIT_MASK(bits))
+        << bit_writer->_scratch_bits;
+    bit_writer->_scratch_bits += bits;
+
+    if (bit_writer->_scratch_bits >= 32)
+    {
+        int ret = hazel_message_writer_uint32(bit_writer->writer,
+                                              (uint32_t)bit_writer->_scratch);
+        if (ret != 0)
+        {
+            bit_writer->_scratch_bits -= bits;
+            bit_writer->_scratch &= HAZEL_BIT_MASK(bit_writer->_scratch_bits);
+            return ret;
+        }
+
+        bit_writer->_scratch >>= 32;
+        bit_writer->_scratch_bits -= 32;
+    }
+
+    return 0;
+}
+
+int hazel_bit_writer_bool(hazel_bit_writer *bit_writer, bool value)
+{
+    return hazel_bit_writer_bits(bit_writer, value ? 1 : 0, 1);
+}
+
+int hazel_bit_writer_signed(hazel_bit_writer *bit_writer, int32_t value,
+                            uint8_t bits)
+{
+    // Zigzag, so small negative values only need a few bits
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    return hazel_bit_writer_bits(bit_writer, zigzag, bits);
+}
+
+int hazel_bit_writer_quantized(hazel_bit_writer *bit_writer, float value,
+                               float min, float max, float precision)
+{
+    uint8_t bits = hazel_bit_quantize_bits(min, max, precision);
+    uint32_t max_value = (uint32_t)HAZEL_BIT_MASK(bits);
+
+    if (!(value > min))
+    {
+        value = min;
+    }
+    else if (value > max)
+    {
+        value = max;
+    }
+
+    double normalized = ((double)value - (double)min)
+        / ((double)max - (double)min);
+    uint32_t quantized = (uint32_t)(normalized * max_value + 0.5);
+
+    return hazel_bit_writer_bits(bit_writer, quantized, bits);
+}
+
+int hazel_bit_writer_half(hazel_bit_writer *bit_writer, float value)
+{
+    return hazel_bit_writer_bits(bit_writer, hazel_bit_float_to_half(value),
+                                 16);
+}
+
+int hazel_bit_writer_flush(hazel_bit_writer *bit_writer)
+{
+    if (bit_writer->_scratch_bits == 0)
+    {
+        return 0;
+    }
+
+    uint8_t bytes[4];
+    size_t length = (bit_writer->_scratch_bits + 7) / 8;
+    for (size_t i = 0; i < length; i++)
+    {
+        bytes[i] = (uint8_t)(bit_writer->_scratch >> (i * 8));
+    }
+
+    int ret = hazel_message_writer_bytes(bit_writer->writer, bytes, 0, length);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    bit_writer->_scratch = 0;
+    bit_writer->_scratch_bits = 0;
+    return 0;
+}
+
+int hazel_bit_writer_start_message(hazel_bit_writer *bit_writer, uint8_t tag)
+{
+    int ret = hazel_bit_writer_flush(bit_writer);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return hazel_message_writer_start_message(bit_writer->writer, tag);
+}
+
+int hazel_bit_writer_end_message(hazel_bit_writer *bit_writer)
+{
+    int ret = hazel_bit_writer_flush(bit_writer);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return hazel_message_writer_end_message(bit_writer->writer);
+}
+
+void hazel_bit_reader_init(hazel_bit_reader *bit_reader,
+                           hazel_message_reader *reader)
+{
+    bit_reader->reader = reader;
+    bit_reader->_scratch = 0;
+    bit_reader->_scratch_bits = 0;
+}
+
+static void hazel_bit_reader_refill(hazel_bit_reader *bit_reader)
+{
+    hazel_message_reader *reader = bit_reader->reader;
+
+    if (bit_reader->_scratch_bits <= 32
+        && hazel_message_reader_has_remaining(reader, sizeof(uint32_t)))
+    {
+        uint32_t word = 0;
+        hazel_message_reader_uint32(reader, &word);
+        bit_reader->_scratch |= (uint64_t)word << bit_reader->_scratch_bits;
+        bit_reader->_scratch_bits += 32;
+        return;
+    }
+
+    // Tail of the buffer, or not enough room in the scratch word for a whole
+    // word, fall back to single bytes.
+    uint8_t byte;
+    while (bit_reader->_scratch_bits <= 56
+           && hazel_message_reader_uint8(reader, &byte) == 0)
+    {
+        bit_reader->_scratch |= (uint64_t)byte << bit_reader->_scratch_bits;
+        bit_reader->_scratch_bits += 8;
+    }
+}
+
+int hazel_bit_reader_bits(hazel_bit_reader *bit_reader, uint8_t bits,
+                          uint32_t *result)
+{
+    if (bits == 0 || bits > 32)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    if (bit_reader->_scratch_bits < bits)
+    {
+        hazel_bit_reader_refill(bit_reader);
+        if (bit_reader->_scratch_bits < bits)
+        {
+            return HAZEL_READER_CAPACITY_EXCEEDED;
+        }
+    }
+
+    *result = (uint32_t)(bit_reader->_scratch & HAZEL_BIT_MASK(bits));
+    bit_reader->_scratch >>= bits;
+    bit_reader->_scratch_bits -= bits;
+    return 0;
+}
+
+int hazel_bit_reader_bool(hazel_bit_reader *bit_reader, bool *result)
+{
+    uint32_t value;
+    int ret = hazel_bit_reader_bits(bit_reader, 1, &value);
+    if (ret == 0)
+    {
+        *result = value != 0;
+    }
+    return ret;
+}
+
+int hazel_bit_reader_signed(hazel_bit_reader *bit_reader, uint8_t bits,
+                            int32_t *result)
+{
+    uint32_t zigzag;
+    int ret = hazel_bit_reader_bits(bit_reader, bits, &zigzag);
+    if (ret == 0)
+    {
+        *result = (int32_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    }
+    return ret;
+}
+
+int hazel_bit_reader_quantized(hazel_bit_reader *bit_reader, float min,
+                               float max, float precision, float *result)
+{
+    uint8_t bits = hazel_bit_quantize_bits(min, max, precision);
+    uint32_t max_value = (uint32_t)HAZEL_BIT_MASK(bits);
+
+    uint32_t quantized;
+    int ret = hazel_bit_reader_bits(bit_reader, bits, &quantized);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    *result = (float)((double)min
+        + ((double)max - (double)min) * quantized / max_value);
+    return 0;
+}
+
+int hazel_bit_reader_half(hazel_bit_reader *bit_reader, float *result)
+{
+    uint32_t half;
+    int ret = hazel_bit_reader_bits(bit_reader, 16, &half);
+    if (ret == 0)
+    {
+        *result = hazel_bit_half_to_float((uint16_t)half);
+    }
+    return ret;
+}
+
+void hazel_bit_reader_align(hazel_bit_reader *bit_reader)
+{
+    uint32_t unread_bytes = bit_reader->_scratch_bits / 8;
+    if (unread_bytes > 0)
+    {
+        hazel_message_reader_set_position(
+            bit_reader->reader,
+            hazel_message_reader_get_position(bit_reader->reader)
+                - unread_bytes);
+    }
+
+    bit_reader->_scratch = 0;
+    bit_reader->_scratch_bits = 0;
+}
+
+int hazel_bit_reader_read_message(hazel_bit_reader *bit_reader,
+                                  hazel_message_reader *output)
+{
+    hazel_bit_reader_align(bit_reader);
+    return hazel_message_reader_read_message(bit_reader->reader, output);
+}
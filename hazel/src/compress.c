@@ -0,0 +1,331 @@
+#include "hazel/compress.h"
+
+#include <string.h>
+
+#define HAZEL_COMPRESS_MIN_MATCH 4
+
+// The dictionary and the input form one virtual stream, positions below
+// dictionary_size are in the dictionary.
+typedef struct hazel_compress_stream
+{
+    const uint8_t *dictionary;
+    size_t dictionary_size;
+    const uint8_t *data;
+} hazel_compress_stream;
+
+static inline uint8_t hazel_compress_stream_at(hazel_compress_stream *stream,
+                                               size_t position)
+{
+    return position < stream->dictionary_size
+        ? stream->dictionary[position]
+        : stream->data[position - stream->dictionary_size];
+}
+
+static inline uint32_t hazel_compress_stream_read32(
+    hazel_compress_stream *stream, size_t position)
+{
+    if (position >= stream->dictionary_size)
+    {
+        uint32_t value;
+        memcpy(&value, stream->data + position - stream->dictionary_size,
+               sizeof(value));
+        return value;
+    }
+
+    uint8_t bytes[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        bytes[i] = hazel_compress_stream_at(stream, position + i);
+    }
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hazel_compress_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - HAZEL_COMPRESS_HASH_BITS);
+}
+
+size_t hazel_compress_bound(size_t input_size)
+{
+    return input_size + input_size / 255 + 16;
+}
+
+static int hazel_compress_put_length(uint8_t *output, size_t capacity,
+                                     size_t *op, size_t length)
+{
+    while (length >= 255)
+    {
+        if (*op >= capacity)
+        {
+            return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+        }
+        output[(*op)++] = 255;
+        length -= 255;
+    }
+    if (*op >= capacity)
+    {
+        return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+    }
+    output[(*op)++] = (uint8_t)length;
+    return 0;
+}
+
+static int hazel_compress_emit(uint8_t *output, size_t capacity, size_t *op,
+                               const uint8_t *literals, size_t literal_length,
+                               size_t offset, size_t match_length)
+{
+    int ret;
+
+    if (*op >= capacity)
+    {
+        return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+    }
+
+    size_t match_code = match_length != 0
+        ? match_length - HAZEL_COMPRESS_MIN_MATCH
+        : 0;
+    uint8_t token = (uint8_t)(((literal_length < 15 ? literal_length : 15) << 4)
+        | (match_code < 15 ? match_code : 15));
+    output[(*op)++] = token;
+
+    if (literal_length >= 15
+        && (ret = hazel_compress_put_length(output, capacity, op,
+                                            literal_length - 15)) != 0)
+    {
+        return ret;
+    }
+
+    if (capacity - *op < literal_length)
+    {
+        return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+    }
+    memcpy(output + *op, literals, literal_length);
+    *op += literal_length;
+
+    if (match_length == 0)
+    {
+        return 0;
+    }
+
+    if (capacity - *op < 2)
+    {
+        return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+    }
+    output[(*op)++] = (uint8_t)offset;
+    output[(*op)++] = (uint8_t)(offset >> 8);
+
+    if (match_code >= 15
+        && (ret = hazel_compress_put_length(output, capacity, op,
+                                            match_code - 15)) != 0)
+    {
+        return ret;
+    }
+
+    return 0;
+}
+
+void hazel_compress_dictionary_init(hazel_compress_dictionary *dictionary,
+                                    const uint8_t *data, size_t size)
+{
+    if (data == NULL)
+    {
+        size = 0;
+    }
+    if (size > HAZEL_COMPRESS_MAX_OFFSET)
+    {
+        data += size - HAZEL_COMPRESS_MAX_OFFSET;
+        size = HAZEL_COMPRESS_MAX_OFFSET;
+    }
+
+    dictionary->data = data;
+    dictionary->size = size;
+    memset(dictionary->table, 0, sizeof(dictionary->table));
+
+    for (size_t pos = 0; pos + HAZEL_COMPRESS_MIN_MATCH <= size; pos++)
+    {
+        uint32_t value;
+        memcpy(&value, data + pos, sizeof(value));
+        dictionary->table[hazel_compress_hash(value)] = (uint32_t)pos + 1;
+    }
+}
+
+int hazel_compress(const hazel_compress_dictionary *dictionary,
+                   const uint8_t *input, size_t input_size,
+                   uint8_t *output, size_t output_capacity, size_t *out_size)
+{
+    int ret;
+
+    size_t dictionary_size = dictionary != NULL ? dictionary->size : 0;
+    hazel_compress_stream stream = {
+        .dictionary = dictionary != NULL ? dictionary->data : NULL,
+        .dictionary_size = dictionary_size,
+        .data = input
+    };
+
+    // Matches update the table, so each call works on its own copy
+    uint32_t table[HAZEL_COMPRESS_HASH_SIZE];
+    if (dictionary != NULL)
+    {
+        memcpy(table, dictionary->table, sizeof(table));
+    }
+    else
+    {
+        memset(table, 0, sizeof(table));
+    }
+
+    size_t total = dictionary_size + input_size;
+    size_t op = 0;
+    size_t anchor = dictionary_size;
+    size_t pos = dictionary_size;
+
+    while (pos + HAZEL_COMPRESS_MIN_MATCH <= total)
+    {
+        uint32_t sequence = hazel_compress_stream_read32(&stream, pos);
+        uint32_t hash = hazel_compress_hash(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)pos + 1;
+
+        if (candidate == 0
+            || pos - (candidate - 1) > HAZEL_COMPRESS_MAX_OFFSET
+            || hazel_compress_stream_read32(&stream, candidate - 1)
+                != sequence)
+        {
+            pos++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = HAZEL_COMPRESS_MIN_MATCH;
+        while (pos + length < total
+               && hazel_compress_stream_at(&stream, match + length)
+                   == hazel_compress_stream_at(&stream, pos + length))
+        {
+            length++;
+        }
+
+        if ((ret = hazel_compress_emit(
+                 output, output_capacity, &op,
+                 input + (anchor - dictionary_size), pos - anchor,
+                 pos - match, length)) != 0)
+        {
+            return ret;
+        }
+
+        pos += length;
+        anchor = pos;
+    }
+
+    if ((ret = hazel_compress_emit(output, output_capacity, &op,
+                                   input + (anchor - dictionary_size),
+                                   total - anchor, 0, 0)) != 0)
+    {
+        return ret;
+    }
+
+    *out_size = op;
+    return 0;
+}
+
+static int hazel_decompress_get_length(const uint8_t *input, size_t input_size,
+                                       size_t *ip, size_t *length)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip >= input_size)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+        b = input[(*ip)++];
+        *length += b;
+    } while (b == 255);
+    return 0;
+}
+
+int hazel_decompress(const uint8_t *dictionary, size_t dictionary_size,
+                     const uint8_t *input, size_t input_size,
+                     uint8_t *output, size_t output_capacity,
+                     size_t *out_size)
+{
+    if (dictionary == NULL)
+    {
+        dictionary_size = 0;
+    }
+    if (dictionary_size > HAZEL_COMPRESS_MAX_OFFSET)
+    {
+        dictionary += dictionary_size - HAZEL_COMPRESS_MAX_OFFSET;
+        dictionary_size = HAZEL_COMPRESS_MAX_OFFSET;
+    }
+
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < input_size)
+    {
+        uint8_t token = input[ip++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15
+            && hazel_decompress_get_length(input, input_size, &ip,
+                                           &literal_length) != 0)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+
+        if (input_size - ip < literal_length)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+        if (output_capacity - op < literal_length)
+        {
+            return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+        }
+        memcpy(output + op, input + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == input_size)
+        {
+            break;
+        }
+
+        if (input_size - ip < 2)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+        size_t offset = input[ip] | (input[ip + 1] << 8);
+        ip += 2;
+
+        size_t match_length = (token & 0x0F);
+        if (match_length == 15
+            && hazel_decompress_get_length(input, input_size, &ip,
+                                           &match_length) != 0)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+        match_length += HAZEL_COMPRESS_MIN_MATCH;
+
+        if (offset == 0 || offset > dictionary_size + op)
+        {
+            return HAZEL_COMPRESS_MALFORMED_INPUT;
+        }
+        if (output_capacity - op < match_length)
+        {
+            return HAZEL_COMPRESS_INSUFFICIENT_BUFFER;
+        }
+
+        // Byte by byte, as matches may overlap the bytes they produce
+        size_t source = dictionary_size + op - offset;
+        for (size_t i = 0; i < match_length; i++, source++)
+        {
+            output[op++] = source < dictionary_size
+                ? dictionary[source]
+                : output[source - dictionary_size];
+        }
+    }
+
+    *out_size = op;
+    return 0;
+}
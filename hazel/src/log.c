@@ -0,0 +1,559 @@
+#include "hazel/log.h"
+#include "hazel/spsc_ring.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HAZEL_LOG_MESSAGE_SIZE 512
+
+typedef struct hazel_log_record
+{
+    uint64_t timestamp_ns;
+    const char *file;
+    const char *format;
+    int line;
+    uint8_t level;
+    bool is_bytes;
+    uint8_t arg_count;
+    union {
+        uint64_t args[HAZEL_LOG_MAX_ARGS];
+        struct {
+            uint32_t size;
+            uint8_t data[HAZEL_LOG_MAX_BYTES];
+        } bytes;
+    } payload;
+} hazel_log_record;
+
+typedef struct hazel_log_thread_ring
+{
+    hazel_spsc_ring ring;
+    atomic_uint_least64_t dropped;
+    struct hazel_log_thread_ring *next;
+} hazel_log_thread_ring;
+
+// Rings are created on a thread's first log statement. When the thread
+// exits, its ring is drained, unlinked under the drain lock and freed
+static _Atomic(hazel_log_thread_ring *) hazel_log_rings = NULL;
+static pthread_key_t hazel_log_ring_key;
+// Drops counted by rings which were freed since
+static atomic_uint_least64_t hazel_log_freed_dropped = 0;
+static _Thread_local hazel_log_thread_ring *hazel_log_local_ring = NULL;
+static _Thread_local bool hazel_log_local_failed = false;
+// Set while this thread drains, so a sink which logs cannot drain again
+static _Thread_local bool hazel_log_local_draining = false;
+static pthread_once_t hazel_log_setup_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t hazel_log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static hazel_log_sink hazel_log_current_sink = NULL;
+static void *hazel_log_sink_user_data = NULL;
+
+static pthread_t hazel_log_thread;
+static atomic_bool hazel_log_thread_running = false;
+static int hazel_log_thread_interval_ms;
+
+static const char *hazel_log_level_name(enum hazel_log_level level)
+{
+    switch (level)
+    {
+    case HAZEL_LOG_LEVEL_ERROR:
+        return "error";
+    case HAZEL_LOG_LEVEL_WARN:
+        return "warn";
+    case HAZEL_LOG_LEVEL_INFO:
+        return "info";
+    case HAZEL_LOG_LEVEL_DEBUG:
+        return "debug";
+    case HAZEL_LOG_LEVEL_TRACE:
+        return "trace";
+    default:
+        return "?";
+    }
+}
+
+static void hazel_log_default_sink(enum hazel_log_level level,
+                                   uint64_t timestamp_ns, const char *file,
+                                   int line, const char *message,
+                                   void *user_data)
+{
+    (void)timestamp_ns;
+    (void)user_data;
+    fprintf(stderr, "[%s %s:%d] %s\n", hazel_log_level_name(level), file,
+            line, message);
+}
+
+static void hazel_log_drain_at_exit(void)
+{
+    hazel_log_drain();
+}
+
+/**
+ * Destructor of a thread's ring, run as the thread exits.
+ */
+static void hazel_log_free_ring(void *arg)
+{
+    hazel_log_thread_ring *ring = arg;
+    hazel_log_drain();
+
+    pthread_mutex_lock(&hazel_log_drain_lock);
+    // Rings are only pushed at the head, everything else changes under the
+    // lock
+    hazel_log_thread_ring *head = ring;
+    if (!atomic_compare_exchange_strong(&hazel_log_rings, &head, ring->next))
+    {
+        hazel_log_thread_ring *previous = head;
+        while (previous->next != ring)
+        {
+            previous = previous->next;
+        }
+        previous->next = ring->next;
+    }
+    atomic_fetch_add_explicit(
+        &hazel_log_freed_dropped,
+        atomic_load_explicit(&ring->dropped, memory_order_relaxed),
+        memory_order_relaxed);
+    pthread_mutex_unlock(&hazel_log_drain_lock);
+
+    hazel_spsc_ring_free(&ring->ring);
+    free(ring);
+    // A later destructor which logs gets a new ring
+    hazel_log_local_ring = NULL;
+}
+
+static void hazel_log_setup(void)
+{
+    pthread_key_create(&hazel_log_ring_key, hazel_log_free_ring);
+    atexit(hazel_log_drain_at_exit);
+}
+
+static hazel_log_thread_ring *hazel_log_get_ring(void)
+{
+    if (hazel_log_local_ring != NULL || hazel_log_local_failed)
+    {
+        return hazel_log_local_ring;
+    }
+
+    pthread_once(&hazel_log_setup_once, hazel_log_setup);
+
+    // With the alignment of its type rather than assuming malloc()'s. The
+    // size of a type is a multiple of its alignment, as aligned_alloc()
+    // requires.
+    hazel_log_thread_ring *ring = aligned_alloc(
+        _Alignof(hazel_log_thread_ring), sizeof(hazel_log_thread_ring));
+    if (ring == NULL
+        || hazel_spsc_ring_init(&ring->ring, sizeof(hazel_log_record),
+                                HAZEL_LOG_RING_CAPACITY) != 0)
+    {
+        free(ring);
+        hazel_log_local_failed = true;
+        return NULL;
+    }
+    atomic_init(&ring->dropped, 0);
+
+    ring->next = atomic_load(&hazel_log_rings);
+    while (!atomic_compare_exchange_weak(&hazel_log_rings, &ring->next, ring))
+    {
+    }
+
+    hazel_log_local_ring = ring;
+    pthread_setspecific(hazel_log_ring_key, ring);
+    return ring;
+}
+
+static hazel_log_record *hazel_log_acquire(enum hazel_log_level level,
+                                           const char *file, int line)
+{
+    hazel_log_thread_ring *ring = hazel_log_get_ring();
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+
+    hazel_log_record *record = hazel_spsc_ring_acquire(&ring->ring);
+    if (record == NULL && !hazel_log_local_draining)
+    {
+        // Nothing drained in time, make room rather than drop
+        hazel_log_drain();
+        record = hazel_spsc_ring_acquire(&ring->ring);
+    }
+    if (record == NULL)
+    {
+        atomic_store_explicit(
+            &ring->dropped,
+            atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record->file = file;
+    record->line = line;
+    record->level = (uint8_t)level;
+    return record;
+}
+
+/**
+ * Publish the record of hazel_log_acquire(). Without a drain thread, errors
+ * are drained right away so they are not lost if nothing else drains.
+ */
+static void hazel_log_commit(enum hazel_log_level level)
+{
+    hazel_spsc_ring_commit(&hazel_log_local_ring->ring);
+
+    if (level == HAZEL_LOG_LEVEL_ERROR && !hazel_log_local_draining
+        && !atomic_load_explicit(&hazel_log_thread_running,
+                                 memory_order_relaxed))
+    {
+        hazel_log_drain();
+    }
+}
+
+void hazel_log_write(enum hazel_log_level level, const char *file, int line,
+                     const char *format, size_t arg_count,
+                     const uint64_t *args)
+{
+    hazel_log_record *record = hazel_log_acquire(level, file, line);
+    if (record == NULL)
+    {
+        return;
+    }
+
+    if (arg_count > HAZEL_LOG_MAX_ARGS)
+    {
+        arg_count = HAZEL_LOG_MAX_ARGS;
+    }
+    record->is_bytes = false;
+    record->format = format;
+    record->arg_count = (uint8_t)arg_count;
+    if (arg_count > 0)
+    {
+        memcpy(record->payload.args, args, arg_count * sizeof(uint64_t));
+    }
+
+    hazel_log_commit(level);
+}
+
+void hazel_log_write_bytes(enum hazel_log_level level, const char *file,
+                           int line, const char *tag, const uint8_t *bytes,
+                           size_t size)
+{
+    hazel_log_record *record = hazel_log_acquire(level, file, line);
+    if (record == NULL)
+    {
+        return;
+    }
+
+    size_t kept = size < HAZEL_LOG_MAX_BYTES ? size : HAZEL_LOG_MAX_BYTES;
+    record->is_bytes = true;
+    record->format = tag;
+    record->arg_count = 0;
+    record->payload.bytes.size = (uint32_t)size;
+    memcpy(record->payload.bytes.data, bytes, kept);
+
+    hazel_log_commit(level);
+}
+
+static size_t hazel_log_append(size_t size, size_t n, int written)
+{
+    if (written < 0)
+    {
+        return n;
+    }
+    return n + (size_t)written < size ? n + (size_t)written : size - 1;
+}
+
+size_t hazel_log_format(char *out, size_t size, const char *format,
+                        const uint64_t *args, size_t arg_count)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    size_t n = 0;
+    size_t arg = 0;
+    const char *p = format;
+
+    while (*p != '\0' && n + 1 < size)
+    {
+        if (*p != '%')
+        {
+            out[n++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out[n++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Keep flags, width and precision, and rebuild the length modifier
+        const char *start = p++;
+        while (*p != '\0' && strchr("-+ #0", *p) != NULL)
+        {
+            p++;
+        }
+        while ((*p >= '0' && *p <= '9') || *p == '.')
+        {
+            p++;
+        }
+        const char *modifier = p;
+        while (*p != '\0' && strchr("hlLjzt", *p) != NULL)
+        {
+            p++;
+        }
+        char conversion = *p;
+        if (conversion == '\0')
+        {
+            break;
+        }
+        p++;
+
+        size_t modifier_length = (size_t)(p - 1 - modifier);
+        bool is_short = modifier_length > 0 && modifier[0] == 'h';
+        bool is_char = modifier_length > 1 && modifier[1] == 'h';
+        bool is_long = modifier_length > 0 && !is_short;
+
+        char spec[32];
+        size_t spec_length = (size_t)(modifier - start);
+        if (spec_length > sizeof(spec) - 4)
+        {
+            spec_length = sizeof(spec) - 4;
+        }
+        memcpy(spec, start, spec_length);
+
+        uint64_t value = arg < arg_count ? args[arg++] : 0;
+        char *out_p = out + n;
+        size_t out_size = size - n;
+        int written;
+
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+        {
+            long long v = (long long)value;
+            if (is_char)
+            {
+                v = (signed char)v;
+            }
+            else if (is_short)
+            {
+                v = (short)v;
+            }
+            else if (!is_long)
+            {
+                v = (int)v;
+            }
+            memcpy(spec + spec_length, "lld", 4);
+            written = snprintf(out_p, out_size, spec, v);
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        {
+            unsigned long long v = value;
+            if (is_char)
+            {
+                v = (unsigned char)v;
+            }
+            else if (is_short)
+            {
+                v = (unsigned short)v;
+            }
+            else if (!is_long)
+            {
+                v = (unsigned int)v;
+            }
+            spec[spec_length] = 'l';
+            spec[spec_length + 1] = 'l';
+            spec[spec_length + 2] = conversion;
+            spec[spec_length + 3] = '\0';
+            written = snprintf(out_p, out_size, spec, v);
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+        {
+            double v;
+            memcpy(&v, &value, sizeof(v));
+            spec[spec_length] = conversion;
+            spec[spec_length + 1] = '\0';
+            written = snprintf(out_p, out_size, spec, v);
+            break;
+        }
+        case 'c':
+            memcpy(spec + spec_length, "c", 2);
+            written = snprintf(out_p, out_size, spec, (int)value);
+            break;
+        case 's':
+        {
+            const char *v = (const char *)(uintptr_t)value;
+            memcpy(spec + spec_length, "s", 2);
+            written = snprintf(out_p, out_size, spec, v != NULL ? v : "(null)");
+            break;
+        }
+        case 'p':
+            memcpy(spec + spec_length, "p", 2);
+            written = snprintf(out_p, out_size, spec,
+                               (void *)(uintptr_t)value);
+            break;
+        default:
+            written = snprintf(out_p, out_size, "%.*s",
+                               (int)(p - start), start);
+            break;
+        }
+
+        n = hazel_log_append(size, n, written);
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+static void hazel_log_format_bytes(char *out, size_t size,
+                                   const hazel_log_record *record)
+{
+    size_t n = hazel_log_append(
+        size, 0,
+        snprintf(out, size, "%s (size:%u) [", record->format,
+                 (unsigned)record->payload.bytes.size));
+
+    size_t kept = record->payload.bytes.size < HAZEL_LOG_MAX_BYTES
+        ? record->payload.bytes.size
+        : HAZEL_LOG_MAX_BYTES;
+    for (size_t i = 0; i < kept; i++)
+    {
+        n = hazel_log_append(size, n,
+                             snprintf(out + n, size - n, i == 0 ? "%02x"
+                                                                : " %02x",
+                                      record->payload.bytes.data[i]));
+    }
+
+    snprintf(out + n, size - n, "%s]",
+             kept < record->payload.bytes.size ? " ..." : "");
+}
+
+void hazel_log_set_sink(hazel_log_sink sink, void *user_data)
+{
+    pthread_mutex_lock(&hazel_log_drain_lock);
+    hazel_log_current_sink = sink;
+    hazel_log_sink_user_data = user_data;
+    pthread_mutex_unlock(&hazel_log_drain_lock);
+}
+
+size_t hazel_log_drain(void)
+{
+    size_t count = 0;
+    char message[HAZEL_LOG_MESSAGE_SIZE];
+
+    bool draining = hazel_log_local_draining;
+    hazel_log_local_draining = true;
+    pthread_mutex_lock(&hazel_log_drain_lock);
+
+    hazel_log_sink sink = hazel_log_current_sink != NULL
+        ? hazel_log_current_sink
+        : hazel_log_default_sink;
+
+    for (hazel_log_thread_ring *ring = atomic_load(&hazel_log_rings);
+         ring != NULL; ring = ring->next)
+    {
+        hazel_log_record *record;
+        while ((record = hazel_spsc_ring_peek(&ring->ring)) != NULL)
+        {
+            if (record->is_bytes)
+            {
+                hazel_log_format_bytes(message, sizeof(message), record);
+            }
+            else
+            {
+                hazel_log_format(message, sizeof(message), record->format,
+                                 record->payload.args, record->arg_count);
+            }
+
+            sink((enum hazel_log_level)record->level, record->timestamp_ns,
+                 record->file, record->line, message,
+                 hazel_log_sink_user_data);
+
+            hazel_spsc_ring_release(&ring->ring);
+            count++;
+        }
+    }
+
+    pthread_mutex_unlock(&hazel_log_drain_lock);
+    hazel_log_local_draining = draining;
+    return count;
+}
+
+uint64_t hazel_log_dropped(void)
+{
+    // Held so no ring is freed while it is read
+    pthread_mutex_lock(&hazel_log_drain_lock);
+    uint64_t dropped = atomic_load_explicit(&hazel_log_freed_dropped,
+                                            memory_order_relaxed);
+    for (hazel_log_thread_ring *ring = atomic_load(&hazel_log_rings);
+         ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&hazel_log_drain_lock);
+    return dropped;
+}
+
+static void *hazel_log_thread_main(void *arg)
+{
+    (void)arg;
+    struct timespec interval = {
+        hazel_log_thread_interval_ms / 1000,
+        (hazel_log_thread_interval_ms % 1000) * 1000000L
+    };
+
+    while (atomic_load(&hazel_log_thread_running))
+    {
+        hazel_log_drain();
+        nanosleep(&interval, NULL);
+    }
+
+    hazel_log_drain();
+    return NULL;
+}
+
+int hazel_log_start_thread(int interval_ms)
+{
+    if (atomic_exchange(&hazel_log_thread_running, true))
+    {
+        return 0;
+    }
+
+    hazel_log_thread_interval_ms = interval_ms > 0 ? interval_ms : 1;
+    if (pthread_create(&hazel_log_thread, NULL, hazel_log_thread_main, NULL)
+        != 0)
+    {
+        atomic_store(&hazel_log_thread_running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void hazel_log_stop_thread(void)
+{
+    if (!atomic_exchange(&hazel_log_thread_running, false))
+    {
+        return;
+    }
+    pthread_join(hazel_log_thread, NULL);
+}
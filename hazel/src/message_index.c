@@ -0,0 +1,97 @@
+#include "hazel/message_index.h"
+
+#include <string.h>
+
+int hazel_message_index_build(hazel_message_index *index,
+                              hazel_message_reader *reader)
+{
+    uint8_t last[256];
+
+    memset(index->first, HAZEL_MESSAGE_INDEX_END, sizeof(index->first));
+    index->data = reader->data;
+    index->count = 0;
+
+    size_t head = reader->read_head;
+    size_t end = reader->offset + reader->size;
+
+    while (head != end)
+    {
+        if (end - head < 3)
+        {
+            return HAZEL_READER_MALFORMED_INPUT;
+        }
+
+        uint16_t size = reader->data[head] | (reader->data[head + 1] << 8);
+        uint8_t tag = reader->data[head + 2];
+        head += 3;
+
+        if (end - head < size)
+        {
+            return HAZEL_READER_MALFORMED_INPUT;
+        }
+
+        if (index->count == HAZEL_MESSAGE_INDEX_CAPACITY)
+        {
+            return HAZEL_MESSAGE_INDEX_FULL;
+        }
+
+        uint8_t entry = (uint8_t)index->count++;
+        index->entries[entry].offset = (uint32_t)head;
+        index->entries[entry].size = size;
+        index->entries[entry].tag = tag;
+        index->entries[entry].next = HAZEL_MESSAGE_INDEX_END;
+
+        // Append to the tag's chain, so repeated tags keep wire order.
+        if (index->first[tag] == HAZEL_MESSAGE_INDEX_END)
+        {
+            index->first[tag] = entry;
+        }
+        else
+        {
+            index->entries[last[tag]].next = entry;
+        }
+        last[tag] = entry;
+
+        head += size;
+    }
+
+    return 0;
+}
+
+void hazel_message_index_get(hazel_message_index *index, uint8_t entry,
+                             hazel_message_reader *output)
+{
+    hazel_message_index_entry *e = &index->entries[entry];
+
+    output->data = index->data;
+    output->size = e->size;
+    output->offset = e->offset;
+    output->read_head = e->offset;
+    output->tag = e->tag;
+    output->_position = 0;
+}
+
+int hazel_message_index_find(hazel_message_index *index, uint8_t tag,
+                             hazel_message_reader *output)
+{
+    uint8_t entry = hazel_message_index_first(index, tag);
+    if (entry == HAZEL_MESSAGE_INDEX_END)
+    {
+        return HAZEL_MESSAGE_INDEX_NOT_FOUND;
+    }
+
+    hazel_message_index_get(index, entry, output);
+    return 0;
+}
+
+size_t hazel_message_index_count(hazel_message_index *index, uint8_t tag)
+{
+    size_t count = 0;
+    for (uint8_t entry = hazel_message_index_first(index, tag);
+         entry != HAZEL_MESSAGE_INDEX_END;
+         entry = hazel_message_index_next(index, entry))
+    {
+        count++;
+    }
+    return count;
+}
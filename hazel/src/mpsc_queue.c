@@ -0,0 +1,63 @@
+#include "hazel/mpsc_queue.h"
+
+// Dmitry Vyukov's intrusive MPSC queue. The stub node keeps the list non
+// empty, so producers only ever touch the head and the consumer the tail.
+
+void hazel_mpsc_queue_init(hazel_mpsc_queue *queue)
+{
+    atomic_init(&queue->_stub.next, NULL);
+    atomic_init(&queue->_head, &queue->_stub);
+    queue->_tail = &queue->_stub;
+}
+
+void hazel_mpsc_queue_push(hazel_mpsc_queue *queue, hazel_mpsc_node *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    hazel_mpsc_node *prev = atomic_exchange_explicit(&queue->_head, node,
+                                                     memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+hazel_mpsc_node *hazel_mpsc_queue_pop(hazel_mpsc_queue *queue)
+{
+    hazel_mpsc_node *tail = queue->_tail;
+    hazel_mpsc_node *next = atomic_load_explicit(&tail->next,
+                                                 memory_order_acquire);
+
+    if (tail == &queue->_stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        queue->_tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        queue->_tail = next;
+        return tail;
+    }
+
+    hazel_mpsc_node *head = atomic_load_explicit(&queue->_head,
+                                                 memory_order_acquire);
+    if (tail != head)
+    {
+        // A producer has swapped the head but not linked it in yet
+        return NULL;
+    }
+
+    // tail is the last node, put the stub behind it so it can be unlinked
+    hazel_mpsc_queue_push(queue, &queue->_stub);
+
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        queue->_tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
@@ -1,4 +1,6 @@
+#define HAZEL_PRIMITIVES_IMPLEMENTATION
 #include "hazel/reader.h"
+#include "hazel/impl/reader_primitives.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -28,143 +30,12 @@ void hazel_message_reader_free(hazel_message_reader* reader)
     free(reader->data);
 }
 
-size_t hazel_message_reader_get_position(hazel_message_reader* reader)
-{
-    return reader->_position;
-}
-void hazel_message_reader_set_position(hazel_message_reader* reader, size_t value)
-{
-    reader->_position = value;
-    reader->read_head = value + reader->offset;
-}
-
-size_t hazel_message_reader_remaining(hazel_message_reader* reader)
-{
-    return reader->size - reader->_position;
-}
-bool hazel_message_reader_has_remaining(hazel_message_reader* reader,
-                                        size_t amount)
-{
-    return hazel_message_reader_remaining(reader) >= amount;
-} 
-
 #define BUFFER_CHECK(reader, wanted_size)                         \
     if (!hazel_message_reader_has_remaining(reader, wanted_size)) \
     {                                                             \
         return HAZEL_READER_CAPACITY_EXCEEDED;                    \
     }
 
-uint8_t hazel_message_reader_byte(hazel_message_reader* reader)
-{
-    reader->_position++;
-    size_t pos = reader->read_head++;
-    return reader->data[pos];
-}
-
-int hazel_message_reader_bool(hazel_message_reader* reader, bool* result)
-{
-    uint8_t tmp = 0;
-    int ret = hazel_message_reader_uint8(reader, &tmp);
-    if (ret == 0)
-    {
-        *result = tmp != 0;
-    }
-    return ret;
-}
-
-int hazel_message_reader_uint8(hazel_message_reader* reader, uint8_t* result)
-{
-    BUFFER_CHECK(reader, sizeof(uint8_t));
-    *result = hazel_message_reader_byte(reader);
-    return 0;
-}
-
-int hazel_message_reader_uint16(hazel_message_reader* reader, uint16_t *result)
-{
-    BUFFER_CHECK(reader, sizeof(uint16_t));
-    *result = hazel_message_reader_byte(reader) 
-        | (hazel_message_reader_byte(reader) << 8);
-    return 0;
-}
-int hazel_message_reader_int16(hazel_message_reader* reader, int16_t *result)
-{
-    return hazel_message_reader_uint16(reader, (uint16_t*) result);
-}
-
-int hazel_message_reader_uint32(hazel_message_reader* reader, uint32_t *result)
-{
-    BUFFER_CHECK(reader, sizeof(uint32_t));
-    *result = hazel_message_reader_byte(reader)
-        | (hazel_message_reader_byte(reader) << 8)
-        | (hazel_message_reader_byte(reader) << 16)
-        | (hazel_message_reader_byte(reader) << 24);
-    return 0;
-}
-int hazel_message_reader_int32(hazel_message_reader* reader, int32_t *result)
-{
-    return hazel_message_reader_uint32(reader, (uint32_t*) result);
-}
-
-int hazel_message_reader_uint64(hazel_message_reader* reader, uint64_t *result)
-{
-    BUFFER_CHECK(reader, sizeof(uint64_t));
-    *result = hazel_message_reader_byte(reader)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 8)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 16)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 24)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 32)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 40)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 48)
-        | ((uint64_t)hazel_message_reader_byte(reader) << 56);
-    return 0;
-}
-int hazel_message_reader_int64(hazel_message_reader* reader, int64_t *result)
-{
-    return hazel_message_reader_uint64(reader, (uint64_t*) result);
-}
-
-int hazel_message_reader_packed_uint32(hazel_message_reader* reader, uint32_t* result)
-{
-    int ret = 0;
-    bool readMore = true;
-    int32_t shift = 0;
-    uint32_t output = 0;
-    while (readMore) 
-    {
-        uint8_t b;
-        if ((ret = hazel_message_reader_uint8(reader, &b)) != 0)
-        {
-            return ret;
-        }
-        if (b >= 0x80)
-        {
-            readMore = true;
-            b ^= 0x80;
-        }
-        else
-        {
-            readMore = false;
-        }
-        output |= (uint32_t)(b << shift);
-        shift += 7;
-    }
-
-    *result = output;
-
-    return 0;
-}
-int hazel_message_reader_packed_int32(hazel_message_reader* reader, int32_t* result)
-{
-    return hazel_message_reader_packed_uint32(reader, (uint32_t*) result);
-}
-
-int hazel_message_reader_single(hazel_message_reader* reader, float* result)
-{
-    BUFFER_CHECK(reader, sizeof(float));
-    memcpy(result, &reader->data[reader->read_head], sizeof(float));
-    return 0;
-}
-
 int hazel_message_reader_string(hazel_message_reader* reader, 
                                 char* output, size_t output_size)
 {
@@ -195,8 +66,8 @@ int hazel_message_reader_string(hazel_message_reader* reader,
     return 0;
 }
 
-int hazel_message_reader_string_malloc(hazel_message_reader* reader,
-                                       char** output)
+static int hazel_message_reader_string_alloc(hazel_message_reader* reader,
+                                             char** output, hazel_arena* arena)
 {
     int32_t read_length;
     int ret = hazel_message_reader_packed_int32(reader, &read_length);
@@ -205,15 +76,18 @@ int hazel_message_reader_string_malloc(hazel_message_reader* reader,
         return ret;
     }
 
-    char* str_buffer = malloc((read_length + 1) * sizeof(char));
-    if (str_buffer == NULL)
+    if (!hazel_message_reader_has_remaining(reader, read_length))
     {
-        return HAZEL_ERR_FAILED_ALLOC;
+        return HAZEL_READER_MALFORMED_INPUT;
     }
 
-    if (!hazel_message_reader_has_remaining(reader, read_length))
+    size_t alloc_size = (read_length + 1) * sizeof(char);
+    char* str_buffer = arena != NULL
+        ? hazel_arena_alloc(arena, alloc_size)
+        : malloc(alloc_size);
+    if (str_buffer == NULL)
     {
-        return HAZEL_READER_MALFORMED_INPUT;
+        return HAZEL_ERR_FAILED_ALLOC;
     }
 
     memcpy(str_buffer, reader->data + reader->read_head, read_length);
@@ -228,13 +102,29 @@ int hazel_message_reader_string_malloc(hazel_message_reader* reader,
     return 0;
 }
 
+int hazel_message_reader_string_malloc(hazel_message_reader* reader,
+                                       char** output)
+{
+    return hazel_message_reader_string_alloc(reader, output, NULL);
+}
+
+int hazel_message_reader_string_arena(hazel_message_reader* reader,
+                                      hazel_arena* arena, char** output)
+{
+    if (arena == NULL)
+    {
+        return HAZEL_ERR_READER_INVALID_ARGUMENTS;
+    }
+    return hazel_message_reader_string_alloc(reader, output, arena);
+}
+
 int hazel_message_reader_string_view(
     hazel_message_reader* reader,
     hazel_message_reader_string_buffer_view* result)
 {
     int ret;
     int32_t read_length;
-    if ((ret = hazel_message_reader_packed_int32(reader, &read_length) != 0))
+    if ((ret = hazel_message_reader_packed_int32(reader, &read_length)) != 0)
     {
         return ret;
     }
@@ -263,41 +153,87 @@ bool hazel_message_reader_can_read_message(hazel_message_reader* reader)
 
 int hazel_message_reader_read_message(hazel_message_reader* reader, hazel_message_reader* output)
 {
-    hazel_message_reader temp = {
+    BUFFER_CHECK(reader, 3);
+
+    const uint8_t* header = reader->data + reader->read_head;
+    uint16_t size = header[0] | (header[1] << 8);
+
+    BUFFER_CHECK(reader, (size_t)size + 3);
+
+    hazel_message_reader message = {
         .data = reader->data,
-        .size = reader->size,
-        .offset = reader->read_head
+        .size = size,
+        .offset = reader->read_head + 3,
+        .read_head = reader->read_head + 3,
+        .tag = header[2]
     };
 
-    int ret = 0;
+    hazel_message_reader_set_position(
+        reader,
+        hazel_message_reader_get_position(reader) + size + 3);
 
-    hazel_message_reader_set_position(&temp, 0);
+    *output = message;
 
-    uint16_t size;
-    uint8_t tag;
-    ret |= hazel_message_reader_uint16(&temp, &size);
-    ret |= hazel_message_reader_uint8(&temp, &tag);
-    
-    if (ret != 0)
+    return 0;
+}
+
+int hazel_message_reader_validate(hazel_message_reader* reader, size_t depth,
+                                  hazel_message_reader* output)
+{
+    if (depth > HAZEL_READER_MAX_VALIDATE_DEPTH)
     {
-        return ret;
+        return HAZEL_ERR_READER_INVALID_ARGUMENTS;
     }
 
-    temp.size = size;
-    temp.tag = tag;
+    // Explicit stack of the end offsets of the messages we are inside of, the
+    // bottom entry being the end of the reader itself.
+    size_t ends[HAZEL_READER_MAX_VALIDATE_DEPTH + 1];
+    size_t level = 0;
 
-    temp.offset += 3;
-    hazel_message_reader_set_position(&temp, 0);
+    size_t head = reader->read_head;
+    ends[0] = reader->offset + reader->size;
 
-    if (!hazel_message_reader_has_remaining(reader, temp.size + 3))
+    if (depth == 0)
     {
-        return HAZEL_READER_CAPACITY_EXCEEDED;
+        *output = *reader;
+        return 0;
     }
-    hazel_message_reader_set_position(
-        reader,
-        hazel_message_reader_get_position(reader) + temp.size + 3);
 
-    *output = temp;
+    while (true)
+    {
+        if (head == ends[level])
+        {
+            if (level == 0)
+            {
+                break;
+            }
+            level--;
+            continue;
+        }
+
+        if (ends[level] - head < 3)
+        {
+            return HAZEL_READER_MALFORMED_INPUT;
+        }
+
+        size_t size = reader->data[head] | (reader->data[head + 1] << 8);
+        head += 3;
+
+        if (ends[level] - head < size)
+        {
+            return HAZEL_READER_MALFORMED_INPUT;
+        }
+
+        if (level + 1 < depth)
+        {
+            ends[++level] = head + size;
+        }
+        else
+        {
+            head += size;
+        }
+    }
 
-    return ret;
+    *output = *reader;
+    return 0;
 }
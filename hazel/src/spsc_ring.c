@@ -0,0 +1,87 @@
+#include "hazel/spsc_ring.h"
+
+#include <stdlib.h>
+
+int hazel_spsc_ring_init(hazel_spsc_ring *ring, size_t element_size,
+                         size_t capacity)
+{
+    if (element_size == 0 || capacity == 0)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    size_t rounded = 1;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+
+    ring->_stride = (element_size + HAZEL_CACHE_LINE_SIZE - 1)
+        & ~(size_t)(HAZEL_CACHE_LINE_SIZE - 1);
+    ring->capacity = rounded;
+    ring->_slots = aligned_alloc(HAZEL_CACHE_LINE_SIZE,
+                                 ring->_stride * ring->capacity);
+    if (ring->_slots == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    atomic_init(&ring->_head, 0);
+    atomic_init(&ring->_tail, 0);
+    ring->_cached_head = 0;
+    ring->_cached_tail = 0;
+    return 0;
+}
+
+void hazel_spsc_ring_free(hazel_spsc_ring *ring)
+{
+    free(ring->_slots);
+    ring->_slots = NULL;
+}
+
+static inline void *hazel_spsc_ring_slot(hazel_spsc_ring *ring, size_t index)
+{
+    return ring->_slots + (index & (ring->capacity - 1)) * ring->_stride;
+}
+
+void *hazel_spsc_ring_acquire(hazel_spsc_ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->_head, memory_order_relaxed);
+    if (head - ring->_cached_tail == ring->capacity)
+    {
+        ring->_cached_tail = atomic_load_explicit(&ring->_tail,
+                                                  memory_order_acquire);
+        if (head - ring->_cached_tail == ring->capacity)
+        {
+            return NULL;
+        }
+    }
+    return hazel_spsc_ring_slot(ring, head);
+}
+
+void hazel_spsc_ring_commit(hazel_spsc_ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->_head, memory_order_relaxed);
+    atomic_store_explicit(&ring->_head, head + 1, memory_order_release);
+}
+
+void *hazel_spsc_ring_peek(hazel_spsc_ring *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->_tail, memory_order_relaxed);
+    if (tail == ring->_cached_head)
+    {
+        ring->_cached_head = atomic_load_explicit(&ring->_head,
+                                                  memory_order_acquire);
+        if (tail == ring->_cached_head)
+        {
+            return NULL;
+        }
+    }
+    return hazel_spsc_ring_slot(ring, tail);
+}
+
+void hazel_spsc_ring_release(hazel_spsc_ring *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->_tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->_tail, tail + 1, memory_order_release);
+}
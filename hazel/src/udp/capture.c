@@ -0,0 +1,460 @@
+#include "hazel/udp/capture.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#else
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#endif
+
+#define HAZEL_UDP_CAPTURE_PCAP_MAGIC_NS 0xA1B23C4Du
+#define HAZEL_UDP_CAPTURE_LINKTYPE_RAW 101
+#define HAZEL_UDP_CAPTURE_IPV4_HEADER 20
+#define HAZEL_UDP_CAPTURE_IPV6_HEADER 40
+#define HAZEL_UDP_CAPTURE_UDP_HEADER 8
+#define HAZEL_UDP_CAPTURE_MAX_HEADERS \
+    (HAZEL_UDP_CAPTURE_IPV6_HEADER + HAZEL_UDP_CAPTURE_UDP_HEADER)
+
+_Atomic(hazel_udp_capture *) hazel_udp_capture_active = NULL;
+
+// Threads inside hazel_udp_capture_write(), so that disabling can wait for
+// them to leave the capture alone
+static atomic_uint hazel_udp_capture_writers = 0;
+
+typedef struct hazel_udp_capture_slot
+{
+    atomic_size_t sequence;
+    uint64_t timestamp_ns;
+    uint32_t original_size;
+    uint32_t captured_size;
+    // Followed by captured_size bytes of IP packet
+} hazel_udp_capture_slot;
+
+static hazel_udp_capture_slot *hazel_udp_capture_slot_at(
+    hazel_udp_capture *capture, size_t position)
+{
+    return (hazel_udp_capture_slot *)(capture->_slots
+        + (position & (capture->_capacity - 1)) * capture->_stride);
+}
+
+static void *hazel_udp_capture_flush_main(void *arg);
+
+int hazel_udp_capture_open(hazel_udp_capture *capture, const char *path,
+                           size_t capacity, size_t snaplen)
+{
+    memset(capture, 0, sizeof(*capture));
+
+    size_t ring_capacity = 2;
+    while (ring_capacity < capacity)
+    {
+        ring_capacity <<= 1;
+    }
+    size_t max_snaplen = HAZEL_UDP_CAPTURE_MAX_HEADERS + HAZEL_BUFFER_SIZE;
+    if (snaplen == 0 || snaplen > max_snaplen)
+    {
+        snaplen = max_snaplen;
+    }
+    if (snaplen < HAZEL_UDP_CAPTURE_MAX_HEADERS)
+    {
+        snaplen = HAZEL_UDP_CAPTURE_MAX_HEADERS;
+    }
+
+    size_t align = _Alignof(hazel_udp_capture_slot);
+    capture->_stride = (sizeof(hazel_udp_capture_slot) + snaplen + align - 1)
+        / align * align;
+    capture->_capacity = ring_capacity;
+    capture->snaplen = snaplen;
+    capture->_slots = malloc(capture->_capacity * capture->_stride);
+    if (capture->_slots == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    for (size_t i = 0; i < capture->_capacity; i++)
+    {
+        atomic_init(&hazel_udp_capture_slot_at(capture, i)->sequence, i);
+    }
+    atomic_init(&capture->_head, 0);
+    atomic_init(&capture->dropped, 0);
+    atomic_init(&capture->written, 0);
+
+    capture->_file = fopen(path, "wb");
+    if (capture->_file == NULL)
+    {
+        free(capture->_slots);
+        capture->_slots = NULL;
+        return HAZEL_UDP_CAPTURE_OPEN_ERROR;
+    }
+
+    // Written in host order, readers tell the byte order from the magic
+    uint32_t magic = HAZEL_UDP_CAPTURE_PCAP_MAGIC_NS;
+    uint16_t version[2] = { 2, 4 };
+    int32_t thiszone = 0;
+    uint32_t sigfigs = 0;
+    uint32_t pcap_snaplen = (uint32_t)snaplen;
+    uint32_t linktype = HAZEL_UDP_CAPTURE_LINKTYPE_RAW;
+    if (fwrite(&magic, sizeof(magic), 1, capture->_file) != 1
+        || fwrite(version, sizeof(version), 1, capture->_file) != 1
+        || fwrite(&thiszone, sizeof(thiszone), 1, capture->_file) != 1
+        || fwrite(&sigfigs, sizeof(sigfigs), 1, capture->_file) != 1
+        || fwrite(&pcap_snaplen, sizeof(pcap_snaplen), 1, capture->_file) != 1
+        || fwrite(&linktype, sizeof(linktype), 1, capture->_file) != 1
+        || fflush(capture->_file) != 0)
+    {
+        fclose(capture->_file);
+        free(capture->_slots);
+        capture->_file = NULL;
+        capture->_slots = NULL;
+        return HAZEL_UDP_CAPTURE_OPEN_ERROR;
+    }
+
+    atomic_init(&capture->_running, true);
+    if (pthread_create(&capture->_thread, NULL, hazel_udp_capture_flush_main,
+                       capture) != 0)
+    {
+        fclose(capture->_file);
+        free(capture->_slots);
+        capture->_file = NULL;
+        capture->_slots = NULL;
+        return HAZEL_UDP_CAPTURE_THREAD_ERROR;
+    }
+    return 0;
+}
+
+/**
+ * Write every record the producers have finished to the file.
+ *
+ * \return The number of records written
+ */
+static size_t hazel_udp_capture_drain(hazel_udp_capture *capture)
+{
+    size_t count = 0;
+    for (;;)
+    {
+        hazel_udp_capture_slot *slot
+            = hazel_udp_capture_slot_at(capture, capture->_tail);
+        size_t sequence = atomic_load_explicit(&slot->sequence,
+                                               memory_order_acquire);
+        if (sequence != capture->_tail + 1)
+        {
+            break;
+        }
+
+        uint32_t record[4] = {
+            (uint32_t)(slot->timestamp_ns / 1000000000ull),
+            (uint32_t)(slot->timestamp_ns % 1000000000ull),
+            slot->captured_size,
+            slot->original_size,
+        };
+        fwrite(record, sizeof(record), 1, capture->_file);
+        fwrite(slot + 1, 1, slot->captured_size, capture->_file);
+
+        atomic_store_explicit(&slot->sequence,
+                              capture->_tail + capture->_capacity,
+                              memory_order_release);
+        capture->_tail++;
+        count++;
+    }
+
+    if (count > 0)
+    {
+        fflush(capture->_file);
+        atomic_fetch_add_explicit(&capture->written, count,
+                                  memory_order_relaxed);
+    }
+    return count;
+}
+
+/**
+ * Wait until no thread is inside hazel_udp_capture_write(). Writers only
+ * copy one datagram, but may have been preempted doing so, so the wait
+ * yields instead of spinning.
+ */
+static void hazel_udp_capture_wait_writers(void)
+{
+    while (atomic_load(&hazel_udp_capture_writers) != 0)
+    {
+        sched_yield();
+    }
+}
+
+static void *hazel_udp_capture_flush_main(void *arg)
+{
+    hazel_udp_capture *capture = arg;
+    const struct timespec interval = {
+        .tv_sec = HAZEL_UDP_CAPTURE_FLUSH_INTERVAL_MS / 1000,
+        .tv_nsec = (HAZEL_UDP_CAPTURE_FLUSH_INTERVAL_MS % 1000) * 1000000L,
+    };
+    while (atomic_load_explicit(&capture->_running, memory_order_acquire))
+    {
+        if (hazel_udp_capture_drain(capture) == 0)
+        {
+            nanosleep(&interval, NULL);
+        }
+    }
+    return NULL;
+}
+
+void hazel_udp_capture_close(hazel_udp_capture *capture)
+{
+    if (capture->_file == NULL)
+    {
+        return;
+    }
+
+    hazel_udp_capture *expected = capture;
+    atomic_compare_exchange_strong(&hazel_udp_capture_active, &expected,
+                                   NULL);
+    // Also when another capture replaced this one, writers which loaded it
+    // before may still be copying into its slots
+    hazel_udp_capture_wait_writers();
+
+    atomic_store_explicit(&capture->_running, false, memory_order_release);
+    pthread_join(capture->_thread, NULL);
+    hazel_udp_capture_drain(capture);
+
+    fclose(capture->_file);
+    free(capture->_slots);
+    capture->_file = NULL;
+    capture->_slots = NULL;
+}
+
+void hazel_udp_capture_enable(hazel_udp_capture *capture)
+{
+    hazel_udp_capture *previous = atomic_exchange(&hazel_udp_capture_active,
+                                                  capture);
+    if (previous != NULL && previous != capture)
+    {
+        hazel_udp_capture_wait_writers();
+    }
+}
+
+void hazel_udp_capture_disable(void)
+{
+    atomic_store(&hazel_udp_capture_active, NULL);
+    hazel_udp_capture_wait_writers();
+}
+
+static void hazel_udp_capture_resolve(hazel_udp_socket *socket,
+                                      hazel_udp_socket_capture_info *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    struct sockaddr_storage local, remote;
+    socklen_t local_length = sizeof(local);
+    socklen_t remote_length = sizeof(remote);
+    memset(&local, 0, sizeof(local));
+    memset(&remote, 0, sizeof(remote));
+
+    if (socket->_sock_handle < 0
+        || getsockname(socket->_sock_handle, (struct sockaddr *)&local,
+                       &local_length) != 0)
+    {
+        // No descriptor to ask, make up a flow unique to this socket
+        info->local_address[0] = 127;
+        info->local_address[3] = 1;
+        info->remote_address[0] = 127;
+        info->remote_address[3] = 2;
+        info->local_port = (uint16_t)(49152
+            + ((uintptr_t)socket / sizeof(void *)) % 16384);
+        info->remote_port = (uint16_t)(49152
+            + ((uintptr_t)socket->_context / sizeof(void *)) % 16384);
+        return;
+    }
+
+    // An unconnected socket leaves the remote address zeroed
+    getpeername(socket->_sock_handle, (struct sockaddr *)&remote,
+                &remote_length);
+
+    if (local.ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *local6 = (struct sockaddr_in6 *)&local;
+        const struct sockaddr_in6 *remote6 = (struct sockaddr_in6 *)&remote;
+        info->ipv6 = true;
+        memcpy(info->local_address, &local6->sin6_addr, 16);
+        info->local_port = ntohs(local6->sin6_port);
+        if (remote.ss_family == AF_INET6)
+        {
+            memcpy(info->remote_address, &remote6->sin6_addr, 16);
+            info->remote_port = ntohs(remote6->sin6_port);
+        }
+    }
+    else
+    {
+        const struct sockaddr_in *local4 = (struct sockaddr_in *)&local;
+        const struct sockaddr_in *remote4 = (struct sockaddr_in *)&remote;
+        memcpy(info->local_address, &local4->sin_addr, 4);
+        info->local_port = ntohs(local4->sin_port);
+        if (remote.ss_family == AF_INET)
+        {
+            memcpy(info->remote_address, &remote4->sin_addr, 4);
+            info->remote_port = ntohs(remote4->sin_port);
+        }
+    }
+}
+
+static void hazel_udp_capture_put16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)(value >> 8);
+    out[1] = (uint8_t)value;
+}
+
+/**
+ * Write the IP and UDP headers of a datagram of \p size bytes.
+ *
+ * \return The size of the headers
+ */
+static size_t hazel_udp_capture_headers(
+    const hazel_udp_socket_capture_info *info,
+    enum hazel_udp_capture_direction direction, size_t size, uint8_t *out)
+{
+    bool sent = direction == HAZEL_UDP_CAPTURE_SENT;
+    const uint8_t *source = sent ? info->local_address : info->remote_address;
+    const uint8_t *destination = sent
+        ? info->remote_address : info->local_address;
+    uint16_t source_port = sent ? info->local_port : info->remote_port;
+    uint16_t destination_port = sent ? info->remote_port : info->local_port;
+    uint16_t udp_length = (uint16_t)(HAZEL_UDP_CAPTURE_UDP_HEADER + size);
+
+    size_t ip_length;
+    if (info->ipv6)
+    {
+        ip_length = HAZEL_UDP_CAPTURE_IPV6_HEADER;
+        memset(out, 0, ip_length);
+        out[0] = 0x60;
+        hazel_udp_capture_put16(out + 4, udp_length);
+        out[6] = IPPROTO_UDP;
+        out[7] = 64;
+        memcpy(out + 8, source, 16);
+        memcpy(out + 24, destination, 16);
+    }
+    else
+    {
+        ip_length = HAZEL_UDP_CAPTURE_IPV4_HEADER;
+        memset(out, 0, ip_length);
+        out[0] = 0x45;
+        hazel_udp_capture_put16(out + 2, (uint16_t)(ip_length + udp_length));
+        out[8] = 64;
+        out[9] = IPPROTO_UDP;
+        memcpy(out + 12, source, 4);
+        memcpy(out + 16, destination, 4);
+
+        uint32_t sum = 0;
+        for (size_t i = 0; i < ip_length; i += 2)
+        {
+            sum += (uint32_t)(out[i] << 8 | out[i + 1]);
+        }
+        while (sum >> 16)
+        {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        hazel_udp_capture_put16(out + 10, (uint16_t)~sum);
+    }
+
+    // The UDP checksum is left out, 0 means none for IPv4 and tools accept it
+    // for IPv6 captures
+    uint8_t *udp = out + ip_length;
+    hazel_udp_capture_put16(udp, source_port);
+    hazel_udp_capture_put16(udp + 2, destination_port);
+    hazel_udp_capture_put16(udp + 4, udp_length);
+    udp[6] = 0;
+    udp[7] = 0;
+    return ip_length + HAZEL_UDP_CAPTURE_UDP_HEADER;
+}
+
+void hazel_udp_capture_write(hazel_udp_socket *socket,
+                             enum hazel_udp_capture_direction direction,
+                             const uint8_t *data, size_t size)
+{
+    atomic_fetch_add(&hazel_udp_capture_writers, 1);
+    hazel_udp_capture *capture = atomic_load(&hazel_udp_capture_active);
+    if (capture == NULL)
+    {
+        atomic_fetch_sub(&hazel_udp_capture_writers, 1);
+        return;
+    }
+
+    // Claim a slot, as in Vyukov's bounded MPMC queue
+    hazel_udp_capture_slot *slot;
+    size_t position = atomic_load_explicit(&capture->_head,
+                                           memory_order_relaxed);
+    for (;;)
+    {
+        slot = hazel_udp_capture_slot_at(capture, position);
+        size_t sequence = atomic_load_explicit(&slot->sequence,
+                                               memory_order_acquire);
+        if (sequence == position)
+        {
+            if (atomic_compare_exchange_weak_explicit(
+                    &capture->_head, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (sequence < position)
+        {
+            atomic_fetch_add_explicit(&capture->dropped, 1,
+                                      memory_order_relaxed);
+            atomic_fetch_sub(&hazel_udp_capture_writers, 1);
+            return;
+        }
+        else
+        {
+            position = atomic_load_explicit(&capture->_head,
+                                            memory_order_relaxed);
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    slot->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull
+        + (uint64_t)now.tv_nsec;
+
+    // Resolved once per socket. A thread which finds another one resolving
+    // resolves a copy of its own rather than wait
+    hazel_udp_socket_capture_info local_info;
+    const hazel_udp_socket_capture_info *info = &socket->_capture_info;
+    int state = atomic_load_explicit(&socket->_capture_state,
+                                     memory_order_acquire);
+    if (state != HAZEL_UDP_CAPTURE_RESOLVED)
+    {
+        if (state == HAZEL_UDP_CAPTURE_UNRESOLVED
+            && atomic_compare_exchange_strong_explicit(
+                   &socket->_capture_state, &state,
+                   HAZEL_UDP_CAPTURE_RESOLVING, memory_order_acquire,
+                   memory_order_acquire))
+        {
+            hazel_udp_capture_resolve(socket, &socket->_capture_info);
+            atomic_store_explicit(&socket->_capture_state,
+                                  HAZEL_UDP_CAPTURE_RESOLVED,
+                                  memory_order_release);
+        }
+        else if (state != HAZEL_UDP_CAPTURE_RESOLVED)
+        {
+            hazel_udp_capture_resolve(socket, &local_info);
+            info = &local_info;
+        }
+    }
+
+    uint8_t *packet = (uint8_t *)(slot + 1);
+    size_t headers = hazel_udp_capture_headers(info, direction, size,
+                                               packet);
+    size_t payload = size;
+    if (headers + payload > capture->snaplen)
+    {
+        payload = capture->snaplen - headers;
+    }
+    memcpy(packet + headers, data, payload);
+    slot->original_size = (uint32_t)(headers + size);
+    slot->captured_size = (uint32_t)(headers + payload);
+
+    atomic_store_explicit(&slot->sequence, position + 1,
+                          memory_order_release);
+    atomic_fetch_sub(&hazel_udp_capture_writers, 1);
+}
@@ -3,16 +3,46 @@
 #include "../utils.h"
 #include <malloc.h>
 #include <errno.h>
+#include <stdlib.h>
 
 #define HAZEL_UDP_RECV_TIMEOUT_MS 100
 
 int hazel_udp_client_init(hazel_udp_client *client, const char *hostname,
                               uint16_t port, enum hazel_ip_mode ip_mode)
+{
+#ifndef HAZEL_CONFIG_CUSTOM_SOCKET
+    return hazel_udp_client_init_with(client, hostname, port, ip_mode,
+                                      &hazel_udp_socket_kernel_vtable, NULL);
+#else
+    return hazel_udp_client_init_with(client, hostname, port, ip_mode, NULL,
+                                      NULL);
+#endif
+}
+
+int hazel_udp_client_init_with(hazel_udp_client *client, const char *hostname,
+                               uint16_t port, enum hazel_ip_mode ip_mode,
+                               const hazel_udp_socket_vtable *vtable,
+                               void *context)
 {
     hazel_udp_connection_init(&client->udp_connection);
+    atomic_init(&client->_network_running, false);
+    atomic_init(&client->deferred_messages, 0);
+
+    // Empty until the network thread starts, so peeking finds nothing
+    atomic_init(&client->_deliveries._head, 0);
+    atomic_init(&client->_deliveries._tail, 0);
+    client->_deliveries._cached_head = 0;
+    client->_deliveries._cached_tail = 0;
+    client->_deliveries._slots = NULL;
+    client->_deliveries._stride = 0;
+    client->_deliveries.capacity = 0;
+    client->_spilled = NULL;
+    client->_spilled_tail = NULL;
+    client->_spilled_count = 0;
 
     int ret;
-    if ((ret = hazel_udp_socket_init(&client->udp_connection._socket)) != 0)
+    if ((ret = hazel_udp_socket_init_with(&client->udp_connection._socket,
+                                          vtable, context)) != 0)
     {
         HAZEL_LOG_DEBUG("hazel_udp_socket_init failed: %d", ret);
         return ret;
@@ -36,6 +66,7 @@ int hazel_udp_client_init(hazel_udp_client *client, const char *hostname,
 
 void hazel_udp_client_free(hazel_udp_client* client)
 {
+    hazel_udp_client_stop_network_thread(client);
     hazel_udp_connection_free(&client->udp_connection);
 }
 
@@ -45,8 +76,13 @@ int hazel_udp_client_close(hazel_udp_client *client)
     return 0;
 }
 
-int hazel_udp_client_handshake(hazel_udp_client *client,
-                               uint8_t *in_buffer, size_t in_buffer_len)
+/**
+ * Send the reliable hello packet, with \p in_buffer appended.
+ */
+static int hazel_udp_client_send_hello(hazel_udp_client *client,
+                                       uint8_t *in_buffer,
+                                       size_t in_buffer_len,
+                                       uint16_t *out_reliable_id)
 {
     hazel_udp_socket *socket = &client->udp_connection._socket;
 
@@ -63,15 +99,18 @@ int hazel_udp_client_handshake(hazel_udp_client *client,
     {
         hello_buf_len += in_buffer_len;
         uint8_t *temp = malloc(hello_buf_len);
+        if (temp == NULL)
+        {
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
         memcpy(temp, hello_prefix, hello_prefix_len);
         memcpy(temp + hello_prefix_len, in_buffer, in_buffer_len);
         hello_buf = temp;
     }
 
-    uint16_t hello_reliable_id;
     ret = hazel_udp_connection_make_reliable(&client->udp_connection, hello_buf,
                                              hello_buf_len, 1, 
-                                             &hello_reliable_id);
+                                             out_reliable_id);
     if (ret < 0)
     {
         HAZEL_LOG_DEBUG("hazel_udp_connection_make_reliable failed: %d", ret);
@@ -84,6 +123,30 @@ int hazel_udp_client_handshake(hazel_udp_client *client,
         ret = HAZEL_UDP_SOCKET_SEND_ERROR;
         goto exit;
     }
+    ret = 0;
+
+exit:
+    if (has_buffer)
+    {
+        free(hello_buf);
+    }
+
+    return ret;
+}
+
+int hazel_udp_client_handshake(hazel_udp_client *client,
+                               uint8_t *in_buffer, size_t in_buffer_len)
+{
+    hazel_udp_socket *socket = &client->udp_connection._socket;
+
+    int ret;
+
+    uint16_t hello_reliable_id;
+    if ((ret = hazel_udp_client_send_hello(client, in_buffer, in_buffer_len,
+                                           &hello_reliable_id)) != 0)
+    {
+        return ret;
+    }
 
     uint8_t buffer[HAZEL_BUFFER_SIZE];
     while (true)
@@ -142,12 +205,25 @@ int hazel_udp_client_handshake(hazel_udp_client *client,
     }
 
 exit:
-    if (has_buffer)
+    return ret;
+}
+
+int hazel_udp_client_handshake_async(hazel_udp_client *client,
+                                     uint8_t *in_buffer, size_t in_buffer_len)
+{
+    int ret;
+
+    uint16_t hello_reliable_id;
+    if ((ret = hazel_udp_client_send_hello(client, in_buffer, in_buffer_len,
+                                           &hello_reliable_id)) != 0)
     {
-        free(hello_buf);
+        return ret;
     }
 
-    return ret;
+    client->udp_connection._handshake_id = hello_reliable_id;
+    client->udp_connection._connection_state
+        = HAZEL_CONNECTION_STATE_CONNECTING;
+    return 0;
 }
 
 int hazel_udp_client_recv(hazel_udp_client *client, enum hazel_send_option *out_send_option,
@@ -156,6 +232,8 @@ int hazel_udp_client_recv(hazel_udp_client *client, enum hazel_send_option *out_
     hazel_udp_socket *socket = &client->udp_connection._socket;
     int ret;
 
+    hazel_udp_connection_send_submitted(&client->udp_connection, NULL);
+
     uint8_t buffer[HAZEL_BUFFER_SIZE];
     ret = hazel_udp_socket_recv(socket, buffer, HAZEL_BUFFER_SIZE,
                                 0, HAZEL_UDP_RECV_TIMEOUT_MS);
@@ -180,7 +258,11 @@ int hazel_udp_client_recv(hazel_udp_client *client, enum hazel_send_option *out_
         ret = hazel_udp_connection_handle_recv(&client->udp_connection,
                                                buffer, size, &recv_data);
 
-        if (recv_data.packet_type == HAZEL_SEND_OPTION_UNRELIABLE 
+        if (ret < 0)
+        {
+            ret = HAZEL_UDP_CLIENT_RECV_NO_MESSAGE;
+        }
+        else if (recv_data.packet_type == HAZEL_SEND_OPTION_UNRELIABLE 
             || recv_data.packet_type == HAZEL_SEND_OPTION_RELIABLE)
         {
             ret = HAZEL_UDP_CLIENT_RECV_HAS_MESSAGE;
@@ -207,3 +289,280 @@ int hazel_udp_client_recv(hazel_udp_client *client, enum hazel_send_option *out_
 
     return ret;
 }
+
+/**
+ * Compressed payloads are decompressed into a buffer of their own instead of
+ * the delivery's buffer, which is only freed here if it was not taken from
+ * the connection's arena.
+ */
+static void hazel_udp_client_delivery_free(hazel_udp_client_delivery *delivery)
+{
+    if (delivery->_allocated)
+    {
+        free(delivery->reader.data);
+    }
+}
+
+/**
+ * Fill \p delivery from \p recv_data, which was received into \p buffer.
+ * \p buffer's contents must already be in the delivery's own buffer.
+ */
+static void hazel_udp_client_fill(hazel_udp_client *client,
+                                  hazel_udp_client_delivery *delivery,
+                                  const hazel_udp_connection_recv *recv_data,
+                                  const uint8_t *buffer)
+{
+    delivery->send_option = recv_data->packet_type;
+    delivery->reader = recv_data->packet_type == HAZEL_SEND_OPTION_DISCONNECT
+        ? recv_data->data.disconnect.reader
+        : recv_data->data.msg.reader;
+
+    uint8_t *data = delivery->reader.data;
+    if (data >= buffer && data < buffer + sizeof(delivery->_buffer))
+    {
+        delivery->reader.data = delivery->_buffer + (data - buffer);
+        delivery->_allocated = false;
+    }
+    else
+    {
+        delivery->_allocated = client->udp_connection._arena == NULL;
+    }
+}
+
+/**
+ * Move spilled deliveries into the ring, oldest first, while it has room.
+ */
+static void hazel_udp_client_unspill(hazel_udp_client *client)
+{
+    while (client->_spilled != NULL)
+    {
+        hazel_udp_client_delivery *slot = hazel_spsc_ring_acquire(
+            &client->_deliveries);
+        if (slot == NULL)
+        {
+            return;
+        }
+
+        hazel_udp_client_delivery *spilled = client->_spilled;
+        client->_spilled = spilled->_next;
+        if (client->_spilled == NULL)
+        {
+            client->_spilled_tail = NULL;
+        }
+        client->_spilled_count--;
+
+        *slot = *spilled;
+        uint8_t *data = spilled->reader.data;
+        if (!spilled->_allocated && data >= spilled->_buffer
+            && data < spilled->_buffer + sizeof(spilled->_buffer))
+        {
+            slot->reader.data = slot->_buffer + (data - spilled->_buffer);
+        }
+        free(spilled);
+        hazel_spsc_ring_commit(&client->_deliveries);
+    }
+}
+
+/**
+ * Receive while the ring is full, so acks and pings are still answered and
+ * our own reliable packets still get acknowledged.
+ *
+ * Reliable messages are acked and spilled to the heap until the ring has
+ * room again. Once #HAZEL_UDP_CLIENT_SPILL_LIMIT are waiting, they are left
+ * unacked instead, so the peer's retransmissions slow it down and deliver
+ * them later. Unreliable messages are dropped as if the socket's buffer had
+ * overflowed.
+ */
+static void hazel_udp_client_recv_full(hazel_udp_client *client)
+{
+    hazel_udp_connection *connection = &client->udp_connection;
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    int ret = hazel_udp_socket_recv(&connection->_socket, buffer,
+                                    sizeof(buffer), 0,
+                                    HAZEL_UDP_CLIENT_FULL_TIMEOUT_MS);
+    if (ret <= 0)
+    {
+        if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE)
+        {
+            HAZEL_LOG_ERROR("network thread recv failed: %d", ret);
+        }
+        return;
+    }
+
+    uint8_t send_option = buffer[0] & ~HAZEL_SEND_OPTION_COMPRESSED;
+    if (send_option == HAZEL_SEND_OPTION_UNRELIABLE
+        || (send_option == HAZEL_SEND_OPTION_RELIABLE
+            && client->_spilled_count >= HAZEL_UDP_CLIENT_SPILL_LIMIT))
+    {
+        atomic_fetch_add_explicit(&client->deferred_messages, 1,
+                                  memory_order_relaxed);
+        return;
+    }
+
+    hazel_udp_connection_recv recv_data;
+    if (hazel_udp_connection_handle_recv_in_place(connection, buffer, ret,
+                                                  &recv_data) != 0)
+    {
+        return;
+    }
+    if (recv_data.packet_type != HAZEL_SEND_OPTION_RELIABLE
+        && recv_data.packet_type != HAZEL_SEND_OPTION_DISCONNECT)
+    {
+        return;
+    }
+
+    hazel_udp_client_delivery *spilled = malloc(
+        sizeof(hazel_udp_client_delivery));
+    if (spilled == NULL)
+    {
+        HAZEL_LOG_ERROR("network thread could not spill a message");
+        hazel_udp_connection_release_in_place(connection, buffer, ret,
+                                              &recv_data);
+        return;
+    }
+    memcpy(spilled->_buffer, buffer, (size_t)ret);
+    hazel_udp_client_fill(client, spilled, &recv_data, buffer);
+    spilled->_next = NULL;
+
+    if (client->_spilled_tail != NULL)
+    {
+        client->_spilled_tail->_next = spilled;
+    }
+    else
+    {
+        client->_spilled = spilled;
+    }
+    client->_spilled_tail = spilled;
+    client->_spilled_count++;
+}
+
+static void *hazel_udp_client_network_thread(void *arg)
+{
+    hazel_udp_client *client = arg;
+    hazel_udp_connection *connection = &client->udp_connection;
+
+    while (atomic_load_explicit(&client->_network_running,
+                                memory_order_relaxed))
+    {
+        hazel_udp_connection_send_submitted(connection, NULL);
+
+        // Spilled messages go first, so deliveries stay in order
+        hazel_udp_client_unspill(client);
+        hazel_udp_client_delivery *delivery = client->_spilled == NULL
+            ? hazel_spsc_ring_acquire(&client->_deliveries)
+            : NULL;
+        if (delivery == NULL)
+        {
+            hazel_udp_client_recv_full(client);
+            hazel_udp_connection_manage_reliable(connection);
+            continue;
+        }
+
+        int ret = hazel_udp_socket_recv(
+            &connection->_socket, delivery->_buffer,
+            sizeof(delivery->_buffer), 0,
+            HAZEL_UDP_CLIENT_NETWORK_THREAD_TIMEOUT_MS);
+
+        if (ret > 0)
+        {
+            hazel_udp_connection_recv recv_data;
+            if (hazel_udp_connection_handle_recv_in_place(
+                    connection, delivery->_buffer, ret, &recv_data) == 0)
+            {
+                if (recv_data.packet_type == HAZEL_SEND_OPTION_UNRELIABLE
+                    || recv_data.packet_type == HAZEL_SEND_OPTION_RELIABLE
+                    || recv_data.packet_type == HAZEL_SEND_OPTION_DISCONNECT)
+                {
+                    hazel_udp_client_fill(client, delivery, &recv_data,
+                                          delivery->_buffer);
+                    hazel_spsc_ring_commit(&client->_deliveries);
+                }
+            }
+        }
+        else if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE)
+        {
+            HAZEL_LOG_ERROR("network thread recv failed: %d", ret);
+        }
+
+        hazel_udp_connection_manage_reliable(connection);
+    }
+
+    return NULL;
+}
+
+int hazel_udp_client_start_network_thread(hazel_udp_client *client,
+                                          size_t capacity)
+{
+    int ret;
+
+    if (atomic_load(&client->_network_running))
+    {
+        return HAZEL_UDP_CLIENT_THREAD_RUNNING;
+    }
+
+    if ((ret = hazel_spsc_ring_init(&client->_deliveries,
+                                    sizeof(hazel_udp_client_delivery),
+                                    capacity)) != 0)
+    {
+        return ret;
+    }
+
+    atomic_store(&client->_network_running, true);
+    if (pthread_create(&client->_network_thread, NULL,
+                       hazel_udp_client_network_thread, client) != 0)
+    {
+        atomic_store(&client->_network_running, false);
+        hazel_spsc_ring_free(&client->_deliveries);
+        return HAZEL_UDP_CLIENT_THREAD_ERROR;
+    }
+
+    return 0;
+}
+
+int hazel_udp_client_stop_network_thread(hazel_udp_client *client)
+{
+    if (!atomic_exchange(&client->_network_running, false))
+    {
+        return 0;
+    }
+
+    pthread_join(client->_network_thread, NULL);
+
+    while (client->_spilled != NULL)
+    {
+        hazel_udp_client_delivery *next = client->_spilled->_next;
+        hazel_udp_client_delivery_free(client->_spilled);
+        free(client->_spilled);
+        client->_spilled = next;
+    }
+    client->_spilled_tail = NULL;
+    client->_spilled_count = 0;
+
+    hazel_udp_client_delivery *delivery;
+    while ((delivery = hazel_spsc_ring_peek(&client->_deliveries)) != NULL)
+    {
+        hazel_udp_client_delivery_free(delivery);
+        hazel_spsc_ring_release(&client->_deliveries);
+    }
+    hazel_spsc_ring_free(&client->_deliveries);
+
+    return 0;
+}
+
+hazel_udp_client_delivery *hazel_udp_client_peek(hazel_udp_client *client)
+{
+    return hazel_spsc_ring_peek(&client->_deliveries);
+}
+
+void hazel_udp_client_release(hazel_udp_client *client)
+{
+    hazel_udp_client_delivery *delivery = hazel_spsc_ring_peek(
+        &client->_deliveries);
+    if (delivery == NULL)
+    {
+        return;
+    }
+    hazel_udp_client_delivery_free(delivery);
+    hazel_spsc_ring_release(&client->_deliveries);
+}
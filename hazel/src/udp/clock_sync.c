@@ -0,0 +1,219 @@
+#include "hazel/udp/clock_sync.h"
+
+#include <string.h>
+#include <time.h>
+
+uint64_t hazel_clock_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void hazel_clock_sync_init(hazel_clock_sync *sync)
+{
+    memset(sync->_filter, 0, sizeof(sync->_filter));
+    memset(sync->_history, 0, sizeof(sync->_history));
+    sync->_filter_count = 0;
+    sync->_filter_next = 0;
+    sync->_history_count = 0;
+    sync->_history_next = 0;
+    sync->_used_local_ns = 0;
+    atomic_init(&sync->_sequence, 0);
+    atomic_init(&sync->_samples, 0);
+    atomic_init(&sync->_reference_ns, 0);
+    atomic_init(&sync->_offset_ns, 0);
+    atomic_init(&sync->_delay_ns, 0);
+    atomic_init(&sync->_drift_ppb, 0);
+}
+
+/**
+ * Least squares slope of the offsets of the picked samples over local time,
+ * in parts per billion.
+ */
+static int64_t hazel_clock_sync_fit_drift(const hazel_clock_sync *sync)
+{
+    // Too few seconds apart to tell drift from the noise of the delays
+    if (sync->_history_count < HAZEL_CLOCK_SYNC_DRIFT_MIN_SAMPLES)
+    {
+        return 0;
+    }
+
+    // Relative to the first sample, so the sums stay well inside a double
+    const hazel_clock_sync_sample *first = &sync->_history[
+        (sync->_history_next + HAZEL_CLOCK_SYNC_HISTORY
+         - sync->_history_count) % HAZEL_CLOCK_SYNC_HISTORY];
+
+    double mean_x = 0.0, mean_y = 0.0;
+    for (size_t i = 0; i < sync->_history_count; i++)
+    {
+        const hazel_clock_sync_sample *sample = &sync->_history[i];
+        mean_x += (double)(int64_t)(sample->local_ns - first->local_ns);
+        mean_y += (double)(sample->offset_ns - first->offset_ns);
+    }
+    mean_x /= (double)sync->_history_count;
+    mean_y /= (double)sync->_history_count;
+
+    double sxy = 0.0, sxx = 0.0;
+    for (size_t i = 0; i < sync->_history_count; i++)
+    {
+        const hazel_clock_sync_sample *sample = &sync->_history[i];
+        double dx = (double)(int64_t)(sample->local_ns - first->local_ns)
+            - mean_x;
+        double dy = (double)(sample->offset_ns - first->offset_ns) - mean_y;
+        sxy += dx * dy;
+        sxx += dx * dx;
+    }
+
+    double drift_ppb = sxy / sxx * 1e9;
+    double limit = HAZEL_CLOCK_SYNC_MAX_DRIFT_PPM * 1000.0;
+    if (drift_ppb > limit)
+    {
+        drift_ppb = limit;
+    }
+    else if (drift_ppb < -limit)
+    {
+        drift_ppb = -limit;
+    }
+    return (int64_t)drift_ppb;
+}
+
+/**
+ * Keep one sample per #HAZEL_CLOCK_SYNC_HISTORY_INTERVAL_MS, the one with
+ * the smallest delay, so the history spans long enough to fit the drift.
+ */
+static void hazel_clock_sync_add_history(hazel_clock_sync *sync,
+                                         const hazel_clock_sync_sample *sample)
+{
+    if (sync->_history_count > 0)
+    {
+        hazel_clock_sync_sample *last = &sync->_history[
+            (sync->_history_next + HAZEL_CLOCK_SYNC_HISTORY - 1)
+            % HAZEL_CLOCK_SYNC_HISTORY];
+        if (sample->local_ns - last->local_ns
+            < HAZEL_CLOCK_SYNC_HISTORY_INTERVAL_MS * 1000000ull)
+        {
+            if (sample->delay_ns < last->delay_ns)
+            {
+                *last = *sample;
+            }
+            return;
+        }
+    }
+
+    sync->_history[sync->_history_next] = *sample;
+    sync->_history_next = (sync->_history_next + 1) % HAZEL_CLOCK_SYNC_HISTORY;
+    if (sync->_history_count < HAZEL_CLOCK_SYNC_HISTORY)
+    {
+        sync->_history_count++;
+    }
+}
+
+void hazel_clock_sync_add(hazel_clock_sync *sync, uint64_t t1, uint64_t t2,
+                          uint64_t t3, uint64_t t4)
+{
+    // The clocks have unrelated origins, only differences between times on
+    // the same clock are meaningful
+    int64_t local_elapsed = (int64_t)(t4 - t1);
+    int64_t remote_elapsed = (int64_t)(t3 - t2);
+    if (local_elapsed < 0 || remote_elapsed < 0)
+    {
+        return;
+    }
+
+    hazel_clock_sync_sample sample;
+    sample.local_ns = t4;
+    sample.offset_ns = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+    sample.delay_ns = local_elapsed > remote_elapsed
+        ? (uint64_t)(local_elapsed - remote_elapsed) : 0;
+
+    sync->_filter[sync->_filter_next] = sample;
+    sync->_filter_next = (sync->_filter_next + 1)
+        % HAZEL_CLOCK_SYNC_FILTER_SIZE;
+    if (sync->_filter_count < HAZEL_CLOCK_SYNC_FILTER_SIZE)
+    {
+        sync->_filter_count++;
+    }
+
+    const hazel_clock_sync_sample *best = &sync->_filter[0];
+    for (size_t i = 1; i < sync->_filter_count; i++)
+    {
+        if (sync->_filter[i].delay_ns < best->delay_ns)
+        {
+            best = &sync->_filter[i];
+        }
+    }
+
+    uint64_t samples = atomic_load_explicit(&sync->_samples,
+                                            memory_order_relaxed) + 1;
+    bool picked_new = sync->_history_count == 0
+        || best->local_ns != sync->_used_local_ns;
+    if (picked_new)
+    {
+        sync->_used_local_ns = best->local_ns;
+        hazel_clock_sync_add_history(sync, best);
+    }
+    int64_t drift_ppb = picked_new
+        ? hazel_clock_sync_fit_drift(sync)
+        : atomic_load_explicit(&sync->_drift_ppb, memory_order_relaxed);
+
+    unsigned sequence = atomic_load_explicit(&sync->_sequence,
+                                             memory_order_relaxed);
+    atomic_store_explicit(&sync->_sequence, sequence + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&sync->_samples, samples, memory_order_relaxed);
+    atomic_store_explicit(&sync->_reference_ns, best->local_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&sync->_offset_ns, best->offset_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&sync->_delay_ns, best->delay_ns,
+                          memory_order_relaxed);
+    atomic_store_explicit(&sync->_drift_ppb, drift_ppb,
+                          memory_order_relaxed);
+    atomic_store_explicit(&sync->_sequence, sequence + 2,
+                          memory_order_release);
+}
+
+int hazel_clock_sync_estimate(hazel_clock_sync *sync, uint64_t local_ns,
+                              hazel_clock_estimate *out_estimate)
+{
+    uint64_t samples, reference_ns, delay_ns;
+    int64_t offset_ns, drift_ppb;
+    unsigned sequence;
+    do
+    {
+        sequence = atomic_load_explicit(&sync->_sequence,
+                                        memory_order_acquire);
+        samples = atomic_load_explicit(&sync->_samples,
+                                       memory_order_relaxed);
+        reference_ns = atomic_load_explicit(&sync->_reference_ns,
+                                            memory_order_relaxed);
+        offset_ns = atomic_load_explicit(&sync->_offset_ns,
+                                         memory_order_relaxed);
+        delay_ns = atomic_load_explicit(&sync->_delay_ns,
+                                        memory_order_relaxed);
+        drift_ppb = atomic_load_explicit(&sync->_drift_ppb,
+                                         memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) != 0
+             || atomic_load_explicit(&sync->_sequence, memory_order_relaxed)
+                    != sequence);
+
+    if (samples == 0)
+    {
+        return HAZEL_CLOCK_SYNC_NOT_SYNCED;
+    }
+
+    int64_t age_ns = (int64_t)(local_ns - reference_ns);
+    uint64_t abs_age_ns = age_ns < 0 ? (uint64_t)-age_ns : (uint64_t)age_ns;
+
+    out_estimate->offset_ns = offset_ns
+        + (int64_t)((double)age_ns * (double)drift_ppb / 1e9);
+    out_estimate->drift_ppm = (double)drift_ppb / 1000.0;
+    out_estimate->error_ns = delay_ns / 2
+        + abs_age_ns / 1000000 * HAZEL_CLOCK_SYNC_DISPERSION_PPM;
+    out_estimate->rtt_ns = delay_ns;
+    out_estimate->samples = samples;
+    return 0;
+}
@@ -1,24 +1,205 @@
 #include "hazel/udp/connection.h"
 #include "hazel/errors.h"
+#include "hazel/compress.h"
+#include "hazel/writer_unchecked.h"
 
 #include "../utils.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 int hazel_udp_connection_init(hazel_udp_connection *connection)
 {
     connection->_connection_state = HAZEL_CONNECTION_STATE_NOT_CONNECTED;
     connection->last_reliable_id = -1;
     connection->reliable_packets = NULL;
+    connection->_smoothed_rtt_us = HAZEL_RELIABLE_INITIAL_RTT_MS * 1000;
+    connection->_rtt_sampled = false;
+    hazel_udp_connection_reset_received(connection);
+    hazel_udp_connection_stats_init(&connection->_stats);
+    connection->_kernel_drops_seen = 0;
+    memset(&connection->_rx, 0, sizeof(connection->_rx));
+    hazel_clock_sync_init(&connection->_clock_sync);
+    connection->_clock_sync_interval_ms = 0;
+    connection->_next_clock_ping_ns = 0;
+    memset(connection->_ping_ids, 0, sizeof(connection->_ping_ids));
+    memset(connection->_ping_pending, 0, sizeof(connection->_ping_pending));
+    connection->_ping_next = 0;
+    connection->_arena = NULL;
+    connection->_compression = false;
+    connection->_dictionary = NULL;
+    connection->_dictionary_size = 0;
+    connection->_compress_dictionary = NULL;
+    hazel_mpsc_queue_init(&connection->_send_queue);
+    memset(&connection->handlers, 0, sizeof(connection->handlers));
+    connection->_handshake_id = 0;
     hazel_udp_socket_init(&connection->_socket);
     return 0;
 }
 
+typedef struct hazel_udp_submitted_packet
+{
+    hazel_mpsc_node node;
+
+    enum hazel_send_option send_option;
+    bool compress;
+
+    size_t size;
+    uint8_t data[];
+} hazel_udp_submitted_packet;
+
 void hazel_udp_connection_free(hazel_udp_connection *connection)
 {
+    hazel_mpsc_node *node;
+    while ((node = hazel_mpsc_queue_pop(&connection->_send_queue)) != NULL)
+    {
+        free(node);
+    }
+
+    hazel_udp_sent_packet *packet = connection->reliable_packets;
+    while (packet != NULL)
+    {
+        hazel_udp_sent_packet *next = packet->next_packet;
+        free(packet->data);
+        free(packet);
+        packet = next;
+    }
+    connection->reliable_packets = NULL;
+
+    free(connection->_compress_dictionary);
+    connection->_compress_dictionary = NULL;
+
     hazel_udp_socket_free(&connection->_socket);
 }
 
+void hazel_udp_connection_get_stats(hazel_udp_connection *connection,
+                                    hazel_udp_stats *out_stats)
+{
+    hazel_udp_connection_stats_copy(&connection->_stats, out_stats);
+}
+
+uint32_t hazel_udp_connection_rtt_us(hazel_udp_connection *connection)
+{
+    return connection->_smoothed_rtt_us;
+}
+
+static uint64_t hazel_udp_connection_elapsed_us(const struct timespec *from,
+                                                const struct timespec *to)
+{
+    return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000
+        + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+/**
+ * Put a packet on the wire and count it.
+ */
+static int hazel_udp_connection_socket_send(hazel_udp_connection *connection,
+                                            uint8_t *buffer, size_t size)
+{
+    int ret = hazel_udp_socket_send(&connection->_socket, buffer, size, 0);
+    if (ret < 0)
+    {
+        HAZEL_UDP_STATS_ADD(connection->_stats.drops, 1);
+        return ret;
+    }
+
+    size_t index = (buffer[0] & ~HAZEL_SEND_OPTION_COMPRESSED)
+        % HAZEL_UDP_STATS_SEND_OPTIONS;
+    HAZEL_UDP_STATS_ADD(connection->_stats.packets_sent[index], 1);
+    HAZEL_UDP_STATS_ADD(connection->_stats.bytes_sent[index], size);
+    return ret;
+}
+
+void hazel_udp_connection_set_arena(hazel_udp_connection *connection,
+                                    hazel_arena *arena)
+{
+    connection->_arena = arena;
+}
+
+void hazel_udp_connection_set_handlers(
+    hazel_udp_connection *connection,
+    const hazel_udp_connection_handlers *handlers)
+{
+    connection->handlers = *handlers;
+}
+
+int hazel_udp_connection_set_compression(hazel_udp_connection *connection,
+                                         bool enabled,
+                                         const uint8_t *dictionary,
+                                         size_t dictionary_size)
+{
+    hazel_compress_dictionary *compress_dictionary = NULL;
+    if (enabled && dictionary != NULL)
+    {
+        compress_dictionary = malloc(sizeof(hazel_compress_dictionary));
+        if (compress_dictionary == NULL)
+        {
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        hazel_compress_dictionary_init(compress_dictionary, dictionary,
+                                       dictionary_size);
+    }
+
+    free(connection->_compress_dictionary);
+    connection->_compress_dictionary = compress_dictionary;
+    connection->_compression = enabled;
+    connection->_dictionary = dictionary;
+    connection->_dictionary_size = dictionary != NULL ? dictionary_size : 0;
+    return 0;
+}
+
+/**
+ * Replace the payload after \p header_size bytes with its compressed form
+ * and flag the packet, if that makes it smaller by enough. \p size is
+ * updated in place.
+ */
+static void hazel_udp_connection_compress(hazel_udp_connection *connection,
+                                          uint8_t *buffer, size_t buffer_size,
+                                          size_t header_size, size_t *size)
+{
+    size_t payload_size = *size - header_size;
+    if (payload_size < HAZEL_COMPRESS_MIN_SIZE)
+    {
+        return;
+    }
+
+    uint8_t compressed[HAZEL_BUFFER_SIZE];
+    size_t compressed_size;
+    if (hazel_compress(connection->_compress_dictionary,
+                       buffer + header_size, payload_size,
+                       compressed, sizeof(compressed), &compressed_size) != 0)
+    {
+        return;
+    }
+
+    // The decompressed size as a packed integer
+    size_t framed_size = 1 + compressed_size;
+    for (size_t v = payload_size; v >= 0x80; v >>= 7)
+    {
+        framed_size++;
+    }
+    if (framed_size * 100 > payload_size * HAZEL_COMPRESS_MAX_RATIO)
+    {
+        return;
+    }
+
+    // The payload has already been compressed, it can be overwritten
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer + header_size,
+                              buffer_size - header_size);
+    if (!hazel_message_writer_reserve(&writer, framed_size))
+    {
+        return;
+    }
+    hazel_message_writer_packed_uint32_unchecked(&writer,
+                                                 (uint32_t)payload_size);
+    memcpy(hazel_message_writer_advance_unchecked(&writer, compressed_size),
+           compressed, compressed_size);
+
+    buffer[0] |= HAZEL_SEND_OPTION_COMPRESSED;
+    *size = header_size + writer.position;
+}
+
 int hazel_udp_connection_close(hazel_udp_connection *connection)
 {
     int ret = 0;
@@ -26,6 +207,45 @@ int hazel_udp_connection_close(hazel_udp_connection *connection)
     return ret;
 }
 
+/**
+ * Send a serialized packet, header included. The buffer must have room to be
+ * compressed in place.
+ */
+static int hazel_udp_connection_send_bytes(hazel_udp_connection *connection,
+                                           uint8_t *buffer, size_t buffer_size,
+                                           size_t size,
+                                           enum hazel_send_option send_option,
+                                           bool compress)
+{
+    if (connection->_connection_state != HAZEL_CONNECTION_STATE_CONNECTED)
+    {
+        return HAZEL_UDP_CONNECTION_NOT_CONNECTED;
+    }
+
+    if (compress && connection->_compression)
+    {
+        size_t header_size = send_option == HAZEL_SEND_OPTION_RELIABLE
+            ? 3
+            : 1;
+        hazel_udp_connection_compress(connection, buffer, buffer_size,
+                                      header_size, &size);
+    }
+
+    int ret;
+    if (send_option == HAZEL_SEND_OPTION_RELIABLE
+        && (ret = hazel_udp_connection_make_reliable(
+                connection, buffer, size, 1, NULL)) != 0)
+    {
+        return ret;
+    }
+
+    HAZEL_LOG_TRACE_BYTES("send to socket", buffer, size, 0);
+
+    hazel_udp_connection_socket_send(connection, buffer, size);
+
+    return 0;
+}
+
 int hazel_udp_connection_send(hazel_udp_connection *connection,
                               hazel_message_writer *writer)
 {
@@ -34,24 +254,87 @@ int hazel_udp_connection_send(hazel_udp_connection *connection,
         return HAZEL_UDP_CONNECTION_NOT_CONNECTED;
     }
 
-    uint8_t buffer[1024];
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
     size_t out_size;
-    hazel_message_writer_to_bytes(writer, buffer, sizeof(buffer), 
-                                  true, &out_size);
+    int ret;
+    if ((ret = hazel_message_writer_to_bytes(writer, buffer, sizeof(buffer),
+                                             true, &out_size)) != 0)
+    {
+        return ret;
+    }
+
+    return hazel_udp_connection_send_bytes(connection, buffer, sizeof(buffer),
+                                           out_size, writer->send_option,
+                                           writer->compress);
+}
+
+int hazel_udp_connection_submit(hazel_udp_connection *connection,
+                                hazel_message_writer *writer)
+{
+    int ret;
 
-    if (writer->send_option == HAZEL_SEND_OPTION_RELIABLE)
+    if (writer->size > HAZEL_BUFFER_SIZE)
     {
-        hazel_udp_connection_make_reliable(
-                connection, buffer, sizeof(buffer), 1, NULL);
+        return HAZEL_WRITER_CAPACITY_EXCEEDED;
     }
 
-    HAZEL_LOG_DEBUG_PRINT_BYTES("send to socket", buffer, out_size, 0);
+    hazel_udp_submitted_packet *packet = malloc(
+        sizeof(hazel_udp_submitted_packet) + writer->size);
+    if (packet == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
 
-    hazel_udp_socket_send(&connection->_socket, buffer, out_size, 0);
+    if ((ret = hazel_message_writer_to_bytes(writer, packet->data,
+                                             writer->size, true,
+                                             &packet->size)) != 0)
+    {
+        free(packet);
+        return ret;
+    }
+    packet->send_option = writer->send_option;
+    packet->compress = writer->compress;
 
+    hazel_mpsc_queue_push(&connection->_send_queue, &packet->node);
     return 0;
 }
 
+int hazel_udp_connection_send_submitted(hazel_udp_connection *connection,
+                                        size_t *out_count)
+{
+    int ret = 0;
+    size_t count = 0;
+
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_mpsc_node *node;
+    while ((node = hazel_mpsc_queue_pop(&connection->_send_queue)) != NULL)
+    {
+        hazel_udp_submitted_packet *packet
+            = (hazel_udp_submitted_packet *)node;
+
+        // Copied out so the packet can be compressed in place
+        memcpy(buffer, packet->data, packet->size);
+        int send_ret = hazel_udp_connection_send_bytes(
+            connection, buffer, sizeof(buffer), packet->size,
+            packet->send_option, packet->compress);
+        free(packet);
+
+        if (send_ret != 0)
+        {
+            ret = ret != 0 ? ret : send_ret;
+            continue;
+        }
+        count++;
+    }
+
+    if (out_count != NULL)
+    {
+        *out_count = count;
+    }
+
+    return ret;
+}
+
 int hazel_udp_connection_send_ack(hazel_udp_connection *connection,
                                   uint16_t reliable_id)
 {
@@ -60,42 +343,428 @@ int hazel_udp_connection_send_ack(hazel_udp_connection *connection,
     uint8_t arr[4] = { HAZEL_SEND_OPTION_ACK, (uint8_t)(reliable_id >> 8), (uint8_t)reliable_id, 0xFF };
 
     int ret;
-    if ((ret = hazel_udp_socket_send(&connection->_socket, arr, 4, 0)) < 0)
+    if ((ret = hazel_udp_connection_socket_send(connection, arr, 4)) < 0)
     {
         return ret;
     }
 
+    HAZEL_UDP_STATS_ADD(connection->_stats.acks_sent, 1);
     return 0;
 }
 
+static void hazel_udp_connection_write_u64(uint8_t *buffer, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        buffer[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static uint64_t hazel_udp_connection_read_u64(const uint8_t *buffer)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value |= (uint64_t)buffer[i] << (i * 8);
+    }
+    return value;
+}
+
+int hazel_udp_connection_ping(hazel_udp_connection *connection)
+{
+    uint16_t id = ++connection->last_reliable_id;
+    connection->_ping_ids[connection->_ping_next] = id;
+    connection->_ping_pending[connection->_ping_next] = true;
+    connection->_ping_next = (connection->_ping_next + 1)
+        % HAZEL_UDP_CONNECTION_PENDING_PINGS;
+
+    uint8_t arr[HAZEL_UDP_CONNECTION_PING_SIZE] = {
+        HAZEL_SEND_OPTION_PING, (uint8_t)(id >> 8), (uint8_t)id };
+    hazel_udp_connection_write_u64(arr + 3, hazel_clock_now_ns());
+
+    return hazel_udp_connection_socket_send(connection, arr, sizeof(arr));
+}
+
+/**
+ * \return true if \p id is a ping which was not acked before, which is then
+ *         taken as acked
+ */
+static bool hazel_udp_connection_ack_ping(hazel_udp_connection *connection,
+                                          uint16_t id)
+{
+    for (size_t i = 0; i < HAZEL_UDP_CONNECTION_PENDING_PINGS; i++)
+    {
+        if (connection->_ping_pending[i] && connection->_ping_ids[i] == id)
+        {
+            connection->_ping_pending[i] = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Answer a timestamped ping with \p received_ns, when it arrived, and the
+ * time just before the ack is sent.
+ */
+static int hazel_udp_connection_send_clock_ack(
+    hazel_udp_connection *connection, const uint8_t *ping,
+    uint64_t received_ns)
+{
+    uint8_t arr[HAZEL_UDP_CONNECTION_CLOCK_ACK_SIZE] = {
+        HAZEL_SEND_OPTION_ACK, ping[1], ping[2], 0xFF };
+    memcpy(arr + 4, ping + 3, 8);
+    hazel_udp_connection_write_u64(arr + 12, received_ns);
+    hazel_udp_connection_write_u64(arr + 20, hazel_clock_now_ns());
+
+    int ret;
+    if ((ret = hazel_udp_connection_socket_send(connection, arr,
+                                                sizeof(arr))) < 0)
+    {
+        return ret;
+    }
+
+    HAZEL_UDP_STATS_ADD(connection->_stats.acks_sent, 1);
+    return 0;
+}
+
+void hazel_udp_connection_set_clock_sync(hazel_udp_connection *connection,
+                                         uint32_t interval_ms)
+{
+    connection->_clock_sync_interval_ms = interval_ms;
+    connection->_next_clock_ping_ns = 0;
+}
+
+int hazel_udp_connection_remote_time(hazel_udp_connection *connection,
+                                     uint64_t *out_remote_ns,
+                                     uint64_t *out_error_ns)
+{
+    uint64_t now_ns = hazel_clock_now_ns();
+
+    hazel_clock_estimate estimate;
+    int ret;
+    if ((ret = hazel_clock_sync_estimate(&connection->_clock_sync, now_ns,
+                                         &estimate)) < 0)
+    {
+        return ret;
+    }
+
+    *out_remote_ns = now_ns + (uint64_t)estimate.offset_ns;
+    if (out_error_ns != NULL)
+    {
+        *out_error_ns = estimate.error_ns;
+    }
+    return 0;
+}
+
+int hazel_udp_connection_get_clock(hazel_udp_connection *connection,
+                                   hazel_clock_estimate *out_estimate)
+{
+    return hazel_clock_sync_estimate(&connection->_clock_sync,
+                                     hazel_clock_now_ns(), out_estimate);
+}
+
 int hazel_udp_connection_make_reliable(hazel_udp_connection *connection,
                                        uint8_t *buffer, size_t buffer_size,
                                        size_t offset, uint16_t *out_id)
 {
-    if (offset >= buffer_size)
+    if (offset + 2 > buffer_size)
     {
         return HAZEL_ERR_UNKNOWN;
     }
 
+    hazel_udp_sent_packet *packet = malloc(sizeof(hazel_udp_sent_packet));
+    uint8_t *data = malloc(buffer_size);
+    if (packet == NULL || data == NULL)
+    {
+        free(packet);
+        free(data);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
     uint16_t id = ++connection->last_reliable_id;
     
     buffer[offset] = (id >> 8);
     buffer[offset + 1] = id;
 
+    memcpy(data, buffer, buffer_size);
+    packet->id = id;
+    packet->length = (uint32_t)buffer_size;
+    packet->data = data;
+    packet->acked = false;
+    packet->retransmission_count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &packet->created_at);
+    packet->last_transmission = packet->created_at;
+    packet->tx_key = hazel_udp_socket_tx_next_key(&connection->_socket);
+    packet->tx_timestamp_ns = 0;
+    packet->tx_hardware_timestamp_ns = 0;
+    packet->callback_func = NULL;
+    packet->next_packet = connection->reliable_packets;
+    connection->reliable_packets = packet;
+
     if (out_id != NULL)
     {
         *out_id = id;
     }
 
     return 0;
-    // TODO retransmission
+}
+
+/**
+ * Whether \p timestamp was reported for the first transmission of \p packet.
+ * The key alone goes wrong once a send failed, as it is taken before the
+ * send, so the datagram sent with it must also begin with the packet's
+ * send option and ID.
+ */
+static bool hazel_udp_connection_tx_timestamp_matches(
+    const hazel_udp_sent_packet *packet,
+    const hazel_udp_tx_timestamp *timestamp)
+{
+    size_t tag_size = packet->length < HAZEL_UDP_SOCKET_TX_TAG_SIZE
+        ? packet->length : HAZEL_UDP_SOCKET_TX_TAG_SIZE;
+    return packet->retransmission_count == 0
+        && packet->tx_key == timestamp->key
+        && timestamp->tag_size == tag_size
+        && memcmp(packet->data, timestamp->tag, tag_size) == 0;
+}
+
+/**
+ * Give the reliable packets waiting for an ack the TX timestamps the kernel
+ * reported for their first transmission.
+ */
+static void hazel_udp_connection_collect_tx_timestamps(
+    hazel_udp_connection *connection)
+{
+    hazel_udp_tx_timestamp timestamp;
+    while (hazel_udp_socket_read_tx_timestamp(&connection->_socket,
+                                              &timestamp) == 0)
+    {
+        for (hazel_udp_sent_packet *packet = connection->reliable_packets;
+             packet != NULL; packet = packet->next_packet)
+        {
+            if (hazel_udp_connection_tx_timestamp_matches(packet, &timestamp))
+            {
+                if (timestamp.software_ns != 0)
+                {
+                    packet->tx_timestamp_ns = timestamp.software_ns;
+                }
+                if (timestamp.hardware_ns != 0)
+                {
+                    packet->tx_hardware_timestamp_ns = timestamp.hardware_ns;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static uint64_t hazel_udp_connection_realtime_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * The round trip time of \p packet, acked by the datagram just received. As
+ * far as the kernel timestamped them, the time the ack waited for us to
+ * receive it and the time the packet waited to be sent are left out. Only
+ * stamps of the same clock are subtracted: the network card's if both ends
+ * have one, else the kernel's software stamps.
+ */
+static uint64_t hazel_udp_connection_sample_rtt_us(
+    hazel_udp_connection *connection, hazel_udp_sent_packet *packet)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t rtt_us = hazel_udp_connection_elapsed_us(
+        &packet->last_transmission, &now);
+
+    uint64_t rx_hardware_ns = connection->_rx.hardware_timestamp_ns;
+    if (packet->tx_hardware_timestamp_ns != 0
+        && rx_hardware_ns > packet->tx_hardware_timestamp_ns)
+    {
+        return (rx_hardware_ns - packet->tx_hardware_timestamp_ns) / 1000;
+    }
+
+    uint64_t rx_ns = connection->_rx.timestamp_ns;
+    if (rx_ns == 0)
+    {
+        return rtt_us;
+    }
+    if (packet->tx_timestamp_ns != 0 && rx_ns > packet->tx_timestamp_ns)
+    {
+        return (rx_ns - packet->tx_timestamp_ns) / 1000;
+    }
+
+    uint64_t queued_us = 0;
+    uint64_t realtime_ns = hazel_udp_connection_realtime_ns();
+    if (realtime_ns > rx_ns)
+    {
+        queued_us = (realtime_ns - rx_ns) / 1000;
+    }
+    return queued_us < rtt_us ? rtt_us - queued_us : rtt_us;
+}
+
+/**
+ * Remove the packet with \p id from the retransmission list and measure the
+ * round trip time.
+ */
+static void hazel_udp_connection_ack_reliable(hazel_udp_connection *connection,
+                                              uint16_t id)
+{
+    HAZEL_UDP_STATS_ADD(connection->_stats.acks_received, 1);
+
+    hazel_udp_sent_packet **link = &connection->reliable_packets;
+    while (*link != NULL && (*link)->id != id)
+    {
+        link = &(*link)->next_packet;
+    }
+
+    hazel_udp_sent_packet *packet = *link;
+    if (packet == NULL)
+    {
+        HAZEL_UDP_STATS_ADD(connection->_stats.duplicates, 1);
+        return;
+    }
+
+    // Only packets which were sent once give an unambiguous sample
+    if (packet->retransmission_count == 0)
+    {
+        int timestamping = hazel_udp_socket_timestamping(&connection->_socket);
+        if ((timestamping & HAZEL_UDP_SOCKET_TIMESTAMP_TX)
+            && (packet->tx_timestamp_ns == 0
+                || ((timestamping & HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE)
+                    && packet->tx_hardware_timestamp_ns == 0)))
+        {
+            hazel_udp_connection_collect_tx_timestamps(connection);
+        }
+        uint64_t rtt_us = hazel_udp_connection_sample_rtt_us(connection,
+                                                             packet);
+
+        hazel_udp_connection_stats_record_rtt(&connection->_stats, rtt_us);
+        connection->_smoothed_rtt_us = connection->_rtt_sampled
+            ? (uint32_t)((connection->_smoothed_rtt_us * 7 + rtt_us) / 8)
+            : (uint32_t)rtt_us;
+        connection->_rtt_sampled = true;
+    }
+    *link = packet->next_packet;
+
+    packet->acked = true;
+    if (packet->callback_func != NULL)
+    {
+        packet->callback_func(connection, packet);
+    }
+
+    free(packet->data);
+    free(packet);
+}
+
+/**
+ * When the datagram just received arrived, on the clock of
+ * hazel_clock_now_ns(). The kernel's receive timestamp is on the wall clock,
+ * so the time since it is taken off now.
+ */
+static uint64_t hazel_udp_connection_arrival_ns(
+    hazel_udp_connection *connection)
+{
+    uint64_t now_ns = hazel_clock_now_ns();
+
+    uint64_t rx_ns = connection->_rx.timestamp_ns;
+    if (rx_ns == 0)
+    {
+        return now_ns;
+    }
+    uint64_t realtime_ns = hazel_udp_connection_realtime_ns();
+    if (realtime_ns > rx_ns && realtime_ns - rx_ns < now_ns)
+    {
+        return now_ns - (realtime_ns - rx_ns);
+    }
+    return now_ns;
+}
+
+static void hazel_udp_connection_received_bit(uint16_t id, size_t *word,
+                                              uint64_t *bit)
+{
+    size_t index = id % HAZEL_RELIABLE_RECEIVE_WINDOW;
+    *word = index / 64;
+    *bit = (uint64_t)1 << (index % 64);
+}
+
+/**
+ * \return true if \p id was not received before
+ */
+static bool hazel_udp_connection_track_received(
+    hazel_udp_connection *connection, uint16_t id)
+{
+    uint64_t *mask = connection->_received_reliable_mask;
+    size_t word;
+    uint64_t bit;
+
+    if (!connection->_received_any)
+    {
+        connection->_received_any = true;
+        connection->_received_reliable_id = id;
+        memset(connection->_received_reliable_mask, 0,
+               sizeof(connection->_received_reliable_mask));
+        hazel_udp_connection_received_bit(id, &word, &bit);
+        mask[word] |= bit;
+        return true;
+    }
+
+    // Wider than int16_t, the window may be half the ID space
+    int32_t distance = (int16_t)(id - connection->_received_reliable_id);
+    if (distance > 0)
+    {
+        // Forget the IDs whose slots the window moves onto
+        if (distance >= HAZEL_RELIABLE_RECEIVE_WINDOW)
+        {
+            memset(connection->_received_reliable_mask, 0,
+                   sizeof(connection->_received_reliable_mask));
+        }
+        else
+        {
+            for (uint16_t skipped = connection->_received_reliable_id + 1;
+                 skipped != id; skipped++)
+            {
+                hazel_udp_connection_received_bit(skipped, &word, &bit);
+                mask[word] &= ~bit;
+            }
+        }
+        hazel_udp_connection_received_bit(id, &word, &bit);
+        mask[word] |= bit;
+        connection->_received_reliable_id = id;
+        return true;
+    }
+
+    // Anything older than the window is assumed to be a duplicate
+    if (-distance >= HAZEL_RELIABLE_RECEIVE_WINDOW)
+    {
+        return false;
+    }
+    hazel_udp_connection_received_bit(id, &word, &bit);
+    if (mask[word] & bit)
+    {
+        return false;
+    }
+    mask[word] |= bit;
+    return true;
+}
+
+static uint8_t *hazel_udp_connection_alloc_reader_buffer(
+    hazel_udp_connection *connection, size_t size)
+{
+    return connection->_arena != NULL
+        ? hazel_arena_alloc(connection->_arena, size)
+        : malloc(size);
 }
 
 int hazel_udp_connection_malloc_reader(
-    uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
     size_t offset, hazel_message_reader *reader)
 {
-    uint8_t *reader_buffer = malloc(buffer_size - offset);
+    uint8_t *reader_buffer = hazel_udp_connection_alloc_reader_buffer(
+        connection, buffer_size - offset);
     if (reader_buffer == NULL)
     {
         return HAZEL_ERR_FAILED_ALLOC;
@@ -112,9 +781,69 @@ int hazel_udp_connection_malloc_reader(
     return 0;
 }
 
+static int hazel_udp_connection_decompress_reader(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    size_t offset, hazel_message_reader *reader)
+{
+    hazel_message_reader header;
+    if (!connection->_compression || offset >= buffer_size
+        || hazel_message_reader_init(&header, buffer + offset,
+                                     buffer_size - offset, 0) != 0)
+    {
+        return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
+    }
+
+    uint32_t size;
+    if (hazel_message_reader_packed_uint32(&header, &size) != 0
+        || size == 0 || size > HAZEL_COMPRESS_MAX_DECOMPRESSED_SIZE)
+    {
+        return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
+    }
+
+    uint8_t *reader_buffer = hazel_udp_connection_alloc_reader_buffer(
+        connection, size);
+    if (reader_buffer == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    size_t out_size;
+    size_t head = offset + header.read_head;
+    if (hazel_decompress(connection->_dictionary, connection->_dictionary_size,
+                         buffer + head, buffer_size - head,
+                         reader_buffer, size, &out_size) != 0
+        || out_size != size)
+    {
+        if (connection->_arena == NULL)
+        {
+            free(reader_buffer);
+        }
+        return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
+    }
+
+    return hazel_message_reader_init(reader, reader_buffer, size, 0);
+}
+
+/**
+ * Create the reader for the payload at \p offset, either pointing into
+ * \p buffer or over a copy.
+ */
+static int hazel_udp_connection_payload_reader(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    size_t offset, bool in_place, hazel_message_reader *reader)
+{
+    if (in_place)
+    {
+        return hazel_message_reader_init(reader, buffer + offset,
+                                         buffer_size - offset, 0);
+    }
+    return hazel_udp_connection_malloc_reader(connection, buffer, buffer_size,
+                                              offset, reader);
+}
+
 int hazel_udp_connection_handle_message(
     hazel_udp_connection* connection, uint8_t *buffer, size_t buffer_size,
-    hazel_udp_connection_recv *out_recv_data, bool reliable)
+    hazel_udp_connection_recv *out_recv_data, bool reliable, bool in_place)
 {
     int ret;
 
@@ -127,17 +856,35 @@ int hazel_udp_connection_handle_message(
 
     if (reliable)
     {
+        if (buffer_size < 3)
+        {
+            return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
+        }
         uint16_t reliable_id = (buffer[1] << 8) + buffer[2];
         if ((ret = hazel_udp_connection_send_ack(connection, reliable_id)) < 0)
         {
             return ret;
         }
         offset = 3;
+
+        // Acked again above in case our first ack was lost
+        if (!hazel_udp_connection_track_received(connection, reliable_id))
+        {
+            HAZEL_UDP_STATS_ADD(connection->_stats.duplicates, 1);
+            return HAZEL_UDP_CONNECTION_HANDLE_RECV_DUPLICATE;
+        }
+    }
+
+    if (buffer[0] & HAZEL_SEND_OPTION_COMPRESSED)
+    {
+        return hazel_udp_connection_decompress_reader(
+            connection, buffer, buffer_size, offset,
+            &out_recv_data->data.msg.reader);
     }
 
-    if ((ret = hazel_udp_connection_malloc_reader(
-        buffer, buffer_size, 
-        offset, &out_recv_data->data.msg.reader)) < 0)
+    if ((ret = hazel_udp_connection_payload_reader(
+        connection, buffer, buffer_size, 
+        offset, in_place, &out_recv_data->data.msg.reader)) < 0)
     {
         return ret;
     }
@@ -147,7 +894,7 @@ int hazel_udp_connection_handle_message(
 
 int hazel_udp_connection_handle_disconnect(
     hazel_udp_connection* connection, uint8_t *buffer, size_t buffer_size,
-    hazel_udp_connection_recv *out_recv_data)
+    hazel_udp_connection_recv *out_recv_data, bool in_place)
 {
     int ret;
 
@@ -158,9 +905,9 @@ int hazel_udp_connection_handle_disconnect(
 
     size_t offset = 1;
 
-    if ((ret = hazel_udp_connection_malloc_reader(
-        buffer, buffer_size, 
-        offset, &out_recv_data->data.disconnect.reader)) < 0)
+    if ((ret = hazel_udp_connection_payload_reader(
+        connection, buffer, buffer_size, 
+        offset, in_place, &out_recv_data->data.disconnect.reader)) < 0)
     {
         return ret;
     }
@@ -168,20 +915,26 @@ int hazel_udp_connection_handle_disconnect(
     return 0;
 }
 
-
-int hazel_udp_connection_handle_recv(hazel_udp_connection *connection,
-                                     uint8_t *buffer, size_t buffer_size,
-                                     hazel_udp_connection_recv *out_recv_data)
+static int hazel_udp_connection_parse_packet(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection_recv *out_recv_data, bool in_place)
 {
     if (buffer_size < 1)
     {
         return HAZEL_ERR_UNKNOWN;
     }
 
-    HAZEL_LOG_DEBUG_PRINT_BYTES("hazel_udp_connection_handle_recv", buffer, 
+    HAZEL_LOG_TRACE_BYTES("hazel_udp_connection_handle_recv", buffer, 
                                 buffer_size, 0);
 
-    enum hazel_send_option send_option = buffer[0];
+    enum hazel_send_option send_option
+        = buffer[0] & ~HAZEL_SEND_OPTION_COMPRESSED;
+    if ((buffer[0] & HAZEL_SEND_OPTION_COMPRESSED)
+        && send_option != HAZEL_SEND_OPTION_UNRELIABLE
+        && send_option != HAZEL_SEND_OPTION_RELIABLE)
+    {
+        return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
+    }
 
     switch(send_option)
     {
@@ -189,40 +942,233 @@ int hazel_udp_connection_handle_recv(hazel_udp_connection *connection,
         case HAZEL_SEND_OPTION_RELIABLE:
             return hazel_udp_connection_handle_message(
                 connection, buffer, buffer_size, out_recv_data,
-                send_option == HAZEL_SEND_OPTION_RELIABLE);
+                send_option == HAZEL_SEND_OPTION_RELIABLE, in_place);
         case HAZEL_SEND_OPTION_DISCONNECT:
             return hazel_udp_connection_handle_disconnect(
-                connection, buffer, buffer_size, out_recv_data);
+                connection, buffer, buffer_size, out_recv_data, in_place);
         case HAZEL_SEND_OPTION_ACK:
-            if (buffer_size != 4)
+            if (buffer_size != 4
+                && buffer_size != HAZEL_UDP_CONNECTION_CLOCK_ACK_SIZE)
             {
                 return HAZEL_ERR_UNKNOWN;
             }
             out_recv_data->packet_type = HAZEL_SEND_OPTION_ACK;
             out_recv_data->data.ack.reliable_id = (buffer[1] << 8) + buffer[2];
             out_recv_data->data.ack.recent_packets = buffer[3];
+            if (buffer_size == HAZEL_UDP_CONNECTION_CLOCK_ACK_SIZE)
+            {
+                // Answers a ping, which was never in the reliable list. A
+                // repeated or forged answer must not skew the clock
+                if (!hazel_udp_connection_ack_ping(
+                        connection, out_recv_data->data.ack.reliable_id))
+                {
+                    HAZEL_UDP_STATS_ADD(connection->_stats.duplicates, 1);
+                    break;
+                }
+                HAZEL_UDP_STATS_ADD(connection->_stats.acks_received, 1);
+                hazel_clock_sync_add(
+                    &connection->_clock_sync,
+                    hazel_udp_connection_read_u64(buffer + 4),
+                    hazel_udp_connection_read_u64(buffer + 12),
+                    hazel_udp_connection_read_u64(buffer + 20),
+                    hazel_udp_connection_arrival_ns(connection));
+                break;
+            }
+            if (hazel_udp_connection_ack_ping(
+                    connection, out_recv_data->data.ack.reliable_id))
+            {
+                // A plain ack to a ping, nothing to sample or resend
+                HAZEL_UDP_STATS_ADD(connection->_stats.acks_received, 1);
+                break;
+            }
+            hazel_udp_connection_ack_reliable(
+                connection, out_recv_data->data.ack.reliable_id);
             break;
         case HAZEL_SEND_OPTION_PING:
-            if (buffer_size != 3)
+            if (buffer_size != 3
+                && buffer_size != HAZEL_UDP_CONNECTION_PING_SIZE)
             {
                 return HAZEL_ERR_UNKNOWN;
             }
             out_recv_data->packet_type = HAZEL_SEND_OPTION_PING;
             out_recv_data->data.ping.reliable_id = (buffer[1] << 8) + buffer[2];
+            if (buffer_size == HAZEL_UDP_CONNECTION_PING_SIZE)
+            {
+                hazel_udp_connection_send_clock_ack(
+                    connection, buffer,
+                    hazel_udp_connection_arrival_ns(connection));
+                break;
+            }
             // TODO reliable packets
             hazel_udp_connection_send_ack(connection, 
                                           out_recv_data->data.ping.reliable_id);
             break;
         default:
             HAZEL_LOG_ERROR("Received unknown packet of type %d", buffer[0]);
-            break;
+            return HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG;
     }
 
     return 0;
 }
+
+static int hazel_udp_connection_handle_packet(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    const hazel_udp_connection_rx *rx,
+    hazel_udp_connection_recv *out_recv_data, bool in_place)
+{
+    connection->_rx = *rx;
+    out_recv_data->timestamp_ns = rx->timestamp_ns;
+    // The kernel's count is per socket since it opened, a smaller one
+    // comes from a socket opened again
+    uint32_t kernel_drops = rx->kernel_drops;
+    if (kernel_drops != connection->_kernel_drops_seen)
+    {
+        HAZEL_UDP_STATS_ADD(connection->_stats.kernel_drops,
+                            kernel_drops > connection->_kernel_drops_seen
+                                ? kernel_drops - connection->_kernel_drops_seen
+                                : kernel_drops);
+        connection->_kernel_drops_seen = kernel_drops;
+    }
+    if (buffer_size > 0)
+    {
+        size_t index = (buffer[0] & ~HAZEL_SEND_OPTION_COMPRESSED)
+            % HAZEL_UDP_STATS_SEND_OPTIONS;
+        HAZEL_UDP_STATS_ADD(connection->_stats.packets_received[index], 1);
+        HAZEL_UDP_STATS_ADD(connection->_stats.bytes_received[index],
+                            buffer_size);
+    }
+
+    int ret = hazel_udp_connection_parse_packet(
+        connection, buffer, buffer_size, out_recv_data, in_place);
+    if (ret == HAZEL_UDP_CONNECTION_HANDLE_RECV_INVALID_MSG
+        || ret == HAZEL_ERR_UNKNOWN)
+    {
+        HAZEL_UDP_STATS_ADD(connection->_stats.malformed, 1);
+    }
+    return ret;
+}
+int hazel_udp_connection_handle_recv(hazel_udp_connection *connection,
+                                     uint8_t *buffer, size_t buffer_size,
+                                     hazel_udp_connection_recv *out_recv_data)
+{
+    hazel_udp_connection_rx rx;
+    hazel_udp_connection_rx_from_socket(&connection->_socket, &rx);
+    return hazel_udp_connection_handle_packet(connection, buffer, buffer_size,
+                                              &rx, out_recv_data, false);
+}
+
+int hazel_udp_connection_handle_recv_in_place(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection_recv *out_recv_data)
+{
+    hazel_udp_connection_rx rx;
+    hazel_udp_connection_rx_from_socket(&connection->_socket, &rx);
+    return hazel_udp_connection_handle_packet(connection, buffer, buffer_size,
+                                              &rx, out_recv_data, true);
+}
+
+int hazel_udp_connection_handle_recv_rx(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    const hazel_udp_connection_rx *rx,
+    hazel_udp_connection_recv *out_recv_data)
+{
+    return hazel_udp_connection_handle_packet(connection, buffer, buffer_size,
+                                              rx, out_recv_data, true);
+}
+
+void hazel_udp_connection_reset_received(hazel_udp_connection *connection)
+{
+    connection->_received_any = false;
+    connection->_received_reliable_id = 0;
+    memset(connection->_received_reliable_mask, 0,
+           sizeof(connection->_received_reliable_mask));
+}
+
+void hazel_udp_connection_release_in_place(
+    hazel_udp_connection *connection, uint8_t *buffer, size_t buffer_size,
+    hazel_udp_connection_recv *recv_data)
+{
+    hazel_message_reader *reader;
+    switch (recv_data->packet_type)
+    {
+    case HAZEL_SEND_OPTION_UNRELIABLE:
+    case HAZEL_SEND_OPTION_RELIABLE:
+        reader = &recv_data->data.msg.reader;
+        break;
+    case HAZEL_SEND_OPTION_DISCONNECT:
+        reader = &recv_data->data.disconnect.reader;
+        break;
+    default:
+        return;
+    }
+
+    if (connection->_arena == NULL
+        && (reader->data < buffer || reader->data > buffer + buffer_size))
+    {
+        free(reader->data);
+    }
+}
+
 int hazel_udp_connection_manage_reliable(hazel_udp_connection *connection)
 {
-    HAZEL_UNUSED(connection); // TODO
-    HAZEL_LOG_DEBUG("manage reliable");
+    // Also keeps the socket's error queue from filling up
+    hazel_udp_connection_collect_tx_timestamps(connection);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (connection->_clock_sync_interval_ms != 0)
+    {
+        uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull
+            + (uint64_t)now.tv_nsec;
+        if (now_ns >= connection->_next_clock_ping_ns)
+        {
+            connection->_next_clock_ping_ns = now_ns
+                + (uint64_t)connection->_clock_sync_interval_ms * 1000000;
+            hazel_udp_connection_ping(connection);
+        }
+    }
+
+    hazel_udp_sent_packet **link = &connection->reliable_packets;
+    while (*link != NULL)
+    {
+        hazel_udp_sent_packet *packet = *link;
+
+        uint64_t timeout_us = (uint64_t)connection->_smoothed_rtt_us * 2;
+        if (timeout_us < HAZEL_RELIABLE_RESEND_MIN_MS * 1000)
+        {
+            timeout_us = HAZEL_RELIABLE_RESEND_MIN_MS * 1000;
+        }
+        timeout_us <<= packet->retransmission_count;
+        if (timeout_us > HAZEL_RELIABLE_RESEND_MAX_MS * 1000)
+        {
+            timeout_us = HAZEL_RELIABLE_RESEND_MAX_MS * 1000;
+        }
+
+        if (hazel_udp_connection_elapsed_us(&packet->last_transmission, &now)
+            < timeout_us)
+        {
+            link = &packet->next_packet;
+            continue;
+        }
+
+        if (packet->retransmission_count >= HAZEL_RELIABLE_MAX_RESENDS)
+        {
+            HAZEL_LOG_DEBUG("dropping reliable packet %d", packet->id);
+            HAZEL_UDP_STATS_ADD(connection->_stats.drops, 1);
+            *link = packet->next_packet;
+            free(packet->data);
+            free(packet);
+            continue;
+        }
+
+        packet->retransmission_count++;
+        packet->last_transmission = now;
+        HAZEL_UDP_STATS_ADD(connection->_stats.resends, 1);
+        hazel_udp_connection_socket_send(connection, packet->data,
+                                         packet->length);
+        link = &packet->next_packet;
+    }
+
     return 0;
 }
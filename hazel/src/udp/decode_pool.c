@@ -0,0 +1,369 @@
+#include "hazel/udp/decode_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HAZEL_DECODE_WORKER_INITIAL_CAPACITY 16
+
+typedef struct hazel_decode_datagram
+{
+    struct hazel_decode_datagram *next;
+    // Taken from the socket when submitted, a worker handles the datagram
+    // after the socket went on to receive others
+    hazel_udp_connection_rx rx;
+    size_t size;
+    uint8_t data[];
+} hazel_decode_datagram;
+
+typedef struct hazel_decode_worker
+{
+    hazel_decode_pool *pool;
+    pthread_t thread;
+
+    // Circular deque of queued strands
+    pthread_mutex_t lock;
+    hazel_decode_strand **strands;
+    size_t capacity;
+    size_t front;
+    size_t count;
+} hazel_decode_worker;
+
+int hazel_decode_strand_init(hazel_decode_strand *strand,
+                             hazel_udp_connection *connection,
+                             void *user_data)
+{
+    strand->connection = connection;
+    strand->user_data = user_data;
+    strand->_head = NULL;
+    strand->_tail = NULL;
+    strand->_tick = false;
+    strand->_scheduled = false;
+    if (pthread_mutex_init(&strand->_lock, NULL) != 0)
+    {
+        return HAZEL_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+void hazel_decode_strand_free(hazel_decode_strand *strand)
+{
+    hazel_decode_datagram *datagram = strand->_head;
+    while (datagram != NULL)
+    {
+        hazel_decode_datagram *next = datagram->next;
+        free(datagram);
+        datagram = next;
+    }
+    strand->_head = NULL;
+    strand->_tail = NULL;
+    pthread_mutex_destroy(&strand->_lock);
+}
+
+static int hazel_decode_worker_push(hazel_decode_worker *worker,
+                                    hazel_decode_strand *strand)
+{
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->count == worker->capacity)
+    {
+        size_t capacity = worker->capacity * 2;
+        hazel_decode_strand **strands = malloc(capacity * sizeof(*strands));
+        if (strands == NULL)
+        {
+            pthread_mutex_unlock(&worker->lock);
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        for (size_t i = 0; i < worker->count; i++)
+        {
+            strands[i] = worker->strands[(worker->front + i)
+                                         % worker->capacity];
+        }
+        free(worker->strands);
+        worker->strands = strands;
+        worker->capacity = capacity;
+        worker->front = 0;
+    }
+
+    worker->strands[(worker->front + worker->count) % worker->capacity]
+        = strand;
+    worker->count++;
+
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
+
+static hazel_decode_strand *hazel_decode_worker_pop_front(
+    hazel_decode_worker *worker)
+{
+    hazel_decode_strand *strand = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0)
+    {
+        strand = worker->strands[worker->front];
+        worker->front = (worker->front + 1) % worker->capacity;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return strand;
+}
+
+static hazel_decode_strand *hazel_decode_worker_steal(
+    hazel_decode_worker *worker)
+{
+    hazel_decode_strand *strand = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0)
+    {
+        worker->count--;
+        strand = worker->strands[(worker->front + worker->count)
+                                 % worker->capacity];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return strand;
+}
+
+static int hazel_decode_pool_schedule(hazel_decode_pool *pool,
+                                      hazel_decode_worker *worker,
+                                      hazel_decode_strand *strand)
+{
+    int ret;
+    if ((ret = hazel_decode_worker_push(worker, strand)) != 0)
+    {
+        return ret;
+    }
+
+    // Counted after the push, so a worker which claims a count always finds
+    // a strand in one of the deques
+    pthread_mutex_lock(&pool->_idle_lock);
+    pool->_queued++;
+    pthread_cond_signal(&pool->_idle_cond);
+    pthread_mutex_unlock(&pool->_idle_lock);
+    return 0;
+}
+
+static void hazel_decode_worker_run_strand(hazel_decode_worker *worker,
+                                           hazel_decode_strand *strand)
+{
+    hazel_decode_pool *pool = worker->pool;
+
+    pthread_mutex_lock(&strand->_lock);
+    hazel_decode_datagram *datagram = strand->_head;
+    strand->_head = NULL;
+    strand->_tail = NULL;
+    bool tick = strand->_tick;
+    strand->_tick = false;
+    pthread_mutex_unlock(&strand->_lock);
+
+    while (datagram != NULL)
+    {
+        hazel_udp_connection_recv recv;
+        if (hazel_udp_connection_handle_recv_rx(
+                strand->connection, datagram->data, datagram->size,
+                &datagram->rx, &recv) == 0)
+        {
+            pool->callback(strand, &recv, pool->user_data);
+            hazel_udp_connection_release_in_place(
+                strand->connection, datagram->data, datagram->size, &recv);
+        }
+
+        hazel_decode_datagram *next = datagram->next;
+        free(datagram);
+        datagram = next;
+    }
+
+    if (tick)
+    {
+        hazel_udp_connection_manage_reliable(strand->connection);
+    }
+    hazel_udp_connection_send_submitted(strand->connection, NULL);
+
+    // Datagrams which arrived during the batch go to the back of our own
+    // deque, so a busy connection cannot starve the others
+    pthread_mutex_lock(&strand->_lock);
+    bool requeue = strand->_head != NULL || strand->_tick;
+    strand->_scheduled = requeue;
+    pthread_mutex_unlock(&strand->_lock);
+
+    if (requeue && hazel_decode_pool_schedule(pool, worker, strand) != 0)
+    {
+        pthread_mutex_lock(&strand->_lock);
+        strand->_scheduled = false;
+        pthread_mutex_unlock(&strand->_lock);
+    }
+}
+
+static void *hazel_decode_worker_thread(void *arg)
+{
+    hazel_decode_worker *worker = arg;
+    hazel_decode_pool *pool = worker->pool;
+    size_t index = worker - pool->_workers;
+
+    while (true)
+    {
+        pthread_mutex_lock(&pool->_idle_lock);
+        while (pool->_queued == 0 && pool->_running)
+        {
+            pthread_cond_wait(&pool->_idle_cond, &pool->_idle_lock);
+        }
+        if (!pool->_running)
+        {
+            pthread_mutex_unlock(&pool->_idle_lock);
+            break;
+        }
+        pool->_queued--;
+        pthread_mutex_unlock(&pool->_idle_lock);
+
+        hazel_decode_strand *strand = hazel_decode_worker_pop_front(worker);
+        for (size_t i = 1; strand == NULL; i++)
+        {
+            strand = hazel_decode_worker_steal(
+                &pool->_workers[(index + i) % pool->worker_count]);
+        }
+
+        hazel_decode_worker_run_strand(worker, strand);
+    }
+
+    return NULL;
+}
+
+int hazel_decode_pool_init(hazel_decode_pool *pool, size_t worker_count,
+                           hazel_decode_callback callback, void *user_data)
+{
+    if (worker_count == 0 || callback == NULL)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    pool->callback = callback;
+    pool->user_data = user_data;
+    pool->worker_count = 0;
+    pool->_queued = 0;
+    pool->_running = true;
+    atomic_init(&pool->_next_worker, 0);
+    pthread_mutex_init(&pool->_idle_lock, NULL);
+    pthread_cond_init(&pool->_idle_cond, NULL);
+
+    pool->_workers = calloc(worker_count, sizeof(hazel_decode_worker));
+    if (pool->_workers == NULL)
+    {
+        hazel_decode_pool_free(pool);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        hazel_decode_worker *worker = &pool->_workers[i];
+        worker->pool = pool;
+        worker->capacity = HAZEL_DECODE_WORKER_INITIAL_CAPACITY;
+        worker->strands = malloc(worker->capacity * sizeof(*worker->strands));
+        if (worker->strands == NULL)
+        {
+            hazel_decode_pool_free(pool);
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        pthread_mutex_init(&worker->lock, NULL);
+
+        if (pthread_create(&worker->thread, NULL, hazel_decode_worker_thread,
+                           worker) != 0)
+        {
+            pthread_mutex_destroy(&worker->lock);
+            free(worker->strands);
+            hazel_decode_pool_free(pool);
+            return HAZEL_DECODE_POOL_THREAD_ERROR;
+        }
+        pool->worker_count++;
+    }
+
+    return 0;
+}
+
+void hazel_decode_pool_free(hazel_decode_pool *pool)
+{
+    pthread_mutex_lock(&pool->_idle_lock);
+    pool->_running = false;
+    pthread_cond_broadcast(&pool->_idle_cond);
+    pthread_mutex_unlock(&pool->_idle_lock);
+
+    for (size_t i = 0; i < pool->worker_count; i++)
+    {
+        pthread_join(pool->_workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < pool->worker_count; i++)
+    {
+        pthread_mutex_destroy(&pool->_workers[i].lock);
+        free(pool->_workers[i].strands);
+    }
+
+    free(pool->_workers);
+    pool->_workers = NULL;
+    pool->worker_count = 0;
+    pthread_mutex_destroy(&pool->_idle_lock);
+    pthread_cond_destroy(&pool->_idle_cond);
+}
+
+/**
+ * Queue \p strand on a worker unless it already is. Called with the strand's
+ * lock held, which it releases.
+ */
+static int hazel_decode_pool_wake(hazel_decode_pool *pool,
+                                  hazel_decode_strand *strand)
+{
+    bool schedule = !strand->_scheduled;
+    strand->_scheduled = true;
+    pthread_mutex_unlock(&strand->_lock);
+
+    if (!schedule)
+    {
+        return 0;
+    }
+
+    size_t index = atomic_fetch_add_explicit(&pool->_next_worker, 1,
+                                             memory_order_relaxed);
+    int ret = hazel_decode_pool_schedule(
+        pool, &pool->_workers[index % pool->worker_count], strand);
+    if (ret != 0)
+    {
+        // The work stays pending and goes out with the next submit or tick
+        pthread_mutex_lock(&strand->_lock);
+        strand->_scheduled = false;
+        pthread_mutex_unlock(&strand->_lock);
+    }
+    return ret;
+}
+
+int hazel_decode_pool_submit(hazel_decode_pool *pool,
+                             hazel_decode_strand *strand,
+                             const uint8_t *buffer, size_t size)
+{
+    hazel_decode_datagram *datagram = malloc(sizeof(hazel_decode_datagram)
+                                             + size);
+    if (datagram == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    datagram->next = NULL;
+    hazel_udp_connection_rx_from_socket(&strand->connection->_socket,
+                                        &datagram->rx);
+    datagram->size = size;
+    memcpy(datagram->data, buffer, size);
+
+    pthread_mutex_lock(&strand->_lock);
+    if (strand->_tail != NULL)
+    {
+        strand->_tail->next = datagram;
+    }
+    else
+    {
+        strand->_head = datagram;
+    }
+    strand->_tail = datagram;
+    return hazel_decode_pool_wake(pool, strand);
+}
+
+int hazel_decode_pool_tick(hazel_decode_pool *pool,
+                           hazel_decode_strand *strand)
+{
+    pthread_mutex_lock(&strand->_lock);
+    strand->_tick = true;
+    return hazel_decode_pool_wake(pool, strand);
+}
@@ -0,0 +1,189 @@
+#include "hazel/udp/event_loop.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#define HAZEL_EVENT_LOOP_INITIAL_CAPACITY 8
+
+int hazel_event_loop_init(hazel_event_loop *loop)
+{
+    loop->_count = 0;
+    loop->_capacity = HAZEL_EVENT_LOOP_INITIAL_CAPACITY;
+    loop->_connections = malloc(loop->_capacity
+                                * sizeof(*loop->_connections));
+    loop->_pollfds = malloc(loop->_capacity * sizeof(*loop->_pollfds));
+    if (loop->_connections == NULL || loop->_pollfds == NULL)
+    {
+        hazel_event_loop_free(loop);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    return 0;
+}
+
+void hazel_event_loop_free(hazel_event_loop *loop)
+{
+    free(loop->_connections);
+    free(loop->_pollfds);
+    loop->_connections = NULL;
+    loop->_pollfds = NULL;
+    loop->_count = 0;
+}
+
+int hazel_event_loop_add(hazel_event_loop *loop,
+                         hazel_udp_connection *connection)
+{
+    if (loop->_count == loop->_capacity)
+    {
+        size_t capacity = loop->_capacity * 2;
+        hazel_udp_connection **connections = realloc(
+            loop->_connections, capacity * sizeof(*connections));
+        if (connections == NULL)
+        {
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        loop->_connections = connections;
+
+        struct pollfd *pollfds = realloc(loop->_pollfds,
+                                         capacity * sizeof(*pollfds));
+        if (pollfds == NULL)
+        {
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        loop->_pollfds = pollfds;
+        loop->_capacity = capacity;
+    }
+
+    loop->_connections[loop->_count] = connection;
+    loop->_pollfds[loop->_count].fd = connection->_socket._sock_handle;
+    loop->_pollfds[loop->_count].events = POLLIN;
+    loop->_pollfds[loop->_count].revents = 0;
+    loop->_count++;
+    return 0;
+}
+
+int hazel_event_loop_remove(hazel_event_loop *loop,
+                            hazel_udp_connection *connection)
+{
+    for (size_t i = 0; i < loop->_count; i++)
+    {
+        if (loop->_connections[i] == connection)
+        {
+            loop->_count--;
+            loop->_connections[i] = loop->_connections[loop->_count];
+            loop->_pollfds[i] = loop->_pollfds[loop->_count];
+            return 0;
+        }
+    }
+    return HAZEL_EVENT_LOOP_NOT_FOUND;
+}
+
+static void hazel_event_loop_dispatch(hazel_udp_connection *connection,
+                                      hazel_udp_connection_recv *recv)
+{
+    hazel_udp_connection_handlers *handlers = &connection->handlers;
+
+    switch (recv->packet_type)
+    {
+    case HAZEL_SEND_OPTION_UNRELIABLE:
+    case HAZEL_SEND_OPTION_RELIABLE:
+        if (handlers->on_message != NULL)
+        {
+            handlers->on_message(connection, recv->packet_type,
+                                 &recv->data.msg.reader,
+                                 handlers->user_data);
+        }
+        break;
+    case HAZEL_SEND_OPTION_DISCONNECT:
+        if (handlers->on_disconnect != NULL)
+        {
+            handlers->on_disconnect(connection, &recv->data.disconnect.reader,
+                                    handlers->user_data);
+        }
+        break;
+    case HAZEL_SEND_OPTION_ACK:
+        if (connection->_connection_state
+                == HAZEL_CONNECTION_STATE_CONNECTING
+            && recv->data.ack.reliable_id == connection->_handshake_id)
+        {
+            connection->_connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+            if (handlers->on_connected != NULL)
+            {
+                handlers->on_connected(connection, handlers->user_data);
+            }
+        }
+        if (handlers->on_ack != NULL)
+        {
+            handlers->on_ack(connection, recv->data.ack.reliable_id,
+                             handlers->user_data);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+int hazel_poll(hazel_event_loop *loop, int timeout_ms)
+{
+    for (size_t i = 0; i < loop->_count; i++)
+    {
+        hazel_udp_connection_send_submitted(loop->_connections[i], NULL);
+    }
+
+    // Sockets without a descriptor, such as loopback ones, cannot be waited
+    // on, so they are checked on every call and poll only takes a look
+    bool has_virtual = false;
+    for (size_t i = 0; i < loop->_count; i++)
+    {
+        has_virtual |= loop->_pollfds[i].fd < 0;
+    }
+
+    int ready = poll(loop->_pollfds, loop->_count,
+                     has_virtual ? 0 : timeout_ms);
+    if (ready < 0)
+    {
+        return errno == EINTR ? 0 : HAZEL_EVENT_LOOP_POLL_ERROR;
+    }
+
+    int handled = 0;
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+
+    for (size_t i = 0; i < loop->_count; i++)
+    {
+        if (loop->_pollfds[i].fd >= 0
+            && (loop->_pollfds[i].revents & (POLLIN | POLLERR)) == 0)
+        {
+            continue;
+        }
+
+        hazel_udp_connection *connection = loop->_connections[i];
+        for (int budget = 0; budget < HAZEL_EVENT_LOOP_RECV_BUDGET; budget++)
+        {
+            int size = hazel_udp_socket_try_recv(&connection->_socket,
+                                                 buffer, sizeof(buffer), 0);
+            if (size <= 0)
+            {
+                break;
+            }
+
+            hazel_udp_connection_recv recv;
+            if (hazel_udp_connection_handle_recv_in_place(
+                    connection, buffer, size, &recv) != 0)
+            {
+                continue;
+            }
+
+            hazel_event_loop_dispatch(connection, &recv);
+            hazel_udp_connection_release_in_place(connection, buffer, size,
+                                                  &recv);
+            handled++;
+        }
+    }
+
+    for (size_t i = 0; i < loop->_count; i++)
+    {
+        hazel_udp_connection_manage_reliable(loop->_connections[i]);
+    }
+
+    return handled;
+}
@@ -0,0 +1,343 @@
+#include "hazel/udp/impairment.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** The longest a receive sleeps on the inner socket before releasing due
+ *  datagrams again */
+#define HAZEL_UDP_IMPAIRMENT_RECV_SLICE_MS 1
+
+typedef struct hazel_udp_impaired_datagram
+{
+    uint64_t release_ns;
+    // Keeps datagrams released at the same time in send order
+    uint64_t sequence;
+    uint32_t slot;
+    uint32_t size;
+} hazel_udp_impaired_datagram;
+
+static uint64_t hazel_udp_impairment_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/** splitmix64, so that any seed, 0 included, gives a good sequence */
+static uint64_t hazel_udp_impairment_next(hazel_udp_impairment *impairment)
+{
+    uint64_t z = (impairment->_rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/** \return true with probability \p p */
+static bool hazel_udp_impairment_chance(hazel_udp_impairment *impairment,
+                                        double p)
+{
+    if (p <= 0.0)
+    {
+        return false;
+    }
+    return (double)(hazel_udp_impairment_next(impairment) >> 11)
+        * (1.0 / 9007199254740992.0) < p;
+}
+
+int hazel_udp_impairment_init(hazel_udp_impairment *impairment,
+                              const hazel_udp_impairment_config *config,
+                              hazel_udp_socket *inner)
+{
+    memset(impairment, 0, sizeof(*impairment));
+    impairment->config = *config;
+    if (impairment->config.queue_limit == 0)
+    {
+        impairment->config.queue_limit = HAZEL_UDP_IMPAIRMENT_QUEUE_LIMIT;
+    }
+    impairment->_inner = inner;
+    impairment->_rng = config->seed;
+
+    size_t limit = impairment->config.queue_limit;
+    impairment->_heap = malloc(limit * sizeof(hazel_udp_impaired_datagram));
+    impairment->_slots = malloc(limit * HAZEL_BUFFER_SIZE);
+    impairment->_free_slots = malloc(limit * sizeof(uint32_t));
+    if (impairment->_heap == NULL || impairment->_slots == NULL
+        || impairment->_free_slots == NULL)
+    {
+        hazel_udp_impairment_free(impairment);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    for (size_t i = 0; i < limit; i++)
+    {
+        impairment->_free_slots[i] = (uint32_t)(limit - 1 - i);
+    }
+    impairment->_free_count = limit;
+    return 0;
+}
+
+void hazel_udp_impairment_free(hazel_udp_impairment *impairment)
+{
+    free(impairment->_heap);
+    free(impairment->_slots);
+    free(impairment->_free_slots);
+    impairment->_heap = NULL;
+    impairment->_slots = NULL;
+    impairment->_free_slots = NULL;
+    impairment->_count = 0;
+    impairment->_free_count = 0;
+}
+
+static bool hazel_udp_impaired_before(const hazel_udp_impaired_datagram *a,
+                                      const hazel_udp_impaired_datagram *b)
+{
+    return a->release_ns < b->release_ns
+        || (a->release_ns == b->release_ns && a->sequence < b->sequence);
+}
+
+static void hazel_udp_impairment_heap_push(
+    hazel_udp_impairment *impairment, hazel_udp_impaired_datagram datagram)
+{
+    hazel_udp_impaired_datagram *heap = impairment->_heap;
+    size_t i = impairment->_count++;
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if (!hazel_udp_impaired_before(&datagram, &heap[parent]))
+        {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = datagram;
+}
+
+static void hazel_udp_impairment_heap_pop(hazel_udp_impairment *impairment)
+{
+    hazel_udp_impaired_datagram *heap = impairment->_heap;
+    hazel_udp_impaired_datagram last = heap[--impairment->_count];
+    size_t count = impairment->_count;
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= count)
+        {
+            break;
+        }
+        if (child + 1 < count
+            && hazel_udp_impaired_before(&heap[child + 1], &heap[child]))
+        {
+            child++;
+        }
+        if (!hazel_udp_impaired_before(&heap[child], &last))
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (count > 0)
+    {
+        heap[i] = last;
+    }
+}
+
+static size_t hazel_udp_impairment_release(hazel_udp_impairment *impairment,
+                                           uint64_t now)
+{
+    size_t released = 0;
+    while (impairment->_count > 0 && impairment->_heap[0].release_ns <= now)
+    {
+        hazel_udp_impaired_datagram datagram = impairment->_heap[0];
+        hazel_udp_impairment_heap_pop(impairment);
+
+        uint8_t *data = impairment->_slots
+            + (size_t)datagram.slot * HAZEL_BUFFER_SIZE;
+        // Errors of the inner socket are losses like any other
+        hazel_udp_socket *inner = impairment->_inner;
+        inner->_vtable->send(inner, data, datagram.size, 0);
+        impairment->_free_slots[impairment->_free_count++] = datagram.slot;
+        impairment->delivered++;
+        released++;
+    }
+    return released;
+}
+
+size_t hazel_udp_impairment_flush(hazel_udp_impairment *impairment)
+{
+    if (impairment->_count == 0)
+    {
+        return 0;
+    }
+    return hazel_udp_impairment_release(impairment,
+                                        hazel_udp_impairment_now_ns());
+}
+
+/**
+ * Decide the fate of one copy of a datagram and hold it until it is due.
+ */
+static void hazel_udp_impairment_enqueue(hazel_udp_impairment *impairment,
+                                         const uint8_t *buffer, size_t size,
+                                         uint64_t now)
+{
+    const hazel_udp_impairment_config *config = &impairment->config;
+    if (impairment->_free_count == 0)
+    {
+        impairment->dropped++;
+        return;
+    }
+
+    uint64_t departure = now;
+    if (config->bandwidth_bps > 0)
+    {
+        if (impairment->_link_free_ns > departure)
+        {
+            departure = impairment->_link_free_ns;
+        }
+        departure += (uint64_t)size * 8 * 1000000000ull
+            / config->bandwidth_bps;
+        impairment->_link_free_ns = departure;
+    }
+
+    uint64_t delay_us = config->latency_us;
+    if (config->jitter_us > 0)
+    {
+        delay_us += hazel_udp_impairment_next(impairment)
+            % ((uint64_t)config->jitter_us + 1);
+    }
+    if (hazel_udp_impairment_chance(impairment, config->reorder))
+    {
+        delay_us += config->reorder_us;
+        impairment->reordered++;
+    }
+
+    hazel_udp_impaired_datagram datagram;
+    datagram.release_ns = departure + delay_us * 1000;
+    datagram.sequence = impairment->_sequence++;
+    datagram.slot = impairment->_free_slots[--impairment->_free_count];
+    datagram.size = (uint32_t)size;
+    memcpy(impairment->_slots + (size_t)datagram.slot * HAZEL_BUFFER_SIZE,
+           buffer, size);
+    hazel_udp_impairment_heap_push(impairment, datagram);
+}
+
+static int hazel_udp_impairment_send(hazel_udp_socket *socket,
+                                     uint8_t *buffer, size_t size, int flags)
+{
+    (void)flags;
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    const hazel_udp_impairment_config *config = &impairment->config;
+    if (size > HAZEL_BUFFER_SIZE)
+    {
+        return HAZEL_UDP_SOCKET_SEND_ERROR;
+    }
+
+    impairment->sent++;
+
+    if (config->burst_enter > 0.0)
+    {
+        impairment->_bad_state = impairment->_bad_state
+            ? !hazel_udp_impairment_chance(impairment, config->burst_exit)
+            : hazel_udp_impairment_chance(impairment, config->burst_enter);
+    }
+
+    double loss = impairment->_bad_state ? config->burst_loss : config->loss;
+    if (hazel_udp_impairment_chance(impairment, loss))
+    {
+        impairment->dropped++;
+    }
+    else
+    {
+        uint64_t now = hazel_udp_impairment_now_ns();
+        hazel_udp_impairment_enqueue(impairment, buffer, size, now);
+        if (hazel_udp_impairment_chance(impairment, config->duplicate))
+        {
+            impairment->duplicated++;
+            hazel_udp_impairment_enqueue(impairment, buffer, size, now);
+        }
+        hazel_udp_impairment_release(impairment, now);
+    }
+
+    // Like UDP, the sender cannot tell a lost datagram from a delivered one
+    return (int)size;
+}
+
+static int hazel_udp_impairment_try_recv(hazel_udp_socket *socket,
+                                         uint8_t *buffer, size_t size,
+                                         int flags)
+{
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    hazel_udp_impairment_flush(impairment);
+    hazel_udp_socket *inner = impairment->_inner;
+    return inner->_vtable->try_recv(inner, buffer, size, flags);
+}
+
+static int hazel_udp_impairment_recv(hazel_udp_socket *socket,
+                                     uint8_t *buffer, size_t size, int flags,
+                                     int timeout)
+{
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    uint64_t deadline = hazel_udp_impairment_now_ns()
+        + (uint64_t)(timeout > 0 ? timeout : 0) * 1000000ull;
+
+    for (;;)
+    {
+        hazel_udp_impairment_flush(impairment);
+
+        int remaining = timeout;
+        if (timeout > 0)
+        {
+            uint64_t now = hazel_udp_impairment_now_ns();
+            remaining = now >= deadline
+                ? 0
+                : (int)((deadline - now + 999999) / 1000000);
+        }
+
+        // Wake up in time to release the next held datagram
+        int wait = remaining;
+        if (impairment->_count > 0
+            && (wait < 0 || wait > HAZEL_UDP_IMPAIRMENT_RECV_SLICE_MS))
+        {
+            wait = HAZEL_UDP_IMPAIRMENT_RECV_SLICE_MS;
+        }
+
+        hazel_udp_socket *inner = impairment->_inner;
+        int ret = inner->_vtable->recv(inner, buffer, size, flags, wait);
+        if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE || wait == remaining)
+        {
+            return ret;
+        }
+    }
+}
+
+static int hazel_udp_impairment_open(hazel_udp_socket *socket,
+                                     enum hazel_ip_mode ip_mode)
+{
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_open(impairment->_inner, ip_mode);
+}
+
+static int hazel_udp_impairment_connect(hazel_udp_socket *socket,
+                                        const char *hostname, int port)
+{
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_connect(impairment->_inner, hostname, port);
+}
+
+static int hazel_udp_impairment_close(hazel_udp_socket *socket)
+{
+    hazel_udp_impairment *impairment = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_close(impairment->_inner);
+}
+
+const hazel_udp_socket_vtable hazel_udp_impairment_vtable = {
+    .open = hazel_udp_impairment_open,
+    .connect = hazel_udp_impairment_connect,
+    .send = hazel_udp_impairment_send,
+    .recv = hazel_udp_impairment_recv,
+    .try_recv = hazel_udp_impairment_try_recv,
+    .close = hazel_udp_impairment_close,
+};
@@ -0,0 +1,173 @@
+#include "hazel/udp/loopback.h"
+
+#include <string.h>
+#include <time.h>
+
+typedef struct hazel_udp_loopback_datagram
+{
+    size_t size;
+    uint8_t data[HAZEL_BUFFER_SIZE];
+} hazel_udp_loopback_datagram;
+
+static void hazel_udp_loopback_endpoint_init(
+    hazel_udp_loopback_endpoint *endpoint, hazel_spsc_ring *inbox,
+    hazel_spsc_ring *outbox)
+{
+    endpoint->_inbox = inbox;
+    endpoint->_outbox = outbox;
+    atomic_init(&endpoint->_open, false);
+    atomic_init(&endpoint->dropped, 0);
+}
+
+int hazel_udp_loopback_init(hazel_udp_loopback *loopback, size_t capacity)
+{
+    int ret;
+    if ((ret = hazel_spsc_ring_init(&loopback->_a_to_b,
+                                    sizeof(hazel_udp_loopback_datagram),
+                                    capacity)) != 0)
+    {
+        return ret;
+    }
+    if ((ret = hazel_spsc_ring_init(&loopback->_b_to_a,
+                                    sizeof(hazel_udp_loopback_datagram),
+                                    capacity)) != 0)
+    {
+        hazel_spsc_ring_free(&loopback->_a_to_b);
+        return ret;
+    }
+
+    hazel_udp_loopback_endpoint_init(&loopback->a, &loopback->_b_to_a,
+                                     &loopback->_a_to_b);
+    hazel_udp_loopback_endpoint_init(&loopback->b, &loopback->_a_to_b,
+                                     &loopback->_b_to_a);
+    return 0;
+}
+
+void hazel_udp_loopback_free(hazel_udp_loopback *loopback)
+{
+    hazel_spsc_ring_free(&loopback->_a_to_b);
+    hazel_spsc_ring_free(&loopback->_b_to_a);
+}
+
+static int hazel_udp_loopback_open(hazel_udp_socket *socket,
+                                   enum hazel_ip_mode ip_mode)
+{
+    (void)ip_mode;
+    hazel_udp_loopback_endpoint *endpoint = hazel_udp_socket_context(socket);
+    atomic_store(&endpoint->_open, true);
+    return 0;
+}
+
+static int hazel_udp_loopback_connect(hazel_udp_socket *socket,
+                                      const char *hostname, int port)
+{
+    (void)hostname;
+    (void)port;
+    hazel_udp_loopback_endpoint *endpoint = hazel_udp_socket_context(socket);
+    return atomic_load(&endpoint->_open) ? 0 : HAZEL_UDP_SOCKET_SOCKET_ERROR;
+}
+
+static int hazel_udp_loopback_close(hazel_udp_socket *socket)
+{
+    hazel_udp_loopback_endpoint *endpoint = hazel_udp_socket_context(socket);
+    atomic_store(&endpoint->_open, false);
+    return 0;
+}
+
+static int hazel_udp_loopback_send(hazel_udp_socket *socket, uint8_t *buffer,
+                                   size_t size, int flags)
+{
+    (void)flags;
+    hazel_udp_loopback_endpoint *endpoint = hazel_udp_socket_context(socket);
+    if (!atomic_load_explicit(&endpoint->_open, memory_order_relaxed)
+        || size > HAZEL_BUFFER_SIZE)
+    {
+        return HAZEL_UDP_SOCKET_SEND_ERROR;
+    }
+
+    hazel_udp_loopback_datagram *datagram
+        = hazel_spsc_ring_acquire(endpoint->_outbox);
+    if (datagram == NULL)
+    {
+        atomic_store_explicit(
+            &endpoint->dropped,
+            atomic_load_explicit(&endpoint->dropped, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+        return (int)size;
+    }
+
+    datagram->size = size;
+    memcpy(datagram->data, buffer, size);
+    hazel_spsc_ring_commit(endpoint->_outbox);
+    return (int)size;
+}
+
+static int hazel_udp_loopback_try_recv(hazel_udp_socket *socket,
+                                       uint8_t *buffer, size_t size,
+                                       int flags)
+{
+    (void)flags;
+    hazel_udp_loopback_endpoint *endpoint = hazel_udp_socket_context(socket);
+    if (!atomic_load_explicit(&endpoint->_open, memory_order_relaxed))
+    {
+        return HAZEL_UDP_SOCKET_RECV_ERROR;
+    }
+
+    hazel_udp_loopback_datagram *datagram
+        = hazel_spsc_ring_peek(endpoint->_inbox);
+    if (datagram == NULL)
+    {
+        return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+    }
+
+    // Truncated like a kernel UDP socket would
+    size_t copied = datagram->size < size ? datagram->size : size;
+    memcpy(buffer, datagram->data, copied);
+    hazel_spsc_ring_release(endpoint->_inbox);
+    return (int)copied;
+}
+
+static int hazel_udp_loopback_recv(hazel_udp_socket *socket, uint8_t *buffer,
+                                   size_t size, int flags, int timeout)
+{
+    int ret = hazel_udp_loopback_try_recv(socket, buffer, size, flags);
+    if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE || timeout == 0)
+    {
+        return ret;
+    }
+
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (long)(timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    const struct timespec wait = { 0, HAZEL_UDP_LOOPBACK_WAIT_US * 1000L };
+    do
+    {
+        nanosleep(&wait, NULL);
+        ret = hazel_udp_loopback_try_recv(socket, buffer, size, flags);
+        if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE)
+        {
+            return ret;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (timeout < 0 || now.tv_sec < deadline.tv_sec
+             || (now.tv_sec == deadline.tv_sec
+                 && now.tv_nsec < deadline.tv_nsec));
+
+    return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+}
+
+const hazel_udp_socket_vtable hazel_udp_loopback_vtable = {
+    .open = hazel_udp_loopback_open,
+    .connect = hazel_udp_loopback_connect,
+    .send = hazel_udp_loopback_send,
+    .recv = hazel_udp_loopback_recv,
+    .try_recv = hazel_udp_loopback_try_recv,
+    .close = hazel_udp_loopback_close,
+};
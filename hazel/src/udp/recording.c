@@ -0,0 +1,444 @@
+#include "hazel/udp/recording.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#define HAZEL_UDP_RECORDING_HEADER_SIZE 16
+#define HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE 12
+
+static const uint8_t hazel_udp_recording_magic[4] = { 'H', 'Z', 'R', 'C' };
+
+static uint64_t hazel_udp_recording_now_ns(clockid_t clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void hazel_udp_recording_put(uint8_t *out, uint64_t value,
+                                    size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t hazel_udp_recording_get(const uint8_t *in, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+int hazel_udp_recorder_open(hazel_udp_recorder *recorder, const char *path,
+                            hazel_udp_socket *inner)
+{
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->_inner = inner;
+    recorder->_file = fopen(path, "wb");
+    if (recorder->_file == NULL)
+    {
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+
+    uint8_t header[HAZEL_UDP_RECORDING_HEADER_SIZE];
+    memcpy(header, hazel_udp_recording_magic, 4);
+    hazel_udp_recording_put(header + 4, HAZEL_UDP_RECORDING_VERSION, 4);
+    hazel_udp_recording_put(header + 8,
+                            hazel_udp_recording_now_ns(CLOCK_REALTIME), 8);
+    recorder->_start_ns = hazel_udp_recording_now_ns(CLOCK_MONOTONIC);
+
+    if (fwrite(header, sizeof(header), 1, recorder->_file) != 1)
+    {
+        fclose(recorder->_file);
+        recorder->_file = NULL;
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    recorder->bytes = sizeof(header);
+    return 0;
+}
+
+int hazel_udp_recorder_write(hazel_udp_recorder *recorder,
+                             const uint8_t *data, size_t size)
+{
+    if (size > UINT32_MAX)
+    {
+        return HAZEL_UDP_RECORDING_WRITE_ERROR;
+    }
+
+    uint8_t header[HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE];
+    hazel_udp_recording_put(header,
+                            hazel_udp_recording_now_ns(CLOCK_MONOTONIC)
+                                - recorder->_start_ns,
+                            8);
+    hazel_udp_recording_put(header + 8, size, 4);
+    if (fwrite(header, sizeof(header), 1, recorder->_file) != 1
+        || fwrite(data, 1, size, recorder->_file) != size)
+    {
+        return HAZEL_UDP_RECORDING_WRITE_ERROR;
+    }
+
+    recorder->records++;
+    recorder->bytes += sizeof(header) + size;
+    return 0;
+}
+
+int hazel_udp_recorder_close(hazel_udp_recorder *recorder)
+{
+    if (recorder->_file == NULL)
+    {
+        return 0;
+    }
+    int ret = fclose(recorder->_file) == 0
+        ? 0 : HAZEL_UDP_RECORDING_WRITE_ERROR;
+    recorder->_file = NULL;
+    return ret;
+}
+
+static int hazel_udp_recorder_recv(hazel_udp_socket *socket, uint8_t *buffer,
+                                   size_t size, int flags, int timeout)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    hazel_udp_socket *inner = recorder->_inner;
+    int ret = inner->_vtable->recv(inner, buffer, size, flags, timeout);
+    if (ret > 0)
+    {
+        // A full disk loses the recording, not the session
+        hazel_udp_recorder_write(recorder, buffer, (size_t)ret);
+    }
+    return ret;
+}
+
+static int hazel_udp_recorder_try_recv(hazel_udp_socket *socket,
+                                       uint8_t *buffer, size_t size,
+                                       int flags)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    hazel_udp_socket *inner = recorder->_inner;
+    int ret = inner->_vtable->try_recv(inner, buffer, size, flags);
+    if (ret > 0)
+    {
+        hazel_udp_recorder_write(recorder, buffer, (size_t)ret);
+    }
+    return ret;
+}
+
+static int hazel_udp_recorder_send(hazel_udp_socket *socket, uint8_t *buffer,
+                                   size_t size, int flags)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    hazel_udp_socket *inner = recorder->_inner;
+    return inner->_vtable->send(inner, buffer, size, flags);
+}
+
+static int hazel_udp_recorder_open_socket(hazel_udp_socket *socket,
+                                          enum hazel_ip_mode ip_mode)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_open(recorder->_inner, ip_mode);
+}
+
+static int hazel_udp_recorder_connect(hazel_udp_socket *socket,
+                                      const char *hostname, int port)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_connect(recorder->_inner, hostname, port);
+}
+
+static int hazel_udp_recorder_close_socket(hazel_udp_socket *socket)
+{
+    hazel_udp_recorder *recorder = hazel_udp_socket_context(socket);
+    return hazel_udp_socket_close(recorder->_inner);
+}
+
+const hazel_udp_socket_vtable hazel_udp_recorder_vtable = {
+    .open = hazel_udp_recorder_open_socket,
+    .connect = hazel_udp_recorder_connect,
+    .send = hazel_udp_recorder_send,
+    .recv = hazel_udp_recorder_recv,
+    .try_recv = hazel_udp_recorder_try_recv,
+    .close = hazel_udp_recorder_close_socket,
+};
+
+#if !defined(_WIN32)
+static int hazel_udp_replay_load(hazel_udp_replay *replay, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    if ((size_t)st.st_size < HAZEL_UDP_RECORDING_HEADER_SIZE)
+    {
+        close(fd);
+        return HAZEL_UDP_RECORDING_FORMAT_ERROR;
+    }
+
+    // Private and writable so that readers may be handed a non-const buffer
+    // without the file changing under them
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    replay->_data = data;
+    replay->_size = (size_t)st.st_size;
+    return 0;
+}
+
+static void hazel_udp_replay_unload(hazel_udp_replay *replay)
+{
+    munmap(replay->_data, replay->_size);
+}
+#else
+// Without mmap the whole file is read into a buffer of its own
+static int hazel_udp_replay_load(hazel_udp_replay *replay, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        size = ftell(file);
+    }
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    if ((size_t)size < HAZEL_UDP_RECORDING_HEADER_SIZE)
+    {
+        fclose(file);
+        return HAZEL_UDP_RECORDING_FORMAT_ERROR;
+    }
+
+    uint8_t *data = malloc((size_t)size);
+    if (data == NULL)
+    {
+        fclose(file);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    if (fread(data, (size_t)size, 1, file) != 1)
+    {
+        free(data);
+        fclose(file);
+        return HAZEL_UDP_RECORDING_OPEN_ERROR;
+    }
+    fclose(file);
+
+    replay->_data = data;
+    replay->_size = (size_t)size;
+    return 0;
+}
+
+static void hazel_udp_replay_unload(hazel_udp_replay *replay)
+{
+    free(replay->_data);
+}
+#endif
+
+int hazel_udp_replay_open(hazel_udp_replay *replay, const char *path)
+{
+    memset(replay, 0, sizeof(*replay));
+
+    int ret = hazel_udp_replay_load(replay, path);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    if (memcmp(replay->_data, hazel_udp_recording_magic, 4) != 0
+        || hazel_udp_recording_get(replay->_data + 4, 4)
+               != HAZEL_UDP_RECORDING_VERSION)
+    {
+        hazel_udp_replay_close(replay);
+        return HAZEL_UDP_RECORDING_FORMAT_ERROR;
+    }
+    replay->started_at_ns = hazel_udp_recording_get(replay->_data + 8, 8);
+    replay->_offset = HAZEL_UDP_RECORDING_HEADER_SIZE;
+    return 0;
+}
+
+void hazel_udp_replay_close(hazel_udp_replay *replay)
+{
+    if (replay->_data != NULL)
+    {
+        hazel_udp_replay_unload(replay);
+    }
+    replay->_data = NULL;
+    replay->_size = 0;
+    replay->_offset = 0;
+}
+
+void hazel_udp_replay_rewind(hazel_udp_replay *replay)
+{
+    replay->_offset = HAZEL_UDP_RECORDING_HEADER_SIZE;
+}
+
+int hazel_udp_replay_next(hazel_udp_replay *replay,
+                          hazel_udp_replay_record *out_record)
+{
+    size_t remaining = replay->_size - replay->_offset;
+    if (remaining == 0)
+    {
+        return HAZEL_UDP_RECORDING_END;
+    }
+    if (remaining < HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE)
+    {
+        return HAZEL_UDP_RECORDING_FORMAT_ERROR;
+    }
+
+    uint8_t *header = replay->_data + replay->_offset;
+    size_t size = (size_t)hazel_udp_recording_get(header + 8, 4);
+    if (remaining - HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE < size)
+    {
+        return HAZEL_UDP_RECORDING_FORMAT_ERROR;
+    }
+
+    out_record->timestamp_ns = hazel_udp_recording_get(header, 8);
+    out_record->data = header + HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE;
+    out_record->size = size;
+    replay->_offset += HAZEL_UDP_RECORDING_RECORD_HEADER_SIZE + size;
+    return 0;
+}
+
+int hazel_udp_replay_run(hazel_udp_replay *replay,
+                         hazel_udp_connection *connection,
+                         enum hazel_udp_replay_pace pace,
+                         hazel_udp_replay_callback callback, void *user_data)
+{
+    // The recording starts over, so its reliable IDs are new to the
+    // connection again
+    if (replay->_offset == HAZEL_UDP_RECORDING_HEADER_SIZE)
+    {
+        hazel_udp_connection_reset_received(connection);
+    }
+
+    uint64_t start_ns = hazel_udp_recording_now_ns(CLOCK_MONOTONIC);
+    uint64_t first_timestamp_ns = 0;
+    bool first = true;
+
+    hazel_udp_replay_record record;
+    int ret;
+    while ((ret = hazel_udp_replay_next(replay, &record)) == 0)
+    {
+        if (pace == HAZEL_UDP_REPLAY_REAL_TIME)
+        {
+            if (first)
+            {
+                first_timestamp_ns = record.timestamp_ns;
+                first = false;
+            }
+            uint64_t due = start_ns + (record.timestamp_ns - first_timestamp_ns);
+            uint64_t now = hazel_udp_recording_now_ns(CLOCK_MONOTONIC);
+            if (due > now)
+            {
+                struct timespec wait = {
+                    .tv_sec = (time_t)((due - now) / 1000000000ull),
+                    .tv_nsec = (long)((due - now) % 1000000000ull),
+                };
+                nanosleep(&wait, NULL);
+            }
+        }
+
+        replay->replayed++;
+        hazel_udp_connection_recv recv;
+        if (hazel_udp_connection_handle_recv_in_place(connection, record.data,
+                                                      record.size, &recv) != 0)
+        {
+            replay->rejected++;
+            continue;
+        }
+        if (callback != NULL)
+        {
+            callback(connection, &recv, user_data);
+        }
+        hazel_udp_connection_release_in_place(connection, record.data,
+                                              record.size, &recv);
+    }
+    return ret == HAZEL_UDP_RECORDING_END ? 0 : ret;
+}
+
+static int hazel_udp_replay_sink_open(hazel_udp_socket *socket,
+                                      enum hazel_ip_mode ip_mode)
+{
+    (void)socket;
+    (void)ip_mode;
+    return 0;
+}
+
+static int hazel_udp_replay_sink_connect(hazel_udp_socket *socket,
+                                         const char *hostname, int port)
+{
+    (void)socket;
+    (void)hostname;
+    (void)port;
+    return 0;
+}
+
+static int hazel_udp_replay_sink_send(hazel_udp_socket *socket,
+                                      uint8_t *buffer, size_t size, int flags)
+{
+    (void)socket;
+    (void)buffer;
+    (void)flags;
+    return (int)size;
+}
+
+static int hazel_udp_replay_sink_recv(hazel_udp_socket *socket,
+                                      uint8_t *buffer, size_t size, int flags,
+                                      int timeout)
+{
+    (void)socket;
+    (void)buffer;
+    (void)size;
+    (void)flags;
+    (void)timeout;
+    return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+}
+
+static int hazel_udp_replay_sink_try_recv(hazel_udp_socket *socket,
+                                          uint8_t *buffer, size_t size,
+                                          int flags)
+{
+    return hazel_udp_replay_sink_recv(socket, buffer, size, flags, 0);
+}
+
+static int hazel_udp_replay_sink_close(hazel_udp_socket *socket)
+{
+    (void)socket;
+    return 0;
+}
+
+const hazel_udp_socket_vtable hazel_udp_replay_sink_vtable = {
+    .open = hazel_udp_replay_sink_open,
+    .connect = hazel_udp_replay_sink_connect,
+    .send = hazel_udp_replay_sink_send,
+    .recv = hazel_udp_replay_sink_recv,
+    .try_recv = hazel_udp_replay_sink_try_recv,
+    .close = hazel_udp_replay_sink_close,
+};
@@ -0,0 +1,454 @@
+#include "hazel/udp/resolver.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#   include <sys/socket.h>
+#   include <netdb.h>
+#else
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#endif
+
+typedef struct hazel_resolver_waiter
+{
+    hazel_resolver_callback callback;
+    void *user_data;
+    struct hazel_resolver_waiter *next;
+} hazel_resolver_waiter;
+
+typedef struct hazel_resolver_query
+{
+    char hostname[HAZEL_RESOLVER_HOSTNAME_SIZE];
+    enum hazel_ip_mode ip_mode;
+    bool started;
+    hazel_resolver_waiter *waiters;
+    struct hazel_resolver_query *next;
+} hazel_resolver_query;
+
+static uint64_t hazel_resolver_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * The live cache entry of \p hostname, or NULL. Called with the lock held.
+ */
+static hazel_resolver_entry *hazel_resolver_find(hazel_resolver *resolver,
+                                                 const char *hostname,
+                                                 enum hazel_ip_mode ip_mode,
+                                                 uint64_t now_ns)
+{
+    for (size_t i = 0; i < HAZEL_RESOLVER_CACHE_SIZE; i++)
+    {
+        hazel_resolver_entry *entry = &resolver->_cache[i];
+        if (entry->expires_ns > now_ns && entry->ip_mode == ip_mode
+            && strcmp(entry->hostname, hostname) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remember the outcome of a lookup, in place of the entry which expires
+ * first. Called with the lock held.
+ */
+static void hazel_resolver_store(hazel_resolver *resolver,
+                                 const hazel_resolver_query *query, int status,
+                                 const hazel_udp_address *address)
+{
+    hazel_resolver_entry *slot = &resolver->_cache[0];
+    for (size_t i = 0; i < HAZEL_RESOLVER_CACHE_SIZE; i++)
+    {
+        hazel_resolver_entry *entry = &resolver->_cache[i];
+        if (entry->ip_mode == query->ip_mode
+            && strcmp(entry->hostname, query->hostname) == 0)
+        {
+            slot = entry;
+            break;
+        }
+        if (entry->expires_ns < slot->expires_ns)
+        {
+            slot = entry;
+        }
+    }
+
+    memcpy(slot->hostname, query->hostname, sizeof(slot->hostname));
+    slot->ip_mode = query->ip_mode;
+    slot->status = status;
+    if (status == 0)
+    {
+        slot->address = *address;
+    }
+    slot->expires_ns = hazel_resolver_now_ns() + (status == 0
+        ? HAZEL_RESOLVER_TTL_MS : HAZEL_RESOLVER_NEGATIVE_TTL_MS) * 1000000ull;
+}
+
+static int hazel_resolver_getaddrinfo(const char *hostname,
+                                      enum hazel_ip_mode ip_mode,
+                                      hazel_udp_address *out_address)
+{
+    int family = ip_mode == HAZEL_IP_MODE_IPV6 ? AF_INET6 : AF_INET;
+
+    struct addrinfo hints, *result, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (getaddrinfo(hostname, NULL, &hints, &result) != 0)
+    {
+        return HAZEL_RESOLVER_FAILED;
+    }
+
+    int ret = HAZEL_RESOLVER_FAILED;
+    for (rp = result; rp != NULL; rp = rp->ai_next)
+    {
+        if (rp->ai_family == family && rp->ai_addrlen <= HAZEL_UDP_ADDRESS_SIZE)
+        {
+            memcpy(out_address->data, rp->ai_addr, rp->ai_addrlen);
+            out_address->length = (uint32_t)rp->ai_addrlen;
+            ret = 0;
+            break;
+        }
+    }
+
+    freeaddrinfo(result);
+    return ret;
+}
+
+static void hazel_resolver_notify(hazel_resolver_waiter *waiters, int status,
+                                  const hazel_udp_address *address)
+{
+    while (waiters != NULL)
+    {
+        hazel_resolver_waiter *next = waiters->next;
+        waiters->callback(status, status == 0 ? address : NULL,
+                          waiters->user_data);
+        free(waiters);
+        waiters = next;
+    }
+}
+
+static void *hazel_resolver_thread(void *arg)
+{
+    hazel_resolver *resolver = arg;
+
+    pthread_mutex_lock(&resolver->_lock);
+    for (;;)
+    {
+        hazel_resolver_query *query = resolver->_queries;
+        while (query != NULL && query->started)
+        {
+            query = query->next;
+        }
+        if (query == NULL)
+        {
+            if (!resolver->_running)
+            {
+                break;
+            }
+            pthread_cond_wait(&resolver->_cond, &resolver->_lock);
+            continue;
+        }
+        query->started = true;
+        pthread_mutex_unlock(&resolver->_lock);
+
+        atomic_fetch_add_explicit(&resolver->lookups, 1, memory_order_relaxed);
+        hazel_udp_address address;
+        int status = hazel_resolver_getaddrinfo(query->hostname,
+                                                query->ip_mode, &address);
+
+        pthread_mutex_lock(&resolver->_lock);
+        hazel_resolver_store(resolver, query, status, &address);
+        hazel_resolver_query **link = &resolver->_queries;
+        while (*link != query)
+        {
+            link = &(*link)->next;
+        }
+        *link = query->next;
+        // Requests added to the query while it ran are answered too
+        hazel_resolver_waiter *waiters = query->waiters;
+        pthread_mutex_unlock(&resolver->_lock);
+
+        hazel_resolver_notify(waiters, status, &address);
+        free(query);
+
+        pthread_mutex_lock(&resolver->_lock);
+    }
+    pthread_mutex_unlock(&resolver->_lock);
+    return NULL;
+}
+
+int hazel_resolver_init(hazel_resolver *resolver, size_t thread_count)
+{
+    // No thread would ever take a lookup
+    if (thread_count == 0)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    atomic_init(&resolver->cache_hits, 0);
+    atomic_init(&resolver->lookups, 0);
+    resolver->thread_count = 0;
+    resolver->_queries = NULL;
+    resolver->_running = true;
+    memset(resolver->_cache, 0, sizeof(resolver->_cache));
+    pthread_mutex_init(&resolver->_lock, NULL);
+    pthread_cond_init(&resolver->_cond, NULL);
+
+    resolver->_threads = calloc(thread_count, sizeof(pthread_t));
+    if (resolver->_threads == NULL)
+    {
+        hazel_resolver_free(resolver);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        if (pthread_create(&resolver->_threads[i], NULL,
+                           hazel_resolver_thread, resolver) != 0)
+        {
+            hazel_resolver_free(resolver);
+            return HAZEL_RESOLVER_THREAD_ERROR;
+        }
+        resolver->thread_count++;
+    }
+
+    return 0;
+}
+
+void hazel_resolver_free(hazel_resolver *resolver)
+{
+    pthread_mutex_lock(&resolver->_lock);
+    resolver->_running = false;
+    // Threads finish the lookups they started, the rest are cancelled
+    hazel_resolver_query *cancelled = NULL;
+    hazel_resolver_query **link = &resolver->_queries;
+    while (*link != NULL)
+    {
+        hazel_resolver_query *query = *link;
+        if (query->started)
+        {
+            link = &query->next;
+            continue;
+        }
+        *link = query->next;
+        query->next = cancelled;
+        cancelled = query;
+    }
+    pthread_cond_broadcast(&resolver->_cond);
+    pthread_mutex_unlock(&resolver->_lock);
+
+    for (size_t i = 0; i < resolver->thread_count; i++)
+    {
+        pthread_join(resolver->_threads[i], NULL);
+    }
+
+    while (cancelled != NULL)
+    {
+        hazel_resolver_query *next = cancelled->next;
+        hazel_resolver_notify(cancelled->waiters, HAZEL_RESOLVER_CANCELLED,
+                              NULL);
+        free(cancelled);
+        cancelled = next;
+    }
+
+    // The lock outlives the threads, so that lookups asked for too late
+    // are turned away instead of touching a destroyed mutex
+    free(resolver->_threads);
+    resolver->_threads = NULL;
+    resolver->thread_count = 0;
+}
+
+int hazel_resolver_resolve(hazel_resolver *resolver, const char *hostname,
+                           enum hazel_ip_mode ip_mode,
+                           hazel_resolver_callback callback, void *user_data)
+{
+    if (strlen(hostname) >= HAZEL_RESOLVER_HOSTNAME_SIZE)
+    {
+        return HAZEL_RESOLVER_FAILED;
+    }
+
+    hazel_resolver_waiter *waiter = malloc(sizeof(hazel_resolver_waiter));
+    if (waiter == NULL)
+    {
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    waiter->callback = callback;
+    waiter->user_data = user_data;
+    waiter->next = NULL;
+
+    pthread_mutex_lock(&resolver->_lock);
+    if (!resolver->_running)
+    {
+        pthread_mutex_unlock(&resolver->_lock);
+        free(waiter);
+        return HAZEL_RESOLVER_CANCELLED;
+    }
+
+    hazel_resolver_entry *entry = hazel_resolver_find(
+        resolver, hostname, ip_mode, hazel_resolver_now_ns());
+    if (entry != NULL)
+    {
+        int status = entry->status;
+        hazel_udp_address address = entry->address;
+        pthread_mutex_unlock(&resolver->_lock);
+
+        atomic_fetch_add_explicit(&resolver->cache_hits, 1,
+                                  memory_order_relaxed);
+        hazel_resolver_notify(waiter, status, &address);
+        return 0;
+    }
+
+    hazel_resolver_query **link = &resolver->_queries;
+    while (*link != NULL)
+    {
+        hazel_resolver_query *query = *link;
+        if (query->ip_mode == ip_mode
+            && strcmp(query->hostname, hostname) == 0)
+        {
+            waiter->next = query->waiters;
+            query->waiters = waiter;
+            pthread_mutex_unlock(&resolver->_lock);
+            return 0;
+        }
+        link = &query->next;
+    }
+
+    hazel_resolver_query *query = malloc(sizeof(hazel_resolver_query));
+    if (query == NULL)
+    {
+        pthread_mutex_unlock(&resolver->_lock);
+        free(waiter);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+    strcpy(query->hostname, hostname);
+    query->ip_mode = ip_mode;
+    query->started = false;
+    query->waiters = waiter;
+    query->next = NULL;
+    *link = query;
+
+    pthread_cond_signal(&resolver->_cond);
+    pthread_mutex_unlock(&resolver->_lock);
+    return 0;
+}
+
+int hazel_resolver_lookup(hazel_resolver *resolver, const char *hostname,
+                          enum hazel_ip_mode ip_mode,
+                          hazel_udp_address *out_address)
+{
+    int ret = HAZEL_RESOLVER_NOT_CACHED;
+
+    pthread_mutex_lock(&resolver->_lock);
+    hazel_resolver_entry *entry = hazel_resolver_find(
+        resolver, hostname, ip_mode, hazel_resolver_now_ns());
+    if (entry != NULL)
+    {
+        ret = entry->status;
+        if (ret == 0)
+        {
+            *out_address = entry->address;
+        }
+    }
+    pthread_mutex_unlock(&resolver->_lock);
+
+    if (ret != HAZEL_RESOLVER_NOT_CACHED)
+    {
+        atomic_fetch_add_explicit(&resolver->cache_hits, 1,
+                                  memory_order_relaxed);
+    }
+    return ret;
+}
+
+/**
+ * Hands the outcome of a lookup to hazel_resolver_resolve_wait().
+ */
+typedef struct hazel_resolver_wait
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    int status;
+    hazel_udp_address address;
+} hazel_resolver_wait;
+
+static void hazel_resolver_wait_done(int status,
+                                     const hazel_udp_address *address,
+                                     void *user_data)
+{
+    hazel_resolver_wait *wait = user_data;
+    pthread_mutex_lock(&wait->lock);
+    wait->status = status;
+    if (status == 0)
+    {
+        wait->address = *address;
+    }
+    wait->done = true;
+    pthread_cond_signal(&wait->cond);
+    pthread_mutex_unlock(&wait->lock);
+}
+
+int hazel_resolver_resolve_wait(hazel_resolver *resolver,
+                                const char *hostname,
+                                enum hazel_ip_mode ip_mode,
+                                hazel_udp_address *out_address)
+{
+    if (resolver == NULL)
+    {
+        return hazel_resolver_getaddrinfo(hostname, ip_mode, out_address);
+    }
+
+    hazel_resolver_wait wait;
+    pthread_mutex_init(&wait.lock, NULL);
+    pthread_cond_init(&wait.cond, NULL);
+    wait.done = false;
+    wait.status = HAZEL_RESOLVER_FAILED;
+
+    int ret = hazel_resolver_resolve(resolver, hostname, ip_mode,
+                                     hazel_resolver_wait_done, &wait);
+    if (ret == 0)
+    {
+        pthread_mutex_lock(&wait.lock);
+        while (!wait.done)
+        {
+            pthread_cond_wait(&wait.cond, &wait.lock);
+        }
+        pthread_mutex_unlock(&wait.lock);
+
+        ret = wait.status;
+        if (ret == 0)
+        {
+            *out_address = wait.address;
+        }
+    }
+
+    pthread_mutex_destroy(&wait.lock);
+    pthread_cond_destroy(&wait.cond);
+    return ret;
+}
+
+static hazel_resolver hazel_resolver_default_instance;
+static hazel_resolver *hazel_resolver_default_pointer = NULL;
+static pthread_once_t hazel_resolver_default_once = PTHREAD_ONCE_INIT;
+
+static void hazel_resolver_default_init(void)
+{
+    if (hazel_resolver_init(&hazel_resolver_default_instance,
+                            HAZEL_RESOLVER_DEFAULT_THREADS) == 0)
+    {
+        hazel_resolver_default_pointer = &hazel_resolver_default_instance;
+    }
+}
+
+hazel_resolver *hazel_resolver_default(void)
+{
+    pthread_once(&hazel_resolver_default_once, hazel_resolver_default_init);
+    return hazel_resolver_default_pointer;
+}
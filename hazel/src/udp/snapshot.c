@@ -0,0 +1,326 @@
+#include "hazel/udp/snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HAZEL_SNAPSHOT_SLOT(sequence) ((sequence) % HAZEL_SNAPSHOT_HISTORY)
+
+int hazel_snapshot_channel_init(hazel_snapshot_channel *channel,
+                                size_t field_count, uint8_t snapshot_tag,
+                                uint8_t ack_tag)
+{
+    if (field_count == 0 || snapshot_tag == ack_tag)
+    {
+        return HAZEL_ERR_INVALID_ARGUMENTS;
+    }
+
+    memset(channel, 0, sizeof(*channel));
+    channel->field_count = field_count;
+    channel->snapshot_tag = snapshot_tag;
+    channel->ack_tag = ack_tag;
+    channel->_next_sequence = 1;
+
+    size_t history_size = HAZEL_SNAPSHOT_HISTORY * field_count
+        * sizeof(uint32_t);
+    channel->_sent = malloc(history_size);
+    channel->_received = malloc(history_size);
+    if (channel->_sent == NULL || channel->_received == NULL)
+    {
+        hazel_snapshot_channel_free(channel);
+        return HAZEL_ERR_FAILED_ALLOC;
+    }
+
+    return 0;
+}
+
+void hazel_snapshot_channel_free(hazel_snapshot_channel *channel)
+{
+    free(channel->_sent);
+    free(channel->_received);
+    channel->_sent = NULL;
+    channel->_received = NULL;
+}
+
+static const uint32_t *hazel_snapshot_channel_sent_baseline(
+    hazel_snapshot_channel *channel, uint32_t sequence)
+{
+    if (sequence == 0
+        || channel->_sent_sequences[HAZEL_SNAPSHOT_SLOT(sequence)] != sequence)
+    {
+        return NULL;
+    }
+    return channel->_sent
+        + HAZEL_SNAPSHOT_SLOT(sequence) * channel->field_count;
+}
+
+static const uint32_t *hazel_snapshot_channel_received_baseline(
+    hazel_snapshot_channel *channel, uint32_t sequence)
+{
+    if (channel->_received_sequences[HAZEL_SNAPSHOT_SLOT(sequence)]
+        != sequence)
+    {
+        return NULL;
+    }
+    return channel->_received
+        + HAZEL_SNAPSHOT_SLOT(sequence) * channel->field_count;
+}
+
+int hazel_snapshot_channel_write(hazel_snapshot_channel *channel,
+                                 hazel_message_writer *writer,
+                                 const uint32_t *fields,
+                                 uint32_t *out_sequence)
+{
+    int ret;
+    size_t mask_size = (channel->field_count + 7) / 8;
+
+    uint32_t sequence = channel->_next_sequence;
+    uint32_t baseline_sequence = channel->_acked_sequence;
+    const uint32_t *baseline = hazel_snapshot_channel_sent_baseline(
+        channel, baseline_sequence);
+    if (baseline == NULL)
+    {
+        baseline_sequence = 0;
+    }
+
+    if ((ret = hazel_message_writer_start_message(
+             writer, channel->snapshot_tag)) != 0)
+    {
+        return ret;
+    }
+
+    ret |= hazel_message_writer_packed_uint32(writer, sequence);
+    ret |= hazel_message_writer_packed_uint32(writer, baseline_sequence);
+    if (ret != 0)
+    {
+        hazel_message_writer_cancel_message(writer);
+        return ret;
+    }
+
+    // Reserve the bitmask, it is filled in while the fields are written
+    size_t mask_position = writer->position;
+    for (size_t i = 0; i < mask_size; i++)
+    {
+        if ((ret = hazel_message_writer_uint8(writer, 0)) != 0)
+        {
+            hazel_message_writer_cancel_message(writer);
+            return ret;
+        }
+    }
+
+    for (size_t i = 0; i < channel->field_count; i++)
+    {
+        uint32_t delta = baseline != NULL
+            ? fields[i] ^ baseline[i]
+            : fields[i];
+        if (delta == 0)
+        {
+            continue;
+        }
+
+        writer->data[mask_position + i / 8] |= (uint8_t)(1 << (i % 8));
+        if ((ret = hazel_message_writer_packed_uint32(writer, delta)) != 0)
+        {
+            hazel_message_writer_cancel_message(writer);
+            return ret;
+        }
+    }
+
+    if ((ret = hazel_message_writer_end_message(writer)) != 0)
+    {
+        return ret;
+    }
+
+    if (out_sequence != NULL)
+    {
+        *out_sequence = sequence;
+    }
+
+    return 0;
+}
+
+void hazel_snapshot_channel_mark_sent(hazel_snapshot_channel *channel,
+                                      const uint32_t *fields)
+{
+    uint32_t sequence = channel->_next_sequence;
+    memcpy(channel->_sent + HAZEL_SNAPSHOT_SLOT(sequence)
+               * channel->field_count,
+           fields, channel->field_count * sizeof(uint32_t));
+    channel->_sent_sequences[HAZEL_SNAPSHOT_SLOT(sequence)] = sequence;
+    channel->_next_sequence++;
+}
+
+int hazel_snapshot_channel_read(hazel_snapshot_channel *channel,
+                                hazel_message_reader *reader,
+                                uint32_t *out_fields,
+                                uint32_t *out_sequence)
+{
+    int ret = 0;
+    size_t mask_size = (channel->field_count + 7) / 8;
+
+    uint32_t sequence, baseline_sequence;
+    ret |= hazel_message_reader_packed_uint32(reader, &sequence);
+    ret |= hazel_message_reader_packed_uint32(reader, &baseline_sequence);
+    if (ret != 0)
+    {
+        return HAZEL_READER_MALFORMED_INPUT;
+    }
+
+    if (sequence == 0)
+    {
+        return HAZEL_READER_MALFORMED_INPUT;
+    }
+
+    if (sequence <= channel->_last_received_sequence)
+    {
+        return HAZEL_SNAPSHOT_STALE;
+    }
+
+    const uint32_t *baseline = NULL;
+    if (baseline_sequence != 0)
+    {
+        baseline = hazel_snapshot_channel_received_baseline(
+            channel, baseline_sequence);
+        if (baseline == NULL)
+        {
+            return HAZEL_SNAPSHOT_BASELINE_MISSING;
+        }
+    }
+
+    if (!hazel_message_reader_has_remaining(reader, mask_size))
+    {
+        return HAZEL_READER_MALFORMED_INPUT;
+    }
+    const uint8_t *mask = reader->data + reader->read_head;
+    hazel_message_reader_set_position(
+        reader, hazel_message_reader_get_position(reader) + mask_size);
+
+    // Decode into the history slot first, so a malformed snapshot does not
+    // leave a half written state in out_fields.
+    uint32_t *slot = channel->_received
+        + HAZEL_SNAPSHOT_SLOT(sequence) * channel->field_count;
+    if (slot == baseline)
+    {
+        // Baseline is a full history behind, it shares our slot
+        return HAZEL_SNAPSHOT_BASELINE_MISSING;
+    }
+
+    for (size_t i = 0; i < channel->field_count; i++)
+    {
+        uint32_t value = baseline != NULL ? baseline[i] : 0;
+        if (mask[i / 8] & (1 << (i % 8)))
+        {
+            uint32_t delta;
+            if (hazel_message_reader_packed_uint32(reader, &delta) != 0)
+            {
+                channel->_received_sequences[HAZEL_SNAPSHOT_SLOT(sequence)]
+                    = 0;
+                return HAZEL_READER_MALFORMED_INPUT;
+            }
+            value ^= delta;
+        }
+        slot[i] = value;
+    }
+
+    channel->_received_sequences[HAZEL_SNAPSHOT_SLOT(sequence)] = sequence;
+    channel->_last_received_sequence = sequence;
+
+    memcpy(out_fields, slot, channel->field_count * sizeof(uint32_t));
+    if (out_sequence != NULL)
+    {
+        *out_sequence = sequence;
+    }
+
+    return 0;
+}
+
+int hazel_snapshot_channel_write_ack(hazel_snapshot_channel *channel,
+                                     hazel_message_writer *writer,
+                                     uint32_t sequence)
+{
+    int ret;
+    if ((ret = hazel_message_writer_start_message(writer,
+                                                  channel->ack_tag)) != 0)
+    {
+        return ret;
+    }
+    if ((ret = hazel_message_writer_packed_uint32(writer, sequence)) != 0)
+    {
+        hazel_message_writer_cancel_message(writer);
+        return ret;
+    }
+    return hazel_message_writer_end_message(writer);
+}
+
+int hazel_snapshot_channel_read_ack(hazel_snapshot_channel *channel,
+                                    hazel_message_reader *reader)
+{
+    uint32_t sequence;
+    if (hazel_message_reader_packed_uint32(reader, &sequence) != 0)
+    {
+        return HAZEL_READER_MALFORMED_INPUT;
+    }
+
+    // Acks can arrive out of order, only ever move the baseline forward
+    if (sequence > channel->_acked_sequence
+        && sequence < channel->_next_sequence)
+    {
+        channel->_acked_sequence = sequence;
+    }
+
+    return 0;
+}
+
+int hazel_udp_connection_send_snapshot(hazel_udp_connection *connection,
+                                       hazel_snapshot_channel *channel,
+                                       const uint32_t *fields)
+{
+    int ret;
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+    hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+
+    if ((ret = hazel_snapshot_channel_write(channel, &writer, fields,
+                                            NULL)) != 0)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        return ret;
+    }
+
+    // A snapshot which never left must not become a baseline
+    if ((ret = hazel_udp_connection_send(connection, &writer)) != 0)
+    {
+        return ret;
+    }
+    hazel_snapshot_channel_mark_sent(channel, fields);
+    return 0;
+}
+
+int hazel_udp_connection_recv_snapshot(hazel_udp_connection *connection,
+                                       hazel_snapshot_channel *channel,
+                                       hazel_message_reader *reader,
+                                       uint32_t *out_fields)
+{
+    int ret;
+    uint32_t sequence;
+    if ((ret = hazel_snapshot_channel_read(channel, reader, out_fields,
+                                           &sequence)) != 0)
+    {
+        return ret;
+    }
+
+    uint8_t buffer[16];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+    hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+
+    if ((ret = hazel_snapshot_channel_write_ack(channel, &writer,
+                                                sequence)) != 0)
+    {
+        hazel_message_writer_clear(&writer, HAZEL_SEND_OPTION_UNRELIABLE);
+        return ret;
+    }
+
+    return hazel_udp_connection_send(connection, &writer);
+}
@@ -1,8 +1,297 @@
 #include "hazel/udp/socket.h"
+#include "hazel/udp/capture.h"
+#include "hazel/udp/resolver.h"
 
+#include "../utils.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#   include <unistd.h>
+#endif
+
+static void hazel_udp_socket_set_kernel_busy_poll(hazel_udp_socket *socket,
+                                                  uint32_t budget_us);
+
+int hazel_udp_socket_init_with(hazel_udp_socket *socket,
+                               const hazel_udp_socket_vtable *vtable,
+                               void *context)
+{
+    socket->_sock_handle = -1;
+    socket->_vtable = vtable;
+    socket->_context = context;
+    atomic_init(&socket->_capture_state, HAZEL_UDP_CAPTURE_UNRESOLVED);
+    socket->_timestamping = 0;
+    socket->_tx_next_key = 0;
+    memset(socket->_tx_tags, 0, sizeof(socket->_tx_tags));
+    socket->_rx_timestamp_ns = 0;
+    socket->_rx_hardware_timestamp_ns = 0;
+    socket->_count_drops = false;
+    socket->_rx_dropped = 0;
+    socket->_busy_poll_budget_ns = 0;
+    socket->_busy_poll_spin_ns = 0;
+    socket->_last_arrival_ns = 0;
+    socket->_interarrival_ns = 0;
+    return 0;
+}
+
+int hazel_udp_socket_init(hazel_udp_socket *socket)
+{
 #ifndef HAZEL_CONFIG_CUSTOM_SOCKET
+    return hazel_udp_socket_init_with(socket, &hazel_udp_socket_kernel_vtable,
+                                      NULL);
+#else
+    return hazel_udp_socket_init_with(socket, NULL, NULL);
+#endif
+}
 
-#include "../utils.h"
+void hazel_udp_socket_free(hazel_udp_socket *socket)
+{
+    HAZEL_UNUSED(socket);
+}
+
+int hazel_udp_socket_open(hazel_udp_socket *socket,
+                          enum hazel_ip_mode ip_mode)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    socket->ip_mode = ip_mode;
+    hazel_udp_capture_forget(socket);
+    return socket->_vtable->open(socket, ip_mode);
+}
+
+int hazel_udp_socket_close(hazel_udp_socket *socket)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    return socket->_vtable->close(socket);
+}
+
+int hazel_udp_socket_connect(hazel_udp_socket *socket, const char *hostname,
+                             int port)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    hazel_udp_capture_forget(socket);
+    return socket->_vtable->connect(socket, hostname, port);
+}
+
+#ifndef HAZEL_CONFIG_CUSTOM_SOCKET
+typedef struct hazel_udp_socket_pending_connect
+{
+    hazel_udp_socket *socket;
+    int port;
+    hazel_udp_socket_connect_callback callback;
+    void *user_data;
+} hazel_udp_socket_pending_connect;
+
+static void hazel_udp_socket_connect_resolved(
+    int status, const hazel_udp_address *address, void *user_data)
+{
+    hazel_udp_socket_pending_connect *pending = user_data;
+    if (status == 0)
+    {
+        status = hazel_udp_socket_connect_address(pending->socket, address,
+                                                  pending->port);
+    }
+    pending->callback(pending->socket, status, pending->user_data);
+    free(pending);
+}
+#endif
+
+int hazel_udp_socket_connect_async(hazel_udp_socket *socket,
+                                   hazel_resolver *resolver,
+                                   const char *hostname, int port,
+                                   hazel_udp_socket_connect_callback callback,
+                                   void *user_data)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+
+#ifndef HAZEL_CONFIG_CUSTOM_SOCKET
+    if (socket->_vtable == &hazel_udp_socket_kernel_vtable)
+    {
+        if (resolver == NULL
+            && (resolver = hazel_resolver_default()) == NULL)
+        {
+            return HAZEL_RESOLVER_THREAD_ERROR;
+        }
+
+        hazel_udp_socket_pending_connect *pending
+            = malloc(sizeof(hazel_udp_socket_pending_connect));
+        if (pending == NULL)
+        {
+            return HAZEL_ERR_FAILED_ALLOC;
+        }
+        pending->socket = socket;
+        pending->port = port;
+        pending->callback = callback;
+        pending->user_data = user_data;
+
+        int ret = hazel_resolver_resolve(resolver, hostname, socket->ip_mode,
+                                         hazel_udp_socket_connect_resolved,
+                                         pending);
+        if (ret != 0)
+        {
+            free(pending);
+        }
+        return ret;
+    }
+#else
+    HAZEL_UNUSED(resolver);
+#endif
+
+    callback(socket, hazel_udp_socket_connect(socket, hostname, port),
+             user_data);
+    return 0;
+}
+
+int hazel_udp_socket_set_busy_poll(hazel_udp_socket *socket,
+                                   uint32_t budget_us)
+{
+    socket->_busy_poll_budget_ns = (uint64_t)budget_us * 1000;
+#ifdef _SC_NPROCESSORS_ONLN
+    // With one CPU, the spin only keeps the sender from running
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+    {
+        socket->_busy_poll_budget_ns = 0;
+    }
+#endif
+    socket->_busy_poll_spin_ns = socket->_busy_poll_budget_ns;
+    socket->_last_arrival_ns = 0;
+    socket->_interarrival_ns = 0;
+    hazel_udp_socket_set_kernel_busy_poll(socket, budget_us);
+    return 0;
+}
+
+static uint64_t hazel_udp_socket_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Track the time between datagrams, and spin the whole budget again once
+ * they come within it of each other.
+ */
+static void hazel_udp_socket_busy_poll_arrived(hazel_udp_socket *socket,
+                                               uint64_t now_ns)
+{
+    if (socket->_last_arrival_ns != 0)
+    {
+        uint64_t gap_ns = now_ns - socket->_last_arrival_ns;
+        // Moving average over about the last 8 datagrams
+        socket->_interarrival_ns = socket->_interarrival_ns == 0
+            ? gap_ns
+            : socket->_interarrival_ns - socket->_interarrival_ns / 8
+                + gap_ns / 8;
+        if (socket->_interarrival_ns <= socket->_busy_poll_budget_ns)
+        {
+            socket->_busy_poll_spin_ns = socket->_busy_poll_budget_ns;
+        }
+    }
+    socket->_last_arrival_ns = now_ns;
+}
+
+static int hazel_udp_socket_busy_recv(hazel_udp_socket *socket,
+                                      uint8_t *buffer, size_t size, int flags,
+                                      int timeout)
+{
+    uint64_t spin_ns = socket->_busy_poll_spin_ns;
+    if (timeout >= 0 && spin_ns > (uint64_t)timeout * 1000000)
+    {
+        spin_ns = (uint64_t)timeout * 1000000;
+    }
+
+    uint64_t start_ns = hazel_udp_socket_now_ns();
+    uint64_t now_ns = start_ns;
+    int ret;
+    do
+    {
+        ret = socket->_vtable->try_recv(socket, buffer, size, flags);
+        now_ns = hazel_udp_socket_now_ns();
+        if (ret != HAZEL_UDP_SOCKET_RECV_NO_MESSAGE)
+        {
+            if (ret >= 0)
+            {
+                hazel_udp_socket_busy_poll_arrived(socket, now_ns);
+            }
+            return ret;
+        }
+    } while (now_ns - start_ns < spin_ns);
+
+    if (spin_ns != 0)
+    {
+        socket->_busy_poll_spin_ns /= 2;
+    }
+
+    int spent_ms = (int)((now_ns - start_ns) / 1000000);
+    if (timeout >= 0)
+    {
+        if (spent_ms >= timeout)
+        {
+            return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+        }
+        timeout -= spent_ms;
+    }
+
+    ret = socket->_vtable->recv(socket, buffer, size, flags, timeout);
+    if (ret >= 0)
+    {
+        hazel_udp_socket_busy_poll_arrived(socket, hazel_udp_socket_now_ns());
+    }
+    return ret;
+}
+
+int hazel_udp_socket_recv(hazel_udp_socket *socket, uint8_t *buffer,
+                          size_t size, int flags, int timeout)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    int ret = socket->_busy_poll_budget_ns != 0
+        ? hazel_udp_socket_busy_recv(socket, buffer, size, flags, timeout)
+        : socket->_vtable->recv(socket, buffer, size, flags, timeout);
+    hazel_udp_capture_packet(socket, HAZEL_UDP_CAPTURE_RECEIVED, buffer, ret);
+    return ret;
+}
+
+int hazel_udp_socket_try_recv(hazel_udp_socket *socket, uint8_t *buffer,
+                              size_t size, int flags)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    int ret = socket->_vtable->try_recv(socket, buffer, size, flags);
+    hazel_udp_capture_packet(socket, HAZEL_UDP_CAPTURE_RECEIVED, buffer, ret);
+    return ret;
+}
+
+int hazel_udp_socket_send(hazel_udp_socket *socket, uint8_t *buffer,
+                          size_t size, int flags)
+{
+    if (socket->_vtable == NULL)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    int ret = socket->_vtable->send(socket, buffer, size, flags);
+    hazel_udp_capture_packet(socket, HAZEL_UDP_CAPTURE_SENT, buffer, ret);
+    return ret;
+}
+
+#ifndef HAZEL_CONFIG_CUSTOM_SOCKET
 
 #ifdef HAZEL_NET_USE_POLL
 #include <poll.h>
@@ -13,6 +302,7 @@
 #if !defined(_WIN32)
 #   include <sys/socket.h>
 #   include <sys/select.h>
+#   include <sys/uio.h>
 #   include <arpa/inet.h>
 #   include <unistd.h>
 #   include <netdb.h>
@@ -25,6 +315,12 @@
 #   pragma comment(lib, "Ws2_32.lib")
 #endif
 
+#if defined(__linux__)
+#   include <linux/errqueue.h>
+#   include <linux/net_tstamp.h>
+#   define HAZEL_UDP_SOCKET_HAS_TIMESTAMPING 1
+#endif
+
 int hazel_ip_mode_to_af (enum hazel_ip_mode ip_mode)
 {
     int sock_family = AF_INET;
@@ -39,17 +335,7 @@ int hazel_ip_mode_to_af (enum hazel_ip_mode ip_mode)
     return sock_family;
 }
 
-int hazel_udp_socket_init(hazel_udp_socket* hazel_socket)
-{
-    hazel_socket->_sock_handle = -1;
-    return 0;
-}
-void hazel_udp_socket_free(hazel_udp_socket* hazel_socket)
-{
-    HAZEL_UNUSED(hazel_socket);
-}
-
-int hazel_udp_socket_open(hazel_udp_socket* hazel_socket, enum hazel_ip_mode ip_mode)
+static int hazel_udp_socket_kernel_open(hazel_udp_socket* hazel_socket, enum hazel_ip_mode ip_mode)
 {  
     hazel_socket->ip_mode = ip_mode;
     int family = hazel_ip_mode_to_af(hazel_socket->ip_mode);
@@ -61,6 +347,17 @@ int hazel_udp_socket_open(hazel_udp_socket* hazel_socket, enum hazel_ip_mode ip_
     }
 
     hazel_socket->_sock_handle = handle;
+    hazel_socket->_count_drops = false;
+    hazel_socket->_rx_dropped = 0;
+
+    if (HAZEL_UDP_SOCKET_RECV_BUFFER_SIZE != 0
+        || HAZEL_UDP_SOCKET_SEND_BUFFER_SIZE != 0)
+    {
+        // Only a hint, the kernel may still cap the sizes
+        hazel_udp_socket_set_buffer_sizes(hazel_socket,
+                                          HAZEL_UDP_SOCKET_RECV_BUFFER_SIZE,
+                                          HAZEL_UDP_SOCKET_SEND_BUFFER_SIZE);
+    }
 
 #if defined(_WIN32)
     {
@@ -75,7 +372,7 @@ int hazel_udp_socket_open(hazel_udp_socket* hazel_socket, enum hazel_ip_mode ip_
     return 0;
 }
 
-int hazel_udp_socket_close(hazel_udp_socket* socket)
+static int hazel_udp_socket_kernel_close(hazel_udp_socket* socket)
 {
     int ret = close(socket->_sock_handle);
     if (ret == -1)
@@ -85,44 +382,162 @@ int hazel_udp_socket_close(hazel_udp_socket* socket)
     return ret;
 }
 
-int hazel_udp_socket_connect(hazel_udp_socket* hazel_socket, const char* hostname, int port)
+/**
+ * connect() to \p address with its port replaced, which sits in a
+ * different place in IPv4 and IPv6 addresses.
+ */
+static int hazel_udp_socket_kernel_connect_address(
+    hazel_udp_socket *socket, const hazel_udp_address *address, int port)
 {
-    int ret = 0;
-    int family = hazel_ip_mode_to_af(hazel_socket->ip_mode);
+    struct sockaddr_storage storage;
+    if (address->length > sizeof(storage))
+    {
+        return -1;
+    }
+    memset(&storage, 0, sizeof(storage));
+    memcpy(&storage, address->data, address->length);
+
+    if (storage.ss_family != hazel_ip_mode_to_af(socket->ip_mode))
+    {
+        return -1;
+    }
+    if (storage.ss_family == AF_INET6)
+    {
+        ((struct sockaddr_in6 *)&storage)->sin6_port = htons(port);
+    }
+    else
+    {
+        ((struct sockaddr_in *)&storage)->sin_port = htons(port);
+    }
 
-    struct addrinfo hints, *result, *rp;
-    memset (&hints, 0, sizeof(hints));
-    hints.ai_family = family;
-    hints.ai_socktype = SOCK_DGRAM;
+    return connect(socket->_sock_handle, (const struct sockaddr *)&storage,
+                   (socklen_t)address->length);
+}
 
-    if ((ret = getaddrinfo(hostname, NULL, &hints, &result)) != 0) {
+static int hazel_udp_socket_kernel_connect(hazel_udp_socket* hazel_socket, const char* hostname, int port)
+{
+    hazel_udp_address address;
+    int ret = hazel_resolver_resolve_wait(hazel_resolver_default(), hostname,
+                                          hazel_socket->ip_mode, &address);
+    if (ret != 0)
+    {
         return ret;
     }
 
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-        if (rp->ai_family == family) {
-            break;
-        }
-    }
+    return hazel_udp_socket_kernel_connect_address(hazel_socket, &address,
+                                                   port);
+}
 
-    if (rp == NULL) {
-        freeaddrinfo(result);
-        return -1;
+int hazel_udp_socket_connect_address(hazel_udp_socket *socket,
+                                     const hazel_udp_address *address,
+                                     int port)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
     }
 
-    ((struct sockaddr_in *) rp->ai_addr)->sin_port = htons(port);
+    hazel_udp_capture_forget(socket);
+    return hazel_udp_socket_kernel_connect_address(socket, address, port)
+        == 0 ? 0 : HAZEL_UDP_SOCKET_SOCKET_ERROR;
+}
 
-    ret = connect(hazel_socket->_sock_handle,
-                  (const struct sockaddr*) rp->ai_addr,
-                  rp->ai_addrlen);
+#ifdef HAZEL_UDP_SOCKET_HAS_TIMESTAMPING
+static uint64_t hazel_udp_socket_timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
 
-    freeaddrinfo(result);
+/**
+ * Take the software and the hardware timestamp out of an
+ * \c SCM_TIMESTAMPING or \c SCM_TIMESTAMPNS control message, leaving them
+ * alone if \p cmsg is neither. Stamps which were not taken are 0.
+ */
+static void hazel_udp_socket_cmsg_timestamps(const hazel_udp_socket *socket,
+                                             struct cmsghdr *cmsg,
+                                             uint64_t *software_ns,
+                                             uint64_t *hardware_ns)
+{
+    if (cmsg->cmsg_level != SOL_SOCKET)
+    {
+        return;
+    }
 
-    return ret;
+    if (cmsg->cmsg_type == SO_TIMESTAMPING)
+    {
+        // Software stamps come first, raw hardware stamps third
+        struct timespec stamps[3];
+        memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+        *software_ns = hazel_udp_socket_timespec_ns(&stamps[0]);
+        *hardware_ns = socket->_timestamping
+                & HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE
+            ? hazel_udp_socket_timespec_ns(&stamps[2])
+            : 0;
+    }
+    else if (cmsg->cmsg_type == SO_TIMESTAMPNS)
+    {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        *software_ns = hazel_udp_socket_timespec_ns(&ts);
+        *hardware_ns = 0;
+    }
+}
+#endif
 
+/**
+ * recv() which also takes the receive timestamp and the count of datagrams
+ * the kernel dropped out of the control messages.
+ */
+static int hazel_udp_socket_kernel_recvmsg(hazel_udp_socket *socket,
+                                                    uint8_t *buffer,
+                                                    size_t size, int flags)
+{
+#ifdef HAZEL_UDP_SOCKET_HAS_TIMESTAMPING
+    union {
+        struct cmsghdr align;
+        uint8_t data[CMSG_SPACE(3 * sizeof(struct timespec))
+                     + CMSG_SPACE(sizeof(uint32_t))];
+    } control;
+    struct iovec iov = { .iov_base = buffer, .iov_len = size };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    int ret = (int)recvmsg(socket->_sock_handle, &msg, flags);
+    socket->_rx_timestamp_ns = 0;
+    socket->_rx_hardware_timestamp_ns = 0;
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+#ifdef SO_RXQ_OVFL
+        // Only sent once the kernel dropped something
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(&socket->_rx_dropped, CMSG_DATA(cmsg),
+                   sizeof(socket->_rx_dropped));
+            continue;
+        }
+#endif
+        hazel_udp_socket_cmsg_timestamps(socket, cmsg,
+                                         &socket->_rx_timestamp_ns,
+                                         &socket->_rx_hardware_timestamp_ns);
+    }
+    return ret;
+#else
+    return (int)recv(socket->_sock_handle, buffer, size, flags);
+#endif
 }
 
-int hazel_udp_socket_recv(hazel_udp_socket* socket, uint8_t* buffer, 
+static int hazel_udp_socket_kernel_recv(hazel_udp_socket* socket, uint8_t* buffer, 
                               size_t size, 
                               int flags, int timeout)
 {
@@ -161,11 +576,26 @@ int hazel_udp_socket_recv(hazel_udp_socket* socket, uint8_t* buffer,
         return HAZEL_UDP_SOCKET_RECV_ERROR;
     }
     
-    ret = (int)recv(socket->_sock_handle, buffer, size, flags);
+    if (socket->_timestamping != 0 || socket->_count_drops)
+    {
+        // A pending TX timestamp also wakes select() up, with no datagram
+        // to read
+        ret = hazel_udp_socket_kernel_recvmsg(
+            socket, buffer, size, flags | MSG_DONTWAIT);
+    }
+    else
+    {
+        ret = (int)recv(socket->_sock_handle, buffer, size, flags);
+    }
     if (ret == -1)
     {
         switch(errno)
         {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
         case ECONNREFUSED:
         {
             return HAZEL_UDP_SOCKET_CONN_REFUSED;
@@ -175,10 +605,386 @@ int hazel_udp_socket_recv(hazel_udp_socket* socket, uint8_t* buffer,
     return ret;
 }
 
-int hazel_udp_socket_send(hazel_udp_socket* socket, uint8_t* buffer, size_t size, 
+static int hazel_udp_socket_kernel_try_recv(hazel_udp_socket* socket, uint8_t* buffer,
+                              size_t size, int flags)
+{
+#ifdef MSG_DONTWAIT
+    int ret = socket->_timestamping != 0 || socket->_count_drops
+        ? hazel_udp_socket_kernel_recvmsg(socket, buffer, size,
+                                                   flags | MSG_DONTWAIT)
+        : (int)recv(socket->_sock_handle, buffer, size, flags | MSG_DONTWAIT);
+    if (ret == -1)
+    {
+        switch(errno)
+        {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+        case EINTR:
+            return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+        case ECONNREFUSED:
+            return HAZEL_UDP_SOCKET_CONN_REFUSED;
+        default:
+            return HAZEL_UDP_SOCKET_RECV_ERROR;
+        }
+    }
+    return ret;
+#else
+    return hazel_udp_socket_kernel_recv(socket, buffer, size, flags, 0);
+#endif
+}
+
+static int hazel_udp_socket_kernel_send(hazel_udp_socket* socket, uint8_t* buffer, size_t size, 
                            int flags)
 {
-    return (int)send(socket->_sock_handle, buffer, size, flags);
+    int ret = (int)send(socket->_sock_handle, buffer, size, flags);
+    if (ret >= 0 && (socket->_timestamping & HAZEL_UDP_SOCKET_TIMESTAMP_TX))
+    {
+        hazel_udp_socket_tx_tag *tag = &socket->_tx_tags[
+            socket->_tx_next_key % HAZEL_UDP_SOCKET_TX_TAGS];
+        tag->key = socket->_tx_next_key++;
+        tag->size = (uint32_t)(size < HAZEL_UDP_SOCKET_TX_TAG_SIZE
+            ? size : HAZEL_UDP_SOCKET_TX_TAG_SIZE);
+        memcpy(tag->data, buffer, tag->size);
+    }
+    return ret;
+}
+
+int hazel_udp_socket_set_timestamping(hazel_udp_socket *socket, int flags)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
+    }
+
+#ifdef HAZEL_UDP_SOCKET_HAS_TIMESTAMPING
+    int options = 0;
+    if (flags & HAZEL_UDP_SOCKET_TIMESTAMP_RX)
+    {
+        options |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (flags & HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE)
+        {
+            options |= SOF_TIMESTAMPING_RX_HARDWARE
+                | SOF_TIMESTAMPING_RAW_HARDWARE;
+        }
+    }
+    if (flags & HAZEL_UDP_SOCKET_TIMESTAMP_TX)
+    {
+        // Only the timestamp and a counter come back, not the datagram
+        options |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+            | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (flags & HAZEL_UDP_SOCKET_TIMESTAMP_HARDWARE)
+        {
+            options |= SOF_TIMESTAMPING_TX_HARDWARE
+                | SOF_TIMESTAMPING_RAW_HARDWARE;
+        }
+    }
+
+    if (setsockopt(socket->_sock_handle, SOL_SOCKET, SO_TIMESTAMPING,
+                   &options, sizeof(options)) != 0)
+    {
+        // Kernels without SO_TIMESTAMPING still stamp what they receive
+        int enable = flags == HAZEL_UDP_SOCKET_TIMESTAMP_RX;
+        if (!enable
+            || setsockopt(socket->_sock_handle, SOL_SOCKET, SO_TIMESTAMPNS,
+                          &enable, sizeof(enable)) != 0)
+        {
+            return HAZEL_UDP_SOCKET_UNSUPPORTED;
+        }
+    }
+
+    // The kernel restarts its counter only when OPT_ID gets turned on
+    if (!(socket->_timestamping & HAZEL_UDP_SOCKET_TIMESTAMP_TX)
+        && (flags & HAZEL_UDP_SOCKET_TIMESTAMP_TX))
+    {
+        socket->_tx_next_key = 0;
+        memset(socket->_tx_tags, 0, sizeof(socket->_tx_tags));
+    }
+    socket->_timestamping = flags;
+    socket->_rx_timestamp_ns = 0;
+    socket->_rx_hardware_timestamp_ns = 0;
+    return 0;
+#else
+    HAZEL_UNUSED(flags);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+#endif
+}
+
+int hazel_udp_socket_set_drop_counting(hazel_udp_socket *socket,
+                                       bool enable)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
+    }
+
+#ifdef SO_RXQ_OVFL
+    int value = enable;
+    if (setsockopt(socket->_sock_handle, SOL_SOCKET, SO_RXQ_OVFL, &value,
+                   sizeof(value)) != 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
+    }
+    socket->_count_drops = enable;
+    return 0;
+#else
+    HAZEL_UNUSED(enable);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+#endif
+}
+
+int hazel_udp_socket_read_tx_timestamp(hazel_udp_socket *socket,
+                                       hazel_udp_tx_timestamp *out_timestamp)
+{
+    if (!(socket->_timestamping & HAZEL_UDP_SOCKET_TIMESTAMP_TX))
+    {
+        return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+    }
+
+#ifdef HAZEL_UDP_SOCKET_HAS_TIMESTAMPING
+    union {
+        struct cmsghdr align;
+        uint8_t data[CMSG_SPACE(3 * sizeof(struct timespec))
+                     + CMSG_SPACE(sizeof(struct sock_extended_err)
+                                  + sizeof(struct sockaddr_storage))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    for (;;)
+    {
+        if (recvmsg(socket->_sock_handle, &msg,
+                    MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+                ? HAZEL_UDP_SOCKET_RECV_NO_MESSAGE
+                : HAZEL_UDP_SOCKET_RECV_ERROR;
+        }
+
+        uint32_t key = 0;
+        uint64_t software_ns = 0, hardware_ns = 0;
+        bool has_key = false;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6
+                    && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                struct sock_extended_err error;
+                memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                if (error.ee_errno == ENOMSG
+                    && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    key = error.ee_data;
+                    has_key = true;
+                }
+            }
+            else
+            {
+                hazel_udp_socket_cmsg_timestamps(socket, cmsg, &software_ns,
+                                                 &hardware_ns);
+            }
+        }
+
+        // Anything else on the error queue, like ICMP errors, is skipped
+        if (has_key && (software_ns != 0 || hardware_ns != 0))
+        {
+            out_timestamp->key = key;
+            out_timestamp->software_ns = software_ns;
+            out_timestamp->hardware_ns = hardware_ns;
+            // Unless more datagrams were sent since than are remembered
+            const hazel_udp_socket_tx_tag *tag
+                = &socket->_tx_tags[key % HAZEL_UDP_SOCKET_TX_TAGS];
+            out_timestamp->tag_size = tag->key == key ? tag->size : 0;
+            memcpy(out_timestamp->tag, tag->data, sizeof(tag->data));
+            return 0;
+        }
+        msg.msg_controllen = sizeof(control.data);
+    }
+#else
+    HAZEL_UNUSED(out_timestamp);
+    return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
+#endif
+}
+
+/**
+ * Set a buffer size, past the sysctl limit if the process is allowed to.
+ */
+static int hazel_udp_socket_kernel_set_buffer(hazel_udp_socket *socket,
+                                              int force_option, int option,
+                                              int bytes)
+{
+    if (force_option != 0
+        && setsockopt(socket->_sock_handle, SOL_SOCKET, force_option,
+                      &bytes, sizeof(bytes)) == 0)
+    {
+        return 0;
+    }
+    if (setsockopt(socket->_sock_handle, SOL_SOCKET, option,
+                   (const char *)&bytes, sizeof(bytes)) != 0)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    return 0;
+}
+
+int hazel_udp_socket_set_buffer_sizes(hazel_udp_socket *socket,
+                                      int recv_bytes, int send_bytes)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
+    }
+
+#ifdef SO_RCVBUFFORCE
+    const int recv_force = SO_RCVBUFFORCE;
+    const int send_force = SO_SNDBUFFORCE;
+#else
+    const int recv_force = 0;
+    const int send_force = 0;
+#endif
+
+    int ret;
+    if (recv_bytes > 0
+        && (ret = hazel_udp_socket_kernel_set_buffer(
+                socket, recv_force, SO_RCVBUF, recv_bytes)) < 0)
+    {
+        return ret;
+    }
+    if (send_bytes > 0
+        && (ret = hazel_udp_socket_kernel_set_buffer(
+                socket, send_force, SO_SNDBUF, send_bytes)) < 0)
+    {
+        return ret;
+    }
+    return 0;
+}
+
+int hazel_udp_socket_get_buffer_sizes(hazel_udp_socket *socket,
+                                      int *out_recv_bytes,
+                                      int *out_send_bytes)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return HAZEL_UDP_SOCKET_UNSUPPORTED;
+    }
+
+    socklen_t length = sizeof(*out_recv_bytes);
+    if (getsockopt(socket->_sock_handle, SOL_SOCKET, SO_RCVBUF,
+                   (char *)out_recv_bytes, &length) != 0)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    length = sizeof(*out_send_bytes);
+    if (getsockopt(socket->_sock_handle, SOL_SOCKET, SO_SNDBUF,
+                   (char *)out_send_bytes, &length) != 0)
+    {
+        return HAZEL_UDP_SOCKET_SOCKET_ERROR;
+    }
+    return 0;
+}
+
+static void hazel_udp_socket_set_kernel_busy_poll(hazel_udp_socket *socket,
+                                                  uint32_t budget_us)
+{
+    if (socket->_vtable != &hazel_udp_socket_kernel_vtable
+        || socket->_sock_handle < 0)
+    {
+        return;
+    }
+
+    // Best effort: without them the spin still happens in user space
+#ifdef SO_BUSY_POLL
+    int busy_poll = (int)budget_us;
+    setsockopt(socket->_sock_handle, SOL_SOCKET, SO_BUSY_POLL,
+               &busy_poll, sizeof(busy_poll));
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer = budget_us != 0;
+    setsockopt(socket->_sock_handle, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+               &prefer, sizeof(prefer));
+#endif
+#if !defined(SO_BUSY_POLL) && !defined(SO_PREFER_BUSY_POLL)
+    HAZEL_UNUSED(budget_us);
+#endif
+}
+
+const hazel_udp_socket_vtable hazel_udp_socket_kernel_vtable = {
+    .open = hazel_udp_socket_kernel_open,
+    .connect = hazel_udp_socket_kernel_connect,
+    .send = hazel_udp_socket_kernel_send,
+    .recv = hazel_udp_socket_kernel_recv,
+    .try_recv = hazel_udp_socket_kernel_try_recv,
+    .close = hazel_udp_socket_kernel_close,
+};
+
+#else
+
+int hazel_udp_socket_connect_address(hazel_udp_socket *socket,
+                                     const hazel_udp_address *address,
+                                     int port)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(address);
+    HAZEL_UNUSED(port);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+}
+
+int hazel_udp_socket_set_buffer_sizes(hazel_udp_socket *socket,
+                                      int recv_bytes, int send_bytes)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(recv_bytes);
+    HAZEL_UNUSED(send_bytes);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+}
+
+int hazel_udp_socket_get_buffer_sizes(hazel_udp_socket *socket,
+                                      int *out_recv_bytes,
+                                      int *out_send_bytes)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(out_recv_bytes);
+    HAZEL_UNUSED(out_send_bytes);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+}
+
+static void hazel_udp_socket_set_kernel_busy_poll(hazel_udp_socket *socket,
+                                                  uint32_t budget_us)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(budget_us);
+}
+
+int hazel_udp_socket_set_timestamping(hazel_udp_socket *socket, int flags)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(flags);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+}
+
+int hazel_udp_socket_set_drop_counting(hazel_udp_socket *socket,
+                                       bool enable)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(enable);
+    return HAZEL_UDP_SOCKET_UNSUPPORTED;
+}
+
+int hazel_udp_socket_read_tx_timestamp(hazel_udp_socket *socket,
+                                       hazel_udp_tx_timestamp *out_timestamp)
+{
+    HAZEL_UNUSED(socket);
+    HAZEL_UNUSED(out_timestamp);
+    return HAZEL_UDP_SOCKET_RECV_NO_MESSAGE;
 }
 
 #endif
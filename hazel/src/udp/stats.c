@@ -0,0 +1,122 @@
+#include "hazel/udp/stats.h"
+
+void hazel_udp_connection_stats_init(hazel_udp_connection_stats *stats)
+{
+    for (size_t i = 0; i < HAZEL_UDP_STATS_SEND_OPTIONS; i++)
+    {
+        atomic_init(&stats->packets_sent[i], 0);
+        atomic_init(&stats->bytes_sent[i], 0);
+        atomic_init(&stats->packets_received[i], 0);
+        atomic_init(&stats->bytes_received[i], 0);
+    }
+    atomic_init(&stats->resends, 0);
+    atomic_init(&stats->acks_sent, 0);
+    atomic_init(&stats->acks_received, 0);
+    atomic_init(&stats->duplicates, 0);
+    atomic_init(&stats->drops, 0);
+    atomic_init(&stats->malformed, 0);
+    atomic_init(&stats->kernel_drops, 0);
+    for (size_t i = 0; i < HAZEL_UDP_STATS_RTT_BUCKETS; i++)
+    {
+        atomic_init(&stats->rtt_histogram[i], 0);
+    }
+}
+
+#define HAZEL_UDP_STATS_LOAD(counter)                                          \
+    atomic_load_explicit(&(counter), memory_order_relaxed)
+
+void hazel_udp_connection_stats_copy(const hazel_udp_connection_stats *stats,
+                                     hazel_udp_stats *out)
+{
+    // The counters are never written through this pointer, loading an
+    // atomic through a const pointer is fine
+    hazel_udp_connection_stats *live = (hazel_udp_connection_stats *)stats;
+
+    for (size_t i = 0; i < HAZEL_UDP_STATS_SEND_OPTIONS; i++)
+    {
+        out->packets_sent[i] = HAZEL_UDP_STATS_LOAD(live->packets_sent[i]);
+        out->bytes_sent[i] = HAZEL_UDP_STATS_LOAD(live->bytes_sent[i]);
+        out->packets_received[i]
+            = HAZEL_UDP_STATS_LOAD(live->packets_received[i]);
+        out->bytes_received[i] = HAZEL_UDP_STATS_LOAD(live->bytes_received[i]);
+    }
+    out->resends = HAZEL_UDP_STATS_LOAD(live->resends);
+    out->acks_sent = HAZEL_UDP_STATS_LOAD(live->acks_sent);
+    out->acks_received = HAZEL_UDP_STATS_LOAD(live->acks_received);
+    out->duplicates = HAZEL_UDP_STATS_LOAD(live->duplicates);
+    out->drops = HAZEL_UDP_STATS_LOAD(live->drops);
+    out->malformed = HAZEL_UDP_STATS_LOAD(live->malformed);
+    out->kernel_drops = HAZEL_UDP_STATS_LOAD(live->kernel_drops);
+    for (size_t i = 0; i < HAZEL_UDP_STATS_RTT_BUCKETS; i++)
+    {
+        out->rtt_histogram[i] = HAZEL_UDP_STATS_LOAD(live->rtt_histogram[i]);
+    }
+}
+
+size_t hazel_udp_stats_rtt_bucket(uint64_t rtt_us)
+{
+    if (rtt_us < HAZEL_UDP_STATS_RTT_SUB_BUCKETS)
+    {
+        return (size_t)rtt_us;
+    }
+
+#if defined(__GNUC__)
+    size_t exponent = 63 - (size_t)__builtin_clzll(rtt_us);
+#else
+    size_t exponent = 0;
+    for (uint64_t v = rtt_us; v > 1; v >>= 1)
+    {
+        exponent++;
+    }
+#endif
+    size_t bucket = (exponent - 2) * HAZEL_UDP_STATS_RTT_SUB_BUCKETS
+        + ((rtt_us >> (exponent - 3)) & (HAZEL_UDP_STATS_RTT_SUB_BUCKETS - 1));
+    return bucket < HAZEL_UDP_STATS_RTT_BUCKETS
+        ? bucket
+        : HAZEL_UDP_STATS_RTT_BUCKETS - 1;
+}
+
+uint64_t hazel_udp_stats_rtt_bucket_floor(size_t bucket)
+{
+    if (bucket < HAZEL_UDP_STATS_RTT_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    size_t exponent = bucket / HAZEL_UDP_STATS_RTT_SUB_BUCKETS + 2;
+    uint64_t sub = bucket % HAZEL_UDP_STATS_RTT_SUB_BUCKETS;
+    return (HAZEL_UDP_STATS_RTT_SUB_BUCKETS + sub) << (exponent - 3);
+}
+
+void hazel_udp_connection_stats_record_rtt(hazel_udp_connection_stats *stats,
+                                           uint64_t rtt_us)
+{
+    HAZEL_UDP_STATS_ADD(stats->rtt_histogram[hazel_udp_stats_rtt_bucket(
+                            rtt_us)], 1);
+}
+
+uint64_t hazel_udp_stats_rtt_percentile(const hazel_udp_stats *stats,
+                                        double percentile)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < HAZEL_UDP_STATS_RTT_BUCKETS; i++)
+    {
+        total += stats->rtt_histogram[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    double target = total * percentile / 100.0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HAZEL_UDP_STATS_RTT_BUCKETS; i++)
+    {
+        seen += stats->rtt_histogram[i];
+        if (seen > 0 && seen >= target)
+        {
+            return hazel_udp_stats_rtt_bucket_floor(i);
+        }
+    }
+    return hazel_udp_stats_rtt_bucket_floor(HAZEL_UDP_STATS_RTT_BUCKETS - 1);
+}
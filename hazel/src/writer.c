@@ -1,4 +1,6 @@
+#define HAZEL_PRIMITIVES_IMPLEMENTATION
 #include "hazel/writer.h"
+#include "hazel/impl/writer_primitives.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -66,6 +68,7 @@ int hazel_message_writer_init(hazel_message_writer *writer, uint8_t *data,
     writer->_buffer_size = size;
     writer->size = 0;
     writer->position = 0;
+    writer->compress = false;
     writer->_start_head = NULL;
 
     return 0;
@@ -140,11 +143,6 @@ int hazel_message_writer_to_bytes(hazel_message_writer *writer, uint8_t *buffer,
     return 0;
 }
 
-size_t hazel_message_writer_remaining(hazel_message_writer *writer)
-{
-    return writer->_buffer_size - writer->size;
-}
-
 int hazel_message_writer_start_message(hazel_message_writer *writer,
                                        uint8_t tag)
 {
@@ -222,155 +220,3 @@ int hazel_message_writer_clear(hazel_message_writer *writer,
     }
     return 0;
 }
-
-#define BUFFER_CHECK(writer, wanted_size)                       \
-    if (writer->_buffer_size < writer->position + wanted_size)  \
-    {                                                           \
-        return HAZEL_WRITER_CAPACITY_EXCEEDED;                  \
-    }
-
-#define LENGTH_CHECK(writer)             \
-    if (writer->position > writer->size) \
-    writer->size = writer->position
-
-int hazel_message_writer_bool(hazel_message_writer *writer, bool value)
-{
-    return hazel_message_writer_uint8(writer, value);
-}
-int hazel_message_writer_uint8(hazel_message_writer *writer, uint8_t value)
-{
-    BUFFER_CHECK(writer, sizeof(uint8_t));
-    writer->data[writer->position++] = value;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_uint16(hazel_message_writer *writer, uint16_t value)
-{
-    BUFFER_CHECK(writer, sizeof(uint16_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_int16(hazel_message_writer *writer, int16_t value)
-{
-    BUFFER_CHECK(writer, sizeof(int16_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_uint32(hazel_message_writer *writer, uint32_t value)
-{
-    BUFFER_CHECK(writer, sizeof(uint32_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    writer->data[writer->position++] = value >> 16;
-    writer->data[writer->position++] = value >> 24;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_int32(hazel_message_writer *writer, int32_t value)
-{
-    BUFFER_CHECK(writer, sizeof(int32_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    writer->data[writer->position++] = value >> 16;
-    writer->data[writer->position++] = value >> 24;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_uint64(hazel_message_writer *writer, uint64_t value)
-{
-    BUFFER_CHECK(writer, sizeof(uint64_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    writer->data[writer->position++] = value >> 16;
-    writer->data[writer->position++] = value >> 24;
-    writer->data[writer->position++] = value >> 32;
-    writer->data[writer->position++] = value >> 40;
-    writer->data[writer->position++] = value >> 48;
-    writer->data[writer->position++] = value >> 56;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_int64(hazel_message_writer *writer, int64_t value)
-{
-    BUFFER_CHECK(writer, sizeof(int64_t));
-    writer->data[writer->position++] = value;
-    writer->data[writer->position++] = value >> 8;
-    writer->data[writer->position++] = value >> 16;
-    writer->data[writer->position++] = value >> 24;
-    writer->data[writer->position++] = value >> 32;
-    writer->data[writer->position++] = value >> 40;
-    writer->data[writer->position++] = value >> 48;
-    writer->data[writer->position++] = value >> 56;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-
-int hazel_message_writer_packed_uint32(hazel_message_writer *writer,
-                                       uint32_t value)
-{
-    do
-    {
-        uint8_t b = (uint8_t)(value & 0xFF);
-        if (value >= 0x80)
-            b |= 0x80;
-
-        int ret = hazel_message_writer_uint8(writer, b);
-        if (ret != 0)
-        {
-            return ret;
-        }
-
-        value >>= 7;
-    } while (value > 0);
-
-    return 0;
-}
-int hazel_message_writer_packed_int32(hazel_message_writer *writer,
-                                      int32_t value)
-{
-    return hazel_message_writer_packed_uint32(writer, (uint32_t)value);
-}
-
-int hazel_message_writer_single(hazel_message_writer *writer, float value)
-{
-    BUFFER_CHECK(writer, sizeof(float));
-    memcpy(&writer->data[writer->position], &value, sizeof(float));
-    writer->position += sizeof(float);
-    LENGTH_CHECK(writer);
-    return 0;
-}
-
-int hazel_message_writer_string(hazel_message_writer *writer, 
-                                const char *string)
-{
-    size_t length = strlen(string);
-    return hazel_message_writer_bytes_and_size(
-        writer, (uint8_t *)string, 0, length);
-}
-
-int hazel_message_writer_bytes(hazel_message_writer *writer,
-                               const uint8_t *buffer, size_t offset,
-                               size_t length)
-{
-    BUFFER_CHECK(writer, length);
-    memcpy(&writer->data[writer->position], &buffer[offset], length);
-    writer->position += length;
-    LENGTH_CHECK(writer);
-    return 0;
-}
-int hazel_message_writer_bytes_and_size(hazel_message_writer *writer,
-                                        const uint8_t *buffer, size_t offset, 
-                                        size_t length)
-{
-    int ret = hazel_message_writer_packed_uint32(writer, (uint32_t)length);
-    if (ret != 0)
-    {
-        return ret;
-    }
-
-    return hazel_message_writer_bytes(writer, buffer, offset, length);
-}
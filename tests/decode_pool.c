@@ -0,0 +1,269 @@
+/*
+ * Several connections share a hazel_decode_pool: each streams sequenced
+ * unreliable messages over its own hazel_udp_loopback, the main thread hands
+ * what arrives to the connection's strand and ticks it, and every message
+ * handed over must reach the callback exactly once and in order. Reliable
+ * messages are interleaved so that the workers also ack and the ticks have
+ * packets to manage; resends may reorder them, so only the unreliable ones
+ * are checked.
+ */
+
+#include "hazel/udp/connection.h"
+#include "hazel/udp/decode_pool.h"
+#include "hazel/udp/loopback.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define STRANDS 8
+#define WORKERS 4
+#define MESSAGES 5000
+#define BATCH 16
+#define RELIABLE_EVERY 4
+#define LOOPBACK_CAPACITY 256
+
+// How long each callback keeps its worker busy, so that two batches of one
+// strand would overlap if the pool ever ran them at once
+#define CALLBACK_WORK_NS 2000
+
+#define TAG_SEQUENCED 0x01
+#define TAG_RELIABLE 0x02
+#define DRAIN_TIMEOUT_NS 10000000000ull
+
+typedef struct test_link
+{
+    hazel_udp_loopback loopback;
+    hazel_udp_connection sender;
+    hazel_udp_connection receiver;
+    hazel_decode_strand strand;
+    uint32_t sent;
+    // Sequenced messages handed to the pool
+    uint32_t submitted;
+
+    // Only touched by the worker running the strand
+    uint32_t last;
+    bool received_any;
+    // Read by the main thread while workers run
+    atomic_uint delivered;
+    atomic_bool out_of_order;
+} test_link;
+
+static test_link links[STRANDS];
+
+static uint64_t test_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void test_on_message(hazel_decode_strand *strand,
+                            hazel_udp_connection_recv *recv, void *user_data)
+{
+    (void)user_data;
+    test_link *link = strand->user_data;
+
+    if (recv->packet_type != HAZEL_SEND_OPTION_UNRELIABLE)
+    {
+        return;
+    }
+
+    hazel_message_reader message;
+    uint32_t sequence;
+    if (hazel_message_reader_read_message(&recv->data.msg.reader,
+                                          &message) != 0
+        || message.tag != TAG_SEQUENCED
+        || hazel_message_reader_uint32(&message, &sequence) != 0
+        || (link->received_any && sequence <= link->last))
+    {
+        atomic_store(&link->out_of_order, true);
+        return;
+    }
+    link->last = sequence;
+    link->received_any = true;
+
+    uint64_t until = test_now_ns() + CALLBACK_WORK_NS;
+    while (test_now_ns() < until)
+    {
+    }
+    atomic_fetch_add(&link->delivered, 1);
+}
+
+static int test_link_init(test_link *link)
+{
+    memset(link, 0, sizeof(*link));
+    hazel_udp_connection_init(&link->sender);
+    hazel_udp_connection_init(&link->receiver);
+    if (hazel_udp_loopback_init(&link->loopback, LOOPBACK_CAPACITY) != 0
+        || hazel_udp_socket_init_with(&link->sender._socket,
+                                      &hazel_udp_loopback_vtable,
+                                      &link->loopback.a) != 0
+        || hazel_udp_socket_init_with(&link->receiver._socket,
+                                      &hazel_udp_loopback_vtable,
+                                      &link->loopback.b) != 0
+        || hazel_udp_socket_open(&link->sender._socket,
+                                 HAZEL_IP_MODE_IPV4) != 0
+        || hazel_udp_socket_open(&link->receiver._socket,
+                                 HAZEL_IP_MODE_IPV4) != 0
+        || hazel_decode_strand_init(&link->strand, &link->receiver,
+                                    link) != 0)
+    {
+        return -1;
+    }
+    link->sender._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+    link->receiver._connection_state = HAZEL_CONNECTION_STATE_CONNECTED;
+    return 0;
+}
+
+static void test_link_free(test_link *link)
+{
+    hazel_decode_strand_free(&link->strand);
+    hazel_udp_connection_free(&link->sender);
+    hazel_udp_connection_free(&link->receiver);
+    hazel_udp_loopback_free(&link->loopback);
+}
+
+/**
+ * Send the next batch on \p link, hand what reached the receiver to the pool
+ * and take in the acks which came back.
+ */
+static int test_link_pump(hazel_decode_pool *pool, test_link *link)
+{
+    uint8_t buffer[HAZEL_BUFFER_SIZE];
+    hazel_message_writer writer;
+    hazel_message_writer_init(&writer, buffer, sizeof(buffer));
+
+    for (size_t i = 0; i < BATCH && link->sent < MESSAGES; i++)
+    {
+        bool reliable = link->sent % RELIABLE_EVERY == 0;
+        int ret = 0;
+        hazel_message_writer_clear(&writer, reliable
+                                                ? HAZEL_SEND_OPTION_RELIABLE
+                                                : HAZEL_SEND_OPTION_UNRELIABLE);
+        ret |= hazel_message_writer_start_message(
+            &writer, reliable ? TAG_RELIABLE : TAG_SEQUENCED);
+        ret |= hazel_message_writer_uint32(&writer, link->sent);
+        ret |= hazel_message_writer_end_message(&writer);
+        if (ret != 0 || hazel_udp_connection_send(&link->sender, &writer) < 0)
+        {
+            return -1;
+        }
+        link->sent++;
+    }
+
+    uint8_t datagram[HAZEL_BUFFER_SIZE];
+    int size;
+    while ((size = hazel_udp_socket_try_recv(&link->receiver._socket,
+                                             datagram, sizeof(datagram),
+                                             0)) > 0)
+    {
+        if (datagram[0] == HAZEL_SEND_OPTION_UNRELIABLE)
+        {
+            link->submitted++;
+        }
+        if (hazel_decode_pool_submit(pool, &link->strand, datagram,
+                                     (size_t)size) != 0)
+        {
+            return -1;
+        }
+    }
+    if (hazel_decode_pool_tick(pool, &link->strand) != 0)
+    {
+        return -1;
+    }
+
+    while ((size = hazel_udp_socket_try_recv(&link->sender._socket, datagram,
+                                             sizeof(datagram), 0)) > 0)
+    {
+        hazel_udp_connection_recv recv;
+        if (hazel_udp_connection_handle_recv_in_place(
+                &link->sender, datagram, (size_t)size, &recv) == 0)
+        {
+            hazel_udp_connection_release_in_place(
+                &link->sender, datagram, (size_t)size, &recv);
+        }
+    }
+    hazel_udp_connection_manage_reliable(&link->sender);
+    return 0;
+}
+
+static bool test_done(void)
+{
+    for (size_t i = 0; i < STRANDS; i++)
+    {
+        if (atomic_load(&links[i].out_of_order))
+        {
+            return true;
+        }
+        if (links[i].sent < MESSAGES
+            || atomic_load(&links[i].delivered) < links[i].submitted)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    hazel_decode_pool pool;
+    if (hazel_decode_pool_init(&pool, WORKERS, test_on_message, NULL) != 0)
+    {
+        fprintf(stderr, "decode_pool: failed to start the workers\n");
+        return 1;
+    }
+    for (size_t i = 0; i < STRANDS; i++)
+    {
+        if (test_link_init(&links[i]) != 0)
+        {
+            fprintf(stderr, "decode_pool: failed to set up link %zu\n", i);
+            return 1;
+        }
+    }
+
+    uint64_t deadline = test_now_ns() + DRAIN_TIMEOUT_NS;
+    while (!test_done() && test_now_ns() < deadline)
+    {
+        for (size_t i = 0; i < STRANDS; i++)
+        {
+            if (test_link_pump(&pool, &links[i]) != 0)
+            {
+                fprintf(stderr, "decode_pool: link %zu failed to pump\n", i);
+                failed = 1;
+                deadline = 0;
+                break;
+            }
+        }
+    }
+
+    hazel_decode_pool_free(&pool);
+
+    for (size_t i = 0; i < STRANDS; i++)
+    {
+        test_link *link = &links[i];
+        unsigned delivered = atomic_load(&link->delivered);
+        if (atomic_load(&link->out_of_order))
+        {
+            fprintf(stderr, "decode_pool: link %zu out of order after %u\n",
+                    i, link->last);
+            failed = 1;
+        }
+        else if (delivered != link->submitted || link->submitted == 0)
+        {
+            fprintf(stderr, "decode_pool: link %zu delivered %u of %u\n", i,
+                    delivered, link->submitted);
+            failed = 1;
+        }
+        test_link_free(link);
+    }
+
+    if (!failed)
+    {
+        printf("decode_pool: %d strands on %d workers delivered in order\n",
+               STRANDS, WORKERS);
+    }
+    return failed;
+}
@@ -74,7 +74,7 @@ int clienttest()
     hazel_message_writer_int32(&handshake_writer, 6969);
     hazel_message_writer_end_message(&handshake_writer);
 
-    HAZEL_LOG_DEBUG_PRINT_BYTES("handshake_writer", handshake_writer.data, handshake_writer.size, 0);
+    HAZEL_LOG_TRACE_BYTES("handshake_writer", handshake_writer.data, handshake_writer.size, 0);
 
     if ((ret = hazel_udp_client_handshake(&client, handshake_writer.data, handshake_writer.size)) != HAZEL_UDP_CLIENT_HANDSHAKE_SUCCESS)
     {